@@ -0,0 +1,15 @@
+FIND_PATH(LIBURING_INCLUDE_DIR NAMES liburing.h)
+
+FIND_LIBRARY(LIBURING_LIBRARY NAMES uring liburing)
+get_filename_component(LIBURING_LIBRARY_DIR ${LIBURING_LIBRARY} PATH)
+
+include(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(liburing DEFAULT_MSG
+  LIBURING_INCLUDE_DIR
+  LIBURING_LIBRARY
+  LIBURING_LIBRARY_DIR)
+
+mark_as_advanced(
+  LIBURING_INCLUDE_DIR
+  LIBURING_LIBRARY_DIR
+  LIBURING_LIBRARY)
@@ -0,0 +1,15 @@
+FIND_PATH(ZSTD_INCLUDE_DIR NAMES zstd.h)
+
+FIND_LIBRARY(ZSTD_LIBRARY NAMES zstd libzstd)
+get_filename_component(ZSTD_LIBRARY_DIR ${ZSTD_LIBRARY} PATH)
+
+include(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(zstd DEFAULT_MSG
+  ZSTD_INCLUDE_DIR
+  ZSTD_LIBRARY
+  ZSTD_LIBRARY_DIR)
+
+mark_as_advanced(
+  ZSTD_INCLUDE_DIR
+  ZSTD_LIBRARY_DIR
+  ZSTD_LIBRARY)
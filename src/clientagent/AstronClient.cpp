@@ -3,12 +3,15 @@
 #include "ClientFactory.h"
 #include "ClientAgent.h"
 #include "net/NetworkClient.h"
+#include "net/StreamCompressor.h"
 #include "core/global.h"
 #include "core/msgtypes.h"
 #include "config/constraints.h"
 #include "dclass/dc/Class.h"
 #include "dclass/dc/Field.h"
 #include "util/Timeout.h"
+#include <fstream>
+#include <map>
 
 using namespace std;
 using dclass::Class;
@@ -26,6 +29,15 @@ static ConfigVariable<bool> send_version_to_client("send_version", true, astronc
 static ConfigVariable<uint64_t> write_buffer_size("write_buffer_size", 256 * 1024,
         astronclient_config);
 static ConfigVariable<unsigned int> write_timeout_ms("write_timeout_ms", 5000, astronclient_config);
+static ConfigVariable<unsigned int> write_coalesce_us("write_coalesce_us", 0, astronclient_config);
+static ConfigVariable<uint64_t> write_coalesce_bytes("write_coalesce_bytes", 16 * 1024,
+        astronclient_config);
+
+static ConfigVariable<bool> compression_enabled("compression", false, astronclient_config);
+static ConfigVariable<int> compression_level("compression_level", 3, astronclient_config);
+static ConfigVariable<string> compression_dictionary("compression_dictionary", "",
+        astronclient_config);
+static BooleanValueConstraint compression_is_boolean(compression_enabled);
 
 //by default, have heartbeat disabled.
 static ConfigVariable<long> heartbeat_timeout_config("heartbeat_timeout", 0, astronclient_config);
@@ -37,6 +49,45 @@ static bool is_permission_level(const string& str)
 static ConfigConstraint<string> valid_permission_level(is_permission_level, interest_permissions,
         "Permissions for add_interest must be one of 'visible', 'enabled', 'disabled'.");
 
+// get_dictionary returns the compression dictionary loaded from "path" (or derived from the DC
+// file, if "path" is empty), shared by every client using it; or nullptr if compression isn't
+// available.
+static std::shared_ptr<CompressionDictionary> get_dictionary(const string &path, int level,
+        LogCategory *log)
+{
+    static mutex dictionaries_lock;
+    static map<pair<string, int>, std::shared_ptr<CompressionDictionary>> dictionaries;
+
+    lock_guard<mutex> lock(dictionaries_lock);
+    auto it = dictionaries.find(make_pair(path, level));
+    if(it != dictionaries.end()) {
+        return it->second;
+    }
+
+    string content;
+    if(path.empty()) {
+        content = CompressionDictionary::from_dc_file();
+    } else {
+        ifstream file(path, ios::binary);
+        if(!file) {
+            log->error() << "Couldn't read compression dictionary " << path << std::endl;
+        } else {
+            content.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        }
+    }
+
+    std::shared_ptr<CompressionDictionary> dict;
+    if(!content.empty()) {
+        dict = CompressionDictionary::create(content, level);
+    }
+    if(dict == nullptr) {
+        log->warning() << "Compression was enabled, but isn't available;"
+                       << " clients will be sent uncompressed data." << std::endl;
+    }
+    dictionaries[make_pair(path, level)] = dict;
+    return dict;
+}
+
 enum InterestPermission {
     INTERESTS_ENABLED,
     INTERESTS_VISIBLE,
@@ -53,13 +104,15 @@ class AstronClient : public Client, public NetworkHandler
     bool m_send_hash;
     bool m_send_version;
     InterestPermission m_interests_allowed;
+    // Set if the client asked for unreliable fields to be sent over UDP.
+    std::shared_ptr<UnreliableSession> m_udp;
 
     //Heartbeat
     long m_heartbeat_timeout;
     Timeout* m_heartbeat_timer = nullptr;
 
   public:
-    AstronClient(ConfigNode config, ClientAgent* client_agent, const std::shared_ptr<uvw::TcpHandle> &socket,
+    AstronClient(ConfigNode config, ClientAgent* client_agent, const NetworkSocket &socket,
                  const uvw::Addr &remote, const uvw::Addr &local, const bool haproxy_mode) :
         Client(config, client_agent), m_client(std::make_shared<NetworkClient>(this)),
         m_config(config),
@@ -73,6 +126,13 @@ class AstronClient : public Client, public NetworkHandler
         m_client->initialize(socket, remote, local, haproxy_mode);
     }
 
+    ~AstronClient()
+    {
+        // We're normally only deleted once the connection is gone, but everything left is
+        // released at exit; don't leave the connection to call back into us as it closes.
+        m_client->abandon();
+    }
+
     inline void pre_initialize()
     {
         // Set interest permissions
@@ -88,6 +148,8 @@ class AstronClient : public Client, public NetworkHandler
         // Set NetworkClient configuration.
         m_client->set_write_timeout(write_timeout_ms.get_rval(m_config));
         m_client->set_write_buffer(write_buffer_size.get_rval(m_config));
+        m_client->set_write_coalesce(write_coalesce_us.get_rval(m_config),
+                                     write_coalesce_bytes.get_rval(m_config));
     }
 
     void heartbeat_timeout()
@@ -284,12 +346,16 @@ class AstronClient : public Client, public NetworkHandler
     virtual void handle_add_object(doid_t do_id, doid_t parent_id, zone_t zone_id, uint16_t dc_id,
                                    DatagramIterator &dgi, bool other)
     {
-        DatagramPtr resp = Datagram::create();
+        // The fields are copied straight out of the message we were sent, into a response
+        // that's made big enough for them up front.
+        DatagramSpan fields = dgi.read_remainder_view();
+        DatagramPtr resp = Datagram::create_with_capacity(sizeof(uint16_t) + sizeof(doid_t) +
+                           sizeof(doid_t) + sizeof(zone_t) + sizeof(uint16_t) + fields.size());
         resp->add_uint16(other ? CLIENT_ENTER_OBJECT_REQUIRED_OTHER : CLIENT_ENTER_OBJECT_REQUIRED);
         resp->add_doid(do_id);
         resp->add_location(parent_id, zone_id);
         resp->add_uint16(dc_id);
-        resp->add_data(dgi.read_remainder());
+        resp->add_data(fields);
         m_client->send_datagram(resp);
     }
 
@@ -299,35 +365,49 @@ class AstronClient : public Client, public NetworkHandler
     virtual void handle_add_ownership(doid_t do_id, doid_t parent_id, zone_t zone_id, uint16_t dc_id,
                                       DatagramIterator &dgi, bool other)
     {
-        DatagramPtr resp = Datagram::create();
+        DatagramSpan fields = dgi.read_remainder_view();
+        DatagramPtr resp = Datagram::create_with_capacity(sizeof(uint16_t) + sizeof(doid_t) +
+                           sizeof(doid_t) + sizeof(zone_t) + sizeof(uint16_t) + fields.size());
         resp->add_uint16(other ? CLIENT_ENTER_OBJECT_REQUIRED_OTHER_OWNER
                          : CLIENT_ENTER_OBJECT_REQUIRED_OWNER);
         resp->add_doid(do_id);
         resp->add_location(parent_id, zone_id);
         resp->add_uint16(dc_id);
-        resp->add_data(dgi.read_remainder());
+        resp->add_data(fields);
         m_client->send_datagram(resp);
     }
 
     // handle_set_field should inform the client that the field has been updated.
     virtual void handle_set_field(doid_t do_id, uint16_t field_id, DatagramIterator &dgi)
     {
-        DatagramPtr resp = Datagram::create();
+        DatagramSpan value = dgi.read_remainder_view();
+        DatagramPtr resp = Datagram::create_with_capacity(sizeof(uint16_t) + sizeof(doid_t) +
+                           sizeof(uint16_t) + value.size());
         resp->add_uint16(CLIENT_OBJECT_SET_FIELD);
         resp->add_doid(do_id);
         resp->add_uint16(field_id);
-        resp->add_data(dgi.read_remainder());
+        resp->add_data(value);
+
+        // Unreliable fields go over UDP, if the client has a channel up:
+        if(m_udp != nullptr) {
+            const Field *field = g_dcf->get_field_by_id(field_id);
+            if(field != nullptr && field->has_keyword(dclass::KW_UNRELIABLE) && m_udp->send(resp)) {
+                return;
+            }
+        }
         m_client->send_datagram(resp);
     }
 
     // handle_set_fields should inform the client that a group of fields has been updated.
     virtual void handle_set_fields(doid_t do_id, uint16_t num_fields, DatagramIterator &dgi)
     {
-        DatagramPtr resp = Datagram::create();
+        DatagramSpan values = dgi.read_remainder_view();
+        DatagramPtr resp = Datagram::create_with_capacity(sizeof(uint16_t) + sizeof(doid_t) +
+                           sizeof(uint16_t) + values.size());
         resp->add_uint16(CLIENT_OBJECT_SET_FIELDS);
         resp->add_doid(do_id);
         resp->add_uint16(num_fields);
-        resp->add_data(dgi.read_remainder());
+        resp->add_data(values);
         m_client->send_datagram(resp);
     }
 
@@ -388,6 +468,12 @@ class AstronClient : public Client, public NetworkHandler
 
         uint32_t dc_hash = dgi.read_uint32();
         string version = dgi.read_string();
+        // Newer clients follow with the compression methods they support, and then whether
+        // they want a UDP channel.
+        bool negotiate = dgi.get_remaining() > 0;
+        uint8_t compression = negotiate ? dgi.read_uint8() : CLIENT_COMPRESSION_NONE;
+        bool offer_udp = dgi.get_remaining() > 0;
+        bool want_udp = offer_udp && dgi.read_bool();
 
         if(version != m_client_agent->get_version()) {
             stringstream ss;
@@ -414,7 +500,44 @@ class AstronClient : public Client, public NetworkHandler
 
         DatagramPtr resp = Datagram::create();
         resp->add_uint16(CLIENT_HELLO_RESP);
+        if(!negotiate) {
+            m_client->send_datagram(resp);
+            m_state = CLIENT_STATE_ANONYMOUS;
+            return;
+        }
+
+        // The client gets told which compression (if any) we chose, and then everything after
+        // the response is compressed.
+        std::shared_ptr<CompressionDictionary> dict;
+        std::unique_ptr<StreamCompressor> compressor;
+        if((compression & CLIENT_COMPRESSION_ZSTD) && compression_enabled.get_rval(m_config)) {
+            dict = get_dictionary(compression_dictionary.get_rval(m_config),
+                                  compression_level.get_rval(m_config), m_log);
+            if(dict != nullptr) {
+                compressor = dict->acquire();
+            }
+        }
+        if(compressor != nullptr) {
+            resp->add_uint8(CLIENT_COMPRESSION_ZSTD);
+            resp->add_uint32(dict->id());
+        } else {
+            resp->add_uint8(CLIENT_COMPRESSION_NONE);
+        }
+        if(offer_udp) {
+            UnreliableChannel *channel = m_client_agent->udp_channel();
+            if(want_udp && channel != nullptr) {
+                m_udp = channel->open_session(m_client->get_remote().ip);
+                resp->add_bool(true);
+                resp->add_uint64(m_udp->token());
+                resp->add_uint16(channel->port());
+            } else {
+                resp->add_bool(false);
+            }
+        }
         m_client->send_datagram(resp);
+        if(compressor != nullptr) {
+            m_client->set_compression(std::move(compressor));
+        }
 
         m_state = CLIENT_STATE_ANONYMOUS;
     }
@@ -545,7 +668,8 @@ class AstronClient : public Client, public NetworkHandler
 
         // Check that the client is actually allowed to send updates to this field
         bool is_owned = m_owned_objects.find(do_id) != m_owned_objects.end();
-        if(!field->has_keyword("clsend") && !(is_owned && field->has_keyword("ownsend"))) {
+        if(!field->has_keyword(dclass::KW_CLSEND) &&
+           !(is_owned && field->has_keyword(dclass::KW_OWNSEND))) {
             auto send_it = m_fields_sendable.find(do_id);
             if(send_it == m_fields_sendable.end() ||
                send_it->second.find(field_id) == send_it->second.end()) {
@@ -7,9 +7,9 @@ using namespace std;
 using dclass::Class;
 
 Client::Client(ConfigNode, ClientAgent* client_agent) :
-    m_client_agent(client_agent)
+    m_client_agent(client_agent), m_tasks(&TaskQueue::current())
 {
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    assert(m_tasks->in_loop_thread());
 
     m_channel = m_client_agent->m_ct.alloc_channel();
     if(!m_channel) {
@@ -92,8 +92,8 @@ void Client::generate_timeout(TimeoutSetCallback timeout_set_callback)
         m_pending_timeouts.push(timeout_set_callback);
     }
 
-    if(std::this_thread::get_id() != g_main_thread_id) {
-        TaskQueue::singleton.enqueue_task([self = this]() {
+    if(!m_tasks->in_loop_thread()) {
+        m_tasks->enqueue_task([self = this]() {
             self->generate_timeouts();
         });
     } else {
@@ -103,7 +103,7 @@ void Client::generate_timeout(TimeoutSetCallback timeout_set_callback)
 
 void Client::generate_timeouts()
 {
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    assert(m_tasks->in_loop_thread());
 
     if(m_is_generating_timeouts) {
         // Already in the middle of another generate_timeouts invocation.
@@ -346,9 +346,33 @@ void Client::send_disconnect(uint16_t reason, const string &error_string, bool s
     log_event(event);
 }
 
+void Client::release()
+{
+    // Anything routed to us may still be queued up on our loop (see handle_datagram), and the
+    // queue runs its tasks in order; so delete ourselves from there, once they're done.
+    m_tasks->enqueue_task([self = this]() {
+        delete self;
+    });
+}
+
 // handle_datagram is the handler for datagrams received from the Astron cluster
 void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
 {
+    if(m_tasks != &TaskQueue::singleton && !m_tasks->in_loop_thread()) {
+        // We're pinned to a LoopThread: handle the datagram there, with the rest of our work,
+        // instead of holding up the MessageDirector.
+        dgsize_t offset = dgi.tell();
+        m_tasks->enqueue_task([self = this, in_dg, offset]() {
+            DatagramIterator dgi(in_dg, offset);
+            try {
+                self->handle_datagram(in_dg, dgi);
+            } catch(const DatagramIteratorEOF &) {
+                self->m_log->error() << "Detected truncated datagram in handle_datagram.\n";
+            }
+        });
+        return;
+    }
+
     lock_guard<recursive_mutex> lock(m_client_lock);
     if(is_terminated()) {
         return;
@@ -414,8 +438,9 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
     }
     break;
     case CLIENTAGENT_SEND_DATAGRAM: {
-        DatagramPtr forward = Datagram::create();
-        forward->add_data(dgi.read_datagram());
+        DatagramSpan data = dgi.read_blob_view();
+        DatagramPtr forward = Datagram::create_with_capacity(data.size());
+        forward->add_data(data);
         forward_datagram(forward);
     }
     break;
@@ -888,7 +913,7 @@ InterestOperation::~InterestOperation()
 
 void InterestOperation::on_timeout_generate(Timeout* timeout)
 {
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    assert(m_client->m_tasks->in_loop_thread());
 
     m_timeout = timeout;
     m_timeout->initialize(m_timeout_interval, bind(&InterestOperation::timeout, this));
@@ -103,10 +103,12 @@ class Client : public MDParticipantInterface
 
     // handle_datagram is the handler for datagrams received from the server
     void handle_datagram(DatagramHandle dg, DatagramIterator &dgi);
+    virtual void release();
 
   protected:
     std::recursive_mutex m_client_lock;     // The lock guarding the client.
     ClientAgent* m_client_agent;            // The ClientAgent handling this client
+    TaskQueue *m_tasks;                     // The queue (and loop) the client is pinned to
     ClientState m_state = CLIENT_STATE_NEW; // Current state of the Client state machine
     channel_t m_channel = 0;                // Current channel client is listening on
     channel_t m_allocated_channel = 0;      // Channel assigned to client at creation time
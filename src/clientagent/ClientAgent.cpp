@@ -7,6 +7,7 @@
 #include "core/shutdown.h"
 #include "dclass/file/hash.h"
 #include "net/TcpAcceptor.h"
+#include "net/address_utils.h"
 using namespace std;
 
 RoleConfigGroup clientagent_config("clientagent");
@@ -16,6 +17,11 @@ static ConfigVariable<string> server_version("version", "dev",
                                              clientagent_config);
 static ConfigVariable<bool> behind_haproxy("haproxy", false,
                                            clientagent_config);
+static ConfigVariable<bool> use_io_uring("io_uring", false,
+                                         clientagent_config);
+static ConfigVariable<unsigned int> loop_threads("threads", 0,
+                                                 clientagent_config);
+static ConfigVariable<string> udp_bind_addr("udp_bind", "", clientagent_config);
 static ConfigVariable<uint32_t> override_hash("manual_dc_hash", 0x0,
                                               clientagent_config);
 static ValidAddressConstraint valid_bind_addr(bind_addr);
@@ -81,24 +87,75 @@ ClientAgent::ClientAgent(RoleConfig roleconfig)
       clientagent_config.get_child_node(tuning_config, roleconfig);
   m_interest_timeout = interest_timeout.get_rval(tuning);
 
+  m_bind_addr = bind_addr.get_rval(m_roleconfig);
+  m_haproxy_mode = behind_haproxy.get_rval(m_roleconfig);
+  m_io_uring = use_io_uring.get_rval(m_roleconfig);
+
+  // Clients may be offered a UDP channel for their unreliable fields:
+  std::string udp_addr = udp_bind_addr.get_rval(m_roleconfig);
+  if (!udp_addr.empty()) {
+    m_udp.reset(new UnreliableChannel(udp_addr, m_log.get()));
+  }
+
+  unsigned int threads = loop_threads.get_rval(m_roleconfig);
+  std::string path;
+  if (threads > 0 && split_unix_address(m_bind_addr, path)) {
+    m_log->warning() << "Can't share a Unix domain socket between threads; "
+                     << "running all clients on the main thread.\n";
+    threads = 0;
+  }
+
+  if (threads == 0) {
+    // Begin listening for new Clients
+    m_net_acceptor = make_acceptor(false);
+    return;
+  }
+
+  // Otherwise, each thread runs a loop with a listener of its own on the bind address, and
+  // the clients it accepts live on that loop; the kernel shares the connections out.
+  m_log->info() << "Running clients on " << threads << " threads.\n";
+  m_loop_acceptors.resize(threads);
+  for (unsigned int i = 0; i < threads; ++i) {
+    m_loops.emplace_back(new LoopThread);
+    m_loops.back()->start();
+    m_loops.back()->tasks().enqueue_task(
+        [this, i]() { m_loop_acceptors[i] = make_acceptor(true); });
+  }
+}
+
+ClientAgent::~ClientAgent() {
+  // Each loop's acceptor was made on that loop, so it's destroyed there too; the loop is
+  // stopped after that task (and anything queued before it, like deleting its clients).
+  for (unsigned int i = 0; i < m_loops.size(); ++i) {
+    m_loops[i]->tasks().enqueue_task([this, i]() { m_loop_acceptors[i].reset(); });
+    m_loops[i]->stop();
+  }
+}
+
+// make_acceptor starts accepting clients onto the calling thread's loop.
+std::unique_ptr<NetworkAcceptor> ClientAgent::make_acceptor(bool reuse_port) {
   TcpAcceptorCallback callback = std::bind(
       &ClientAgent::handle_tcp, this, std::placeholders::_1,
       std::placeholders::_2, std::placeholders::_3, std::placeholders::_4);
   AcceptorErrorCallback err_callback =
       std::bind(&ClientAgent::handle_error, this, std::placeholders::_1);
 
-  m_net_acceptor =
-      std::unique_ptr<TcpAcceptor>(new TcpAcceptor(callback, err_callback));
+  std::unique_ptr<NetworkAcceptor> acceptor(
+      new TcpAcceptor(callback, err_callback));
 
-  m_net_acceptor->set_haproxy_mode(behind_haproxy.get_rval(m_roleconfig));
+  acceptor->set_haproxy_mode(m_haproxy_mode);
+  acceptor->set_reuse_port(reuse_port);
+  if (m_io_uring && !acceptor->set_io_uring(true)) {
+    m_log->warning() << "io_uring isn't available, using libuv instead.\n";
+  }
 
-  // Begin listening for new Clients
-  m_net_acceptor->bind(bind_addr.get_rval(m_roleconfig), 7198);
-  m_net_acceptor->start();
+  acceptor->bind(m_bind_addr, 7198);
+  acceptor->start();
+  return acceptor;
 }
 
 // handle_tcp generates a new Client object from a raw tcp connection.
-void ClientAgent::handle_tcp(const std::shared_ptr<uvw::TcpHandle> &socket,
+void ClientAgent::handle_tcp(const NetworkSocket &socket,
                              const uvw::Addr &remote, const uvw::Addr &local,
                              const bool haproxy_mode) {
   m_log->debug() << "Got an incoming connection from " << remote.ip << ":"
@@ -128,7 +185,16 @@ static RoleFactoryItem<ClientAgent> ca_fact("clientagent");
 ChannelTracker::ChannelTracker(channel_t min, channel_t max)
     : m_next(min), m_max(max), m_unused_channels() {}
 
+ChannelTracker& ChannelTracker::operator=(ChannelTracker&& other) {
+  std::lock_guard<std::mutex> lock(m_lock);
+  m_next = other.m_next;
+  m_max = other.m_max;
+  m_unused_channels = std::move(other.m_unused_channels);
+  return *this;
+}
+
 channel_t ChannelTracker::alloc_channel() {
+  std::lock_guard<std::mutex> lock(m_lock);
   if (m_next <= m_max) {
     return m_next++;
   } else {
@@ -142,5 +208,6 @@ channel_t ChannelTracker::alloc_channel() {
 }
 
 void ChannelTracker::free_channel(channel_t channel) {
+  std::lock_guard<std::mutex> lock(m_lock);
   m_unused_channels.push(channel);
 }
@@ -1,20 +1,25 @@
 #pragma once
 #include "core/Role.h"
+#include "util/LoopThread.h"
 #include "Client.h"
+#include "UnreliableChannel.h"
 
 #include <memory>
+#include <mutex>
 
 extern RoleConfigGroup clientagent_config;
 extern KeyedConfigGroup ca_client_config;
 extern ConfigVariable<std::string> ca_client_type;
 
 // A ChannelTracker is used to keep track of available and allocated channels that
-// the ClientAgent can use to assign to new Clients.
+// the ClientAgent can use to assign to new Clients.  Clients free their channel when
+// they are deleted, which may happen on any of the MessageDirector's routing threads.
 // TODO: Consider moving to util/ this class might be reusable in other roles that utilize ranges.
 class ChannelTracker
 {
   public:
     ChannelTracker(channel_t min = INVALID_CHANNEL, channel_t max = INVALID_CHANNEL);
+    ChannelTracker& operator=(ChannelTracker&& other);
 
     channel_t alloc_channel();
     void free_channel(channel_t channel);
@@ -23,6 +28,7 @@ class ChannelTracker
     channel_t m_next;
     channel_t m_max;
     std::queue<channel_t> m_unused_channels;
+    std::mutex m_lock;
 };
 
 class ClientAgent final : public Role
@@ -31,9 +37,10 @@ class ClientAgent final : public Role
 
   public:
     ClientAgent(RoleConfig rolconfig);
+    ~ClientAgent();
 
     // handle_tcp generates a new Client object from a raw tcp connection.
-    void handle_tcp(const std::shared_ptr<uvw::TcpHandle> &socket,
+    void handle_tcp(const NetworkSocket &socket,
                     const uvw::Addr &remote,
                     const uvw::Addr &local,
                     const bool haproxy_mode);
@@ -60,14 +67,31 @@ class ClientAgent final : public Role
         return m_log.get();
     }
 
+    // udp_channel returns the channel for unreliable fields, or nullptr if "udp_bind" isn't set.
+    UnreliableChannel *udp_channel()
+    {
+        return m_udp.get();
+    }
+
   private:
+    std::string m_bind_addr;
+    bool m_haproxy_mode;
+    bool m_io_uring;
     std::unique_ptr<NetworkAcceptor> m_net_acceptor;
+    // With "threads", the clients are spread over LoopThreads, each with an acceptor of its
+    // own (which is only touched by its thread, and destroyed there), and m_net_acceptor
+    // isn't used.
+    std::vector<std::unique_ptr<LoopThread> > m_loops;
+    std::vector<std::unique_ptr<NetworkAcceptor> > m_loop_acceptors;
     std::string m_client_type;
     std::string m_server_version;
     ChannelTracker m_ct;
     ConfigNode m_clientconfig;
     std::unique_ptr<LogCategory> m_log;
+    std::unique_ptr<UnreliableChannel> m_udp;
     uint32_t m_hash;
 
     unsigned long m_interest_timeout;
+
+    std::unique_ptr<NetworkAcceptor> make_acceptor(bool reuse_port);
 };
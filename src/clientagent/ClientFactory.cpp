@@ -27,7 +27,7 @@ bool ClientFactory::has_client_type(const std::string &name)
 
 // instantiate_client creates a new Client object of type 'client_type'.
 Client* ClientFactory::instantiate_client(const std::string &client_type, ConfigNode config,
-        ClientAgent* client_agent, const std::shared_ptr<uvw::TcpHandle> &socket,
+        ClientAgent* client_agent, const NetworkSocket &socket,
         const uvw::Addr &remote, const uvw::Addr &local, const bool haproxy_mode)
 {
     if(m_factories.find(client_type) != m_factories.end()) {
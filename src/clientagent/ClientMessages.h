@@ -34,3 +34,6 @@
 #define CLIENT_DISCONNECT_BAD_DCHASH 125
 #define CLIENT_DISCONNECT_FIELD_CONSTRAINT 127
 #define CLIENT_DISCONNECT_SESSION_OBJECT_DELETED 153
+
+#define CLIENT_COMPRESSION_NONE 0
+#define CLIENT_COMPRESSION_ZSTD 1
@@ -0,0 +1,157 @@
+#include "UnreliableChannel.h"
+#include "core/global.h"
+#include "net/address_utils.h"
+#include <cstring>
+
+// same_ip returns true if "a" and "b" are the same IP address, treating an IPv4-mapped IPv6
+//     address (as seen by a dual-stack socket) as the IPv4 address it maps.
+static bool same_ip(const std::string &a, const std::string &b)
+{
+    static const std::string mapped = "::ffff:";
+    auto unmap = [](const std::string &ip) {
+        if(ip.compare(0, mapped.size(), mapped) == 0 && ip.find('.') != std::string::npos) {
+            return ip.substr(mapped.size());
+        }
+        return ip;
+    };
+    return unmap(a) == unmap(b);
+}
+
+UnreliableSession::UnreliableSession(UnreliableChannel *channel, uint64_t token,
+                                     const std::string &ip) :
+    m_channel(channel), m_token(token), m_ip(ip)
+{
+}
+
+UnreliableSession::~UnreliableSession()
+{
+    m_channel->forget(m_token);
+}
+
+bool UnreliableSession::send(DatagramHandle dg)
+{
+    if(dg->size() + sizeof(uint32_t) > UnreliableChannel::max_payload) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if(!m_has_addr) {
+        return false;
+    }
+
+    uint32_t sequence = swap_le(++m_sequence);
+    iovec iov[2];
+    iov[0].iov_base = &sequence;
+    iov[0].iov_len = sizeof(sequence);
+    iov[1].iov_base = const_cast<uint8_t*>(dg->get_data());
+    iov[1].iov_len = dg->size();
+
+    // The socket belongs to the main loop, but sending on it straight from any thread is safe,
+    // and libuv never writes to it itself. If the send buffer is full, the update is lost, as
+    // it might have been anyway.
+    msghdr msg = {};
+    msg.msg_name = &m_addr;
+    msg.msg_namelen = m_addr_len;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    sendmsg(m_channel->m_fd, &msg, MSG_DONTWAIT);
+    return true;
+}
+
+UnreliableChannel::UnreliableChannel(const std::string &addr, LogCategory *log) : m_log(log),
+    m_random(std::random_device()())
+{
+    assert(std::this_thread::get_id() == g_main_thread_id);
+
+    auto addresses = resolve_address(addr, 7199, g_loop);
+    if(addresses.size() == 0) {
+        m_log->fatal() << "Failed to bind to UDP address " << addr << "\n";
+        exit(1);
+    }
+
+    m_socket = g_loop->resource<uvw::UDPHandle>();
+    bool ipv6 = addresses.front().ip.find(':') != std::string::npos;
+    if(ipv6) {
+        m_socket->bind<uvw::IPv6>(addresses.front());
+        m_local = m_socket->sock<uvw::IPv6>();
+    } else {
+        m_socket->bind(addresses.front());
+        m_local = m_socket->sock();
+    }
+    m_fd = m_socket->fileno();
+    m_log->info() << "Sending unreliable fields over UDP on port " << m_local.port << ".\n";
+
+    m_socket->on<uvw::UDPDataEvent>([this](const uvw::UDPDataEvent &event, uvw::UDPHandle &) {
+        receive(event);
+    });
+    if(ipv6) {
+        m_socket->recv<uvw::IPv6>();
+    } else {
+        m_socket->recv();
+    }
+}
+
+std::shared_ptr<UnreliableSession> UnreliableChannel::open_session(const std::string &ip)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    uint64_t token;
+    do {
+        token = m_random();
+    } while(token == 0 || m_sessions.find(token) != m_sessions.end());
+
+    std::shared_ptr<UnreliableSession> session(new UnreliableSession(this, token, ip));
+    m_sessions[token] = session.get();
+    return session;
+}
+
+void UnreliableChannel::forget(uint64_t token)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_sessions.erase(token);
+}
+
+void UnreliableChannel::receive(const uvw::UDPDataEvent &event)
+{
+    // The only thing clients send us is their token, to tell us where to send their updates.
+    uint64_t token;
+    if(event.partial || event.length != sizeof(token)) {
+        m_log->trace() << "Ignoring malformed UDP packet from " << event.sender.ip << ":"
+                       << event.sender.port << ".\n";
+        return;
+    }
+    memcpy(&token, event.data.get(), sizeof(token));
+    token = swap_le(token);
+
+    sockaddr_storage addr = {};
+    socklen_t addr_len;
+    if(event.sender.ip.find(':') != std::string::npos) {
+        uv_ip6_addr(event.sender.ip.c_str(), event.sender.port, reinterpret_cast<sockaddr_in6*>(&addr));
+        addr_len = sizeof(sockaddr_in6);
+    } else {
+        uv_ip4_addr(event.sender.ip.c_str(), event.sender.port, reinterpret_cast<sockaddr_in*>(&addr));
+        addr_len = sizeof(sockaddr_in);
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto it = m_sessions.find(token);
+    if(it == m_sessions.end()) {
+        m_log->trace() << "Ignoring UDP packet with an unknown token from " << event.sender.ip
+                       << ":" << event.sender.port << ".\n";
+        return;
+    }
+
+    // Even if the session is being destroyed, it's intact until it has forgotten itself,
+    // which waits on m_lock.
+    UnreliableSession *session = it->second;
+    if(!same_ip(event.sender.ip, session->m_ip)) {
+        m_log->security() << "Ignoring UDP token sent from " << event.sender.ip << ":"
+                          << event.sender.port << ", not " << session->m_ip
+                          << " where its client is connected from.\n";
+        return;
+    }
+    std::lock_guard<std::mutex> session_lock(session->m_lock);
+    session->m_addr = addr;
+    session->m_addr_len = addr_len;
+    session->m_has_addr = true;
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <sys/socket.h>
+#include "core/Logger.h"
+#include "deps/uvw/uvw.hpp"
+#include "util/Datagram.h"
+
+// NOTES:
+//
+// The UnreliableChannel is a UDP socket shared by a Client Agent's clients, for field updates
+// which are resent often enough (positions, animations) that losing one doesn't matter, but
+// waiting on TCP to retransmit one would hold up everything sent after it.
+//
+// A client which asks for it in its CLIENT_HELLO is given a session token in CLIENT_HELLO_RESP.
+// It sends that token (as a uint64) from its UDP socket to register the address updates should
+// go to, and should keep sending it every few seconds to keep any NAT mapping alive. The token
+// is only accepted from the IP address the client is connected from over TCP. From then
+// on, updates of fields with the "unreliable" keyword are sent to it over UDP, each prefixed
+// with a uint32 sequence number; the client should drop any update for a field that's older
+// than the one it last applied. Everything else stays on TCP.
+
+class UnreliableChannel;
+
+// An UnreliableSession is one client's end of the channel.
+class UnreliableSession
+{
+  public:
+    ~UnreliableSession();
+
+    inline uint64_t token() const
+    {
+        return m_token;
+    }
+
+    // send sends "dg" to the client, unless it hasn't registered an address yet or "dg" is too
+    //     big for one packet, in which case it returns false and the caller should use TCP.
+    bool send(DatagramHandle dg);
+
+  private:
+    UnreliableChannel *m_channel;
+    uint64_t m_token;
+    std::string m_ip;
+
+    std::mutex m_lock;
+    bool m_has_addr = false;
+    sockaddr_storage m_addr;
+    socklen_t m_addr_len = 0;
+    uint32_t m_sequence = 0;
+
+    UnreliableSession(UnreliableChannel *channel, uint64_t token, const std::string &ip);
+
+    friend class UnreliableChannel;
+};
+
+class UnreliableChannel
+{
+  public:
+    // The largest datagram sent over UDP; anything bigger goes over TCP, so as not to be
+    // fragmented.
+    static const size_t max_payload = 1200;
+
+    // The UnreliableChannel binds to "addr" on the main loop; it must be created on the
+    // main thread.
+    UnreliableChannel(const std::string &addr, LogCategory *log);
+
+    inline uint16_t port() const
+    {
+        return m_local.port;
+    }
+
+    // open_session returns a new session for a client connected from "ip", which may be used
+    //     from any thread.
+    std::shared_ptr<UnreliableSession> open_session(const std::string &ip);
+
+  private:
+    LogCategory *m_log;
+    uvw::Addr m_local;
+    std::shared_ptr<uvw::UDPHandle> m_socket;
+    int m_fd;
+
+    std::mutex m_lock;
+    std::unordered_map<uint64_t, UnreliableSession*> m_sessions;
+    std::mt19937_64 m_random;
+
+    void receive(const uvw::UDPDataEvent &event);
+    // forget is called by a session as it's destroyed.
+    void forget(uint64_t token);
+
+    friend class UnreliableSession;
+};
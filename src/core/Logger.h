@@ -175,6 +175,13 @@ class LogCategory
         m_name = name;
     }
 
+    // is_enabled returns true if messages of the given severity will be output, so that
+    // expensive log messages can be skipped entirely when they would be discarded anyway.
+    inline bool is_enabled(LogSeverity sev)
+    {
+        return sev >= g_logger->get_min_severity();
+    }
+
 #define F(level, severity) \
 	LockedLogOutput level() \
 	{ \
@@ -14,6 +14,8 @@ using dclass::Class;
 #include <signal.h>
 #include <pthread.h> // for setting thread-local storage size
 #endif
+#include "util/FieldPlan.h"
+#include "util/FieldStore.h"
 #include "util/TaskQueue.h"
 #include "util/filesystem.h"
 
@@ -202,6 +204,7 @@ int main(int argc, char *argv[])
     dcf->add_keyword("ownsend");
     dcf->add_keyword("ownrecv");
     dcf->add_keyword("airecv");
+    dcf->add_keyword("unreliable");
     vector<string> dc_file_names = dc_files.get_val();
     for(auto it = dc_file_names.begin(); it != dc_file_names.end(); ++it) {
         bool ok = dclass::append(dcf, *it);
@@ -211,6 +214,8 @@ int main(int argc, char *argv[])
         }
     }
     g_dcf = dcf;
+    FieldPlan::compile_all(g_dcf);
+    FieldLayout::compile_all(g_dcf);
 
     // Now hook up our speciailize signal handler
     astron_handle_signals();
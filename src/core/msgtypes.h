@@ -30,15 +30,25 @@ enum MessageTypes {
     RESERVED_MSG_TYPE = 0,
 
     // Control messages
-    CONTROL_ADD_CHANNEL        = 9000,
-    CONTROL_REMOVE_CHANNEL     = 9001,
-    CONTROL_ADD_RANGE          = 9002,
-    CONTROL_REMOVE_RANGE       = 9003,
-    CONTROL_ADD_POST_REMOVE    = 9010,
-    CONTROL_CLEAR_POST_REMOVES = 9011,
-    CONTROL_SET_CON_NAME       = 9012,
-    CONTROL_SET_CON_URL        = 9013,
-    CONTROL_LOG_MESSAGE        = 9014,
+    CONTROL_ADD_CHANNEL              = 9000,
+    CONTROL_REMOVE_CHANNEL           = 9001,
+    CONTROL_ADD_RANGE                = 9002,
+    CONTROL_REMOVE_RANGE             = 9003,
+    CONTROL_ADD_CHANNELS             = 9004,
+    CONTROL_REMOVE_CHANNELS          = 9005,
+    CONTROL_ADD_RANGES               = 9006,
+    CONTROL_REMOVE_RANGES            = 9007,
+    CONTROL_ADD_POST_REMOVE          = 9010,
+    CONTROL_CLEAR_POST_REMOVES       = 9011,
+    CONTROL_SET_CON_NAME             = 9012,
+    CONTROL_SET_CON_URL              = 9013,
+    CONTROL_LOG_MESSAGE              = 9014,
+    CONTROL_WATCH_INTEREST           = 9015,
+    CONTROL_INTEREST_READY           = 9016,
+    CONTROL_INTEREST_ADD_CHANNELS    = 9017,
+    CONTROL_INTEREST_REMOVE_CHANNELS = 9018,
+    CONTROL_INTEREST_ADD_RANGES      = 9019,
+    CONTROL_INTEREST_REMOVE_RANGES   = 9020,
 
     // ClientAgent messages
     CLIENTAGENT_SET_STATE                  = 1000,
@@ -3,6 +3,7 @@
 
 #include "core/global.h"
 #include "core/msgtypes.h"
+#include "util/FieldStore.h"
 #include "DatabaseServer.h"
 using namespace std;
 using dclass::Field;
@@ -104,7 +105,7 @@ bool DBOperation::populate_set_fields(DatagramIterator &dgi, uint16_t field_coun
             return false;
         }
 
-        if(field->has_keyword("db")) {
+        if(field->has_keyword(dclass::KW_DB)) {
             try {
                 // Get criteria value
                 if(check_values) {
@@ -163,7 +164,7 @@ bool DBOperation::populate_get_fields(DatagramIterator &dgi, uint16_t field_coun
         }
 
         // Add the field to the fields we want to get from the database
-        if(field->has_keyword("db"))
+        if(field->has_keyword(dclass::KW_DB))
             m_get_fields.insert(field);
         else
             m_dbserver->m_log->error() << "Get field request included non-DB field "
@@ -213,10 +214,8 @@ bool DBOperationCreate::initialize(channel_t sender, uint16_t, DatagramIterator
     }
 
     // Set all non-present fields to defaults (if they exist)
-    for(unsigned int i = 0; i < m_dclass->get_num_fields(); ++i) {
-        const dclass::Field *field = m_dclass->get_field(i);
-        if(field->has_default_value() && field->has_keyword("db")
-           && m_set_fields.find(field) == m_set_fields.end()) {
+    for(const dclass::Field *field : FieldLayout::get(m_dclass)->get_db_fields()) {
+        if(field->has_default_value() && m_set_fields.find(field) == m_set_fields.end()) {
             string val = field->get_default_value();
             m_set_fields[field] = vector<uint8_t>(val.begin(), val.end());
         }
@@ -210,7 +210,7 @@ class SociSQLDatabase : public OldDatabaseBackend
             return false; // Class has no database fields
         }
 
-        if(!field->has_keyword("db")) {
+        if(!field->has_keyword(KW_DB)) {
             value.clear();
             return false;
         }
@@ -258,7 +258,7 @@ class SociSQLDatabase : public OldDatabaseBackend
             m_sql.begin(); // Start transaction
             for(auto it = values.begin(); it != values.end(); ++it) {
                 const Field* field = it->first;
-                if(field->has_keyword("db")) {
+                if(field->has_keyword(KW_DB)) {
                     m_sql << "SELECT " << field->get_name() << " FROM fields_" << dcc->get_name()
                           << " WHERE object_id=" << do_id << ";", into(value, ind);
                     if(ind != i_null) {
@@ -306,7 +306,7 @@ class SociSQLDatabase : public OldDatabaseBackend
             return false; // Class has no database fields
         }
 
-        if(!field->has_keyword("db")) {
+        if(!field->has_keyword(KW_DB)) {
             return false;
         }
 
@@ -359,7 +359,7 @@ class SociSQLDatabase : public OldDatabaseBackend
             m_sql.begin(); // Start transaction
             for(auto it = equals.begin(); it != equals.end(); ++it) {
                 const Field* field = it->first;
-                if(field->has_keyword("db")) {
+                if(field->has_keyword(KW_DB)) {
                     m_sql << "SELECT " << field->get_name() << " FROM fields_" << dcc->get_name()
                           << " WHERE object_id=" << do_id << ";", into(value, ind);
                     if(ind != i_ok) {
@@ -612,7 +612,7 @@ class SociSQLDatabase : public OldDatabaseBackend
         int db_field_count = 0;
         for(unsigned int i = 0; i < dcc->get_num_fields(); ++i) {
             const Field* field = dcc->get_field(i);
-            if(field->has_keyword("db") && !field->as_molecular()) {
+            if(field->has_keyword(KW_DB) && !field->as_molecular()) {
                 db_field_count += 1;
                 // TODO: Store SimpleParameters and fields with 1 SimpleParameter
                 //       as a simpler type.
@@ -648,7 +648,7 @@ class SociSQLDatabase : public OldDatabaseBackend
         indicator ind;
         for(unsigned int i = 0; i < dcc->get_num_fields(); ++i) {
             const Field* field = dcc->get_field(i);
-            if(field->has_keyword("db")) {
+            if(field->has_keyword(KW_DB)) {
                 m_sql << "SELECT " << field->get_name() << " FROM fields_" << dcc->get_name()
                       << " WHERE object_id=" << id << ";", into(value, ind);
 
@@ -673,7 +673,7 @@ class SociSQLDatabase : public OldDatabaseBackend
         indicator ind;
         for(auto it = fields.begin(); it != fields.end(); ++it) {
             const Field* field = *it;
-            if(field->has_keyword("db")) {
+            if(field->has_keyword(KW_DB)) {
                 m_sql << "SELECT " << field->get_name() << " FROM fields_" << dcc->get_name()
                       << " WHERE object_id=" << id << ";", into(value, ind);
 
@@ -696,7 +696,7 @@ class SociSQLDatabase : public OldDatabaseBackend
     {
         string name, value;
         for(auto it = fields.begin(); it != fields.end(); ++it) {
-            if(it->first->has_keyword("db")) {
+            if(it->first->has_keyword(KW_DB)) {
                 name = it->first->get_name();
                 value = format_value(it->first->get_type(), it->second);
                 m_sql << "UPDATE fields_" << dcc->get_name() << " SET " << name << "='" << value
@@ -710,7 +710,7 @@ class SociSQLDatabase : public OldDatabaseBackend
         string name;
         for(auto it = fields.begin(); it != fields.end(); ++it) {
             const Field* field = *it;
-            if(field->has_keyword("db")) {
+            if(field->has_keyword(KW_DB)) {
                 m_sql << "UPDATE fields_" << dcc->get_name() << " SET " << field->get_name()
                       << "=NULL WHERE object_id=" << id << ";";
             }
@@ -59,6 +59,9 @@ class File
     inline DistributedType* get_type_by_name(const std::string &name);
     inline const DistributedType* get_type_by_name(const std::string &name) const;
 
+    // get_num_fields returns the number of fields in the file.
+    //     All field ids will be within the range 0 <= id < get_num_fields().
+    inline size_t get_num_fields() const;
     // get_field_by_id returns the request field or nullptr if there is no such field.
     inline Field* get_field_by_id(unsigned int id);
     inline const Field* get_field_by_id(unsigned int id) const;
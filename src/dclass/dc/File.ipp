@@ -87,6 +87,13 @@ inline const DistributedType* File::get_type_by_name(const std::string &name) co
 	return nullptr;
 }
 
+// get_num_fields returns the number of fields in the file.
+//     All field ids will be within the range 0 <= id < get_num_fields().
+inline size_t File::get_num_fields() const
+{
+	return m_fields_by_id.size();
+}
+
 // get_field_by_id returns the request field or nullptr if there is no such field.
 inline Field* File::get_field_by_id(unsigned int id)
 {
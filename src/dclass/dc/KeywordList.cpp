@@ -5,14 +5,42 @@ namespace dclass   // open namespace dclass
 {
 
 
+// keyword_from_name returns the Keyword with the given name, or KW_NONE if it isn't one.
+Keyword keyword_from_name(const std::string& name)
+{
+    static const struct {
+        const char* name;
+        Keyword keyword;
+    } keywords[] = {
+        {"required", KW_REQUIRED},
+        {"broadcast", KW_BROADCAST},
+        {"ram", KW_RAM},
+        {"db", KW_DB},
+        {"clsend", KW_CLSEND},
+        {"clrecv", KW_CLRECV},
+        {"ownsend", KW_OWNSEND},
+        {"ownrecv", KW_OWNRECV},
+        {"airecv", KW_AIRECV},
+        {"unreliable", KW_UNRELIABLE},
+    };
+
+    for(const auto& entry : keywords) {
+        if(name == entry.name) {
+            return entry.keyword;
+        }
+    }
+    return KW_NONE;
+}
+
 // empty list constructor
-KeywordList::KeywordList()
+KeywordList::KeywordList() : m_keyword_mask(KW_NONE)
 {
 }
 
 // copy constructor
 KeywordList::KeywordList(const KeywordList& copy) :
-    m_keywords(copy.m_keywords), m_keywords_by_name(copy.m_keywords_by_name)
+    m_keywords(copy.m_keywords), m_keywords_by_name(copy.m_keywords_by_name),
+    m_keyword_mask(copy.m_keyword_mask)
 {
 }
 
@@ -21,6 +49,7 @@ void KeywordList::operator=(const KeywordList& copy)
 {
     m_keywords = copy.m_keywords;
     m_keywords_by_name = copy.m_keywords_by_name;
+    m_keyword_mask = copy.m_keyword_mask;
 }
 
 // has_keyword returns true if this list includes the indicated keyword, false otherwise.
@@ -60,6 +89,7 @@ bool KeywordList::add_keyword(const std::string& keyword)
     bool inserted = m_keywords_by_name.insert(keyword).second;
     if(inserted) {
         m_keywords.push_back(keyword);
+        m_keyword_mask |= keyword_from_name(keyword);
     }
 
     return inserted;
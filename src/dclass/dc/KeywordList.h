@@ -1,5 +1,7 @@
 // Filename: KeywordList.h
 #pragma once
+#include <stdint.h>      // uint32_t
+#include <string>        // std::string
 #include <vector>        // std::vector
 #include <unordered_set> // std::unordered_set
 namespace dclass   // open namespace dclass
@@ -9,6 +11,25 @@ namespace dclass   // open namespace dclass
 // Forward declaration
 class HashGenerator;
 
+// A Keyword is one of the well-known keywords which Astron itself looks for.
+//     Each is a bit in a KeywordList's mask, so that checking for it doesn't go by name.
+enum Keyword : uint32_t {
+    KW_NONE = 0,
+    KW_REQUIRED = 1 << 0,
+    KW_BROADCAST = 1 << 1,
+    KW_RAM = 1 << 2,
+    KW_DB = 1 << 3,
+    KW_CLSEND = 1 << 4,
+    KW_CLRECV = 1 << 5,
+    KW_OWNSEND = 1 << 6,
+    KW_OWNRECV = 1 << 7,
+    KW_AIRECV = 1 << 8,
+    KW_UNRELIABLE = 1 << 9,
+};
+
+// keyword_from_name returns the Keyword with the given name, or KW_NONE if it isn't one.
+Keyword keyword_from_name(const std::string& name);
+
 // KeywordList this is a list of keywords (see Keyword) that may be set on a particular field.
 class KeywordList
 {
@@ -22,6 +43,20 @@ class KeywordList
 
     // has_keyword returns true if this list includes the indicated keyword, false otherwise.
     bool has_keyword(const std::string& name) const;
+    inline bool has_keyword(Keyword keyword) const
+    {
+        return (m_keyword_mask & keyword) != 0;
+    }
+    // has_any_keyword returns true if this list includes any of the Keywords in the mask.
+    inline bool has_any_keyword(uint32_t mask) const
+    {
+        return (m_keyword_mask & mask) != 0;
+    }
+    // get_keyword_mask returns the Keywords in this list, ORed together.
+    inline uint32_t get_keyword_mask() const
+    {
+        return m_keyword_mask;
+    }
     // get_num_keywords returns the number of keywords in the list.
     size_t get_num_keywords() const;
     // get_keyword returns the nth keyword in the list.
@@ -44,6 +79,7 @@ class KeywordList
   private:
     std::vector<std::string> m_keywords; // the actual list of keywords
     std::unordered_set<std::string> m_keywords_by_name; // a map of name to keywords in list
+    uint32_t m_keyword_mask; // the well-known keywords in the list
 };
 
 
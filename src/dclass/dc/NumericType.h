@@ -32,6 +32,8 @@ class NumericType : public DistributedType
     virtual bool has_range() const;
     // get_range returns the NumericRange that constrains the type's values.
     inline NumericRange get_range() const;
+    // get_scaled_range returns the range scaled up by the divisor, as packed values are checked.
+    inline const NumericRange& get_scaled_range() const;
 
     // set_divisor sets a divisor for the numeric type, typically to represent fixed-point.
     //     Returns false if the divisor is not valid for this type.
@@ -31,6 +31,11 @@ inline NumericRange NumericType::get_range() const
 {
 	return m_orig_range;
 }
+// get_scaled_range returns the range scaled up by the divisor, as packed values are checked.
+inline const NumericRange& NumericType::get_scaled_range() const
+{
+	return m_range;
+}
 
 
 } // close namespace dclass
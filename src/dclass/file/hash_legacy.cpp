@@ -191,7 +191,7 @@ void hash_keywords(HashGenerator& hashgen, const KeywordList* list)
     for(size_t i{}; i < num_keywords; ++i) {
         bool set_flag = false;
         string keyword = list->get_keyword(i);
-        for(size_t j{}; j < sizeof(legacy_keywords); ++j) {
+        for(size_t j{}; legacy_keywords[j].keyword != nullptr; ++j) {
             if(keyword == legacy_keywords[j].keyword) {
                 flags |= legacy_keywords[j].flag;
                 set_flag = true;
@@ -1,4 +1,7 @@
 #include "ChannelMap.h"
+#include <algorithm>
+#include <functional>
+#include <thread>
 
 typedef boost::icl::discrete_interval<channel_t> interval_t;
 
@@ -15,12 +18,315 @@ static void get_closed_bounds(const interval_t &interval, channel_t &lower, chan
     }
 }
 
-ChannelMap::ChannelMap()
+// The epoch of a reader slot which isn't in use by any lookup.
+static const uint64_t EPOCH_IDLE = UINT64_MAX;
+// The number of retired objects to collect before trying to free them.
+static const size_t RECLAIM_THRESHOLD = 64;
+// The size of the smallest channel table, as a power of two.
+static const unsigned int MIN_TABLE_BITS = 4;
+
+const ChannelMap::SubscriberList ChannelMap::s_no_subscribers;
+
+static inline size_t hash_channel(channel_t c, unsigned int bits)
+{
+    // Fold wide channels down to 64 bits, then use the top bits of a Fibonacci hash,
+    // which spreads out the sequential channels that ids are usually allocated as.
+    uint64_t h = uint64_t(c) ^ uint64_t(c >> (sizeof(channel_t) * 4));
+    return size_t((h * 0x9E3779B97F4A7C15ull) >> (64 - bits));
+}
+
+ChannelMap::ChannelTable::ChannelTable(unsigned int bits) : bits(bits), used(0), live(0),
+    slots(new ChannelSlot[size_t(1) << bits])
+{
+}
+
+ChannelMap::ChannelSlot &ChannelMap::ChannelTable::find(channel_t c) const
+{
+    // N.B. a table is never allowed to fill up past half of its slots, so this terminates.
+    size_t mask = (size_t(1) << bits) - 1;
+    for(size_t i = hash_channel(c, bits);; i = (i + 1) & mask) {
+        ChannelSlot &slot = slots[i];
+        if(slot.subscribers.load() == nullptr || slot.channel == c) {
+            return slot;
+        }
+    }
+}
+
+ChannelMap::ChannelMap() : m_channel_table(new ChannelTable(MIN_TABLE_BITS)),
+    m_range_index(new RangeIndex), m_epoch(0)
+{
+    for(size_t i = 0; i < READER_SLOTS; ++i) {
+        m_reader_slots[i].epoch = EPOCH_IDLE;
+    }
+
+    // Initialize m_ranges with a single segment, covering every channel, with no subscribers
+    m_ranges.starts.push_back(0);
+    m_ranges.subscribers.push_back(&s_no_subscribers);
+    m_range_index.load()->starts = m_ranges.starts;
+    m_range_index.load()->subscribers = m_ranges.subscribers;
+}
+
+ChannelMap::~ChannelMap()
+{
+    // There can't be any lookups left by now, so everything can go at once.
+    ChannelTable *table = m_channel_table.load();
+    for(size_t i = 0; i < (size_t(1) << table->bits); ++i) {
+        const SubscriberList *subs = table->slots[i].subscribers.load();
+        if(subs != &s_no_subscribers) {
+            delete subs;
+        }
+    }
+    delete table;
+    delete m_range_index.load();
+
+    for(auto it = m_interned.begin(); it != m_interned.end(); ++it) {
+        delete *it;
+    }
+}
+
+size_t ChannelMap::SubscriberListHash::operator()(const SubscriberList *list) const
+{
+    size_t h = list->subscribers.size();
+    for(auto it = list->subscribers.begin(); it != list->subscribers.end(); ++it) {
+        h = h * 31 + std::hash<ChannelSubscriber *>()(*it);
+    }
+    return h;
+}
+
+size_t ChannelMap::RangeIndex::find(channel_t c) const
+{
+    // Find the last segment starting at or before the channel; there always is one, since
+    // the first segment starts at 0. The loop body compiles down to a conditional move.
+    const channel_t *base = starts.data();
+    size_t n = starts.size();
+    while(n > 1) {
+        size_t half = n / 2;
+        base = (base[half] <= c) ? base + half : base;
+        n -= half;
+    }
+    return base - starts.data();
+}
+
+size_t ChannelMap::enter_lookup()
+{
+    // Each thread remembers the last reader slot it used, so it usually gets its own cache line.
+    static thread_local size_t slot_hint = std::hash<std::thread::id>()(std::this_thread::get_id());
+
+    // N.B. the epoch may already be stale by the time it's announced; that's fine, because
+    // anything retired before the announcement can't be reached by the loads that follow it.
+    uint64_t epoch = m_epoch.load();
+    for(size_t i = slot_hint;; ++i) {
+        ReaderSlot &slot = m_reader_slots[i % READER_SLOTS];
+        uint64_t idle = EPOCH_IDLE;
+        if(slot.epoch.load(std::memory_order_relaxed) == EPOCH_IDLE &&
+           slot.epoch.compare_exchange_strong(idle, epoch)) {
+            slot_hint = i % READER_SLOTS;
+            return slot_hint;
+        }
+
+        if((i + 1 - slot_hint) % READER_SLOTS == 0) {
+            // Every slot is taken by a lookup on another thread; let one of them finish
+            // rather than spinning on the slots, and announce a fresh epoch next time round.
+            std::this_thread::yield();
+            epoch = m_epoch.load();
+        }
+    }
+}
+
+void ChannelMap::leave_lookup(size_t slot)
+{
+    m_reader_slots[slot].epoch.store(EPOCH_IDLE, std::memory_order_release);
+}
+
+void ChannelMap::retire(const Retired *garbage)
+{
+    if(garbage == nullptr || garbage == &s_no_subscribers) {
+        return;
+    }
+
+    // Anything retired has already been unpublished, so a lookup announcing this
+    // epoch (or any later one) can't see it anymore.
+    m_retired.emplace_back(++m_epoch, std::unique_ptr<const Retired>(garbage));
+    if(m_retired.size() >= RECLAIM_THRESHOLD) {
+        reclaim();
+    }
+}
+
+void ChannelMap::reclaim()
+{
+    uint64_t oldest = EPOCH_IDLE;
+    for(size_t i = 0; i < READER_SLOTS; ++i) {
+        oldest = std::min(oldest, m_reader_slots[i].epoch.load());
+    }
+
+    m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(),
+    [oldest](const std::pair<uint64_t, std::unique_ptr<const Retired> > &garbage) {
+        return garbage.first <= oldest;
+    }), m_retired.end());
+}
+
+void ChannelMap::insert_subscriber(ChannelSubscriber *p, channel_t c)
+{
+    ChannelTable *table = m_channel_table.load();
+    ChannelSlot *slot = &table->find(c);
+
+    if(slot->subscribers.load() == nullptr && (table->used + 1) * 2 > (size_t(1) << table->bits)) {
+        // Out of free slots: rebuild the table, sized for the channels that still have
+        // subscribers, and publish it in place of the old one.
+        unsigned int bits = MIN_TABLE_BITS;
+        while((size_t(1) << bits) < (table->live + 1) * 4) {
+            ++bits;
+        }
+
+        ChannelTable *rebuilt = new ChannelTable(bits);
+        for(size_t i = 0; i < (size_t(1) << table->bits); ++i) {
+            const ChannelSlot &old = table->slots[i];
+            const SubscriberList *subs = old.subscribers.load();
+            if(subs != nullptr && subs != &s_no_subscribers) {
+                ChannelSlot &moved = rebuilt->find(old.channel);
+                moved.channel = old.channel;
+                moved.subscribers.store(subs, std::memory_order_relaxed);
+                ++rebuilt->used;
+                ++rebuilt->live;
+            }
+        }
+
+        m_channel_table.store(rebuilt);
+        retire(table);
+
+        table = rebuilt;
+        slot = &table->find(c);
+    }
+
+    const SubscriberList *old = slot->subscribers.load();
+    SubscriberList *subs = new SubscriberList;
+    if(old == nullptr) {
+        slot->channel = c;
+        ++table->used;
+    }
+    if(old == nullptr || old->subscribers.empty()) {
+        ++table->live;
+    } else {
+        subs->subscribers.reserve(old->subscribers.size() + 1);
+        subs->subscribers = old->subscribers;
+    }
+    subs->subscribers.push_back(p);
+
+    slot->subscribers.store(subs);
+    retire(old);
+}
+
+// split_ranges makes sure a segment starts at the channel, and returns its index.
+size_t ChannelMap::split_ranges(channel_t c)
 {
-    // Initialize m_range_susbcriptions with empty range
-    auto empty_set = std::unordered_set<ChannelSubscriber*>();
-    m_range_subscriptions = boost::icl::interval_map<channel_t, std::unordered_set<ChannelSubscriber*> >();
-    m_range_subscriptions += std::make_pair(interval_t::closed(0, CHANNEL_MAX), empty_set);
+    size_t index = m_ranges.find(c);
+    if(m_ranges.starts[index] == c) {
+        return index;
+    }
+
+    // The new segment starts out with the same subscribers as the one it was split off from.
+    const SubscriberList *subs = m_ranges.subscribers[index];
+    if(subs != &s_no_subscribers) {
+        ++subs->segments;
+    }
+
+    m_ranges.starts.insert(m_ranges.starts.begin() + index + 1, c);
+    m_ranges.subscribers.insert(m_ranges.subscribers.begin() + index + 1, subs);
+    return index + 1;
+}
+
+// intern_subscribers returns the interned list with the given (sorted) subscribers.
+const ChannelMap::SubscriberList *ChannelMap::intern_subscribers(
+    std::vector<ChannelSubscriber *> &subscribers)
+{
+    if(subscribers.empty()) {
+        return &s_no_subscribers;
+    }
+
+    m_intern_probe.subscribers.swap(subscribers);
+    auto it = m_interned.find(&m_intern_probe);
+    const SubscriberList *list;
+    if(it != m_interned.end()) {
+        list = *it;
+    } else {
+        SubscriberList *interned = new SubscriberList;
+        interned->subscribers = m_intern_probe.subscribers;
+        m_interned.insert(interned);
+        list = interned;
+    }
+    m_intern_probe.subscribers.swap(subscribers);
+
+    return list;
+}
+
+// update_ranges adds the subscriber to (or removes it from) every segment in [lo, hi].
+// N.B. lookups won't see the change until publish_ranges is called.
+void ChannelMap::update_ranges(ChannelSubscriber *p, channel_t lo, channel_t hi, bool subscribe)
+{
+    size_t first = split_ranges(lo);
+    size_t last = (hi == CHANNEL_MAX) ? m_ranges.starts.size() : split_ranges(hi + 1);
+
+    // Neighbouring segments often share a list, so each distinct one is only updated once.
+    std::unordered_map<const SubscriberList *, const SubscriberList *> updated;
+    std::vector<ChannelSubscriber *> subscribers;
+    for(size_t i = first; i < last; ++i) {
+        const SubscriberList *old = m_ranges.subscribers[i];
+        auto it = updated.find(old);
+        if(it == updated.end()) {
+            subscribers = old->subscribers;
+            auto pos = std::lower_bound(subscribers.begin(), subscribers.end(), p);
+            if(subscribe && (pos == subscribers.end() || *pos != p)) {
+                subscribers.insert(pos, p);
+            } else if(!subscribe && pos != subscribers.end() && *pos == p) {
+                subscribers.erase(pos);
+            }
+            it = updated.emplace(old, intern_subscribers(subscribers)).first;
+        }
+
+        const SubscriberList *subs = it->second;
+        if(subs != &s_no_subscribers) {
+            ++subs->segments;
+        }
+        if(old != &s_no_subscribers && --old->segments == 0) {
+            m_interned.erase(old);
+            m_unused_lists.push_back(old);
+        }
+        m_ranges.subscribers[i] = subs;
+    }
+
+    // Merge neighbouring segments that ended up with the same subscribers.
+    size_t merged = 1;
+    for(size_t i = 1; i < m_ranges.starts.size(); ++i) {
+        if(m_ranges.subscribers[i] == m_ranges.subscribers[merged - 1]) {
+            const SubscriberList *subs = m_ranges.subscribers[i];
+            if(subs != &s_no_subscribers && --subs->segments == 0) {
+                m_interned.erase(subs);
+                m_unused_lists.push_back(subs);
+            }
+        } else {
+            m_ranges.starts[merged] = m_ranges.starts[i];
+            m_ranges.subscribers[merged] = m_ranges.subscribers[i];
+            ++merged;
+        }
+    }
+    m_ranges.starts.resize(merged);
+    m_ranges.subscribers.resize(merged);
+
+}
+
+// publish_ranges makes the current range segments visible to lookups.
+void ChannelMap::publish_ranges()
+{
+    RangeIndex *index = new RangeIndex;
+    index->starts = m_ranges.starts;
+    index->subscribers = m_ranges.subscribers;
+    retire(m_range_index.exchange(index));
+
+    // Only now is nothing published still using the lists that lost all of their segments.
+    for(auto it = m_unused_lists.begin(); it != m_unused_lists.end(); ++it) {
+        retire(*it);
+    }
+    m_unused_lists.clear();
 }
 
 void ChannelMap::subscribe_channel(ChannelSubscriber *p, channel_t c)
@@ -32,33 +338,59 @@ void ChannelMap::subscribe_channel(ChannelSubscriber *p, channel_t c)
     }
 
     p->channels().insert(p->channels().end(), c);
-    bool has_subs = (m_channel_subscriptions.find(c) != m_channel_subscriptions.end());
+    if(m_track_subscribers) {
+        on_subscriber_channel(p, c, true);
+    }
+    const SubscriberList *subs = m_channel_table.load()->find(c).subscribers.load();
+    bool has_subs = (subs != nullptr && !subs->subscribers.empty());
 
     if(!has_subs) {
         on_add_channel(c);
     }
 
-    m_channel_subscriptions.insert(std::make_pair(c, p));
+    insert_subscriber(p, c);
+}
+
+void ChannelMap::subscribe_channels(ChannelSubscriber *p, const std::vector<channel_t> &channels)
+{
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
+
+    for(auto it = channels.begin(); it != channels.end(); ++it) {
+        subscribe_channel(p, *it);
+    }
 }
 
 bool ChannelMap::remove_subscriber(ChannelSubscriber *p, channel_t c)
 {
-    auto sub_cnt = m_channel_subscriptions.count(c);
-    if(sub_cnt == 0) {
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
+
+    ChannelTable *table = m_channel_table.load();
+    ChannelSlot &slot = table->find(c);
+    const SubscriberList *old = slot.subscribers.load();
+    if(old == nullptr || old->subscribers.empty()) {
         return false;
     }
 
-    auto subs = m_channel_subscriptions.equal_range(c);
+    auto it = std::find(old->subscribers.begin(), old->subscribers.end(), p);
+    if(it == old->subscribers.end()) {
+        return false;
+    }
 
-    for(auto it = subs.first; it != subs.second; ++it) {
-        if(it->second == p) {
-            m_channel_subscriptions.erase(it);
-            --sub_cnt;
-            break;
-        }
+    if(old->subscribers.size() == 1) {
+        slot.subscribers.store(&s_no_subscribers);
+        --table->live;
+        retire(old);
+        return true;
     }
 
-    return (sub_cnt == 0);
+    SubscriberList *subs = new SubscriberList;
+    subs->subscribers.reserve(old->subscribers.size() - 1);
+    subs->subscribers.insert(subs->subscribers.end(), old->subscribers.begin(), it);
+    subs->subscribers.insert(subs->subscribers.end(), it + 1, old->subscribers.end());
+
+    slot.subscribers.store(subs);
+    retire(old);
+    return false;
 }
 
 void ChannelMap::unsubscribe_channel(ChannelSubscriber *p, channel_t c)
@@ -70,30 +402,65 @@ void ChannelMap::unsubscribe_channel(ChannelSubscriber *p, channel_t c)
     }
 
     p->channels().erase(c);
+    if(m_track_subscribers) {
+        on_subscriber_channel(p, c, false);
+    }
 
     if(remove_subscriber(p, c)) {
         on_remove_channel(c);
     }
 }
 
+void ChannelMap::unsubscribe_channels(ChannelSubscriber *p, const std::vector<channel_t> &channels)
+{
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
+
+    for(auto it = channels.begin(); it != channels.end(); ++it) {
+        unsubscribe_channel(p, *it);
+    }
+}
+
 void ChannelMap::subscribe_range(ChannelSubscriber *p, channel_t lo, channel_t hi)
 {
     std::lock_guard<std::recursive_mutex> guard(m_lock);
 
-    // Prepare participant and range
-    std::unordered_set<ChannelSubscriber *> participant_set;
-    participant_set.insert(p);
+    add_range(p, lo, hi);
+    publish_ranges();
+}
 
-    interval_t interval = interval_t::closed(lo, hi);
+void ChannelMap::subscribe_ranges(ChannelSubscriber *p, const std::vector<range_t> &ranges)
+{
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
+
+    for(auto it = ranges.begin(); it != ranges.end(); ++it) {
+        add_range(p, it->first, it->second);
+    }
+    publish_ranges();
+}
+
+void ChannelMap::add_range(ChannelSubscriber *p, channel_t lo, channel_t hi)
+{
+    if(lo > hi) {
+        return;
+    }
 
     // Update range mappings
-    p->ranges() += interval;
-    m_range_subscriptions += std::make_pair(interval, participant_set);
+    if(m_track_subscribers) {
+        boost::icl::interval_set<channel_t> added;
+        added += interval_t::closed(lo, hi);
+        added -= p->ranges();
+        p->ranges() += interval_t::closed(lo, hi);
+        if(!added.empty()) {
+            on_subscriber_ranges(p, added, true);
+        }
+    } else {
+        p->ranges() += interval_t::closed(lo, hi);
+    }
+    update_ranges(p, lo, hi, true);
 
     // Now, check if anything along this interval is *new*:
-    auto interval_range = m_range_subscriptions.equal_range(interval);
-    for(auto it = interval_range.first; it != interval_range.second; ++it) {
-        if(it->second.size() == 1) {
+    for(size_t i = m_ranges.find(lo); i < m_ranges.starts.size() && m_ranges.starts[i] <= hi; ++i) {
+        if(m_ranges.subscribers[i]->subscribers.size() == 1) {
             // There's a segment of the interval that has only one element
             // (our newly added participant!) and thus, we should upstream the
             // range addition.
@@ -107,33 +474,70 @@ void ChannelMap::unsubscribe_range(ChannelSubscriber *p, channel_t lo, channel_t
 {
     std::lock_guard<std::recursive_mutex> guard(m_lock);
 
+    remove_range(p, lo, hi);
+    publish_ranges();
+}
+
+void ChannelMap::unsubscribe_ranges(ChannelSubscriber *p, const std::vector<range_t> &ranges)
+{
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
+
+    for(auto it = ranges.begin(); it != ranges.end(); ++it) {
+        remove_range(p, it->first, it->second);
+    }
+    publish_ranges();
+}
+
+void ChannelMap::remove_range(ChannelSubscriber *p, channel_t lo, channel_t hi)
+{
     // Pre-check: if there are no ranges subscribed anyway, no use doing this:
-    if(m_range_subscriptions.empty()) {
+    size_t segments = m_ranges.starts.size();
+    if(segments == 1 && m_ranges.subscribers[0] == &s_no_subscribers) {
         return;
     }
 
-    // Prepare participant set
-    std::unordered_set<ChannelSubscriber *> participant_set;
-    participant_set.insert(p);
-
-    // Construct the interval we are removing, bounded to m_range_subscriptions.
-    channel_t lower = m_range_subscriptions.begin()->first.lower();
-    channel_t upper = m_range_subscriptions.rbegin()->first.upper();
-    interval_t interval = interval_t::closed(std::max(lo, lower), std::min(hi, upper));
+    // Construct the interval we are removing, bounded to the subscribed ranges.
+    channel_t lower = (m_ranges.subscribers[0] == &s_no_subscribers) ? m_ranges.starts[1] : 0;
+    channel_t upper = (m_ranges.subscribers[segments - 1] == &s_no_subscribers) ?
+                      m_ranges.starts[segments - 1] - 1 : CHANNEL_MAX;
+    lower = std::max(lo, lower);
+    upper = std::min(hi, upper);
 
     // Calculate the ranges that will "go silent" as a result of our removal:
-    auto silent_ranges = boost::icl::interval_set<channel_t>(interval);
-    auto interval_range = m_range_subscriptions.equal_range(interval);
-    for(auto it = interval_range.first; it != interval_range.second; ++it) {
-        if(!it->second.empty() && !(it->second.size() == 1 && *it->second.begin() == p)) {
+    std::vector<std::pair<channel_t, channel_t> > silent_ranges;
+    for(size_t i = m_ranges.find(lower); lower <= upper && i < segments; ++i) {
+        channel_t start = std::max(m_ranges.starts[i], lower);
+        if(start > upper) {
+            break;
+        }
+        channel_t end = (i + 1 < segments) ? std::min(m_ranges.starts[i + 1] - 1, upper) : upper;
+
+        const std::vector<ChannelSubscriber *> &subs = m_ranges.subscribers[i]->subscribers;
+        if(!subs.empty() && !(subs.size() == 1 && subs[0] == p)) {
             // We aren't the last subscription in this range, don't kill it.
-            silent_ranges -= it->first;
+            continue;
+        }
+
+        if(!silent_ranges.empty() && silent_ranges.back().second + 1 == start) {
+            silent_ranges.back().second = end;
+        } else {
+            silent_ranges.emplace_back(start, end);
         }
     }
 
     // Update range mappings
-    p->ranges() -= interval;
-    m_range_subscriptions -= std::make_pair(interval, participant_set);
+    if(lower <= upper) {
+        if(m_track_subscribers) {
+            boost::icl::interval_set<channel_t> removed = p->ranges() & interval_t::closed(lower, upper);
+            p->ranges() -= interval_t::closed(lower, upper);
+            if(!removed.empty()) {
+                on_subscriber_ranges(p, removed, false);
+            }
+        } else {
+            p->ranges() -= interval_t::closed(lower, upper);
+        }
+        update_ranges(p, lower, upper, false);
+    }
 
     // Clobber *channel* subscriptions that fall within the range.
     for(auto it = p->channels().begin(); it != p->channels().end();) {
@@ -145,16 +549,17 @@ void ChannelMap::unsubscribe_range(ChannelSubscriber *p, channel_t lo, channel_t
             // off an on_remove_channel event. Instead, we just manually update:
             remove_subscriber(p, c);
             p->channels().erase(prev);
+            if(m_track_subscribers) {
+                on_subscriber_channel(p, c, false);
+            }
         }
     }
 
     // Now, clean up any ranges that are now *empty* and should thus be killed:
     for(auto it = silent_ranges.begin(); it != silent_ranges.end(); ++it) {
-        get_closed_bounds(*it, lower, upper);
-
         // Okay, this part of the interval is dead, better request it be
         // sliced off:
-        on_remove_range(lower, upper);
+        on_remove_range(it->first, it->second);
     }
 }
 
@@ -175,8 +580,9 @@ void ChannelMap::unsubscribe_all(ChannelSubscriber* p)
         channel_t lower;
         channel_t upper;
         get_closed_bounds(*it, lower, upper);
-        unsubscribe_range(p, lower, upper);
+        remove_range(p, lower, upper);
     }
+    publish_ranges();
 }
 
 bool ChannelMap::is_subscribed(ChannelSubscriber *p, channel_t c)
@@ -194,19 +600,54 @@ bool ChannelMap::is_subscribed(ChannelSubscriber *p, channel_t c)
     return false;
 }
 
-void ChannelMap::lookup_channels(const std::vector<channel_t> &cl, std::unordered_set<ChannelSubscriber *> &ps)
+void ChannelMap::lookup_channels(const channel_t *cl, size_t count, std::vector<ChannelSubscriber *> &ps)
 {
-    std::lock_guard<std::recursive_mutex> guard(m_lock);
+    ps.clear();
+
+    size_t slot = enter_lookup();
 
-    for(auto it = cl.begin(); it != cl.end(); ++it) {
-        auto subs = m_channel_subscriptions.equal_range(*it);
-        for(auto it2 = subs.first; it2 != subs.second; ++it2) {
-            ps.insert(it2->second);
+    const ChannelTable *table = m_channel_table.load();
+    const RangeIndex *ranges = m_range_index.load();
+
+    // Each list holds unique subscribers, so there's only deduplicating to do if several did.
+    size_t lists = 0;
+    for(size_t i = 0; i < count; ++i) {
+        const SubscriberList *subs = table->find(cl[i]).subscribers.load();
+        if(subs != nullptr && !subs->subscribers.empty()) {
+            ps.insert(ps.end(), subs->subscribers.begin(), subs->subscribers.end());
+            ++lists;
         }
 
-        auto range = boost::icl::find(m_range_subscriptions, *it);
-        if(range != m_range_subscriptions.end()) {
-            ps.insert(range->second.begin(), range->second.end());
+        const SubscriberList *range_subs = ranges->subscribers[ranges->find(cl[i])];
+        if(!range_subs->subscribers.empty()) {
+            ps.insert(ps.end(), range_subs->subscribers.begin(), range_subs->subscribers.end());
+            ++lists;
         }
     }
+
+    leave_lookup(slot);
+
+    if(lists > 1) {
+        std::sort(ps.begin(), ps.end());
+        ps.erase(std::unique(ps.begin(), ps.end()), ps.end());
+    }
+}
+
+bool ChannelMap::has_subscribers(const channel_t *cl, size_t count)
+{
+    size_t slot = enter_lookup();
+
+    const ChannelTable *table = m_channel_table.load();
+    const RangeIndex *ranges = m_range_index.load();
+
+    bool found = false;
+    for(size_t i = 0; i < count && !found; ++i) {
+        const SubscriberList *subs = table->find(cl[i]).subscribers.load();
+        found = (subs != nullptr && !subs->subscribers.empty()) ||
+                !ranges->subscribers[ranges->find(cl[i])]->subscribers.empty();
+    }
+
+    leave_lookup(slot);
+
+    return found;
 }
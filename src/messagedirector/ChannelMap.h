@@ -1,10 +1,15 @@
 #pragma once
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <unordered_set>
 #include <unordered_map>
 #include <mutex>
 #include "core/types.h"
-#include <boost/icl/interval_map.hpp>
+#include <boost/icl/interval_set.hpp>
+
+// An inclusive range of channels, as [first, second].
+typedef std::pair<channel_t, channel_t> range_t;
 
 class ChannelSubscriber
 {
@@ -28,10 +33,18 @@ class ChannelSubscriber
 // ChannelMap is a convenience template. It provides functionality for mapping
 // channels (as channel_t) to objects interested in that channel (represented as
 // the template class).
+//
+// Subscription changes are serialized by a lock, but lookups never take it: the
+// index they read is published read-copy-update style, and anything a writer
+// replaces is only freed once no lookup that may still see it is running.
 class ChannelMap
 {
   public:
     ChannelMap();
+    virtual ~ChannelMap();
+
+    ChannelMap(const ChannelMap&) = delete;
+    ChannelMap& operator=(const ChannelMap&) = delete;
 
     // subscribe_channel adds a single channel to the mapping.
     // (Args) "c": the channel to be added.
@@ -53,6 +66,16 @@ class ChannelMap
     // The range is inclusive.
     void unsubscribe_range(ChannelSubscriber *p, channel_t lo, channel_t hi);
 
+    // subscribe_channels and unsubscribe_channels (un)subscribe to each channel in order,
+    // but only take the lock once for the whole batch.
+    void subscribe_channels(ChannelSubscriber *p, const std::vector<channel_t> &channels);
+    void unsubscribe_channels(ChannelSubscriber *p, const std::vector<channel_t> &channels);
+
+    // subscribe_ranges and unsubscribe_ranges (un)subscribe to each range in order, and
+    // publish the range index to lookups once for the whole batch.
+    void subscribe_ranges(ChannelSubscriber *p, const std::vector<range_t> &ranges);
+    void unsubscribe_ranges(ChannelSubscriber *p, const std::vector<range_t> &ranges);
+
     // unsubscribe_all removes all channel and range subscriptions from a subscriber.
     void unsubscribe_all(ChannelSubscriber *p);
 
@@ -65,8 +88,15 @@ class ChannelMap
     // is_subscribed tests if a given object has a subscription on a channel.
     bool is_subscribed(ChannelSubscriber *p, channel_t c);
 
-    // lookup_channels is the same, but it works on a list of channels.
-    void lookup_channels(const std::vector<channel_t> &cl, std::unordered_set<ChannelSubscriber *> &ps);
+    // lookup_channels finds every subscriber of any of the "count" channels in "cl".
+    // "ps" is cleared and then filled with each subscriber exactly once; callers routing
+    // many lookups should reuse it, so that its storage is reused too.
+    // It is safe to call from any number of threads, concurrently with subscription changes.
+    void lookup_channels(const channel_t *cl, size_t count, std::vector<ChannelSubscriber *> &ps);
+
+    // has_subscribers tests if anything is subscribed to any of the "count" channels in "cl".
+    // Like lookup_channels, it is safe to call from any thread at any time.
+    bool has_subscribers(const channel_t *cl, size_t count);
 
   protected:
     virtual void on_add_channel(channel_t) { }
@@ -77,13 +107,111 @@ class ChannelMap
 
     virtual void on_remove_range(channel_t, channel_t) { }
 
-  private:
-    // Single channel subscriptions
-    std::unordered_multimap<channel_t, ChannelSubscriber *> m_channel_subscriptions;
+    // The on_subscriber hooks are told about every change to an individual subscriber's
+    // channels and ranges (as opposed to the above, which are only told when the channel
+    // gains its first or loses its last subscriber), but only while m_track_subscribers is set.
+    // For ranges, they are given exactly the channels that were added to or removed from "p".
+    virtual void on_subscriber_channel(ChannelSubscriber *, channel_t, bool) { }
 
-    // Range channel subscriptions
-    boost::icl::interval_map<channel_t, std::unordered_set<ChannelSubscriber *> > m_range_subscriptions;
+    virtual void on_subscriber_ranges(ChannelSubscriber *, const boost::icl::interval_set<channel_t> &,
+                                      bool) { }
 
-    // In order to make this object thread-safe...
+    // In order to serialize subscription changes...
     std::recursive_mutex m_lock;
+    bool m_track_subscribers = false;
+
+  private:
+    // Retired is anything published to lookups; once replaced, it is kept around
+    // until every lookup which might have loaded it has finished.
+    struct Retired {
+        virtual ~Retired() {}
+    };
+
+    // A SubscriberList is the immutable set of subscribers of one channel (or channel range).
+    // Range segments share interned lists, which are kept sorted so they can be compared.
+    struct SubscriberList : public Retired {
+        std::vector<ChannelSubscriber *> subscribers;
+        mutable size_t segments = 0; // Writer-only: the number of range segments using this list.
+    };
+    struct SubscriberListHash {
+        size_t operator()(const SubscriberList *list) const;
+    };
+    struct SubscriberListEqual {
+        bool operator()(const SubscriberList *lhs, const SubscriberList *rhs) const
+        {
+            return lhs->subscribers == rhs->subscribers;
+        }
+    };
+
+    // A ChannelTable is an open-addressing hash table from a channel to its subscribers.
+    // Writers fill free slots in place, or replace a slot's list; a slot whose channel lost
+    // all of its subscribers keeps its channel and points at the empty list. The table is
+    // only rebuilt (and republished) when it runs out of free slots.
+    struct ChannelSlot {
+        channel_t channel = 0; // Written once, before subscribers is published.
+        std::atomic<const SubscriberList *> subscribers {nullptr}; // nullptr = slot is free
+    };
+    struct ChannelTable : public Retired {
+        explicit ChannelTable(unsigned int bits);
+
+        // find returns the slot for the channel, or the free slot where it would go.
+        ChannelSlot &find(channel_t c) const;
+
+        unsigned int bits;
+        size_t used; // Slots holding a channel, including ones with no subscribers left.
+        size_t live; // Slots holding a channel with at least one subscriber.
+        std::unique_ptr<ChannelSlot[]> slots;
+    };
+
+    // A RangeIndex splits the whole channel space into segments at sorted breakpoints:
+    // segment i covers [starts[i], starts[i + 1]), and every channel in it is subscribed to
+    // by exactly subscribers[i].  The first segment always starts at channel 0, and no two
+    // neighbouring segments have the same subscribers.
+    struct RangeIndex : public Retired {
+        std::vector<channel_t> starts;
+        std::vector<const SubscriberList *> subscribers;
+
+        // find returns the index of the segment containing the channel.
+        size_t find(channel_t c) const;
+    };
+
+    // Each lookup announces the epoch it started in using one of the reader slots;
+    // writers tag whatever they retire with a new epoch and free it once no announced
+    // lookup is older than that.
+    struct alignas(64) ReaderSlot {
+        std::atomic<uint64_t> epoch;
+    };
+    static const size_t READER_SLOTS = 64;
+
+    size_t enter_lookup();
+    void leave_lookup(size_t slot);
+    void retire(const Retired *garbage);
+    void reclaim();
+
+    // The empty list, which every channel that has lost its last subscriber points at.
+    static const SubscriberList s_no_subscribers;
+
+    // Writer-side helpers, all called with m_lock held:
+    void insert_subscriber(ChannelSubscriber *p, channel_t c);
+    size_t split_ranges(channel_t c);
+    void add_range(ChannelSubscriber *p, channel_t lo, channel_t hi);
+    void remove_range(ChannelSubscriber *p, channel_t lo, channel_t hi);
+    void update_ranges(ChannelSubscriber *p, channel_t lo, channel_t hi, bool subscribe);
+    void publish_ranges();
+    const SubscriberList *intern_subscribers(std::vector<ChannelSubscriber *> &subscribers);
+
+    // Single channel subscriptions
+    std::atomic<ChannelTable *> m_channel_table;
+
+    // Range channel subscriptions; m_ranges is the writers' copy, m_range_index the lookups'.
+    RangeIndex m_ranges;
+    std::atomic<RangeIndex *> m_range_index;
+    std::unordered_set<const SubscriberList *, SubscriberListHash, SubscriberListEqual> m_interned;
+    SubscriberList m_intern_probe;
+    std::vector<const SubscriberList *> m_unused_lists; // Retired by the next publish_ranges.
+
+    // Reclamation state.
+    std::atomic<uint64_t> m_epoch;
+    ReaderSlot m_reader_slots[READER_SLOTS];
+    std::vector<std::pair<uint64_t, std::unique_ptr<const Retired> > > m_retired;
 };
@@ -2,7 +2,7 @@
 #include "core/global.h"
 #include "core/msgtypes.h"
 
-MDNetworkParticipant::MDNetworkParticipant(const std::shared_ptr<uvw::TcpHandle> &socket)
+MDNetworkParticipant::MDNetworkParticipant(const NetworkSocket &socket)
     : MDParticipantInterface(), m_client(std::make_shared<NetworkClient>(this))
 {
     set_con_name("Network Participant");
@@ -10,15 +10,27 @@ MDNetworkParticipant::MDNetworkParticipant(const std::shared_ptr<uvw::TcpHandle>
     m_client->initialize(socket);
 }
 
+MDNetworkParticipant::MDNetworkParticipant(ShmLink &link)
+    : MDParticipantInterface(), m_shm_client(std::make_shared<ShmClient>(this))
+{
+    set_con_name("Network Participant");
+
+    m_shm_client->initialize(link);
+}
+
 MDNetworkParticipant::~MDNetworkParticipant()
 {
-    m_client->disconnect();
+    if(m_shm_client != nullptr) {
+        m_shm_client->disconnect();
+    } else {
+        m_client->disconnect();
+    }
 }
 
 void MDNetworkParticipant::handle_datagram(DatagramHandle dg, DatagramIterator&)
 {
     logger().trace() << "MDNetworkParticipant sending to downstream MD" << std::endl;
-    m_client->send_datagram(dg);
+    send_datagram(dg);
 }
 
 void MDNetworkParticipant::receive_datagram(DatagramHandle dg)
@@ -49,6 +61,39 @@ void MDNetworkParticipant::receive_datagram(DatagramHandle dg)
                     unsubscribe_range(lo, hi);
                     break;
                 }
+                case CONTROL_ADD_CHANNELS:
+                case CONTROL_REMOVE_CHANNELS: {
+                    // Read the whole batch first, so a truncated one isn't half applied.
+                    uint16_t count = dgi.read_uint16();
+                    std::vector<channel_t> batch;
+                    batch.reserve(count);
+                    for(uint16_t i = 0; i < count; ++i) {
+                        batch.push_back(dgi.read_channel());
+                    }
+                    if(msg_type == CONTROL_ADD_CHANNELS) {
+                        subscribe_channels(batch);
+                    } else {
+                        unsubscribe_channels(batch);
+                    }
+                    break;
+                }
+                case CONTROL_ADD_RANGES:
+                case CONTROL_REMOVE_RANGES: {
+                    uint16_t count = dgi.read_uint16();
+                    std::vector<range_t> batch;
+                    batch.reserve(count);
+                    for(uint16_t i = 0; i < count; ++i) {
+                        channel_t lo = dgi.read_channel();
+                        channel_t hi = dgi.read_channel();
+                        batch.emplace_back(lo, hi);
+                    }
+                    if(msg_type == CONTROL_ADD_RANGES) {
+                        subscribe_ranges(batch);
+                    } else {
+                        unsubscribe_ranges(batch);
+                    }
+                    break;
+                }
                 case CONTROL_ADD_POST_REMOVE: {
                     channel_t sender = dgi.read_channel();
                     add_post_remove(sender, dgi.read_datagram());
@@ -70,6 +115,10 @@ void MDNetworkParticipant::receive_datagram(DatagramHandle dg)
                     log_message(dgi.read_blob());
                     break;
                 }
+                case CONTROL_WATCH_INTEREST: {
+                    MessageDirector::singleton.watch_interest(this);
+                    break;
+                }
                 default:
                     logger().error() << "MDNetworkParticipant got unknown control message"
                                      << "with message type: " << msg_type << std::endl;
@@ -87,9 +136,14 @@ void MDNetworkParticipant::receive_datagram(DatagramHandle dg)
 
 void MDNetworkParticipant::receive_disconnect(const uvw::ErrorEvent &evt)
 {
-    logger().info() << "Lost connection from "
-                    << m_client->get_remote().ip << ":"
-                    << m_client->get_remote().port << ": "
-                    << evt.what() << std::endl;
+    if(m_shm_client != nullptr) {
+        logger().info() << "Lost shared-memory link on " << m_shm_client->get_path() << ": "
+                        << evt.what() << std::endl;
+    } else {
+        logger().info() << "Lost connection from "
+                        << m_client->get_remote().ip << ":"
+                        << m_client->get_remote().port << ": "
+                        << evt.what() << std::endl;
+    }
     terminate();
 }
@@ -1,11 +1,13 @@
 #pragma once
 #include "MessageDirector.h"
 #include "net/NetworkClient.h"
+#include "net/ShmTransport.h"
 
 class MDNetworkParticipant : public MDParticipantInterface, public NetworkHandler
 {
   public:
-    MDNetworkParticipant(const std::shared_ptr<uvw::TcpHandle> &socket);
+    MDNetworkParticipant(const NetworkSocket &socket);
+    MDNetworkParticipant(ShmLink &link);
     ~MDNetworkParticipant();
     virtual void initialize()
     {
@@ -13,9 +15,21 @@ class MDNetworkParticipant : public MDParticipantInterface, public NetworkHandle
     }
 
     virtual void handle_datagram(DatagramHandle dg, DatagramIterator &dgi);
+
+    // send_datagram sends a datagram straight down to the downstream MD.
+    inline void send_datagram(DatagramHandle dg)
+    {
+        if(m_shm_client != nullptr) {
+            m_shm_client->send_datagram(dg);
+        } else {
+            m_client->send_datagram(dg);
+        }
+    }
   private:
     virtual void receive_datagram(DatagramHandle dg);
     virtual void receive_disconnect(const uvw::ErrorEvent &evt);
 
+    // Exactly one of these is set, depending on how the downstream MD connected.
     std::shared_ptr<NetworkClient> m_client;
+    std::shared_ptr<ShmClient> m_shm_client;
 };
@@ -3,12 +3,16 @@
 #include "net/NetworkConnector.h"
 #include "core/global.h"
 #include "core/msgtypes.h"
+#include <algorithm>
 
 MDNetworkUpstream::MDNetworkUpstream(MessageDirector *md) :
     m_message_director(md), m_client(std::make_shared<NetworkClient>(this)),
     m_connector(std::make_shared<NetworkConnector>(g_loop))
 {
-
+    m_flush_handle = g_loop->resource<uvw::AsyncHandle>();
+    m_flush_handle->on<uvw::AsyncEvent>([this](const uvw::AsyncEvent&, uvw::AsyncHandle&) {
+        flush_pending_changes();
+    });
 }
 
 void MDNetworkUpstream::connect(const std::string &address)
@@ -17,9 +21,31 @@ void MDNetworkUpstream::connect(const std::string &address)
     ConnectErrorCallback err_callback = std::bind(&MDNetworkUpstream::on_connect_error, this, std::placeholders::_1);
 
     m_connector->connect(address, 7199, callback, err_callback);
+
+    // Ask to be told what upstream is interested in; this is sent as soon as we connect.
+    send_datagram(Datagram::create(CONTROL_WATCH_INTEREST));
+}
+
+void MDNetworkUpstream::connect_shm(const std::string &path, size_t capacity)
+{
+    ShmLink link;
+    int err = shm_connect(path, capacity, link);
+    if(err != 0) {
+        m_message_director->receive_disconnect(uvw::ErrorEvent{err});
+        exit(1);
+    }
+
+    m_connector->destroy();
+    m_connector = nullptr;
+
+    m_shm_client = std::make_shared<ShmClient>(this);
+    m_shm_client->initialize(link);
+    m_initialized = true;
+
+    send_datagram(Datagram::create(CONTROL_WATCH_INTEREST));
 }
 
-void MDNetworkUpstream::on_connect(const std::shared_ptr<uvw::TcpHandle> &socket)
+void MDNetworkUpstream::on_connect(const NetworkSocket &socket)
 {
     if(socket == nullptr) {
         m_message_director->receive_disconnect(uvw::ErrorEvent{(int)UV_EADDRNOTAVAIL});
@@ -43,6 +69,9 @@ void MDNetworkUpstream::send_datagram(DatagramHandle dg)
         std::lock_guard<std::mutex> lock(m_messages_lock);
         m_messages.push(dg);
     }
+    else if(m_shm_client != nullptr) {
+        m_shm_client->send_datagram(dg);
+    }
     else {
         m_client->send_datagram(dg);
     }
@@ -75,44 +104,193 @@ void MDNetworkUpstream::on_connect_error(const uvw::ErrorEvent& evt)
 
 void MDNetworkUpstream::subscribe_channel(channel_t c)
 {
-    DatagramPtr dg = Datagram::create(CONTROL_ADD_CHANNEL);
-    dg->add_channel(c);
-    send_datagram(dg);
+    queue_change(CONTROL_ADD_CHANNEL, c, c);
 }
 
 void MDNetworkUpstream::unsubscribe_channel(channel_t c)
 {
-    DatagramPtr dg = Datagram::create(CONTROL_REMOVE_CHANNEL);
-    dg->add_channel(c);
-    send_datagram(dg);
+    queue_change(CONTROL_REMOVE_CHANNEL, c, c);
 }
 
 void MDNetworkUpstream::subscribe_range(channel_t lo, channel_t hi)
 {
-    DatagramPtr dg = Datagram::create(CONTROL_ADD_RANGE);
-    dg->add_channel(lo);
-    dg->add_channel(hi);
-    send_datagram(dg);
+    queue_change(CONTROL_ADD_RANGE, lo, hi);
 }
 
 void MDNetworkUpstream::unsubscribe_range(channel_t lo, channel_t hi)
 {
-    DatagramPtr dg = Datagram::create(CONTROL_REMOVE_RANGE);
-    dg->add_channel(lo);
-    dg->add_channel(hi);
-    send_datagram(dg);
+    queue_change(CONTROL_REMOVE_RANGE, lo, hi);
 }
 
 void MDNetworkUpstream::handle_datagram(DatagramHandle dg)
 {
+    if(!m_has_pending_changes.load(std::memory_order_acquire)) {
+        send_datagram(dg);
+        return;
+    }
+
+    // Subscription changes made before this datagram was routed must reach upstream first.
+    std::lock_guard<std::mutex> lock(m_pending_lock);
+    send_pending_changes();
     send_datagram(dg);
 }
 
+void MDNetworkUpstream::queue_change(uint16_t msg_type, channel_t lo, channel_t hi)
+{
+    std::lock_guard<std::mutex> lock(m_pending_lock);
+    if(m_pending_changes.empty()) {
+        m_has_pending_changes.store(true, std::memory_order_release);
+        m_flush_handle->send();
+    }
+    m_pending_changes.push_back(PendingChange {msg_type, lo, hi});
+}
+
+void MDNetworkUpstream::flush_pending_changes()
+{
+    std::lock_guard<std::mutex> lock(m_pending_lock);
+    send_pending_changes();
+}
+
+// send_pending_changes sends every queued subscription change, in order. It must be called
+// with m_pending_lock held, and m_has_pending_changes is only cleared once they have all
+// been sent, so that no datagram can skip past them in the meantime.
+void MDNetworkUpstream::send_pending_changes()
+{
+    auto it = m_pending_changes.begin();
+    while(it != m_pending_changes.end()) {
+        // Find the run of changes of the same type starting here.
+        uint16_t msg_type = it->msg_type;
+        auto run_end = it + 1;
+        while(run_end != m_pending_changes.end() && run_end->msg_type == msg_type) {
+            ++run_end;
+        }
+
+        bool is_range = (msg_type == CONTROL_ADD_RANGE || msg_type == CONTROL_REMOVE_RANGE);
+        if(run_end - it == 1) {
+            DatagramPtr dg = Datagram::create(msg_type);
+            dg->add_channel(it->lo);
+            if(is_range) {
+                dg->add_channel(it->hi);
+            }
+            send_datagram(dg);
+            it = run_end;
+            continue;
+        }
+
+        uint16_t batch_type;
+        switch(msg_type) {
+            case CONTROL_ADD_CHANNEL:
+                batch_type = CONTROL_ADD_CHANNELS;
+                break;
+            case CONTROL_REMOVE_CHANNEL:
+                batch_type = CONTROL_REMOVE_CHANNELS;
+                break;
+            case CONTROL_ADD_RANGE:
+                batch_type = CONTROL_ADD_RANGES;
+                break;
+            default:
+                batch_type = CONTROL_REMOVE_RANGES;
+                break;
+        }
+
+        while(it != run_end) {
+            uint16_t count = (uint16_t)std::min<size_t>(run_end - it, MD_CONTROL_BATCH_MAX);
+            DatagramPtr dg = Datagram::create(batch_type);
+            dg->add_uint16(count);
+            for(uint16_t i = 0; i < count; ++i, ++it) {
+                dg->add_channel(it->lo);
+                if(is_range) {
+                    dg->add_channel(it->hi);
+                }
+            }
+            send_datagram(dg);
+        }
+    }
+
+    m_pending_changes.clear();
+    m_has_pending_changes.store(false, std::memory_order_release);
+}
+
+bool MDNetworkUpstream::has_interest(const channel_t *channels, size_t count)
+{
+    // Until upstream has told us everything it's interested in, it may be interested in anything.
+    if(!m_interest_ready.load(std::memory_order_acquire)) {
+        return true;
+    }
+
+    return m_interest.has_subscribers(channels, count);
+}
+
 void MDNetworkUpstream::receive_datagram(DatagramHandle dg)
 {
+    DatagramIterator dgi(dg);
+    try {
+        if(dgi.read_uint8() == 1 && dgi.read_channel() == CONTROL_MESSAGE) {
+            handle_interest(dgi);
+            return;
+        }
+    } catch(const DatagramIteratorEOF &) {
+        // Let the MessageDirector complain about it.
+    }
+
     m_message_director->receive_datagram(dg);
 }
 
+void MDNetworkUpstream::handle_interest(DatagramIterator &dgi)
+{
+    try {
+        uint16_t msg_type = dgi.read_uint16();
+        switch(msg_type) {
+            case CONTROL_INTEREST_READY: {
+                m_interest_ready.store(true, std::memory_order_release);
+                break;
+            }
+            case CONTROL_INTEREST_ADD_CHANNELS:
+            case CONTROL_INTEREST_REMOVE_CHANNELS: {
+                uint16_t count = dgi.read_uint16();
+                std::vector<channel_t> channels;
+                channels.reserve(count);
+                for(uint16_t i = 0; i < count; ++i) {
+                    channels.push_back(dgi.read_channel());
+                }
+                if(msg_type == CONTROL_INTEREST_ADD_CHANNELS) {
+                    m_interest.subscribe_channels(&m_interest_channels, channels);
+                } else {
+                    m_interest.unsubscribe_channels(&m_interest_channels, channels);
+                }
+                break;
+            }
+            case CONTROL_INTEREST_ADD_RANGES:
+            case CONTROL_INTEREST_REMOVE_RANGES: {
+                uint16_t count = dgi.read_uint16();
+                std::vector<range_t> ranges;
+                ranges.reserve(count);
+                for(uint16_t i = 0; i < count; ++i) {
+                    channel_t lo = dgi.read_channel();
+                    channel_t hi = dgi.read_channel();
+                    ranges.emplace_back(lo, hi);
+                }
+                // N.B. channels and ranges are kept on separate subscribers, because removing
+                // a range also removes a subscriber's channels within it.
+                if(msg_type == CONTROL_INTEREST_ADD_RANGES) {
+                    m_interest.subscribe_ranges(&m_interest_ranges, ranges);
+                } else {
+                    m_interest.unsubscribe_ranges(&m_interest_ranges, ranges);
+                }
+                break;
+            }
+            default:
+                m_message_director->logger().error() << "MDNetworkUpstream got unknown control message"
+                                                     << " with message type: " << msg_type << std::endl;
+        }
+    } catch(const DatagramIteratorEOF &) {
+        // We can't know what upstream wants anymore, so go back to sending it everything.
+        m_message_director->logger().error() << "MDNetworkUpstream received a truncated control message."
+                                             << std::endl;
+        m_interest_ready.store(false, std::memory_order_release);
+    }
+}
+
 void MDNetworkUpstream::receive_disconnect(const uvw::ErrorEvent &evt)
 {
     m_message_director->receive_disconnect(evt);
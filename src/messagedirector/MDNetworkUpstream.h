@@ -1,23 +1,38 @@
 #pragma once
+#include <atomic>
+#include <queue>
 #include "MessageDirector.h"
 #include "net/NetworkClient.h"
 #include "net/NetworkConnector.h"
+#include "net/ShmTransport.h"
 
-// All MDUpstreams must be thread-safe. This class does not need a lock, however,
-// because all of its operations are based on local variables and the functions
-// of NetworkClient (which are themselves thread-safe)
+// All MDUpstreams must be thread-safe. Sending is done by NetworkClient (which is
+// itself thread-safe); the only state of our own is the subscription changes waiting
+// to be sent, which m_pending_lock guards.
+//
+// Subscription changes are not sent right away: they are collected until the end of
+// the current loop iteration (or until anything else is sent upstream, so that they
+// never overtake it) and then sent together, as batched control messages where a run
+// of several adds or removes can be sent as one.
+//
+// Upstream, in turn, keeps us told of what everything else there is subscribed to
+// (if it knows), so that we can leave out datagrams nothing upstream wants.
 class MDNetworkUpstream : public NetworkHandler, public MDUpstream
 {
   public:
     MDNetworkUpstream(MessageDirector *md);
 
     void connect(const std::string &address);
-    void on_connect(const std::shared_ptr<uvw::TcpHandle> &socket);
+    // connect_shm links up with an upstream MD on the same host over shared memory,
+    //     negotiated over the Unix socket at "path", instead of connecting over TCP.
+    void connect_shm(const std::string &path, size_t capacity);
+    void on_connect(const NetworkSocket &socket);
     void on_connect_error(const uvw::ErrorEvent& evt);
 
     // Queueing interfaces for datagrams pending being sent upstream.
     void send_datagram(DatagramHandle dg);
     void flush_send_queue();
+    void flush_pending_changes();
 
     // Interfaces that MDUpstream needs us to implement:
     virtual void subscribe_channel(channel_t c);
@@ -25,6 +40,7 @@ class MDNetworkUpstream : public NetworkHandler, public MDUpstream
     virtual void subscribe_range(channel_t lo, channel_t hi);
     virtual void unsubscribe_range(channel_t lo, channel_t hi);
     virtual void handle_datagram(DatagramHandle dg);
+    virtual bool has_interest(const channel_t *channels, size_t count);
 
     // Interfaces that NetworkClient needs us to implement:
     virtual void initialize()
@@ -36,11 +52,35 @@ class MDNetworkUpstream : public NetworkHandler, public MDUpstream
     virtual void receive_disconnect(const uvw::ErrorEvent &evt);
 
   private:
+    // A subscription change waiting to be sent upstream; a single channel has lo == hi.
+    struct PendingChange {
+        uint16_t msg_type;
+        channel_t lo;
+        channel_t hi;
+    };
+
+    void queue_change(uint16_t msg_type, channel_t lo, channel_t hi);
+    void send_pending_changes();
+    void handle_interest(DatagramIterator &dgi);
+
     MessageDirector *m_message_director;
     std::shared_ptr<NetworkClient> m_client;
+    std::shared_ptr<ShmClient> m_shm_client; // Used instead of m_client if set.
     std::shared_ptr<NetworkConnector> m_connector;
     std::mutex m_messages_lock;
     std::queue<DatagramHandle> m_messages;
     bool m_initialized = false;
     bool m_is_sending = false;
+
+    std::mutex m_pending_lock;
+    std::vector<PendingChange> m_pending_changes;
+    std::atomic<bool> m_has_pending_changes {false};
+    std::shared_ptr<uvw::AsyncHandle> m_flush_handle;
+
+    // The channels that something upstream (other than us) is subscribed to, as upstream
+    // has told us; it's only complete, and thus used, once m_interest_ready is set.
+    ChannelMap m_interest;
+    ChannelSubscriber m_interest_channels;
+    ChannelSubscriber m_interest_ranges;
+    std::atomic<bool> m_interest_ready {false};
 };
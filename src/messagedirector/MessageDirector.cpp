@@ -16,28 +16,85 @@ static ConfigVariable<std::string> bind_addr("bind", "unspecified", md_config);
 static ConfigVariable<std::string> connect_addr("connect", "unspecified", md_config);
 static ValidAddressConstraint valid_bind_addr(bind_addr);
 static ValidAddressConstraint valid_connect_addr(connect_addr);
+static ConfigVariable<std::string> shm_bind_path("shm_bind", "unspecified", md_config);
+static ConfigVariable<std::string> shm_connect_path("shm_connect", "unspecified", md_config);
+static ConfigVariable<unsigned int> shm_capacity("shm_capacity", SHM_DEFAULT_CAPACITY, md_config);
 static ConfigVariable<bool> threaded_mode("threaded", true, md_config);
+static ConfigVariable<unsigned int> routing_threads("routing_threads", 1, md_config);
+
+static bool is_nonzero(const unsigned int &n)
+{
+    return n != 0;
+}
+static ConfigConstraint<unsigned int> routing_threads_nonzero(is_nonzero, routing_threads,
+        "The message director needs at least one routing thread.");
+
+static bool is_ring_capacity(const unsigned int &n)
+{
+    return n >= 4096 && n <= (1 << 28) && (n & (n - 1)) == 0;
+}
+static ConfigConstraint<unsigned int> shm_capacity_valid(is_ring_capacity, shm_capacity,
+        "The shared-memory ring capacity must be a power of two from 4096 to 268435456.");
 
 static ConfigGroup daemon_config("daemon");
 static ConfigVariable<std::string> daemon_name("name", "<unnamed>", daemon_config);
 static ConfigVariable<std::string> daemon_url("url", "", daemon_config);
 
+// The number of datagrams each routing shard can hold before it has to fall
+// back to its (locked, unbounded) overflow list.
+static const size_t MD_QUEUE_CAPACITY = 1 << 16;
+// The maximum number of datagrams popped off a shard's queue at a time.
+static const size_t MD_BATCH_SIZE = 256;
+// The number of receivers a shard has room for before its scratch space has to grow.
+static const size_t MD_RECEIVERS_RESERVE = 64;
+// The quiescent epoch of a shard that is parked, and thus holds no participants.
+static const uint64_t MD_EPOCH_PARKED = UINT64_MAX;
+
 MessageDirector MessageDirector::singleton;
 
 
+MessageDirector::RoutingShard::RoutingShard() : messages(MD_QUEUE_CAPACITY), thread(nullptr),
+    overflowing(false), quiescent_epoch(0)
+{
+    batch.reserve(MD_BATCH_SIZE);
+    receivers.reserve(MD_RECEIVERS_RESERVE);
+}
+
 MessageDirector::MessageDirector() :  m_initialized(false), m_net_acceptor(nullptr), m_upstream(nullptr),
-    m_shutdown(false), m_main_is_routing(false), m_thread(nullptr), m_log("msgdir", "Message Director")
+    m_terminated_count(0), m_termination_epoch(0), m_next_shard_key(0), m_shutdown(false),
+    m_threaded(false), m_main_is_routing(false), m_log("msgdir", "Message Director")
 {
+    // Until init_network decides otherwise, the main thread routes everything on a single shard.
+    m_shards.emplace_back(new RoutingShard);
 }
 
 MessageDirector::~MessageDirector()
 {
     shutdown_threading();
 
-    m_terminated_participants.insert(m_participants.begin(), m_participants.end());
+    // Everything still alive gets released, retired or not.
+    std::vector<MDParticipantInterface*> participants(m_participants.begin(), m_participants.end());
     m_participants.clear();
+    for(const auto& it : m_terminated_participants) {
+        participants.push_back(it.second);
+    }
+    m_terminated_participants.clear();
+
+    // Newest first, and participants before their owners, so that nothing is released before
+    // what was made after it: a Role outlives its Clients, whose release() still needs the
+    // loops that the Role owns.
+    std::sort(participants.begin(), participants.end(),
+    [](const MDParticipantInterface *lhs, const MDParticipantInterface *rhs) {
+        if(lhs->m_shard_key != rhs->m_shard_key) {
+            return lhs->m_shard_key > rhs->m_shard_key;
+        }
+        return lhs->m_delivery_lock != &lhs->m_own_delivery_lock &&
+               rhs->m_delivery_lock == &rhs->m_own_delivery_lock;
+    });
 
-    process_terminates();
+    for(const auto& it : participants) {
+        it->release();
+    }
 }
 
 void MessageDirector::init_network()
@@ -60,8 +117,30 @@ void MessageDirector::init_network()
             m_net_acceptor->start();
         }
 
+        // Listen for downstream servers on the same host linking up over shared memory
+        if(shm_bind_path.get_val() != "unspecified") {
+            m_log.info() << "Opening shared-memory socket..." << std::endl;
+
+            ShmAcceptorCallback callback = std::bind(&MessageDirector::handle_shm_link,
+                                           this, std::placeholders::_1);
+
+            AcceptorErrorCallback err_callback = std::bind(&MessageDirector::handle_shm_error,
+                                                    this, std::placeholders::_1);
+
+            m_shm_acceptor = std::unique_ptr<ShmAcceptor>(new ShmAcceptor(callback, err_callback));
+            m_shm_acceptor->bind(shm_bind_path.get_val());
+        }
+
         // Connect to upstream server and start handling received messages
-        if(connect_addr.get_val() != "unspecified") {
+        if(shm_connect_path.get_val() != "unspecified") {
+            m_log.info() << "Connecting upstream over shared memory..." << std::endl;
+
+            MDNetworkUpstream *upstream = new MDNetworkUpstream(this);
+
+            upstream->connect_shm(shm_connect_path.get_val(), shm_capacity.get_val());
+
+            m_upstream = upstream;
+        } else if(connect_addr.get_val() != "unspecified") {
             m_log.info() << "Connecting upstream..." << std::endl;
 
             MDNetworkUpstream *upstream = new MDNetworkUpstream(this);
@@ -72,7 +151,16 @@ void MessageDirector::init_network()
         }
 
         if(threaded_mode.get_val()) {
-            m_thread.reset(new std::thread(std::bind(&MessageDirector::routing_thread, this)));
+            while(m_shards.size() < routing_threads.get_val()) {
+                m_shards.emplace_back(new RoutingShard);
+            }
+
+            m_threaded = true;
+            for(auto it = m_shards.begin(); it != m_shards.end(); ++it) {
+                RoutingShard &shard = **it;
+                shard.thread.reset(new std::thread(std::bind(&MessageDirector::routing_thread,
+                                                             this, std::ref(shard))));
+            }
         }
 
         m_initialized = true;
@@ -81,38 +169,52 @@ void MessageDirector::init_network()
 
 void MessageDirector::shutdown_threading()
 {
-    if(!m_thread) {
+    if(!m_threaded) {
         return;
     }
 
-    // Signal routing thread to shut down:
-    {
-        std::lock_guard<std::mutex> lock(m_messages_lock);
-        m_shutdown = true;
-        m_cv.notify_one();
+    // Signal routing threads to shut down:
+    m_shutdown = true;
+    for(auto it = m_shards.begin(); it != m_shards.end(); ++it) {
+        (*it)->messages.interrupt();
     }
 
-    // Wait for it to do so:
-    m_thread->join();
-    m_thread.reset();
+    // Wait for them to do so:
+    for(auto it = m_shards.begin(); it != m_shards.end(); ++it) {
+        (*it)->thread->join();
+        (*it)->thread.reset();
+    }
+    m_threaded = false;
 }
 
-void MessageDirector::route_datagram(MDParticipantInterface *p, DatagramHandle dg)
+MessageDirector::RoutingShard &MessageDirector::shard_for(MDParticipantInterface *p)
+{
+    // Datagrams from upstream arrive over a single ordered link, so they all share a shard.
+    if(p == nullptr) {
+        return *m_shards[0];
+    }
+
+    return *m_shards[p->m_shard_key % m_shards.size()];
+}
+
+size_t MessageDirector::get_overflow_depth() const
 {
-    std::unique_lock<std::mutex> lock(m_messages_lock);
+    size_t depth = 0;
+    for(auto it = m_shards.begin(); it != m_shards.end(); ++it) {
+        depth += (*it)->messages.overflow_size();
+    }
+    return depth;
+}
 
-    // We need to hold the lock to push the datagram into the message queue, and to signal the MD thread (if in threaded mode).
-    m_messages.push(std::make_pair(p, dg));
+void MessageDirector::route_datagram(MDParticipantInterface *p, DatagramHandle dg)
+{
+    shard_for(p).messages.push(RoutedMessage(p, dg));
 
-    if(m_thread) {
-        // If in threaded mode, ring the bell to let the MD thread know we have a datagram to process and return.
-        m_cv.notify_one();
+    if(m_threaded) {
+        // If in threaded mode, the push already rang the bell if the shard's thread was parked.
         return;
     }
 
-    // We don't need to hold the message lock past this point, as we're not in threaded mode.
-    lock.unlock();
-
     if(std::this_thread::get_id() != g_main_thread_id) {
         // We aren't working in threaded mode, but we aren't in the main thread
         // either. For safety, we should post this down to the main thread.
@@ -130,74 +232,97 @@ void MessageDirector::flush_queue()
     // We want to be sure this is being invoked from within the main thread.
     assert(std::this_thread::get_id() == g_main_thread_id);
 
-    if(m_main_is_routing) {
-        // We're already in the middle of a queue flush, return immediately.
+    if(m_main_is_routing || m_threaded) {
+        // We're already in the middle of a queue flush, or the routing threads
+        // own the queues now; return immediately.
         return;
     }
 
     m_main_is_routing = true;
-    
-    {
-        std::unique_lock<std::mutex> lock(m_messages_lock);
 
-        while(!m_messages.empty()) {
-            // Get and process the datagram:
-            auto msg = m_messages.front();
-            m_messages.pop();
-
-            lock.unlock();
-            process_datagram(msg.first, msg.second);
-            lock.lock();
-        }
+    while(drain_queue(*m_shards[0])) {
     }
 
     // We're done flushing, we can now be invoked from others.
     m_main_is_routing = false;
 }
 
-// This function runs in a thread; it loops until it's told to shut down:
-void MessageDirector::routing_thread()
+// drain_queue routes a batch of datagrams from the shard; returns false if there was nothing to route.
+// N.B. This must only be called from the shard's own thread (or main, when not in threaded mode).
+bool MessageDirector::drain_queue(RoutingShard &shard)
 {
-    std::unique_lock<std::mutex> lock(m_messages_lock);
+    RoutedMessage msg;
+    while(shard.batch.size() < shard.batch.capacity() && shard.messages.try_pop(msg)) {
+        shard.batch.push_back(std::move(msg));
+    }
 
-    while(true) {
-        // Wait for something interesting to handle...
-        while(m_messages.empty() && !m_shutdown) {
-            m_cv.wait(lock);
-        }
+    if(shard.batch.empty()) {
+        return false;
+    }
 
-        if(m_shutdown) {
-            // Ehh, we've been told to shut off:
-            return;
+    // Producers never wait on a full ring, so a routing thread that can't keep up shows
+    // up as a growing overflow instead; say so when it starts and once it's been caught up.
+    size_t overflow = shard.messages.overflow_size();
+    if(overflow != 0 && !shard.overflowing) {
+        m_log.warning() << "Routing queue is full, " << overflow
+                        << " datagram(s) waiting in its overflow." << std::endl;
+    } else if(overflow == 0 && shard.overflowing) {
+        m_log.info() << "Routing queue has caught up with its overflow." << std::endl;
+    }
+    shard.overflowing = overflow != 0;
+
+    for(auto it = shard.batch.begin(); it != shard.batch.end(); ++it) {
+        if(it->second == nullptr) {
+            retire_participant(it->first);
+        } else {
+            process_datagram(shard, it->first, it->second);
         }
+    }
+    shard.batch.clear();
+
+    // We're not holding on to any participants between batches.
+    shard.quiescent_epoch = m_termination_epoch.load();
+
+    // N.B. Participants may reach end-of-life after receiving a datagram, or may
+    // be terminated in another thread (for example if a network socket closes);
+    // either way, process any received terminates after processing a batch.
+    process_terminates();
 
-        // Get and process the message:
-        auto msg = m_messages.front();
-        m_messages.pop();
+    return true;
+}
 
-        lock.unlock();
-        process_datagram(msg.first, msg.second);
-        lock.lock();
+// This function runs in a thread per shard; it loops until it's told to shut down:
+void MessageDirector::routing_thread(RoutingShard &shard)
+{
+    while(!m_shutdown) {
+        if(!drain_queue(shard)) {
+            // Nothing to do, wait for something interesting to handle...
+            shard.quiescent_epoch = MD_EPOCH_PARKED;
+            shard.messages.wait();
+            shard.quiescent_epoch = m_termination_epoch.load();
+        }
     }
 }
 
-void MessageDirector::process_datagram(MDParticipantInterface *p, DatagramHandle dg)
+void MessageDirector::process_datagram(RoutingShard &shard, MDParticipantInterface *p,
+                                       DatagramHandle dg)
 {
-    m_log.trace() << "Processing datagram...." << std::endl;
+    // This is the hottest path in the daemon: don't build any trace output unless it's wanted.
+    bool tracing = m_log.is_enabled(LSEVERITY_TRACE);
+    if(tracing) {
+        m_log.trace() << "Processing datagram...." << std::endl;
+    }
 
-    std::vector<channel_t> channels;
+    // N.B. the channel count is a uint8, so all of the receivers always fit on the stack.
+    channel_t channels[UINT8_MAX];
+    uint8_t channel_count;
     DatagramIterator dgi(dg);
     try {
         // Unpack channels to send messages to
-        uint8_t channel_count = dgi.read_uint8();
-        auto receive_log = m_log.trace();
-        receive_log << "Receivers: ";
+        channel_count = dgi.read_uint8();
         for(uint8_t i = 0; i < channel_count; ++i) {
-            channel_t channel = dgi.read_channel();
-            receive_log << channel << ", ";
-            channels.push_back(channel);
+            channels[i] = dgi.read_channel();
         }
-        receive_log << "\n";
     } catch(const DatagramIteratorEOF &) {
         // Log error with receivers output
         if(p) {
@@ -210,11 +335,23 @@ void MessageDirector::process_datagram(MDParticipantInterface *p, DatagramHandle
         return;
     }
 
+    if(tracing) {
+        auto receive_log = m_log.trace();
+        receive_log << "Receivers: ";
+        for(uint8_t i = 0; i < channel_count; ++i) {
+            receive_log << channels[i] << ", ";
+        }
+        receive_log << "\n";
+    }
+
     // Find the participants that need to receive the message
-    std::unordered_set<ChannelSubscriber*> receiving_participants;
-    lookup_channels(channels, receiving_participants);
+    std::vector<ChannelSubscriber *> &receiving_participants = shard.receivers;
+    lookup_channels(channels, channel_count, receiving_participants);
     if(p) {
-        receiving_participants.erase(p);
+        auto self = std::find(receiving_participants.begin(), receiving_participants.end(), p);
+        if(self != receiving_participants.end()) {
+            receiving_participants.erase(self);
+        }
     }
 
     // Send the datagram to each participant
@@ -222,6 +359,12 @@ void MessageDirector::process_datagram(MDParticipantInterface *p, DatagramHandle
         auto participant = static_cast<MDParticipantInterface *>(it);
         DatagramIterator msg_dgi(dg, dgi.tell());
 
+        // When several shards are routing, another one may be delivering to this participant.
+        std::unique_lock<std::mutex> delivery_lock(*participant->m_delivery_lock, std::defer_lock);
+        if(m_shards.size() > 1) {
+            delivery_lock.lock();
+        }
+
         try {
             participant->handle_datagram(dg, msg_dgi);
         } catch(const DatagramIteratorEOF &) {
@@ -238,35 +381,70 @@ void MessageDirector::process_datagram(MDParticipantInterface *p, DatagramHandle
     }
 
     // Send message upstream, if necessary
-    if(p && m_upstream) {
+    if(p && m_upstream && m_upstream->has_interest(channels, channel_count)) {
         m_upstream->handle_datagram(dg);
-        m_log.trace() << "...routing upstream." << std::endl;
+        if(tracing) {
+            m_log.trace() << "...routing upstream." << std::endl;
+        }
+    } else if(!tracing) {
+        return;
     } else if(!p) {
         // If there is no participant, then it came from the upstream
         m_log.trace() << "...not routing upstream: It came from there." << std::endl;
+    } else if(m_upstream) {
+        m_log.trace() << "...not routing upstream: Nothing there wants it." << std::endl;
     } else {
         // Otherwise this is the root MessageDirector.
         m_log.trace() << "...not routing upstream: There is none." << std::endl;
     }
-
-    // N.B. Participants may reach end-of-life after receiving a datagram, or may
-    // be terminated in another thread (for example if a network socket closes);
-    // either way, process any received terminates after processing a datagram.
-    process_terminates();
 }
 
+// retire_participant is called by a participant's own shard once it has routed everything
+// the participant sent before terminating. Other shards may still be delivering to it though,
+// so it is tagged with a new termination epoch and only deleted once every shard has passed it.
+void MessageDirector::retire_participant(MDParticipantInterface *p)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_participants_lock);
+        m_participants.erase(p);
+    }
+
+    std::lock_guard<std::mutex> lock(m_terminated_lock);
+    m_terminated_participants.emplace_back(++m_termination_epoch, p);
+    ++m_terminated_count;
+}
 
 void MessageDirector::process_terminates()
 {
-    std::unordered_set<MDParticipantInterface*> terminating_participants;
+    if(m_terminated_count == 0) {
+        return;
+    }
+
+    // A participant has been unsubscribed from everything before it is retired, so a shard
+    // which has seen its epoch can no longer find it with lookup_channels.
+    uint64_t safe_epoch = MD_EPOCH_PARKED;
+    for(auto it = m_shards.begin(); it != m_shards.end(); ++it) {
+        safe_epoch = std::min(safe_epoch, (*it)->quiescent_epoch.load());
+    }
+
+    std::vector<MDParticipantInterface*> terminating_participants;
 
     {
         std::lock_guard<std::mutex> lock(m_terminated_lock);
-        terminating_participants = std::move(m_terminated_participants);
+        auto it = m_terminated_participants.begin();
+        while(it != m_terminated_participants.end()) {
+            if(it->first <= safe_epoch) {
+                terminating_participants.push_back(it->second);
+                it = m_terminated_participants.erase(it);
+                --m_terminated_count;
+            } else {
+                ++it;
+            }
+        }
     }
 
     for(const auto& it : terminating_participants) {
-        delete it;
+        it->release();
     }
 }
 
@@ -302,9 +480,165 @@ void MessageDirector::on_remove_range(channel_t lo, channel_t hi)
     }
 }
 
-void MessageDirector::handle_connection(const std::shared_ptr<uvw::TcpHandle> &socket)
+void MessageDirector::on_subscriber_channel(ChannelSubscriber *p, channel_t c, bool subscribed)
 {
-    uvw::Addr remote = socket->peer();
+    for(auto it = m_interest_watchers.begin(); it != m_interest_watchers.end(); ++it) {
+        InterestWatcher &watcher = **it;
+        if(p == watcher.link) {
+            continue;
+        }
+
+        if(subscribed) {
+            if(++watcher.channels[c] == 1) {
+                send_interest(watcher, CONTROL_INTEREST_ADD_CHANNELS, std::vector<channel_t> {c});
+            }
+        } else {
+            auto count = watcher.channels.find(c);
+            if(count != watcher.channels.end() && --count->second == 0) {
+                watcher.channels.erase(count);
+                send_interest(watcher, CONTROL_INTEREST_REMOVE_CHANNELS, std::vector<channel_t> {c});
+            }
+        }
+    }
+}
+
+void MessageDirector::on_subscriber_ranges(ChannelSubscriber *p,
+                                           const boost::icl::interval_set<channel_t> &ranges,
+                                           bool subscribed)
+{
+    for(auto it = m_interest_watchers.begin(); it != m_interest_watchers.end(); ++it) {
+        InterestWatcher &watcher = **it;
+        if(p == watcher.link) {
+            continue;
+        }
+
+        if(subscribed) {
+            // Only the parts nothing else was subscribed to yet are news to the watcher.
+            boost::icl::interval_set<channel_t> added = ranges;
+            for(const auto &segment : watcher.ranges & ranges) {
+                added -= segment.first;
+            }
+            for(const auto &range : ranges) {
+                watcher.ranges += std::make_pair(range, 1u);
+            }
+            if(!added.empty()) {
+                send_interest(watcher, CONTROL_INTEREST_ADD_RANGES, added);
+            }
+        } else {
+            // ...and only the parts nothing else is subscribed to anymore.
+            for(const auto &range : ranges) {
+                watcher.ranges -= std::make_pair(range, 1u);
+            }
+            boost::icl::interval_set<channel_t> removed = ranges;
+            for(const auto &segment : watcher.ranges & ranges) {
+                removed -= segment.first;
+            }
+            if(!removed.empty()) {
+                send_interest(watcher, CONTROL_INTEREST_REMOVE_RANGES, removed);
+            }
+        }
+    }
+}
+
+void MessageDirector::watch_interest(MDNetworkParticipant *link)
+{
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
+
+    if(m_upstream) {
+        m_log.debug() << "Not sending subscriptions to a downstream MD, as there is an upstream MD."
+                      << std::endl;
+        return;
+    }
+    for(auto it = m_interest_watchers.begin(); it != m_interest_watchers.end(); ++it) {
+        if((*it)->link == link) {
+            return;
+        }
+    }
+
+    // Start from everything that's already subscribed...
+    std::unique_ptr<InterestWatcher> watcher(new InterestWatcher);
+    watcher->link = link;
+    {
+        std::lock_guard<std::mutex> lock(m_participants_lock);
+        for(auto it = m_participants.begin(); it != m_participants.end(); ++it) {
+            MDParticipantInterface *p = *it;
+            if(p == link) {
+                continue;
+            }
+            for(auto c = p->channels().begin(); c != p->channels().end(); ++c) {
+                ++watcher->channels[*c];
+            }
+            for(auto range = p->ranges().begin(); range != p->ranges().end(); ++range) {
+                watcher->ranges += std::make_pair(*range, 1u);
+            }
+        }
+    }
+
+    std::vector<channel_t> channels;
+    channels.reserve(watcher->channels.size());
+    for(auto it = watcher->channels.begin(); it != watcher->channels.end(); ++it) {
+        channels.push_back(it->first);
+    }
+    boost::icl::interval_set<channel_t> ranges;
+    for(auto it = watcher->ranges.begin(); it != watcher->ranges.end(); ++it) {
+        ranges += it->first;
+    }
+    send_interest(*watcher, CONTROL_INTEREST_ADD_CHANNELS, channels);
+    send_interest(*watcher, CONTROL_INTEREST_ADD_RANGES, ranges);
+    watcher->link->send_datagram(Datagram::create(CONTROL_INTEREST_READY));
+
+    // ...and then keep it up to date.
+    m_interest_watchers.push_back(std::move(watcher));
+    m_track_subscribers = true;
+}
+
+void MessageDirector::unwatch_interest(MDParticipantInterface *p)
+{
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
+
+    for(auto it = m_interest_watchers.begin(); it != m_interest_watchers.end(); ++it) {
+        if((*it)->link == p) {
+            m_interest_watchers.erase(it);
+            break;
+        }
+    }
+    m_track_subscribers = !m_interest_watchers.empty();
+}
+
+void MessageDirector::send_interest(InterestWatcher &watcher, uint16_t msg_type,
+                                   const std::vector<channel_t> &channels)
+{
+    for(size_t sent = 0; sent < channels.size();) {
+        uint16_t count = (uint16_t)std::min(channels.size() - sent, MD_CONTROL_BATCH_MAX);
+        DatagramPtr dg = Datagram::create(msg_type);
+        dg->add_uint16(count);
+        for(uint16_t i = 0; i < count; ++i, ++sent) {
+            dg->add_channel(channels[sent]);
+        }
+        watcher.link->send_datagram(dg);
+    }
+}
+
+void MessageDirector::send_interest(InterestWatcher &watcher, uint16_t msg_type,
+                                   const boost::icl::interval_set<channel_t> &ranges)
+{
+    auto it = ranges.begin();
+    while(it != ranges.end()) {
+        uint16_t count = (uint16_t)std::min<size_t>(std::distance(it, ranges.end()),
+                                                     MD_CONTROL_BATCH_MAX);
+        DatagramPtr dg = Datagram::create(msg_type);
+        dg->add_uint16(count);
+        for(uint16_t i = 0; i < count; ++i, ++it) {
+            dg->add_channel(boost::icl::first(*it));
+            dg->add_channel(boost::icl::last(*it));
+        }
+        watcher.link->send_datagram(dg);
+    }
+}
+
+void MessageDirector::handle_connection(const NetworkSocket &socket)
+{
+    uvw::Addr remote = socket.remote();
     m_log.info() << "Got an incoming connection from "
                  << remote.ip << ":" << remote.port << std::endl;
     new MDNetworkParticipant(socket); // It deletes itself when connection is lost
@@ -318,23 +652,38 @@ void MessageDirector::handle_error(const uvw::ErrorEvent& evt)
     }
 }
 
-void MessageDirector::add_participant(MDParticipantInterface* p)
+void MessageDirector::handle_shm_link(ShmLink &link)
+{
+    m_log.info() << "Got an incoming shared-memory link on " << link.path << std::endl;
+    new MDNetworkParticipant(link); // It deletes itself when the link is lost
+}
+
+void MessageDirector::handle_shm_error(const uvw::ErrorEvent& evt)
+{
+    m_log.fatal() << "Failed to bind shared-memory socket: " << evt.what() << "\n";
+    exit(1);
+}
+
+void MessageDirector::add_participant(MDParticipantInterface* p, MDParticipantInterface* owner)
 {
     std::lock_guard<std::mutex> lock(m_participants_lock);
     m_participants.insert(p);
+    if(owner != nullptr) {
+        p->m_shard_key = owner->m_shard_key;
+        p->m_delivery_lock = owner->m_delivery_lock;
+    } else {
+        p->m_shard_key = m_next_shard_key++;
+    }
 }
 
 void MessageDirector::remove_participant(MDParticipantInterface* p)
 {
+    // A downstream MD going away doesn't need to hear about it.
+    unwatch_interest(p);
+
     // Unsubscribe the participant from any remaining channels
     unsubscribe_all(p);
 
-    // Stop tracking participant
-    {
-        std::lock_guard<std::mutex> lock(m_participants_lock);
-        m_participants.erase(p);
-    }
-
     // Send out any post-remove messages the participant may have added.
     // N.B. this is done last, because we don't want to send messages
     // through the Director while a participant is being removed, as
@@ -342,11 +691,11 @@ void MessageDirector::remove_participant(MDParticipantInterface* p)
     // during that time.
     p->post_remove();
 
-    // Mark the participant for deletion
-    {
-        std::lock_guard<std::mutex> lock(m_terminated_lock);
-        m_terminated_participants.insert(p);
-    }
+    // Mark the participant for deletion; this goes through the participant's own shard,
+    // so that it is only retired after everything it has sent has been routed.
+    // N.B. we don't flush the queue here in non-threaded mode, as the caller is usually
+    // still running inside of the participant.
+    shard_for(p).messages.push(RoutedMessage(p, nullptr));
 }
 
 void MessageDirector::preroute_post_remove(channel_t sender, DatagramHandle post_remove)
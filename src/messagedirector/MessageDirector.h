@@ -2,23 +2,28 @@
 #include <vector>
 #include <unordered_set>
 #include <string>
-#include <queue>
 #include <thread>
 #include <atomic>
 #include <memory>
 #include <mutex>
-#include <condition_variable>
 #include <boost/icl/interval_map.hpp>
 #include "ChannelMap.h"
 #include "core/global.h"
 #include "util/Datagram.h"
 #include "util/DatagramIterator.h"
+#include "util/MPSCQueue.h"
 #include "util/TaskQueue.h"
 #include "net/NetworkAcceptor.h"
+#include "net/ShmTransport.h"
 
 class MDParticipantInterface;
+class MDNetworkParticipant;
 class MDUpstream;
 
+// The most channels (or ranges) sent in one batched control message; this keeps a batch
+// of ranges well within the 16-bit datagram length.
+const size_t MD_CONTROL_BATCH_MAX = 1024;
+
 // A MessageDirector is the internal networking object for an Astron server-node.
 // The MessageDirector receives message from other servers and routes them to the
 //     Client Agent, State Server, DB Server, DB-SS, and other server-nodes as necessary.
@@ -43,15 +48,29 @@ class MessageDirector final : public ChannelMap
         return m_log;
     }
 
+    // get_overflow_depth returns how many datagrams are waiting in the routing queues'
+    //     overflow lists, having arrived while their rings were full.  The queues never
+    //     refuse a datagram, so this is the backlog beyond MD_QUEUE_CAPACITY per shard.
+    size_t get_overflow_depth() const;
+
     // For MDUpstream (and subclasses) to call.
     void receive_datagram(DatagramHandle dg);
     void receive_disconnect(const uvw::ErrorEvent &evt);
 
+    // watch_interest starts keeping a downstream MD told of every channel that anything
+    //     other than the MD itself is subscribed to, so that it needn't send us datagrams
+    //     nothing here wants.  A MessageDirector with an upstream of its own can't know
+    //     that, and leaves the downstream MD to send everything as usual.
+    void watch_interest(MDNetworkParticipant *link);
+
   protected:
     void on_add_channel(channel_t c);
     void on_remove_channel(channel_t c);
     void on_add_range(channel_t lo, channel_t hi);
     void on_remove_range(channel_t lo, channel_t hi);
+    void on_subscriber_channel(ChannelSubscriber *p, channel_t c, bool subscribed);
+    void on_subscriber_ranges(ChannelSubscriber *p, const boost::icl::interval_set<channel_t> &ranges,
+                              bool subscribed);
 
   private:
     MessageDirector();
@@ -59,39 +78,89 @@ class MessageDirector final : public ChannelMap
     bool m_initialized;
 
     std::unique_ptr<NetworkAcceptor> m_net_acceptor;
+    std::unique_ptr<ShmAcceptor> m_shm_acceptor;
     MDUpstream *m_upstream;
 
+    // An InterestWatcher is a downstream MD being told about the subscriptions of everything
+    //     but itself; it counts those subscriptions, to tell it when a channel gains its first
+    //     or loses its last one.  N.B. watchers are guarded by the ChannelMap's lock.
+    struct InterestWatcher {
+        MDNetworkParticipant *link;
+        std::unordered_map<channel_t, unsigned int> channels;
+        boost::icl::interval_map<channel_t, unsigned int> ranges;
+    };
+    std::vector<std::unique_ptr<InterestWatcher> > m_interest_watchers;
+
     // Connected participants
     std::unordered_set<MDParticipantInterface*> m_participants;
-    std::unordered_set<MDParticipantInterface*> m_terminated_participants;
+    // Terminated participants waiting to be deleted, tagged with their termination epoch.
+    std::vector<std::pair<uint64_t, MDParticipantInterface*> > m_terminated_participants;
+    std::atomic<size_t> m_terminated_count;
+    std::atomic<uint64_t> m_termination_epoch;
+    uint64_t m_next_shard_key;
 
     // Threading stuff:
-    bool m_shutdown;
+    // A RoutedMessage is a datagram waiting to be routed and the participant that sent it
+    // (nullptr if it came from upstream). A null datagram retires the participant instead.
+    typedef std::pair<MDParticipantInterface *, DatagramHandle> RoutedMessage;
+
+    // A RoutingShard is a routing queue, and (in threaded mode) the thread that drains it.
+    // Every participant is assigned to one shard which routes all of its datagrams,
+    // so datagrams from the same sender are always routed in the order they were sent.
+    struct RoutingShard {
+        RoutingShard();
+
+        // Datagrams waiting to be routed. Pushed to by any thread, popped only by
+        // the shard's thread (or the main thread, when not in threaded mode).
+        MPSCQueue<RoutedMessage> messages;
+        std::vector<RoutedMessage> batch;
+        std::unique_ptr<std::thread> thread;
+        // Whether the shard was working through an overflow when it last drained a batch.
+        bool overflowing;
+
+        // Scratch space for the receivers of the datagram being routed; it is
+        // reused from one datagram to the next so that routing doesn't allocate.
+        std::vector<ChannelSubscriber *> receivers;
+
+        // The termination epoch the shard last saw while not holding on to any
+        // participants; participants retired at or before it are safe to delete.
+        std::atomic<uint64_t> quiescent_epoch;
+    };
+    std::vector<std::unique_ptr<RoutingShard> > m_shards;
+
+    std::atomic<bool> m_shutdown;
+    bool m_threaded;
     bool m_main_is_routing;
-    std::unique_ptr<std::thread> m_thread;
     std::mutex m_participants_lock;
     std::mutex m_terminated_lock;
-    std::mutex m_messages_lock;
-    std::queue<std::pair<MDParticipantInterface *, DatagramHandle>> m_messages;
-    std::condition_variable m_cv;
-    
+
+    RoutingShard &shard_for(MDParticipantInterface *p);
     void flush_queue();
-    void process_datagram(MDParticipantInterface *p, DatagramHandle dg);
+    bool drain_queue(RoutingShard &shard);
+    void process_datagram(RoutingShard &shard, MDParticipantInterface *p, DatagramHandle dg);
+    void retire_participant(MDParticipantInterface *p);
+    void unwatch_interest(MDParticipantInterface *p);
+    void send_interest(InterestWatcher &watcher, uint16_t msg_type,
+                       const std::vector<channel_t> &channels);
+    void send_interest(InterestWatcher &watcher, uint16_t msg_type,
+                       const boost::icl::interval_set<channel_t> &ranges);
     void process_terminates();
-    void routing_thread();
+    void routing_thread(RoutingShard &shard);
     void shutdown_threading();
 
     LogCategory m_log;
 
     friend class MDParticipantInterface;
-    void add_participant(MDParticipantInterface* participant);
+    void add_participant(MDParticipantInterface* participant, MDParticipantInterface* owner = nullptr);
     void remove_participant(MDParticipantInterface* participant);
     void preroute_post_remove(channel_t sender, DatagramHandle dg);
     void recall_post_removes(channel_t sender);
 
     // I/O OPERATIONS
-    void handle_connection(const std::shared_ptr<uvw::TcpHandle> &socket);
+    void handle_connection(const NetworkSocket &socket);
     void handle_error(const uvw::ErrorEvent& evt);
+    void handle_shm_link(ShmLink &link);
+    void handle_shm_error(const uvw::ErrorEvent& evt);
 };
 
 
@@ -112,10 +181,27 @@ class MDParticipantInterface : public ChannelSubscriber
         MessageDirector::singleton.add_participant(this);
     }
 
+    // A participant constructed with an owner is routed by the owner's shard and shares its
+    //     delivery lock, so it is never handled concurrently with the owner (or any of the
+    //     owner's other participants).  The owner must outlive the participant.
+    explicit MDParticipantInterface(MDParticipantInterface *owner)
+    {
+        MessageDirector::singleton.add_participant(this, owner);
+    }
+
     // handle_datagram should handle a message received from the MessageDirector.
     // Implementations of handle_datagram should be non-blocking operations.
     virtual void handle_datagram(DatagramHandle dg, DatagramIterator &dgi) = 0;
 
+    // release is called by the MessageDirector once the participant has been retired and
+    //     nothing can route to it any more; it deletes the participant.  A participant which
+    //     hands its datagrams off to another thread can override it to delete itself once
+    //     that thread is done with them.
+    virtual void release()
+    {
+        delete this;
+    }
+
     // post_remove tells the MDParticipant to handle all of its post remove packets.
     inline void post_remove()
     {
@@ -172,6 +258,30 @@ class MDParticipantInterface : public ChannelSubscriber
                          << "lo: " << lo << ", hi: " << hi << std::endl;
         MessageDirector::singleton.unsubscribe_range(this, lo, hi);
     }
+    inline void subscribe_channels(const std::vector<channel_t> &channels)
+    {
+        logger().trace() << "MDParticipant '" << m_name << "' subscribed "
+                         << channels.size() << " channels." << std::endl;
+        MessageDirector::singleton.subscribe_channels(this, channels);
+    }
+    inline void unsubscribe_channels(const std::vector<channel_t> &channels)
+    {
+        logger().trace() << "MDParticipant '" << m_name << "' unsubscribed "
+                         << channels.size() << " channels." << std::endl;
+        MessageDirector::singleton.unsubscribe_channels(this, channels);
+    }
+    inline void subscribe_ranges(const std::vector<range_t> &ranges)
+    {
+        logger().trace() << "MDParticipant '" << m_name << "' subscribed "
+                         << ranges.size() << " ranges." << std::endl;
+        MessageDirector::singleton.subscribe_ranges(this, ranges);
+    }
+    inline void unsubscribe_ranges(const std::vector<range_t> &ranges)
+    {
+        logger().trace() << "MDParticipant '" << m_name << "' unsubscribed "
+                         << ranges.size() << " ranges." << std::endl;
+        MessageDirector::singleton.unsubscribe_ranges(this, ranges);
+    }
     inline void unsubscribe_all()
     {
         logger().trace() << "MDParticipant '" << m_name << "' unsubscribing from all.\n";
@@ -210,6 +320,13 @@ class MDParticipantInterface : public ChannelSubscriber
     // The messages to be distributed on unexpected disconnect.
     std::unordered_map<channel_t, std::vector<DatagramHandle> > m_post_removes;
     std::atomic<bool> m_is_terminated {false};
+    // Which routing shard this participant's datagrams are routed by; keys are handed out
+    //     in the order participants are added (an owned participant shares its owner's).
+    uint64_t m_shard_key = 0;
+    // Serializes deliveries to this participant when several shards are routing;
+    //     points to the owner's lock for participants that have one.
+    std::mutex m_own_delivery_lock;
+    std::mutex *m_delivery_lock = &m_own_delivery_lock;
     std::string m_name;
     std::string m_url;
 };
@@ -225,4 +342,11 @@ class MDUpstream
     virtual void subscribe_range(channel_t lo, channel_t hi) = 0;
     virtual void unsubscribe_range(channel_t lo, channel_t hi) = 0;
     virtual void handle_datagram(DatagramHandle dg) = 0;
+
+    // has_interest tests if anything upstream may want a datagram sent to any of the
+    //     "count" channels in "cl"; the MessageDirector doesn't send it upstream otherwise.
+    virtual bool has_interest(const channel_t *, size_t)
+    {
+        return true;
+    }
 };
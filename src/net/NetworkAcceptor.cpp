@@ -1,10 +1,17 @@
 #include "core/global.h"
 #include "NetworkAcceptor.h"
 #include "address_utils.h"
+#include <cstring>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 
 NetworkAcceptor::NetworkAcceptor(AcceptorErrorCallback err_callback) :
-    m_loop(g_loop),
+    m_tasks(&TaskQueue::current()),
+    m_loop(m_tasks->loop()),
     m_acceptor(nullptr),
     m_started(false),
     m_haproxy_mode(false),
@@ -15,10 +22,13 @@ NetworkAcceptor::NetworkAcceptor(AcceptorErrorCallback err_callback) :
 void NetworkAcceptor::bind(const std::string &address,
         unsigned int default_port)
 {
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    assert(m_tasks->in_loop_thread());
 
-    m_acceptor = m_loop->resource<uvw::TcpHandle>();
-    m_acceptor->simultaneousAccepts(true);
+    std::string path;
+    if(split_unix_address(address, path)) {
+        bind_unix(path);
+        return;
+    }
 
     std::vector<uvw::Addr> addresses = resolve_address(address, default_port, m_loop);
 
@@ -27,17 +37,117 @@ void NetworkAcceptor::bind(const std::string &address,
         return;
     }
 
+    if(m_uring != nullptr) {
+        bind_uring(addresses);
+        return;
+    }
+
+    std::shared_ptr<uvw::TcpHandle> acceptor = m_loop->resource<uvw::TcpHandle>();
+    acceptor->simultaneousAccepts(true);
+    m_acceptor = acceptor;
+
     // Setup listen/error event handlers.
     start_accept();
 
+    if(m_reuse_port) {
+        // The handle can only be given the one socket; take the first address.
+        int err = open_reuse_port(*acceptor, addresses.front());
+        if(err < 0) {
+            this->m_err_callback(uvw::ErrorEvent{err});
+            return;
+        }
+        acceptor->bind(addresses.front());
+        return;
+    }
+
     for (uvw::Addr& addr : addresses) {
-        m_acceptor->bind(addr);
+        acceptor->bind(addr);
+    }
+}
+
+int NetworkAcceptor::open_reuse_port(uvw::TcpHandle &acceptor, const uvw::Addr &address)
+{
+#ifdef SO_REUSEPORT
+    // libuv can't set SO_REUSEPORT itself (on Linux), so we make the socket for it.
+    sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    if(uv_ip4_addr(address.ip.c_str(), address.port, reinterpret_cast<sockaddr_in*>(&ss)) != 0 &&
+       uv_ip6_addr(address.ip.c_str(), address.port, reinterpret_cast<sockaddr_in6*>(&ss)) != 0) {
+        return UV_EINVAL;
+    }
+
+    int fd = socket(ss.ss_family, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return -errno;
+    }
+
+    int on = 1;
+    if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+
+    acceptor.open(fd);
+    return 0;
+#else
+    (void)acceptor;
+    (void)address;
+    return UV_ENOTSUP;
+#endif
+}
+
+bool NetworkAcceptor::set_io_uring(bool io_uring)
+{
+    assert(m_tasks->in_loop_thread());
+
+    m_uring = io_uring ? UringLoop::get() : nullptr;
+    return m_uring != nullptr || !io_uring;
+}
+
+void NetworkAcceptor::bind_uring(const std::vector<uvw::Addr> &addresses)
+{
+    // Setup the accept callback.
+    start_accept();
+
+    // Unlike a uvw::TcpHandle, a listener only has the one socket; take the first address
+    // that works out.
+    int err = 0;
+    for(const uvw::Addr &addr : addresses) {
+        std::shared_ptr<UringListener> listener = std::make_shared<UringListener>(m_uring);
+        err = listener->bind(addr, m_reuse_port);
+        if(err == 0) {
+            m_uring_acceptor = listener;
+            return;
+        }
     }
+
+    this->m_err_callback(uvw::ErrorEvent{err});
+}
+
+void NetworkAcceptor::bind_unix(const std::string &path)
+{
+    m_acceptor = m_loop->resource<uvw::PipeHandle>();
+    m_unix_path = path;
+
+#ifndef _WIN32
+    // A socket left behind by a previous run would make bind fail; anything else at the
+    // path is left alone.
+    struct stat st;
+    if(lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path.c_str());
+    }
+#endif
+
+    // Setup listen/error event handlers.
+    start_accept();
+
+    m_acceptor.pipe->bind(path);
 }
 
 void NetworkAcceptor::start()
 {
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    assert(m_tasks->in_loop_thread());
 
     if(m_started) {
         // Already started, start() was called twice!
@@ -47,12 +157,20 @@ void NetworkAcceptor::start()
     m_started = true;
     
     // Queue listener for loop.
-    m_acceptor->listen();
+    if(m_uring_acceptor != nullptr) {
+        m_uring_acceptor->listen(m_uring_callback, [this](int err) {
+            this->m_err_callback(uvw::ErrorEvent{err});
+        });
+    } else if(m_acceptor.tcp != nullptr) {
+        m_acceptor.tcp->listen();
+    } else {
+        m_acceptor.pipe->listen();
+    }
 }
 
 void NetworkAcceptor::stop()
 {
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    assert(m_tasks->in_loop_thread());
 
     if(!m_started) {
         // Already stopped, stop() was called twice!
@@ -61,5 +179,15 @@ void NetworkAcceptor::stop()
 
     m_started = false;
 
-    m_acceptor->close();
+    if(m_uring_acceptor != nullptr) {
+        m_uring_acceptor->close();
+    } else {
+        m_acceptor.close();
+    }
+
+#ifndef _WIN32
+    if(!m_unix_path.empty()) {
+        unlink(m_unix_path.c_str());
+    }
+#endif
 }
@@ -1,6 +1,8 @@
 #pragma once
 #include <thread>
 #include "deps/uvw/uvw.hpp"
+#include "NetworkSocket.h"
+#include "util/TaskQueue.h"
 
 typedef std::function<void(const uvw::ErrorEvent& evt)> AcceptorErrorCallback;
 
@@ -11,6 +13,8 @@ class NetworkAcceptor
 
     // Parses the string "address" and binds to it. If no port is specified
     // as part of the address, it will use default_port.
+    // An address of the form "unix:/path/to.sock" binds a Unix domain socket instead,
+    // replacing any socket left behind at that path by a previous run.
     void bind(const std::string &address, unsigned int default_port);
 
     void start();
@@ -21,16 +25,41 @@ class NetworkAcceptor
         m_haproxy_mode = haproxy_mode;
     }
 
+    // set_reuse_port asks for TCP addresses to be bound with SO_REUSEPORT, so that several
+    //     acceptors (e.g. one per LoopThread) can listen on the same address, with the kernel
+    //     sharing connections out between them; call it before bind.
+    inline void set_reuse_port(bool reuse_port)
+    {
+        m_reuse_port = reuse_port;
+    }
+
+    // set_io_uring asks for TCP connections to be accepted and serviced with io_uring instead
+    //     of libuv (see UringTransport.h); call it before bind. It returns false, and libuv is
+    //     used after all, if io_uring isn't available.
+    bool set_io_uring(bool io_uring);
+
   protected:
     std::unique_ptr<std::thread> m_thread;
+    TaskQueue *m_tasks; // The queue (and loop) of the thread we were constructed on.
     std::shared_ptr<uvw::Loop> m_loop;
-    std::shared_ptr<uvw::TcpHandle> m_acceptor;
+    NetworkSocket m_acceptor;
+    std::string m_unix_path; // Set if m_acceptor is a Unix domain socket.
+    // Used instead of m_acceptor for TCP if set_io_uring was called.
+    std::shared_ptr<UringLoop> m_uring;
+    std::shared_ptr<UringListener> m_uring_acceptor;
+    UringListener::AcceptCallback m_uring_callback; // Set by start_accept.
 
     bool m_started = false;
     bool m_haproxy_mode = false;
+    bool m_reuse_port = false;
     AcceptorErrorCallback m_err_callback;
 
     NetworkAcceptor(AcceptorErrorCallback err_callback);
 
     virtual void start_accept() = 0;
+
+  private:
+    void bind_unix(const std::string &path);
+    void bind_uring(const std::vector<uvw::Addr> &addresses);
+    int open_reuse_port(uvw::TcpHandle &acceptor, const uvw::Addr &address);
 };
@@ -1,10 +1,13 @@
 #include "NetworkClient.h"
 #include "config/ConfigVariable.h"
 #include "core/global.h"
+#include <algorithm>
+#include <functional>
+#include <queue>
 #include <stdexcept>
 
 NetworkClient::NetworkClient(NetworkHandler *handler)
-    : m_handler(handler), m_socket(nullptr), m_async_timer(), m_send_queue(),
+    : m_handler(handler), m_tasks(&TaskQueue::current()), m_socket(nullptr), m_async_timer(), m_send_queue(),
       m_disconnect_error(UV_EOF) {}
 
 NetworkClient::~NetworkClient() {
@@ -13,11 +16,6 @@ NetworkClient::~NetworkClient() {
   assert(!is_connected(lock));
 
   shutdown(lock);
-
-  if (m_send_buf != nullptr) {
-    delete[] m_send_buf;
-    m_send_buf = nullptr;
-  }
 }
 
 void NetworkClient::shutdown(std::unique_lock<std::mutex> &lock) {
@@ -29,10 +27,10 @@ void NetworkClient::shutdown(std::unique_lock<std::mutex> &lock) {
   auto async_timer = m_async_timer;
 
   lock.unlock();
-  TaskQueue::singleton.enqueue_task([=]() {
-    socket->close();
+  m_tasks->enqueue_task([=]() {
+    socket.close();
     async_timer->stop();
-    async_timer->close();
+    async_timer->set_callback(nullptr);
   });
   lock.lock();
 
@@ -41,24 +39,26 @@ void NetworkClient::shutdown(std::unique_lock<std::mutex> &lock) {
   m_haproxy_handler = nullptr;
 }
 
-void NetworkClient::initialize(const std::shared_ptr<uvw::TcpHandle> &socket,
+void NetworkClient::initialize(const NetworkSocket &socket,
                                const uvw::Addr &remote, const uvw::Addr &local,
                                const bool haproxy_mode,
                                std::unique_lock<std::mutex> &lock) {
-  if (m_socket) {
+  if (m_socket != nullptr) {
     throw std::logic_error("Trying to set a socket of a network client whose "
                            "socket was already set.");
   }
 
-  // This function should ONLY run in the main thread. libuv is not thread-safe.
-  assert(std::this_thread::get_id() == g_main_thread_id);
+  // This function should ONLY run in our loop's thread. libuv is not thread-safe.
+  assert(m_tasks->in_loop_thread());
 
   m_socket = socket;
 
-  m_socket->noDelay(true);
-  m_socket->keepAlive(true, uvw::TcpHandle::Time{60});
+  if (m_socket.tcp != nullptr) {
+    m_socket.tcp->noDelay(true);
+    m_socket.tcp->keepAlive(true, uvw::TcpHandle::Time{60});
+  }
 
-  m_async_timer = g_loop->resource<uvw::TimerHandle>();
+  m_async_timer = std::make_shared<TimerWheel::Timer>();
 
   m_remote = remote;
   m_local = local;
@@ -76,10 +76,102 @@ void NetworkClient::initialize(const std::shared_ptr<uvw::TcpHandle> &socket,
     lock.lock();
   }
 
-  // NOT protected by a lock, make sure it runs in main!
+  // NOT protected by a lock, make sure it runs in our loop's thread!
   start_receive();
 }
 
+// A WriteCoalescer holds on to the NetworkClients of one loop that are waiting out their write
+// coalescing windows, and flushes each one when its window is up. One timer serves all of
+// them: it is only ever armed for the earliest deadline.
+class WriteCoalescer {
+public:
+  // get returns the WriteCoalescer for the calling thread's loop.
+  static WriteCoalescer &get() {
+    static thread_local std::unique_ptr<WriteCoalescer> coalescer;
+    const std::shared_ptr<uvw::Loop> &loop = TaskQueue::current().loop();
+    if (coalescer != nullptr && coalescer->m_loop != loop) {
+      // The thread has moved on to another loop (only the main thread's can be
+      // replaced): nothing waiting on the old one is left stranded.
+      coalescer->flush_all();
+      coalescer.reset();
+    }
+    if (coalescer == nullptr) {
+      coalescer.reset(new WriteCoalescer(loop));
+    }
+    return *coalescer;
+  }
+
+  ~WriteCoalescer() {
+    // The timer's listener points back at us, so it mustn't outlive us.
+    m_timer->clear();
+    m_timer->close();
+  }
+
+  // schedule has "client" flushed within "window_us" microseconds.
+  void schedule(const std::shared_ptr<NetworkClient> &client,
+                unsigned int window_us) {
+    m_pending.push(Pending{uv_hrtime() + window_us * 1000ull, client});
+    arm();
+  }
+
+private:
+  struct Pending {
+    uint64_t deadline; // In nanoseconds, as given by uv_hrtime.
+    std::shared_ptr<NetworkClient> client;
+
+    inline bool operator>(const Pending &other) const {
+      return deadline > other.deadline;
+    }
+  };
+
+  std::shared_ptr<uvw::Loop> m_loop;
+  std::shared_ptr<uvw::TimerHandle> m_timer;
+  std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>>
+      m_pending;
+  uint64_t m_armed = 0; // The deadline the timer is armed for, or 0.
+
+  WriteCoalescer(const std::shared_ptr<uvw::Loop> &loop)
+      : m_loop(loop), m_timer(loop->resource<uvw::TimerHandle>()) {
+    m_timer->on<uvw::TimerEvent>(
+        [this](const uvw::TimerEvent &, uvw::TimerHandle &) { expire(); });
+  }
+
+  void arm() {
+    if (m_pending.empty() || m_pending.top().deadline == m_armed) {
+      return;
+    }
+
+    // The timer only counts whole milliseconds, so round down: nothing is held
+    // past its deadline, and expire takes anything due within the millisecond.
+    m_armed = m_pending.top().deadline;
+    uint64_t now = uv_hrtime();
+    uint64_t delay = m_armed > now ? (m_armed - now) / 1000000 : 0;
+    m_timer->stop();
+    m_timer->start(uvw::TimerHandle::Time{delay}, uvw::TimerHandle::Time{0});
+  }
+
+  void flush_all() {
+    m_timer->stop();
+    m_armed = 0;
+    while (!m_pending.empty()) {
+      std::shared_ptr<NetworkClient> client = m_pending.top().client;
+      m_pending.pop();
+      client->flush_coalesced();
+    }
+  }
+
+  void expire() {
+    m_armed = 0;
+    uint64_t horizon = uv_hrtime() + 1000000;
+    while (!m_pending.empty() && m_pending.top().deadline <= horizon) {
+      std::shared_ptr<NetworkClient> client = m_pending.top().client;
+      m_pending.pop();
+      client->flush_coalesced();
+    }
+    arm();
+  }
+};
+
 void NetworkClient::send_datagram(DatagramHandle dg) {
   std::unique_lock<std::mutex> lock(m_mutex);
 
@@ -98,11 +190,29 @@ void NetworkClient::send_datagram(DatagramHandle dg) {
     return;
   }
 
-  // Poke the main thread to flush its buffer (it's fine if this is called
+  // With a coalescing window, the datagram waits (unless enough have piled up
+  // already) for whatever else gets sent in the meantime.
+  if (m_coalesce_window > 0 && m_total_queue_size < m_coalesce_bytes) {
+    if (!m_coalescing) {
+      m_coalescing = true;
+      lock.unlock();
+      auto schedule = [self = shared_from_this(), window = m_coalesce_window]() {
+        WriteCoalescer::get().schedule(self, window);
+      };
+      if (m_tasks->in_loop_thread()) {
+        schedule();
+      } else {
+        m_tasks->enqueue_task(schedule);
+      }
+    }
+    return;
+  }
+
+  // Poke our loop's thread to flush its buffer (it's fine if this is called
   // twice, it checks if it's already sending)
-  if (g_main_thread_id != std::this_thread::get_id()) {
+  if (!m_tasks->in_loop_thread()) {
     lock.unlock();
-    TaskQueue::singleton.enqueue_task([self = shared_from_this()]() {
+    m_tasks->enqueue_task([self = shared_from_this()]() {
       std::unique_lock<std::mutex> lock(self->m_mutex);
       self->flush_send_queue(lock);
     });
@@ -111,140 +221,185 @@ void NetworkClient::send_datagram(DatagramHandle dg) {
   }
 }
 
-void NetworkClient::defragment_input(std::unique_lock<std::mutex> &lock) {
-  while (m_data_buf.size() > sizeof(dgsize_t)) {
-    // Enough data to know the expected length of the datagram.
-    dgsize_t data_size = *reinterpret_cast<dgsize_t *>(m_data_buf.data());
-    if (m_data_buf.size() >= data_size + sizeof(dgsize_t)) {
-      size_t overread_size = (m_data_buf.size() - data_size - sizeof(dgsize_t));
-      DatagramPtr dg =
-          Datagram::create(reinterpret_cast<const uint8_t *>(m_data_buf.data() +
-                                                             sizeof(dgsize_t)),
-                           data_size);
-      if (0 < overread_size) {
-        // Splice leftover data to new m_data_buf based on expected datagram
-        // length.
-        m_data_buf = std::vector<uint8_t>(
-            reinterpret_cast<uint8_t *>(m_data_buf.data() + sizeof(dgsize_t) +
-                                        data_size),
-            reinterpret_cast<uint8_t *>(m_data_buf.data() + sizeof(dgsize_t) +
-                                        data_size + overread_size));
-      } else {
-        // No overread, buffer is empty.
-        m_data_buf = std::vector<uint8_t>();
+// Reads smaller than this are copied out datagram by datagram instead of being sliced, so
+// that a handler holding onto a lone small datagram doesn't pin a whole read buffer (which
+// libuv always allocates at 64 KiB, however little is read into it).
+static const size_t min_sliced_read = 4096;
+
+static inline dgsize_t read_dgsize(const uint8_t *data) {
+  dgsize_t size;
+  memcpy(&size, data, sizeof(dgsize_t));
+  return swap_le(size);
+}
+
+void ReceiveBuffer::feed(std::unique_ptr<char[]> data, size_t length,
+                         const DatagramCallback &dispatch) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.get());
+  size_t offset = 0;
+
+  // First, finish off the datagram left over from the last read (if any).
+  if (!m_partial.empty()) {
+    if (m_partial.size() < sizeof(dgsize_t)) {
+      size_t needed = std::min(sizeof(dgsize_t) - m_partial.size(), length);
+      m_partial.insert(m_partial.end(), bytes, bytes + needed);
+      offset += needed;
+      if (m_partial.size() < sizeof(dgsize_t)) {
+        return;
       }
+    }
 
-      lock.unlock();
-      m_handler->receive_datagram(dg);
-      lock.lock();
-    } else {
+    size_t total = sizeof(dgsize_t) + read_dgsize(m_partial.data());
+    size_t needed = std::min(total - m_partial.size(), length - offset);
+    m_partial.insert(m_partial.end(), bytes + offset, bytes + offset + needed);
+    offset += needed;
+    if (m_partial.size() < total) {
       return;
     }
+
+    dispatch(Datagram::create(m_partial.data() + sizeof(dgsize_t),
+                              total - sizeof(dgsize_t)));
+    m_partial.clear();
+  }
+
+  // Then hand out every whole datagram in the read as a slice of it.
+  std::shared_ptr<const uint8_t> owner;
+  if (length >= min_sliced_read) {
+    owner = std::shared_ptr<const uint8_t>(
+        reinterpret_cast<const uint8_t *>(data.release()),
+        [](const uint8_t *p) { delete[] reinterpret_cast<const char *>(p); });
   }
+
+  while (length - offset >= sizeof(dgsize_t)) {
+    dgsize_t size = read_dgsize(bytes + offset);
+    if (length - offset - sizeof(dgsize_t) < size) {
+      break;
+    }
+
+    const uint8_t *start = bytes + offset + sizeof(dgsize_t);
+    if (owner != nullptr) {
+      dispatch(Datagram::create_slice(owner, start, size));
+    } else {
+      dispatch(Datagram::create(start, size));
+    }
+    offset += sizeof(dgsize_t) + size;
+  }
+
+  // Keep whatever is left for the next read.
+  m_partial.assign(bytes + offset, bytes + length);
 }
 
-void NetworkClient::process_datagram(const std::unique_ptr<char[]> &data,
+void NetworkClient::process_datagram(std::unique_ptr<char[]> data,
                                      size_t size) {
   std::unique_lock<std::mutex> lock(m_mutex);
 
-  // This function should ONLY run in the main thread. It's a libuv event.
-  assert(std::this_thread::get_id() == g_main_thread_id);
-
-  if (m_data_buf.size() == 0 && size >= sizeof(dgsize_t)) {
-    // Fast-path mode: Check if we have just enough data from the stream for a
-    // single datagram. Should occur in most cases, as we're expecting <= the
-    // average TCP MSS for most datagrams.
-    dgsize_t datagram_size = *reinterpret_cast<dgsize_t *>(data.get());
-    if (datagram_size == size - sizeof(dgsize_t)) {
-      // Yep. Dispatch to receive_datagram and early-out.
-      DatagramPtr dg = Datagram::create(
-          reinterpret_cast<const uint8_t *>(data.get() + sizeof(dgsize_t)),
-          datagram_size);
-      lock.unlock();
-      m_handler->receive_datagram(dg);
-      return;
-    }
-  }
+  // This function should ONLY run in our loop's thread. It's a libuv event.
+  assert(m_tasks->in_loop_thread());
 
-  m_data_buf.insert(m_data_buf.end(), data.get(), data.get() + size);
-  defragment_input(lock);
+  m_recv_buf.feed(std::move(data), size, [&](DatagramHandle dg) {
+    lock.unlock();
+    m_handler->receive_datagram(dg);
+    lock.lock();
+  });
 }
 
-void NetworkClient::start_receive() {
-  // Sets up all the handlers needed for the NetworkClient instance and starts
-  // receiving data from the stream.
-  assert(std::this_thread::get_id() == g_main_thread_id);
-
-  m_socket->on<uvw::DataEvent>([self = shared_from_this()](
-                                   const uvw::DataEvent &event,
-                                   uvw::TcpHandle &) {
-    if (self->m_haproxy_handler != nullptr) {
-      size_t bytes_consumed = self->m_haproxy_handler->consume(
-          reinterpret_cast<const uint8_t *>(event.data.get()), event.length);
-      if (bytes_consumed < event.length || bytes_consumed == 0) {
-        if (self->m_haproxy_handler->has_error()) {
-          // An error occured while processing the HAProxy headers.
-          // Disconnect the client with the error code passed down as the
-          // reason, and destroy the HAProxyHandler instance without doing
-          // anything else.
-          self->disconnect(self->m_haproxy_handler->get_error());
-          self->m_haproxy_handler = nullptr;
-          return;
-        }
-
-        self->m_is_local = self->m_haproxy_handler->is_local();
-        if (!self->m_is_local) {
-          self->m_local = self->m_haproxy_handler->get_local();
-          self->m_remote = self->m_haproxy_handler->get_remote();
-          self->m_tlv_buf = self->m_haproxy_handler->get_tlvs();
-        }
-
-        self->m_haproxy_handler = nullptr;
-        self->m_handler->initialize();
-
-        ssize_t bytes_left =
-            bytes_consumed > 0 ? event.length - bytes_consumed : 0;
-        if (0 < bytes_left) {
-          // Feed any left-over bytes (if any) back to process_datagram.
-          std::unique_ptr<char[]> overread_bytes =
-              std::make_unique<char[]>(bytes_left);
-          memcpy(overread_bytes.get(), event.data.get() + bytes_consumed,
-                 bytes_left);
-          self->process_datagram(overread_bytes, bytes_left);
-        }
+void NetworkClient::receive_data(uvw::DataEvent &event) {
+  if (m_haproxy_handler != nullptr) {
+    size_t bytes_consumed = m_haproxy_handler->consume(
+        reinterpret_cast<const uint8_t *>(event.data.get()), event.length);
+    if (bytes_consumed < event.length || bytes_consumed == 0) {
+      if (m_haproxy_handler->has_error()) {
+        // An error occured while processing the HAProxy headers.
+        // Disconnect the client with the error code passed down as the
+        // reason, and destroy the HAProxyHandler instance without doing
+        // anything else.
+        disconnect(m_haproxy_handler->get_error());
+        m_haproxy_handler = nullptr;
+        return;
+      }
+
+      m_is_local = m_haproxy_handler->is_local();
+      if (!m_is_local) {
+        m_local = m_haproxy_handler->get_local();
+        m_remote = m_haproxy_handler->get_remote();
+        m_tlv_buf = m_haproxy_handler->get_tlvs();
+      }
+
+      m_haproxy_handler = nullptr;
+      m_handler->initialize();
+
+      ssize_t bytes_left =
+          bytes_consumed > 0 ? event.length - bytes_consumed : 0;
+      if (0 < bytes_left) {
+        // Feed any left-over bytes (if any) back to process_datagram.
+        std::unique_ptr<char[]> overread_bytes =
+            std::make_unique<char[]>(bytes_left);
+        memcpy(overread_bytes.get(), event.data.get() + bytes_consumed,
+               bytes_left);
+        process_datagram(std::move(overread_bytes), bytes_left);
       }
-    } else {
-      self->process_datagram(event.data, event.length);
     }
-  });
+  } else {
+    // Take the read buffer for ourselves, so datagrams can be sliced out of it.
+    process_datagram(std::move(event.data), event.length);
+  }
+}
+
+template <typename Handle>
+void NetworkClient::add_socket_listeners(Handle &socket) {
+  socket.template on<uvw::DataEvent>(
+      [self = shared_from_this()](uvw::DataEvent &event, Handle &) {
+        self->receive_data(event);
+      });
 
-  m_socket->on<uvw::ErrorEvent>(
+  socket.template on<uvw::ErrorEvent>(
       [self = shared_from_this()](const uvw::ErrorEvent &event,
-                                  uvw::TcpHandle &) {
+                                  Handle &) {
         self->handle_disconnect((uv_errno_t)event.code());
       });
 
-  m_socket->on<uvw::EndEvent>(
-      [self = shared_from_this()](const uvw::EndEvent &, uvw::TcpHandle &) {
+  socket.template on<uvw::EndEvent>(
+      [self = shared_from_this()](const uvw::EndEvent &, Handle &) {
         self->handle_disconnect(UV_EOF);
       });
 
-  m_socket->on<uvw::CloseEvent>(
-      [self = shared_from_this()](const uvw::CloseEvent &, uvw::TcpHandle &) {
+  socket.template on<uvw::CloseEvent>(
+      [self = shared_from_this()](const uvw::CloseEvent &, Handle &) {
         self->handle_disconnect(UV_EOF);
       });
 
-  m_socket->on<uvw::WriteEvent>(
-      [self = shared_from_this()](const uvw::WriteEvent &, uvw::TcpHandle &) {
-        self->send_finished();
-      });
+}
 
-  m_async_timer->on<uvw::TimerEvent>(
-      [self = shared_from_this()](const uvw::TimerEvent &, uvw::TimerHandle &) {
-        self->send_expired();
-      });
+void NetworkClient::start_receive() {
+  // Sets up all the handlers needed for the NetworkClient instance and starts
+  // receiving data from the stream.
+  assert(m_tasks->in_loop_thread());
+
+  m_async_timer->set_callback([self = shared_from_this()]() {
+    self->send_expired();
+  });
+
+  if (m_socket.uring != nullptr) {
+    // An io_uring socket takes the equivalent of the DataEvent and
+    // EndEvent/ErrorEvent/CloseEvent listeners as callbacks.
+    m_socket.uring->read(
+        [self = shared_from_this()](std::unique_ptr<char[]> data,
+                                    size_t length) {
+          uvw::DataEvent event(std::move(data), length);
+          self->receive_data(event);
+        },
+        [self = shared_from_this()](int error) {
+          self->handle_disconnect(error < 0 ? (uv_errno_t)error : UV_EOF);
+        });
+    return;
+  }
 
-  m_socket->read();
+  if (m_socket.tcp != nullptr) {
+    add_socket_listeners(*m_socket.tcp);
+  } else {
+    add_socket_listeners(*m_socket.pipe);
+  }
+
+  m_socket.read();
 }
 
 void NetworkClient::disconnect(uv_errno_t ec,
@@ -264,9 +419,9 @@ void NetworkClient::disconnect(uv_errno_t ec,
     // Let flush_send_queue execute first:
     // The send_finished callback is responsible for closing the socket at the
     // end of the flush.
-    if (g_main_thread_id != std::this_thread::get_id()) {
+    if (!m_tasks->in_loop_thread()) {
       lock.unlock();
-      TaskQueue::singleton.enqueue_task([self = shared_from_this()]() {
+      m_tasks->enqueue_task([self = shared_from_this()]() {
         std::unique_lock<std::mutex> lock(self->m_mutex);
         self->flush_send_queue(lock);
       });
@@ -278,8 +433,8 @@ void NetworkClient::disconnect(uv_errno_t ec,
 
 void NetworkClient::handle_disconnect(uv_errno_t ec,
                                       std::unique_lock<std::mutex> &lock) {
-  // This function should ONLY run in the main thread. It's a libuv event.
-  assert(std::this_thread::get_id() == g_main_thread_id);
+  // This function should ONLY run in our loop's thread. It's a libuv event.
+  assert(m_tasks->in_loop_thread());
 
   if (m_disconnect_handled) {
     return;
@@ -303,9 +458,9 @@ void NetworkClient::handle_disconnect(uv_errno_t ec,
 }
 
 void NetworkClient::flush_send_queue(std::unique_lock<std::mutex> &lock) {
-  // libuv is NOT thread-safe. This function must ONLY be called in the main
+  // libuv is NOT thread-safe. This function must ONLY be called in our loop's
   // thread.
-  assert(std::this_thread::get_id() == g_main_thread_id);
+  assert(m_tasks->in_loop_thread());
 
   // If we aren't connected, stop here
   if (!is_connected(lock)) {
@@ -325,65 +480,122 @@ void NetworkClient::flush_send_queue(std::unique_lock<std::mutex> &lock) {
 
   auto socket = m_socket;
 
-  // Figure out how big of a send buffer we need
-  size_t buffer_size = 0;
-  for (auto dg : m_send_queue) {
-    buffer_size += sizeof(dgsize_t) + dg->size();
-  }
-  assert(m_send_buf == nullptr);
-  m_send_buf = new char[buffer_size];
-
-  // Fill the send buffer with our data:
-  char *send_ptr = &m_send_buf[0];
-  for (auto dg : m_send_queue) {
+  // The datagrams are written straight out of their own buffers: each gets a
+  // uv_buf_t for its size tag (which lives in m_send_sizes) and one for its
+  // data. Both stay alive until the write completes.
+  m_send_inflight.swap(m_send_queue);
+  m_send_sizes.clear();
+  m_send_sizes.reserve(m_send_inflight.size());
+  m_send_bufs.clear();
+  m_send_bufs.reserve(2 * m_send_inflight.size());
+  for (auto &dg : m_send_inflight) {
     // Add the size tag:
-    dgsize_t len = swap_le(dg->size());
-    memcpy(send_ptr, (char *)&len, sizeof(dgsize_t));
-    send_ptr += sizeof(dgsize_t);
+    m_send_sizes.push_back(swap_le(dg->size()));
+    m_send_bufs.push_back(uv_buf_init(
+        reinterpret_cast<char *>(&m_send_sizes.back()), sizeof(dgsize_t)));
 
     // Add the data:
-    memcpy(send_ptr, dg->get_data(), dg->size());
-    send_ptr += dg->size();
+    m_send_bufs.push_back(uv_buf_init(
+        reinterpret_cast<char *>(const_cast<uint8_t *>(dg->get_data())),
+        dg->size()));
 
     // Discount it from our send queue:
     m_total_queue_size -= dg->size();
   }
-  assert(send_ptr == &m_send_buf[buffer_size]);
 
   // Clean up our m_send_queue:
   assert(m_total_queue_size == 0);
   m_send_queue.clear();
 
+  // Everything queued since compression was turned on goes out as one buffer
+  // of compressed data instead:
+  size_t plain = 2 * std::min(m_compress_from, m_send_inflight.size());
+  m_compress_from = 0;
+  if (m_compressor != nullptr && plain < m_send_bufs.size()) {
+    m_send_compressed.clear();
+    if (!m_compressor->compress(m_send_bufs.data() + plain,
+                                m_send_bufs.size() - plain,
+                                m_send_compressed)) {
+      m_send_inflight.clear();
+      lock.unlock();
+      m_tasks->enqueue_task([self = shared_from_this()]() {
+        self->handle_disconnect(UV_EPROTO);
+      });
+      lock.lock();
+      return;
+    }
+    m_send_bufs.resize(plain);
+    m_send_bufs.push_back(uv_buf_init(m_send_compressed.data(),
+                                      (unsigned int)m_send_compressed.size()));
+  }
+
   // Start async timeout, a value of 0 indicates the writes shouldn't timeout
   // (used in debugging)
   if (m_write_timeout > 0) {
-    m_async_timer->stop();
-    m_async_timer->start(uvw::TimerHandle::Time{m_write_timeout},
-                         uvw::TimerHandle::Time{0});
+    m_async_timer->start(m_tasks->timers(), m_write_timeout);
   }
 
-  // Bombs away!
   m_is_sending = true;
-  lock.unlock();
-  socket->write(m_send_buf, buffer_size);
-  lock.lock();
+  m_write_pending = true;
+
+  if (socket.uring != nullptr) {
+    // Bombs away! The io_uring socket holds on to us until it calls back.
+    lock.unlock();
+    socket.uring->write(m_send_bufs.data(), (unsigned int)m_send_bufs.size(),
+                        [self = shared_from_this()](int status) {
+                          self->send_finished(status);
+                        });
+    lock.lock();
+    return;
+  }
+
+  // Bombs away! We keep ourselves alive until libuv is done with our buffers,
+  // which it always calls back for, even if the socket is closed first.
+  m_write_self = shared_from_this();
+  m_write_req.data = this;
+  int err = uv_write(&m_write_req, socket.stream(), m_send_bufs.data(),
+                     (unsigned int)m_send_bufs.size(), &NetworkClient::write_callback);
+  if (err < 0) {
+    // The write never started, so there will be no callback.
+    std::shared_ptr<NetworkClient> self = std::move(m_write_self);
+    m_write_pending = false;
+    m_is_sending = false;
+    m_send_inflight.clear();
+    lock.unlock();
+    m_tasks->enqueue_task([self, err]() {
+      self->handle_disconnect((uv_errno_t)err);
+    });
+    lock.lock();
+  }
 }
 
-void NetworkClient::send_finished() {
+void NetworkClient::write_callback(uv_write_t *req, int status) {
+  NetworkClient *client = static_cast<NetworkClient *>(req->data);
+
+  // Hold on to ourselves until we're done here.
+  std::shared_ptr<NetworkClient> self = std::move(client->m_write_self);
+  self->send_finished(status);
+}
+
+void NetworkClient::send_finished(int status) {
   std::unique_lock<std::mutex> lock(m_mutex);
 
-  // This function should ONLY run in the main thread. It's a libuv event.
-  assert(std::this_thread::get_id() == g_main_thread_id);
+  // This function should ONLY run in our loop's thread. It's a libuv event.
+  assert(m_tasks->in_loop_thread());
+
+  // Release the datagrams we just sent (the size tags are reused next time):
+  assert(m_write_pending);
+  m_write_pending = false;
+  m_send_inflight.clear();
+
+  if (!m_is_sending) {
+    // The write timed out, and send_expired has already dealt with it.
+    return;
+  }
 
   // Mark ourselves as "not sending"
-  assert(m_is_sending);
   m_is_sending = false;
 
-  // Discard the buffer we just used:
-  assert(m_send_buf != nullptr);
-  delete[] m_send_buf;
-  m_send_buf = nullptr;
-
   // If we aren't connected, stop here
   if (!is_connected(lock)) {
     return;
@@ -392,6 +604,11 @@ void NetworkClient::send_finished() {
   // Cancel the outstanding timeout:
   m_async_timer->stop();
 
+  if (status < 0) {
+    handle_disconnect((uv_errno_t)status, lock);
+    return;
+  }
+
   // If we've had a local disconnect and there are no pending buffers to send,
   // stop here
   if (m_local_disconnect && m_total_queue_size == 0) {
@@ -403,22 +620,29 @@ void NetworkClient::send_finished() {
   flush_send_queue(lock);
 }
 
+void NetworkClient::flush_coalesced() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  // This function should ONLY run in our loop's thread. It's a libuv event.
+  assert(m_tasks->in_loop_thread());
+
+  m_coalescing = false;
+  flush_send_queue(lock);
+}
+
 void NetworkClient::send_expired() {
   std::unique_lock<std::mutex> lock(m_mutex);
 
-  // This function should ONLY run in the main thread. It's a libuv event.
-  assert(std::this_thread::get_id() == g_main_thread_id);
+  // This function should ONLY run in our loop's thread. It's a libuv event.
+  assert(m_tasks->in_loop_thread());
 
   // We need to clean up after ourselves before invoking disconnect:
   // Otherwise we might inadvertedly end up hitting flush_send_queue, and we
-  // don't want to do that here.
+  // don't want to do that here. The datagrams being written stay put until
+  // the write is cancelled by the socket closing.
   assert(m_is_sending);
   m_is_sending = false;
 
-  assert(m_send_buf != nullptr);
-  delete[] m_send_buf;
-  m_send_buf = nullptr;
-
   m_total_queue_size = 0;
   m_send_queue.clear();
 
@@ -5,19 +5,43 @@
 #include "deps/uvw/uvw.hpp"
 #include "util/Datagram.h"
 #include "util/TaskQueue.h"
+#include "util/TimerWheel.h"
 #include "HAProxyHandler.h"
+#include "NetworkSocket.h"
+#include "StreamCompressor.h"
 
 // NOTES:
 //
 // Do not subclass NetworkClient. Instead, you should implement NetworkHandler
 // and instantiate NetworkClient with std::make_shared.
 //
-// To begin receiving, pass it an ASIO socket via initialize().
+// To begin receiving, pass it a connected TCP or Unix domain socket via initialize().
 //
 // You must not destruct your NetworkHandler implementor until
 // receive_disconnect is called!
+//
+// A NetworkClient belongs to the loop of the thread it was constructed on (see
+// TaskQueue::current); it must be initialized there, and its socket events are handled there.
 
 class NetworkClient;
+class WriteCoalescer;
+
+// A ReceiveBuffer splits the byte stream read from a socket back up into the length-prefixed
+// datagrams that were sent over it. Each datagram that arrives whole within one read is handed
+// out as a slice of that read's buffer rather than a copy; only a datagram split across reads
+// is copied, into a staging buffer, until the rest of it arrives.
+class ReceiveBuffer
+{
+  public:
+    typedef std::function<void(DatagramHandle dg)> DatagramCallback;
+
+    // feed takes ownership of a read of "length" bytes, and calls "dispatch" for each
+    //     datagram completed by it, in order.
+    void feed(std::unique_ptr<char[]> data, size_t length, const DatagramCallback &dispatch);
+
+  private:
+    std::vector<uint8_t> m_partial; // The start of a datagram which didn't fit in its read.
+};
 
 class NetworkHandler
 {
@@ -33,6 +57,7 @@ protected:
     virtual void receive_disconnect(const uvw::ErrorEvent &) = 0;
 
     friend class NetworkClient;
+    friend class ShmClient;
 };
 
 class NetworkClient : public std::enable_shared_from_this<NetworkClient>
@@ -41,13 +66,13 @@ public:
     NetworkClient(NetworkHandler *handler);
     ~NetworkClient();
 
-    inline void initialize(const std::shared_ptr<uvw::TcpHandle>& socket)
+    inline void initialize(const NetworkSocket& socket)
     {
         std::unique_lock<std::mutex> lock(m_mutex);
         initialize(socket, lock);
     }
 
-    inline void initialize(const std::shared_ptr<uvw::TcpHandle>& socket,
+    inline void initialize(const NetworkSocket& socket,
                            const uvw::Addr& remote,
                            const uvw::Addr& local,
                            const bool haproxy_mode)
@@ -68,6 +93,25 @@ public:
         m_max_queue_size = max_bytes;
     }
 
+    // set_write_coalesce has datagrams held for up to "window_us" microseconds before they're
+    //     written, so that they can go out with whatever is sent after them in one write, unless
+    //     "max_bytes" are waiting first. A window of 0 (the default) writes them straight away.
+    inline void set_write_coalesce(unsigned int window_us, uint64_t max_bytes)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_coalesce_window = window_us;
+        m_coalesce_bytes = max_bytes;
+    }
+
+    // set_compression has everything sent after the datagrams already queued go out through
+    //     "compressor" instead (see StreamCompressor).
+    inline void set_compression(std::unique_ptr<StreamCompressor> compressor)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_compressor = std::move(compressor);
+        m_compress_from = m_send_queue.size();
+    }
+
     // send_datagram immediately sends the datagram over TCP (blocking).
     void send_datagram(DatagramHandle dg);
 
@@ -83,6 +127,15 @@ public:
         disconnect((uv_errno_t)0);
     }
 
+    // abandon closes the TCP connection straight away, and never informs the NetworkHandler;
+    //     for a handler that is being destroyed while it's still connected.
+    inline void abandon()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_disconnect_handled = true;
+        shutdown(lock);
+    }
+
     // handle_disconnect closes the TCP connection and informs the NetworkHandler.
     inline void handle_disconnect(uv_errno_t ec)
     {
@@ -125,12 +178,12 @@ public:
 
 private:
     // Locked versions of public functions:
-    inline void initialize(const std::shared_ptr<uvw::TcpHandle>& socket, std::unique_lock<std::mutex> &lock)
+    inline void initialize(const NetworkSocket& socket, std::unique_lock<std::mutex> &lock)
     {
-        initialize(socket, socket->peer(), socket->sock(), false, lock);
+        initialize(socket, socket.remote(), socket.local(), false, lock);
     }
 
-    void initialize(const std::shared_ptr<uvw::TcpHandle>& socket,
+    void initialize(const NetworkSocket& socket,
                     const uvw::Addr &remote,
                     const uvw::Addr &local,
                     const bool haproxy_mode,
@@ -143,18 +196,26 @@ private:
     /* Asynchronous call loop */
     // flush_send_queue is called to try and flush m_send_queue to the socket
     void flush_send_queue(std::unique_lock<std::mutex> &lock);
-    // send_finished is called when an async_send has completed
-    void send_finished();
+    // send_finished is called when an async_send has completed, with a (negative)
+    //     libuv error code if it failed.
+    void send_finished(int status);
+    static void write_callback(uv_write_t *req, int status);
     // send_expired is called when an async_send has expired
     void send_expired();
+    // flush_coalesced is called by the WriteCoalescer once our coalescing window is up.
+    void flush_coalesced();
 
     // start_receive is called by initialize() to begin receiving data.
     void start_receive();
+    // receive_data is called with each read from the socket.
+    void receive_data(uvw::DataEvent &event);
+    // add_socket_listeners hooks up the events of whichever kind of handle m_socket holds.
+    template<typename Handle>
+    void add_socket_listeners(Handle &socket);
 
     void handle_disconnect(uv_errno_t ec, std::unique_lock<std::mutex> &lock);
 
-    void defragment_input(std::unique_lock<std::mutex> &lock);
-    void process_datagram(const std::unique_ptr<char[]>& data, size_t length);
+    void process_datagram(std::unique_ptr<char[]> data, size_t length);
 
     inline bool is_connected(std::unique_lock<std::mutex>&)
     {   
@@ -162,15 +223,20 @@ private:
     }
 
     bool m_is_sending = false;
-    char *m_send_buf = nullptr;
+    // m_write_pending is true from uv_write until its callback; m_is_sending is
+    // cleared early if the write times out.
+    bool m_write_pending = false;
+    uv_write_t m_write_req;
+    std::shared_ptr<NetworkClient> m_write_self; // Set while m_write_req is pending.
 
     NetworkHandler *m_handler;
-    std::shared_ptr<uvw::TcpHandle> m_socket;
-    std::shared_ptr<uvw::TimerHandle> m_async_timer;
+    TaskQueue *m_tasks; // The queue (and loop) of the thread we were constructed on.
+    NetworkSocket m_socket;
+    std::shared_ptr<TimerWheel::Timer> m_async_timer;
     std::unique_ptr<HAProxyHandler> m_haproxy_handler;
     uvw::Addr m_remote;
     uvw::Addr m_local;
-    std::vector<uint8_t> m_data_buf;
+    ReceiveBuffer m_recv_buf;
 
     // HAProxy specific:
     std::vector<uint8_t> m_tlv_buf;
@@ -179,7 +245,20 @@ private:
     uint64_t m_total_queue_size = 0;
     uint64_t m_max_queue_size = 0;
     unsigned int m_write_timeout = 0;
+    unsigned int m_coalesce_window = 0; // In microseconds.
+    uint64_t m_coalesce_bytes = 0;
+    bool m_coalescing = false; // True while we're waiting on the WriteCoalescer.
     std::vector<DatagramHandle> m_send_queue;
+    // The datagrams being written, and their size tags; the vectors are reused
+    // from one write to the next.
+    std::vector<DatagramHandle> m_send_inflight;
+    std::vector<dgsize_t> m_send_sizes;
+    std::vector<uv_buf_t> m_send_bufs;
+    // Once compression is on, everything from m_send_queue[m_compress_from] on is
+    // compressed into m_send_compressed before it's written.
+    std::unique_ptr<StreamCompressor> m_compressor;
+    size_t m_compress_from = 0;
+    std::vector<char> m_send_compressed;
 
     std::mutex m_mutex;
 
@@ -188,4 +267,6 @@ private:
     bool m_haproxy_mode = false;
 
     uv_errno_t m_disconnect_error;
+
+    friend class WriteCoalescer;
 };
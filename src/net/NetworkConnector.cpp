@@ -18,11 +18,42 @@ void NetworkConnector::do_connect(const std::string &address,
         return;
     }
 
+    std::shared_ptr<uvw::TcpHandle> socket = m_loop->resource<uvw::TcpHandle>();
+    m_socket = socket;
+
+    socket->once<uvw::ConnectEvent>([self = shared_from_this()](const uvw::ConnectEvent &, uvw::TcpHandle&) {
+        if(self->m_connect_callback != nullptr)
+            self->m_connect_callback(self->m_socket);
+    });
+
+    socket->once<uvw::ErrorEvent>([self = shared_from_this()](const uvw::ErrorEvent &evt, uvw::TcpHandle&) {
+        if(self->m_err_callback != nullptr)
+            self->m_err_callback(evt);
+    });
+
     for(auto it = addresses.begin(); it != addresses.end(); ++it) {
-        m_socket->connect(*it);
+        socket->connect(*it);
     }
 }
 
+void NetworkConnector::do_connect_unix(const std::string &path)
+{
+    std::shared_ptr<uvw::PipeHandle> socket = m_loop->resource<uvw::PipeHandle>();
+    m_socket = socket;
+
+    socket->once<uvw::ConnectEvent>([self = shared_from_this()](const uvw::ConnectEvent &, uvw::PipeHandle&) {
+        if(self->m_connect_callback != nullptr)
+            self->m_connect_callback(self->m_socket);
+    });
+
+    socket->once<uvw::ErrorEvent>([self = shared_from_this()](const uvw::ErrorEvent &evt, uvw::PipeHandle&) {
+        if(self->m_err_callback != nullptr)
+            self->m_err_callback(evt);
+    });
+
+    socket->connect(path);
+}
+
 void NetworkConnector::destroy()
 {
     m_connect_callback = nullptr;
@@ -38,17 +69,10 @@ void NetworkConnector::connect(const std::string &address, unsigned int default_
     m_connect_callback = callback;
     m_err_callback = err_callback;
 
-    m_socket = m_loop->resource<uvw::TcpHandle>();
-
-    m_socket->once<uvw::ConnectEvent>([self = shared_from_this()](const uvw::ConnectEvent &, uvw::TcpHandle&) {
-        if(self->m_connect_callback != nullptr)
-            self->m_connect_callback(self->m_socket);
-    });
-
-    m_socket->once<uvw::ErrorEvent>([self = shared_from_this()](const uvw::ErrorEvent &evt, uvw::TcpHandle&) {
-        if(self->m_err_callback != nullptr)
-            self->m_err_callback(evt);
-    });
-
-    do_connect(address, default_port);
+    std::string path;
+    if(split_unix_address(address, path)) {
+        do_connect_unix(path);
+    } else {
+        do_connect(address, default_port);
+    }
 }
@@ -1,7 +1,8 @@
 #pragma once
 #include "deps/uvw/uvw.hpp"
+#include "NetworkSocket.h"
 
-typedef std::function<void(const std::shared_ptr<uvw::TcpHandle> &)> ConnectCallback;
+typedef std::function<void(const NetworkSocket &)> ConnectCallback;
 typedef std::function<void(const uvw::ErrorEvent& evt)> ConnectErrorCallback;
 
 class NetworkConnector : public std::enable_shared_from_this<NetworkConnector>
@@ -9,6 +10,7 @@ class NetworkConnector : public std::enable_shared_from_this<NetworkConnector>
   public:
     // Parses the string "address" and connects to it. If no port is specified
     // as part of the address, it will use default_port.
+    // An address of the form "unix:/path/to.sock" connects to a Unix domain socket instead.
     // The provided callback will be invoked with the created socket post-connection.
 
     NetworkConnector(const std::shared_ptr<uvw::Loop> &loop);
@@ -16,10 +18,11 @@ class NetworkConnector : public std::enable_shared_from_this<NetworkConnector>
     void connect(const std::string &address, unsigned int default_port,
                  ConnectCallback callback, ConnectErrorCallback err_callback);
   private:
-    std::shared_ptr<uvw::TcpHandle> m_socket;
+    NetworkSocket m_socket;
     std::shared_ptr<uvw::Loop> m_loop;
     ConnectCallback m_connect_callback;
     ConnectErrorCallback m_err_callback;
 
     void do_connect(const std::string &address, uint16_t port);
+    void do_connect_unix(const std::string &path);
 };
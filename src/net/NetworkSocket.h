@@ -0,0 +1,89 @@
+#pragma once
+#include "deps/uvw/uvw.hpp"
+#include "UringTransport.h"
+
+// A NetworkSocket is a connected (or listening) stream socket: either a TCP socket, or a
+// Unix domain socket for processes on the same host, as given by a "unix:/path/to.sock"
+// address. A TCP socket may also be serviced by io_uring rather than libuv (see UringTransport.h).
+// uvw has no common type for these, so exactly one of "tcp", "pipe" and "uring" is set, unless
+// the NetworkSocket is null.
+struct NetworkSocket {
+    std::shared_ptr<uvw::TcpHandle> tcp;
+    std::shared_ptr<uvw::PipeHandle> pipe;
+    std::shared_ptr<UringSocket> uring;
+
+    NetworkSocket() {}
+    NetworkSocket(std::nullptr_t) {}
+    NetworkSocket(const std::shared_ptr<uvw::TcpHandle> &socket) : tcp(socket) {}
+    NetworkSocket(const std::shared_ptr<uvw::PipeHandle> &socket) : pipe(socket) {}
+    NetworkSocket(const std::shared_ptr<UringSocket> &socket) : uring(socket) {}
+
+    inline bool operator==(std::nullptr_t) const
+    {
+        return tcp == nullptr && pipe == nullptr && uring == nullptr;
+    }
+    inline bool operator!=(std::nullptr_t) const
+    {
+        return !(*this == nullptr);
+    }
+
+    // remote and local return the endpoints of the connection. A Unix domain socket has no
+    // port, and its address is reported as "unix:" followed by the path it is bound to.
+    inline uvw::Addr remote() const
+    {
+        if(uring != nullptr) {
+            return uring->peer();
+        }
+        return tcp != nullptr ? tcp->peer() : unix_addr();
+    }
+    inline uvw::Addr local() const
+    {
+        if(uring != nullptr) {
+            return uring->sock();
+        }
+        return tcp != nullptr ? tcp->sock() : unix_addr();
+    }
+
+    // read starts reading from a libuv socket (an io_uring socket is given callbacks instead).
+    inline void read() const
+    {
+        if(tcp != nullptr) {
+            tcp->read();
+        } else {
+            pipe->read();
+        }
+    }
+
+    // stream returns the underlying libuv stream, for calls uvw doesn't wrap (e.g. uv_write
+    //     with several buffers). It's only valid for a libuv socket.
+    inline uv_stream_t *stream() const
+    {
+        if(tcp != nullptr) {
+            return reinterpret_cast<uv_stream_t*>(tcp->raw());
+        } else {
+            return reinterpret_cast<uv_stream_t*>(pipe->raw());
+        }
+    }
+
+    inline void close() const
+    {
+        if(uring != nullptr) {
+            uring->close();
+        } else if(tcp != nullptr) {
+            tcp->close();
+        } else {
+            pipe->close();
+        }
+    }
+
+  private:
+    inline uvw::Addr unix_addr() const
+    {
+        // Only the listening end of a Unix domain socket is bound to a path.
+        std::string path = pipe->sock();
+        if(path.empty()) {
+            path = pipe->peer();
+        }
+        return uvw::Addr{"unix:" + path, 0};
+    }
+};
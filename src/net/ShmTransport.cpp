@@ -0,0 +1,794 @@
+#include "ShmTransport.h"
+#include "core/global.h"
+#include <algorithm>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+// The top bit of a record's length word is set if its datagram continues in the next record.
+static const uint32_t SHM_MORE_FRAGMENTS = 0x80000000;
+// A record with this length word is padding; the next record is at the start of the ring.
+static const uint32_t SHM_WRAP = 0xFFFFFFFF;
+
+static const char SHM_MAGIC[8] = {'A', 'S', 'T', 'R', 'S', 'H', 'M', '\0'};
+static const uint32_t SHM_VERSION = 1;
+static const size_t SHM_MIN_CAPACITY = 1 << 12;
+static const size_t SHM_MAX_CAPACITY = 1 << 28;
+
+// The hello sent by the connecting side, along with the memory and both doorbells.
+struct ShmHello {
+    char magic[8];
+    uint32_t version;
+    uint32_t capacity;
+};
+
+static inline size_t align_record(size_t size)
+{
+    return (size + 7) & ~size_t(7);
+}
+
+size_t ShmRing::mapped_size(size_t capacity)
+{
+    return sizeof(Header) + capacity;
+}
+
+void ShmRing::attach(void *memory, size_t capacity)
+{
+    m_header = static_cast<Header*>(memory);
+    m_data = static_cast<uint8_t*>(memory) + sizeof(Header);
+    m_capacity = capacity;
+    m_tail = m_header->tail.load(std::memory_order_acquire);
+    m_head = m_header->head.load(std::memory_order_acquire);
+    m_pending = 0;
+}
+
+bool ShmRing::write(const uint8_t *data, uint32_t length, bool more)
+{
+    size_t record = align_record(sizeof(uint32_t) + length);
+    size_t offset = m_tail & (m_capacity - 1);
+    size_t contiguous = m_capacity - offset;
+    size_t needed = record > contiguous ? record + contiguous : record;
+
+    // Only our own position decides where we write, so a bad head can't make us write
+    // anywhere we shouldn't; at worst, the ring just looks full.
+    uint64_t head = m_header->head.load(std::memory_order_acquire);
+    if(m_tail - head + needed > m_capacity) {
+        return false;
+    }
+
+    if(record > contiguous) {
+        memcpy(m_data + offset, &SHM_WRAP, sizeof(uint32_t));
+        m_tail += contiguous;
+        offset = 0;
+    }
+
+    uint32_t word = length | (more ? SHM_MORE_FRAGMENTS : 0);
+    memcpy(m_data + offset, &word, sizeof(uint32_t));
+    memcpy(m_data + offset + sizeof(uint32_t), data, length);
+    m_tail += record;
+    m_header->tail.store(m_tail, std::memory_order_release);
+    return true;
+}
+
+void ShmRing::wait_for_room()
+{
+    m_header->writer_waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+bool ShmRing::reader_needs_wakeup()
+{
+    // Pairs with the fence in prepare_sleep: either the consumer sees our new tail,
+    // or we see that it is about to sleep.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_header->reader_waiting.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+    return m_header->reader_waiting.exchange(0, std::memory_order_relaxed) != 0;
+}
+
+ShmRing::ReadResult ShmRing::read(const uint8_t *&data, uint32_t &length, bool &more)
+{
+    while(true) {
+        uint64_t tail = m_header->tail.load(std::memory_order_acquire);
+        if(tail == m_head) {
+            return READ_EMPTY;
+        }
+
+        uint64_t available = tail - m_head;
+        if(available > m_capacity || (available & 7) != 0) {
+            return READ_CORRUPT;
+        }
+
+        size_t offset = m_head & (m_capacity - 1);
+        size_t contiguous = m_capacity - offset;
+        uint32_t word;
+        memcpy(&word, m_data + offset, sizeof(uint32_t));
+        if(word == SHM_WRAP) {
+            if(available < contiguous) {
+                return READ_CORRUPT;
+            }
+            m_head += contiguous;
+            m_header->head.store(m_head, std::memory_order_release);
+            continue;
+        }
+
+        length = word & ~SHM_MORE_FRAGMENTS;
+        size_t record = align_record(sizeof(uint32_t) + size_t(length));
+        if(record > contiguous || record > available) {
+            return READ_CORRUPT;
+        }
+
+        data = m_data + offset + sizeof(uint32_t);
+        more = (word & SHM_MORE_FRAGMENTS) != 0;
+        m_pending = record;
+        return READ_OK;
+    }
+}
+
+void ShmRing::consume()
+{
+    m_head += m_pending;
+    m_pending = 0;
+    m_header->head.store(m_head, std::memory_order_release);
+}
+
+bool ShmRing::prepare_sleep()
+{
+    m_header->reader_waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return m_header->tail.load(std::memory_order_acquire) == m_head;
+}
+
+bool ShmRing::writer_needs_wakeup()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_header->writer_waiting.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+    return m_header->writer_waiting.exchange(0, std::memory_order_relaxed) != 0;
+}
+
+#ifndef _WIN32
+
+void ShmLink::close()
+{
+    int *descriptors[] = {&socket, &memory, &doorbell, &peer_doorbell};
+    for(int *fd : descriptors) {
+        if(*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+static int fill_address(const std::string &path, sockaddr_un &addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        return UV_ENAMETOOLONG;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return 0;
+}
+
+int shm_connect(const std::string &path, size_t capacity, ShmLink &link)
+{
+#ifdef __linux__
+    if(capacity < SHM_MIN_CAPACITY || capacity > SHM_MAX_CAPACITY ||
+       (capacity & (capacity - 1)) != 0) {
+        return UV_EINVAL;
+    }
+
+    sockaddr_un addr;
+    int err = fill_address(path, addr);
+    if(err != 0) {
+        return err;
+    }
+
+    link.path = path;
+    link.capacity = capacity;
+    link.is_acceptor = false;
+
+    link.socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(link.socket < 0 || ::connect(link.socket, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        err = -errno;
+        link.close();
+        return err;
+    }
+
+    link.memory = memfd_create("astron-shm", MFD_CLOEXEC);
+    link.doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    link.peer_doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(link.memory < 0 || link.doorbell < 0 || link.peer_doorbell < 0 ||
+       ftruncate(link.memory, 2 * ShmRing::mapped_size(capacity)) < 0) {
+        err = -errno;
+        link.close();
+        return err;
+    }
+
+    ShmHello hello;
+    memcpy(hello.magic, SHM_MAGIC, sizeof(hello.magic));
+    hello.version = SHM_VERSION;
+    hello.capacity = uint32_t(capacity);
+
+    // From the acceptor's point of view, our doorbell is its peer's, and vice versa.
+    int fds[3] = {link.memory, link.peer_doorbell, link.doorbell};
+    union {
+        cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(fds))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    iovec iov = {&hello, sizeof(hello)};
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent = sendmsg(link.socket, &msg, MSG_NOSIGNAL);
+    if(sent != ssize_t(sizeof(hello))) {
+        err = sent < 0 ? -errno : UV_EPROTO;
+        link.close();
+        return err;
+    }
+
+    return 0;
+#else
+    (void)path;
+    (void)capacity;
+    (void)link;
+    return UV_ENOSYS;
+#endif
+}
+
+ShmAcceptor::ShmAcceptor(ShmAcceptorCallback &callback, AcceptorErrorCallback &err_callback) :
+    m_callback(callback), m_err_callback(err_callback)
+{
+}
+
+ShmAcceptor::~ShmAcceptor()
+{
+    stop();
+}
+
+void ShmAcceptor::bind(const std::string &path)
+{
+#ifdef __linux__
+    sockaddr_un addr;
+    int err = fill_address(path, addr);
+    if(err != 0) {
+        m_err_callback(uvw::ErrorEvent{err});
+        return;
+    }
+
+    m_path = path;
+    m_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(m_socket < 0) {
+        m_err_callback(uvw::ErrorEvent{-errno});
+        return;
+    }
+
+    // A socket left behind by a previous run would make bind fail; anything else at the
+    // path is left alone.
+    struct stat st;
+    if(lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path.c_str());
+    }
+
+    if(::bind(m_socket, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(m_socket, SOMAXCONN) < 0) {
+        err = -errno;
+        ::close(m_socket);
+        m_socket = -1;
+        m_err_callback(uvw::ErrorEvent{err});
+        return;
+    }
+
+    m_poll = g_loop->resource<uvw::PollHandle>(m_socket);
+    m_poll->on<uvw::PollEvent>([this](const uvw::PollEvent &, uvw::PollHandle &) {
+        handle_accept();
+    });
+    m_poll->on<uvw::ErrorEvent>([this](const uvw::ErrorEvent &evt, uvw::PollHandle &) {
+        m_err_callback(evt);
+    });
+    m_poll->start(uvw::PollHandle::Event::READABLE);
+#else
+    m_err_callback(uvw::ErrorEvent{(int)UV_ENOSYS});
+#endif
+}
+
+void ShmAcceptor::stop()
+{
+    if(m_poll != nullptr) {
+        m_poll->close();
+        m_poll = nullptr;
+    }
+    if(m_socket >= 0) {
+        ::close(m_socket);
+        m_socket = -1;
+        unlink(m_path.c_str());
+    }
+}
+
+void ShmAcceptor::handle_accept()
+{
+#ifdef __linux__
+    while(true) {
+        int socket = accept4(m_socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(socket < 0) {
+            return;
+        }
+
+        // The hello may not have arrived yet; wait for it without holding up the loop.
+        auto poll = g_loop->resource<uvw::PollHandle>(socket);
+        poll->once<uvw::PollEvent>([this, socket](const uvw::PollEvent &, uvw::PollHandle &handle) {
+            handle.close();
+            handle_hello(socket);
+        });
+        poll->once<uvw::ErrorEvent>([socket](const uvw::ErrorEvent &, uvw::PollHandle &handle) {
+            handle.close();
+            ::close(socket);
+        });
+        poll->start(uvw::PollHandle::Event::READABLE);
+    }
+#endif
+}
+
+void ShmAcceptor::handle_hello(int socket)
+{
+    ShmLink link;
+    link.socket = socket;
+    link.is_acceptor = true;
+    link.path = m_path;
+
+    ShmHello hello;
+    int fds[3];
+    union {
+        cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(fds))];
+    } control;
+
+    iovec iov = {&hello, sizeof(hello)};
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    int flags = MSG_DONTWAIT;
+#ifdef MSG_CMSG_CLOEXEC
+    flags |= MSG_CMSG_CLOEXEC;
+#endif
+    ssize_t received = recvmsg(socket, &msg, flags);
+
+    // Take ownership of whatever descriptors came with it before checking anything else,
+    // so that none of them leak if it turns out to be bogus.
+    cmsghdr *cmsg = received < 0 ? nullptr : CMSG_FIRSTHDR(&msg);
+    if(cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), std::min(count, size_t(3)) * sizeof(int));
+        for(size_t i = 3; i < count; ++i) {
+            int extra;
+            memcpy(&extra, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            ::close(extra);
+        }
+        if(count > 0) {
+            link.memory = fds[0];
+        }
+        if(count > 1) {
+            link.doorbell = fds[1];
+        }
+        if(count > 2) {
+            link.peer_doorbell = fds[2];
+        }
+    }
+
+    bool valid = received == ssize_t(sizeof(hello)) && (msg.msg_flags & MSG_CTRUNC) == 0 &&
+                 link.peer_doorbell >= 0 &&
+                 memcmp(hello.magic, SHM_MAGIC, sizeof(hello.magic)) == 0 &&
+                 hello.version == SHM_VERSION && hello.capacity >= SHM_MIN_CAPACITY &&
+                 hello.capacity <= SHM_MAX_CAPACITY &&
+                 (hello.capacity & (hello.capacity - 1)) == 0;
+    if(valid) {
+        // The memory must be at least as big as the rings the hello claims it holds.
+        struct stat st;
+        link.capacity = hello.capacity;
+        valid = fstat(link.memory, &st) == 0 &&
+                size_t(st.st_size) >= 2 * ShmRing::mapped_size(link.capacity);
+    }
+
+    if(!valid) {
+        link.close();
+        return;
+    }
+
+    m_callback(link);
+}
+
+ShmClient::ShmClient(NetworkHandler *handler) : m_handler(handler)
+{
+}
+
+ShmClient::~ShmClient()
+{
+    if(m_mapped != nullptr) {
+        munmap(m_mapped, m_mapped_size);
+    }
+
+    int *descriptors[] = {&m_socket, &m_memory, &m_doorbell, &m_peer_doorbell};
+    for(int *fd : descriptors) {
+        if(*fd >= 0) {
+            ::close(*fd);
+        }
+    }
+}
+
+void ShmClient::initialize(ShmLink &link)
+{
+    // This function should ONLY run in the main thread. libuv is not thread-safe.
+    assert(std::this_thread::get_id() == g_main_thread_id);
+
+    m_path = link.path;
+    m_socket = link.socket;
+    m_memory = link.memory;
+    m_doorbell = link.doorbell;
+    m_peer_doorbell = link.peer_doorbell;
+    link.socket = link.memory = link.doorbell = link.peer_doorbell = -1;
+
+    // The connecting side writes to the first ring, and the accepting side to the second.
+    size_t ring_size = ShmRing::mapped_size(link.capacity);
+    m_mapped_size = 2 * ring_size;
+    void *mapped = mmap(nullptr, m_mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_memory, 0);
+    if(mapped == MAP_FAILED) {
+        uv_errno_t ec = (uv_errno_t)-errno;
+        m_disconnect_handled = true;
+        shutdown();
+        m_handler->receive_disconnect(uvw::ErrorEvent{(int)ec});
+        return;
+    }
+    m_mapped = mapped;
+
+    uint8_t *first = static_cast<uint8_t*>(mapped);
+    uint8_t *second = first + ring_size;
+    m_in.attach(link.is_acceptor ? first : second, link.capacity);
+    m_out.attach(link.is_acceptor ? second : first, link.capacity);
+
+    m_doorbell_poll = g_loop->resource<uvw::PollHandle>(m_doorbell);
+    m_doorbell_poll->on<uvw::PollEvent>([self = shared_from_this()](const uvw::PollEvent &,
+                                                                    uvw::PollHandle &) {
+        self->handle_doorbell();
+    });
+
+    m_socket_poll = g_loop->resource<uvw::PollHandle>(m_socket);
+    m_socket_poll->on<uvw::PollEvent>([self = shared_from_this()](const uvw::PollEvent &,
+                                                                  uvw::PollHandle &) {
+        self->handle_socket();
+    });
+
+    auto on_error = [self = shared_from_this()](const uvw::ErrorEvent &evt, uvw::PollHandle &) {
+        self->handle_disconnect((uv_errno_t)evt.code());
+    };
+    m_doorbell_poll->on<uvw::ErrorEvent>(on_error);
+    m_socket_poll->on<uvw::ErrorEvent>(on_error);
+
+    m_doorbell_poll->start(uvw::PollHandle::Event::READABLE);
+    m_socket_poll->start(uvw::Flags<uvw::PollHandle::Event>::from<
+                         uvw::PollHandle::Event::READABLE, uvw::PollHandle::Event::DISCONNECT>());
+
+    {
+        std::lock_guard<std::mutex> lock(m_send_lock);
+        m_connected = true;
+    }
+
+    m_handler->initialize();
+
+    // Pick up anything sent before we were listening for the doorbell; this also tells
+    // the other side to ring it from now on.
+    receive();
+}
+
+void ShmClient::send_datagram(DatagramHandle dg)
+{
+    std::lock_guard<std::mutex> lock(m_send_lock);
+    if(!m_connected) {
+        return;
+    }
+
+    if(m_send_queue.empty()) {
+        // Fast path: straight into the ring, without holding on to the datagram.
+        size_t offset = 0;
+        if(write_datagram(dg->get_data(), dg->size(), offset)) {
+            if(m_out.reader_needs_wakeup()) {
+                ring(m_peer_doorbell);
+            }
+            return;
+        }
+        m_send_offset = offset;
+    }
+
+    m_send_queue.push_back(dg);
+    flush_send_queue();
+}
+
+// write_datagram writes what it can of a datagram, starting from "offset", and
+// returns true once all of it has been written. It must be called with m_send_lock held.
+bool ShmClient::write_datagram(const uint8_t *data, size_t size, size_t &offset)
+{
+    size_t max_fragment = m_out.max_fragment();
+    do {
+        size_t length = std::min(size - offset, max_fragment);
+        bool more = offset + length < size;
+        if(!m_out.write(data + offset, uint32_t(length), more)) {
+            return false;
+        }
+        offset += length;
+    } while(offset < size);
+    return true;
+}
+
+// flush_send_queue writes as much of the send queue as there is room for, and otherwise
+// asks to be woken up once there's more. It must be called with m_send_lock held.
+void ShmClient::flush_send_queue()
+{
+    bool waiting = false;
+    while(!m_send_queue.empty()) {
+        const DatagramHandle &dg = m_send_queue.front();
+        if(write_datagram(dg->get_data(), dg->size(), m_send_offset)) {
+            m_send_queue.pop_front();
+            m_send_offset = 0;
+        } else if(!waiting) {
+            // Try once more after asking, in case the reader made room in the meantime.
+            m_out.wait_for_room();
+            waiting = true;
+        } else {
+            break;
+        }
+    }
+
+    if(m_out.reader_needs_wakeup()) {
+        ring(m_peer_doorbell);
+    }
+}
+
+void ShmClient::ring(int doorbell)
+{
+    uint64_t value = 1;
+    // If this fails, the counter is already about to overflow: it has been rung plenty.
+    ssize_t written = ::write(doorbell, &value, sizeof(value));
+    (void)written;
+}
+
+void ShmClient::receive()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_send_lock);
+        if(!m_connected) {
+            return;
+        }
+    }
+
+    while(true) {
+        const uint8_t *data;
+        uint32_t length;
+        bool more;
+        ShmRing::ReadResult result;
+        while((result = m_in.read(data, length, more)) == ShmRing::READ_OK) {
+            DatagramPtr dg;
+            if(more || !m_partial.empty()) {
+                if(m_partial.size() + length > DGSIZE_MAX) {
+                    result = ShmRing::READ_CORRUPT;
+                    break;
+                }
+                m_partial.insert(m_partial.end(), data, data + length);
+                m_in.consume();
+                if(more) {
+                    continue;
+                }
+                dg = Datagram::create(m_partial.data(), dgsize_t(m_partial.size()));
+                m_partial.clear();
+            } else {
+                if(length > DGSIZE_MAX) {
+                    result = ShmRing::READ_CORRUPT;
+                    break;
+                }
+                dg = Datagram::create(data, dgsize_t(length));
+                m_in.consume();
+            }
+
+            m_handler->receive_datagram(dg);
+            if(m_mapped == nullptr) {
+                // The handler disconnected us.
+                return;
+            }
+        }
+
+        if(result == ShmRing::READ_CORRUPT) {
+            handle_disconnect(UV_EPROTO);
+            return;
+        }
+
+        if(m_in.writer_needs_wakeup()) {
+            ring(m_peer_doorbell);
+        }
+
+        if(m_in.prepare_sleep()) {
+            return;
+        }
+    }
+}
+
+void ShmClient::handle_doorbell()
+{
+    uint64_t value;
+    ssize_t received = ::read(m_doorbell, &value, sizeof(value));
+    (void)received;
+
+    receive();
+
+    // The other side may have made room for whatever we have queued.
+    std::lock_guard<std::mutex> lock(m_send_lock);
+    if(m_connected && !m_send_queue.empty()) {
+        flush_send_queue();
+    }
+}
+
+void ShmClient::handle_socket()
+{
+    // Nothing is sent over the socket after the hello; it's only there to tell us when the
+    // other side goes away.
+    char buffer[64];
+    ssize_t received = recv(m_socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if(received > 0 || (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                                         errno == EINTR))) {
+        return;
+    }
+
+    uv_errno_t ec = received == 0 ? UV_EOF : (uv_errno_t)-errno;
+
+    // Deliver whatever the other side managed to send before it went away.
+    receive();
+    handle_disconnect(ec);
+}
+
+void ShmClient::disconnect()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_send_lock);
+        if(!m_connected) {
+            return;
+        }
+        m_connected = false;
+        m_send_queue.clear();
+    }
+
+    if(std::this_thread::get_id() == g_main_thread_id) {
+        shutdown();
+    } else {
+        TaskQueue::singleton.enqueue_task([self = shared_from_this()]() {
+            self->shutdown();
+        });
+    }
+}
+
+void ShmClient::handle_disconnect(uv_errno_t ec)
+{
+    // This function should ONLY run in the main thread. It's a libuv event.
+    assert(std::this_thread::get_id() == g_main_thread_id);
+
+    if(m_disconnect_handled) {
+        return;
+    }
+    m_disconnect_handled = true;
+
+    bool was_connected;
+    {
+        std::lock_guard<std::mutex> lock(m_send_lock);
+        was_connected = m_connected;
+        m_connected = false;
+        m_send_queue.clear();
+    }
+
+    shutdown();
+
+    if(was_connected) {
+        m_handler->receive_disconnect(uvw::ErrorEvent{(int)ec});
+    }
+}
+
+// shutdown stops listening and unmaps the rings; it's only called once nobody can be
+// sending any more, and (dropping the handles' references to us) only in the main thread.
+void ShmClient::shutdown()
+{
+    if(m_doorbell_poll != nullptr) {
+        m_doorbell_poll->close();
+        m_doorbell_poll = nullptr;
+    }
+    if(m_socket_poll != nullptr) {
+        m_socket_poll->close();
+        m_socket_poll = nullptr;
+    }
+
+    if(m_mapped != nullptr) {
+        munmap(m_mapped, m_mapped_size);
+        m_mapped = nullptr;
+    }
+
+    int *descriptors[] = {&m_socket, &m_memory, &m_doorbell, &m_peer_doorbell};
+    for(int *fd : descriptors) {
+        if(*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+#else // _WIN32
+
+void ShmLink::close()
+{
+}
+
+int shm_connect(const std::string &, size_t, ShmLink &)
+{
+    return UV_ENOSYS;
+}
+
+ShmAcceptor::ShmAcceptor(ShmAcceptorCallback &callback, AcceptorErrorCallback &err_callback) :
+    m_callback(callback), m_err_callback(err_callback)
+{
+}
+
+ShmAcceptor::~ShmAcceptor()
+{
+}
+
+void ShmAcceptor::bind(const std::string &)
+{
+    m_err_callback(uvw::ErrorEvent{(int)UV_ENOSYS});
+}
+
+void ShmAcceptor::stop()
+{
+}
+
+ShmClient::ShmClient(NetworkHandler *handler) : m_handler(handler)
+{
+}
+
+ShmClient::~ShmClient()
+{
+}
+
+void ShmClient::initialize(ShmLink &)
+{
+}
+
+void ShmClient::send_datagram(DatagramHandle)
+{
+}
+
+void ShmClient::disconnect()
+{
+}
+
+#endif // _WIN32
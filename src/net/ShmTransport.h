@@ -0,0 +1,196 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "deps/uvw/uvw.hpp"
+#include "util/Datagram.h"
+#include "NetworkAcceptor.h"
+#include "NetworkClient.h"
+
+// NOTES:
+//
+// The shared-memory transport carries datagrams between two processes on the same host
+// (typically an AI or other role and its MessageDirector) without going through the kernel:
+// each direction is a ShmRing in memory both processes have mapped, and each side has an
+// eventfd "doorbell" which the other side only rings when it has gone to sleep.
+//
+// A link is negotiated over a Unix socket: the connecting side creates the memory and both
+// doorbells, and passes them to the accepting side with SCM_RIGHTS. The socket then stays
+// open for as long as the link is up, so that either side notices when the other goes away.
+//
+// It is only available on Linux; elsewhere, binding or connecting fails with UV_ENOSYS.
+
+// A ShmRing is a single-producer, single-consumer ring of datagram fragments in shared memory.
+// Records are a uint32 word (the fragment's length, with the top bit set if the datagram has
+// more fragments) followed by the fragment, padded to 8 bytes. Neither side trusts anything
+// the other side writes: a ring that doesn't make sense is reported as corrupt.
+class ShmRing
+{
+  public:
+    struct Header {
+        alignas(64) std::atomic<uint64_t> tail; // Written by the producer.
+        alignas(64) std::atomic<uint64_t> head; // Written by the consumer.
+        // Set by the consumer before it sleeps, and by the producer when it is out of room.
+        alignas(64) std::atomic<uint32_t> reader_waiting;
+        std::atomic<uint32_t> writer_waiting;
+    };
+
+    enum ReadResult {
+        READ_OK,
+        READ_EMPTY,
+        READ_CORRUPT
+    };
+
+    // mapped_size returns how much memory a ring with "capacity" bytes of records takes up.
+    static size_t mapped_size(size_t capacity);
+
+    // attach makes the ring use "memory", which starts out zeroed.
+    void attach(void *memory, size_t capacity);
+
+    // max_fragment is the longest fragment that is guaranteed to fit in an empty ring.
+    inline size_t max_fragment() const
+    {
+        return m_capacity / 4;
+    }
+
+    // Producer side:
+    // write appends a fragment, or returns false if there is no room for it right now.
+    bool write(const uint8_t *data, uint32_t length, bool more);
+    // wait_for_room asks the consumer to ring the doorbell once it has read something;
+    //     the producer must try writing once more afterwards, in case it already has.
+    void wait_for_room();
+    // reader_needs_wakeup tests (and clears) whether the consumer went to sleep.
+    bool reader_needs_wakeup();
+
+    // Consumer side:
+    // read finds the next fragment, which stays valid until consume is called.
+    ReadResult read(const uint8_t *&data, uint32_t &length, bool &more);
+    void consume();
+    // prepare_sleep tells the producer to ring the doorbell for the next write,
+    //     then returns false if there is something to read after all.
+    bool prepare_sleep();
+    // writer_needs_wakeup tests (and clears) whether the producer is waiting for room.
+    bool writer_needs_wakeup();
+
+  private:
+    Header *m_header = nullptr;
+    uint8_t *m_data = nullptr;
+    size_t m_capacity = 0;
+    uint64_t m_tail = 0; // Our own copy of the producer's position.
+    uint64_t m_head = 0; // ...and of the consumer's.
+    size_t m_pending = 0; // The size of the record returned by read.
+};
+
+// A ShmLink is a negotiated, but not yet running, shared-memory link.
+struct ShmLink {
+    int socket = -1; // The Unix socket it was negotiated over.
+    int memory = -1;
+    int doorbell = -1; // Rung by the other side to wake us up.
+    int peer_doorbell = -1; // Rung by us to wake the other side up.
+    size_t capacity = 0;
+    bool is_acceptor = false;
+    std::string path;
+
+    // close closes whichever of the descriptors are open.
+    void close();
+};
+
+// shm_connect negotiates a link over the Unix socket at "path", with rings of "capacity"
+// bytes in either direction. It returns 0, or a (negative) libuv error code.
+// This blocks, but only on the local socket.
+int shm_connect(const std::string &path, size_t capacity, ShmLink &link);
+
+// The capacity of each ring, unless something else is asked for.
+const size_t SHM_DEFAULT_CAPACITY = 1 << 22;
+
+typedef std::function<void(ShmLink &link)> ShmAcceptorCallback;
+
+// A ShmAcceptor listens on a Unix socket for shared-memory links. The callback takes
+// ownership of the link's descriptors, typically by initializing a ShmClient with them.
+class ShmAcceptor
+{
+  public:
+    ShmAcceptor(ShmAcceptorCallback &callback, AcceptorErrorCallback &err_callback);
+    ~ShmAcceptor();
+
+    // bind creates the Unix socket at "path" (replacing a stale one) and starts listening.
+    void bind(const std::string &path);
+    void stop();
+
+  private:
+    ShmAcceptorCallback m_callback;
+    AcceptorErrorCallback m_err_callback;
+    std::string m_path;
+    int m_socket = -1;
+    std::shared_ptr<uvw::PollHandle> m_poll;
+
+    void handle_accept();
+    void handle_hello(int socket);
+};
+
+// A ShmClient is the shared-memory counterpart of NetworkClient: it delivers datagrams
+// received over a ShmLink to its NetworkHandler, and may be sent to from any thread.
+// As with NetworkClient, create it with std::make_shared and don't destruct the handler
+// until receive_disconnect is called.
+class ShmClient : public std::enable_shared_from_this<ShmClient>
+{
+  public:
+    ShmClient(NetworkHandler *handler);
+    ~ShmClient();
+
+    // initialize takes ownership of the link's descriptors and starts receiving.
+    void initialize(ShmLink &link);
+
+    // send_datagram copies the datagram into the outgoing ring, or queues it
+    //     until there is room if the ring is full.
+    void send_datagram(DatagramHandle dg);
+
+    // disconnect closes the link without informing the NetworkHandler.
+    void disconnect();
+
+    inline bool is_connected()
+    {
+        std::lock_guard<std::mutex> lock(m_send_lock);
+        return m_connected;
+    }
+
+    inline const std::string &get_path() const
+    {
+        return m_path;
+    }
+
+  private:
+    NetworkHandler *m_handler;
+    std::string m_path;
+    int m_socket = -1;
+    int m_memory = -1;
+    int m_doorbell = -1;
+    int m_peer_doorbell = -1;
+    void *m_mapped = nullptr;
+    size_t m_mapped_size = 0;
+    ShmRing m_in;
+    ShmRing m_out;
+    std::vector<uint8_t> m_partial; // The fragments received so far of a fragmented datagram.
+    std::shared_ptr<uvw::PollHandle> m_socket_poll;
+    std::shared_ptr<uvw::PollHandle> m_doorbell_poll;
+
+    // Datagrams waiting for room in the outgoing ring; the first may be partly written.
+    std::mutex m_send_lock;
+    std::deque<DatagramHandle> m_send_queue;
+    size_t m_send_offset = 0;
+    bool m_connected = false;
+    bool m_disconnect_handled = false;
+
+    bool write_datagram(const uint8_t *data, size_t size, size_t &offset);
+    void flush_send_queue();
+    void ring(int doorbell);
+    void receive();
+    void handle_doorbell();
+    void handle_socket();
+    void handle_disconnect(uv_errno_t ec);
+    void shutdown();
+};
@@ -0,0 +1,187 @@
+#include "StreamCompressor.h"
+#include "core/global.h"
+#include "dclass/dc/Class.h"
+#include "dclass/dc/Field.h"
+#include "dclass/util/byteorder.h"
+#ifdef ASTRON_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+std::string CompressionDictionary::from_dc_file()
+{
+    std::string dict;
+    for(unsigned int i = 0; i < g_dcf->get_num_classes(); ++i) {
+        const dclass::Class *dcc = g_dcf->get_class(i);
+        for(unsigned int n = 0; n < dcc->get_num_fields(); ++n) {
+            const dclass::Field *field = dcc->get_field(n);
+            uint16_t id = swap_le((uint16_t)field->get_id());
+            dict.append(reinterpret_cast<const char*>(&id), sizeof(id));
+            dict.append(field->get_default_value());
+            if(dict.size() >= max_dc_dictionary) {
+                dict.resize(max_dc_dictionary);
+                return dict;
+            }
+        }
+    }
+    return dict;
+}
+
+CompressionDictionary::CompressionDictionary()
+{
+}
+
+#ifdef ASTRON_WITH_ZSTD
+
+struct CompressionDictionary::Impl {
+    ZSTD_CDict *cdict = nullptr;
+};
+
+std::shared_ptr<CompressionDictionary> CompressionDictionary::create(const std::string &content,
+                                                                    int level)
+{
+    std::shared_ptr<CompressionDictionary> dict(new CompressionDictionary());
+    dict->m_impl.reset(new Impl);
+
+    // A trained dictionary (which starts with zstd's magic number) is loaded as one; anything
+    // else is taken as raw content to match against.
+    dict->m_impl->cdict = ZSTD_createCDict(content.data(), content.size(), level);
+    if(dict->m_impl->cdict == nullptr) {
+        return nullptr;
+    }
+
+    dict->m_id = ZSTD_getDictID_fromDict(content.data(), content.size());
+    return dict;
+}
+
+CompressionDictionary::~CompressionDictionary()
+{
+    for(void *context : m_pool) {
+        ZSTD_freeCCtx(static_cast<ZSTD_CCtx*>(context));
+    }
+    if(m_impl != nullptr) {
+        ZSTD_freeCDict(m_impl->cdict);
+    }
+}
+
+std::unique_ptr<StreamCompressor> CompressionDictionary::acquire()
+{
+    ZSTD_CCtx *context = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_pool_lock);
+        if(!m_pool.empty()) {
+            context = static_cast<ZSTD_CCtx*>(m_pool.back());
+            m_pool.pop_back();
+        }
+    }
+
+    if(context == nullptr) {
+        context = ZSTD_createCCtx();
+        if(context == nullptr) {
+            return nullptr;
+        }
+        // The dictionary (and its parameters) stay with the context across session resets.
+        if(ZSTD_isError(ZSTD_CCtx_refCDict(context, m_impl->cdict))) {
+            ZSTD_freeCCtx(context);
+            return nullptr;
+        }
+    }
+
+    return std::unique_ptr<StreamCompressor>(new StreamCompressor(shared_from_this(), context));
+}
+
+void CompressionDictionary::release(void *context)
+{
+    ZSTD_CCtx *cctx = static_cast<ZSTD_CCtx*>(context);
+    if(ZSTD_isError(ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only))) {
+        ZSTD_freeCCtx(cctx);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_pool_lock);
+    if(m_pool.size() < max_pooled) {
+        m_pool.push_back(cctx);
+    } else {
+        ZSTD_freeCCtx(cctx);
+    }
+}
+
+bool StreamCompressor::compress(const uv_buf_t *bufs, size_t nbufs, std::vector<char> &out)
+{
+    ZSTD_CCtx *context = static_cast<ZSTD_CCtx*>(m_context);
+
+    size_t in_size = 0;
+    for(size_t i = 0; i < nbufs; ++i) {
+        in_size += bufs[i].len;
+    }
+    size_t start = out.size();
+    out.resize(start + ZSTD_compressBound(in_size) + ZSTD_CStreamOutSize());
+
+    ZSTD_outBuffer output = { out.data() + start, out.size() - start, 0 };
+    for(size_t i = 0; i <= nbufs; ++i) {
+        // After the last buffer, an empty one flushes everything out.
+        bool last = i == nbufs;
+        ZSTD_inBuffer input = { last ? nullptr : bufs[i].base, last ? 0 : bufs[i].len, 0 };
+        ZSTD_EndDirective mode = last ? ZSTD_e_flush : ZSTD_e_continue;
+        while(true) {
+            size_t remaining = ZSTD_compressStream2(context, &output, &input, mode);
+            if(ZSTD_isError(remaining)) {
+                out.resize(start);
+                return false;
+            }
+            if(input.pos == input.size && (!last || remaining == 0)) {
+                break;
+            }
+            if(output.pos == output.size) {
+                // The bound above should make this impossible, but just in case:
+                out.resize(out.size() + ZSTD_CStreamOutSize());
+                output.dst = out.data() + start;
+                output.size = out.size() - start;
+            }
+        }
+    }
+
+    out.resize(start + output.pos);
+    return true;
+}
+
+#else // ASTRON_WITH_ZSTD
+
+// Without zstd compiled in, create always returns nullptr, so none of the rest is ever used.
+
+struct CompressionDictionary::Impl {
+};
+
+std::shared_ptr<CompressionDictionary> CompressionDictionary::create(const std::string &, int)
+{
+    return nullptr;
+}
+
+CompressionDictionary::~CompressionDictionary()
+{
+}
+
+std::unique_ptr<StreamCompressor> CompressionDictionary::acquire()
+{
+    return nullptr;
+}
+
+void CompressionDictionary::release(void *)
+{
+}
+
+bool StreamCompressor::compress(const uv_buf_t *, size_t, std::vector<char> &)
+{
+    return false;
+}
+
+#endif // ASTRON_WITH_ZSTD
+
+StreamCompressor::StreamCompressor(const std::shared_ptr<CompressionDictionary> &dict,
+                                   void *context) : m_dict(dict), m_context(context)
+{
+}
+
+StreamCompressor::~StreamCompressor()
+{
+    m_dict->release(m_context);
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "deps/uvw/uvw.hpp"
+
+// NOTES:
+//
+// Stream compression squeezes everything the Client Agent sends a client into one zstd stream,
+// which is flushed at the end of every write so the client can decode each write as it arrives.
+// Both ends use the same dictionary: either the one derived from the DC file (see
+// CompressionDictionary::from_dc_file), or one trained by zstd from captured traffic.
+//
+// It is only compiled in if Astron is built with USE_ZSTD; otherwise CompressionDictionary::create
+// returns nullptr, and clients are never offered compression.
+
+class StreamCompressor;
+
+// A CompressionDictionary is a dictionary shared by every connection of a client type, along
+// with a pool of compression contexts that have it loaded, so that a new connection doesn't
+// pay to allocate and load a context of its own.
+class CompressionDictionary : public std::enable_shared_from_this<CompressionDictionary>
+{
+  public:
+    // create returns a dictionary for "content", compressing at "level", or nullptr if
+    //     compression isn't available in this build (or "content" isn't usable).
+    static std::shared_ptr<CompressionDictionary> create(const std::string &content, int level);
+
+    // from_dc_file returns the dictionary derived from the DC file: for every field of every
+    //     class, in order, the field's id (as a uint16) followed by its packed default value.
+    //     It is cut off at max_dc_dictionary bytes.
+    static std::string from_dc_file();
+    static const size_t max_dc_dictionary = 64 * 1024;
+
+    ~CompressionDictionary();
+
+    // id identifies the dictionary to the client: a trained dictionary's own id, or 0 for
+    //     a raw one (e.g. from the DC file).
+    inline uint32_t id() const
+    {
+        return m_id;
+    }
+
+    // acquire returns a compressor starting a new stream, or nullptr if it fails.
+    std::unique_ptr<StreamCompressor> acquire();
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+    uint32_t m_id = 0;
+
+    // The most contexts kept around for reuse.
+    static const size_t max_pooled = 1024;
+    std::mutex m_pool_lock;
+    std::vector<void*> m_pool;
+
+    CompressionDictionary();
+    void release(void *context);
+
+    friend class StreamCompressor;
+};
+
+// A StreamCompressor is one connection's compression stream.
+class StreamCompressor
+{
+  public:
+    ~StreamCompressor();
+
+    // compress appends everything in "bufs" to "out" as part of the stream, and flushes it
+    //     so that the peer can decode all of it. It returns false if compression failed,
+    //     after which the stream is unusable.
+    bool compress(const uv_buf_t *bufs, size_t nbufs, std::vector<char> &out);
+
+  private:
+    std::shared_ptr<CompressionDictionary> m_dict;
+    void *m_context;
+
+    StreamCompressor(const std::shared_ptr<CompressionDictionary> &dict, void *context);
+
+    friend class CompressionDictionary;
+};
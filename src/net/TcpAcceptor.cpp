@@ -8,32 +8,55 @@ TcpAcceptor::TcpAcceptor(TcpAcceptorCallback &callback, AcceptorErrorCallback& e
 
 void TcpAcceptor::start_accept()
 {
-    m_acceptor->on<uvw::ListenEvent>([this](const uvw::ListenEvent &, uvw::TcpHandle &srv) {
+    if(m_acceptor.pipe == nullptr && m_uring != nullptr) {
+        // Accepting TCP connections with io_uring (errors go straight to m_err_callback):
+        m_uring_callback = [this](const std::shared_ptr<UringSocket> &client) {
+            handle_accept(client);
+        };
+        return;
+    }
+
+    if(m_acceptor.pipe != nullptr) {
+        // Bound to a Unix domain socket:
+        m_acceptor.pipe->on<uvw::ListenEvent>([this](const uvw::ListenEvent &, uvw::PipeHandle &srv) {
+            std::shared_ptr<uvw::PipeHandle> client = srv.loop().resource<uvw::PipeHandle>();
+            srv.accept(*client);
+            handle_accept(client);
+        });
+
+        m_acceptor.pipe->on<uvw::ErrorEvent>([this](const uvw::ErrorEvent &evt, uvw::PipeHandle &) {
+            // Inform the error callback:
+            this->m_err_callback(evt);
+        });
+        return;
+    }
+
+    m_acceptor.tcp->on<uvw::ListenEvent>([this](const uvw::ListenEvent &, uvw::TcpHandle &srv) {
         std::shared_ptr<uvw::TcpHandle> client = srv.loop().resource<uvw::TcpHandle>();
         srv.accept(*client);
         handle_accept(client);
     });
 
-    m_acceptor->on<uvw::ErrorEvent>([this](const uvw::ErrorEvent &evt, uvw::TcpHandle &) {
+    m_acceptor.tcp->on<uvw::ErrorEvent>([this](const uvw::ErrorEvent &evt, uvw::TcpHandle &) {
         // Inform the error callback:
         this->m_err_callback(evt);
     });
 }
 
-void TcpAcceptor::handle_accept(const std::shared_ptr<uvw::TcpHandle>& socket)
+void TcpAcceptor::handle_accept(const NetworkSocket& socket)
 {
     if(!m_started) {
         // We were turned off sometime before this operation completed; ignore.
-        socket->close();
+        socket.close();
         return;
     }
 
-    uvw::Addr remote = socket->peer();
-    uvw::Addr local = socket->sock();
+    uvw::Addr remote = socket.remote();
+    uvw::Addr local = socket.local();
     handle_endpoints(socket, remote, local);
 }
 
-void TcpAcceptor::handle_endpoints(const std::shared_ptr<uvw::TcpHandle>& socket, const uvw::Addr& remote, const uvw::Addr& local)
+void TcpAcceptor::handle_endpoints(const NetworkSocket& socket, const uvw::Addr& remote, const uvw::Addr& local)
 {
     // Inform the callback:
     m_callback(socket, remote, local, m_haproxy_mode);
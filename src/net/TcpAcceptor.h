@@ -2,7 +2,7 @@
 #include "NetworkAcceptor.h"
 #include <functional>
 
-typedef std::function<void(const std::shared_ptr<uvw::TcpHandle>&, const uvw::Addr& remote, const uvw::Addr& local, const bool haproxy_mode)> TcpAcceptorCallback;
+typedef std::function<void(const NetworkSocket&, const uvw::Addr& remote, const uvw::Addr& local, const bool haproxy_mode)> TcpAcceptorCallback;
 
 class TcpAcceptor : public NetworkAcceptor
 {
@@ -14,6 +14,6 @@ class TcpAcceptor : public NetworkAcceptor
     TcpAcceptorCallback m_callback;
 
     virtual void start_accept();
-    void handle_accept(const std::shared_ptr<uvw::TcpHandle>& socket);
-    void handle_endpoints(const std::shared_ptr<uvw::TcpHandle>& socket, const uvw::Addr& remote, const uvw::Addr& local);
+    void handle_accept(const NetworkSocket& socket);
+    void handle_endpoints(const NetworkSocket& socket, const uvw::Addr& remote, const uvw::Addr& local);
 };
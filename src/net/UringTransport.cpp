@@ -0,0 +1,685 @@
+#include "UringTransport.h"
+#include "core/global.h"
+
+#ifdef ASTRON_WITH_IO_URING
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+#include <liburing.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static const unsigned int URING_ENTRIES = 4096;
+// Provided buffers are shared by every socket on the ring; each is only held between a recv
+// completing into it and us copying it out, so this many is plenty even for 50k sockets.
+static const unsigned int URING_NUM_BUFFERS = 1024;
+static const int URING_BUFFER_GROUP = 0;
+
+// An operation's user_data is its owner's address, with the operation code in the low bits.
+static const uint64_t URING_OP_MASK = 0x7;
+
+enum UringOp {
+    URING_OP_ACCEPT,
+    URING_OP_RECV,
+    URING_OP_SEND
+};
+
+static uvw::Addr sockaddr_to_addr(const sockaddr_storage &ss)
+{
+    if(ss.ss_family == AF_INET6) {
+        return uvw::details::address<uvw::IPv6>(reinterpret_cast<const sockaddr_in6*>(&ss));
+    } else if(ss.ss_family == AF_INET) {
+        return uvw::details::address<uvw::IPv4>(reinterpret_cast<const sockaddr_in*>(&ss));
+    }
+    return uvw::Addr{};
+}
+
+struct UringLoop::Impl {
+    io_uring ring;
+    bool ring_initialized = false;
+    io_uring_buf_ring *buf_ring = nullptr;
+    std::unique_ptr<char[]> buffers;
+    int eventfd = -1;
+    std::shared_ptr<uvw::Loop> loop;
+    std::shared_ptr<uvw::PollHandle> poll;
+    std::shared_ptr<uvw::PrepareHandle> prepare;
+
+    io_uring_sqe *get_sqe()
+    {
+        io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+        if(sqe == nullptr) {
+            // The submission queue is full; flush it early.
+            io_uring_submit(&ring);
+            sqe = io_uring_get_sqe(&ring);
+        }
+        return sqe;
+    }
+};
+
+std::shared_ptr<UringLoop> UringLoop::get()
+{
+    // Each loop thread has a ring of its own.
+    static thread_local std::weak_ptr<UringLoop> current;
+    static std::atomic<bool> unavailable(false);
+
+    const std::shared_ptr<uvw::Loop> &loop = TaskQueue::current().loop();
+    std::shared_ptr<UringLoop> uring = current.lock();
+    if(uring != nullptr && uring->m_impl->loop == loop) {
+        return uring;
+    }
+    if(unavailable) {
+        return nullptr;
+    }
+
+    uring = std::shared_ptr<UringLoop>(new UringLoop());
+    if(uring->initialize(loop) != 0) {
+        // Most likely the kernel is too old, or io_uring is forbidden to us (e.g. by seccomp).
+        unavailable = true;
+        return nullptr;
+    }
+
+    current = uring;
+    return uring;
+}
+
+UringLoop::UringLoop() : m_impl(new Impl)
+{
+}
+
+int UringLoop::initialize(const std::shared_ptr<uvw::Loop> &loop)
+{
+    Impl &impl = *m_impl;
+    impl.loop = loop;
+
+    int err = io_uring_queue_init(URING_ENTRIES, &impl.ring, 0);
+    if(err < 0) {
+        return err;
+    }
+    impl.ring_initialized = true;
+
+    // Multishot recv needs a ring of provided buffers.
+    impl.buf_ring = io_uring_setup_buf_ring(&impl.ring, URING_NUM_BUFFERS, URING_BUFFER_GROUP, 0,
+                                            &err);
+    if(impl.buf_ring == nullptr) {
+        return err;
+    }
+    impl.buffers.reset(new char[URING_NUM_BUFFERS * buffer_size]);
+    for(unsigned int i = 0; i < URING_NUM_BUFFERS; ++i) {
+        io_uring_buf_ring_add(impl.buf_ring, impl.buffers.get() + i * buffer_size, buffer_size, i,
+                              io_uring_buf_ring_mask(URING_NUM_BUFFERS), i);
+    }
+    io_uring_buf_ring_advance(impl.buf_ring, URING_NUM_BUFFERS);
+
+    // The loop finds out about completions through an eventfd...
+    impl.eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(impl.eventfd < 0) {
+        return -errno;
+    }
+    err = io_uring_register_eventfd(&impl.ring, impl.eventfd);
+    if(err < 0) {
+        return err;
+    }
+
+    std::weak_ptr<UringLoop> weak = shared_from_this();
+    impl.poll = loop->resource<uvw::PollHandle>(impl.eventfd);
+    impl.poll->on<uvw::PollEvent>([weak](const uvw::PollEvent &, uvw::PollHandle &) {
+        std::shared_ptr<UringLoop> self = weak.lock();
+        if(self != nullptr) {
+            self->handle_completions();
+        }
+    });
+    impl.poll->start(uvw::PollHandle::Event::READABLE);
+
+    // ...and submits whatever was queued up during an iteration just before it blocks.
+    impl.prepare = loop->resource<uvw::PrepareHandle>();
+    impl.prepare->on<uvw::PrepareEvent>([weak](const uvw::PrepareEvent &, uvw::PrepareHandle &) {
+        std::shared_ptr<UringLoop> self = weak.lock();
+        if(self != nullptr && io_uring_sq_ready(&self->m_impl->ring) > 0) {
+            io_uring_submit(&self->m_impl->ring);
+        }
+    });
+    impl.prepare->start();
+
+    return 0;
+}
+
+UringLoop::~UringLoop()
+{
+    Impl &impl = *m_impl;
+    if(impl.poll != nullptr) {
+        impl.poll->close();
+    }
+    if(impl.prepare != nullptr) {
+        impl.prepare->close();
+    }
+    if(impl.buf_ring != nullptr) {
+        io_uring_free_buf_ring(&impl.ring, impl.buf_ring, URING_NUM_BUFFERS, URING_BUFFER_GROUP);
+    }
+    if(impl.ring_initialized) {
+        io_uring_queue_exit(&impl.ring);
+    }
+    if(impl.eventfd >= 0) {
+        ::close(impl.eventfd);
+    }
+}
+
+void UringLoop::handle_completions()
+{
+    Impl &impl = *m_impl;
+
+    uint64_t count;
+    if(::read(impl.eventfd, &count, sizeof(count)) < 0) {
+        // Nothing was signalled; there may still be completions, so look anyway.
+    }
+
+    // A completion's handler may submit (or even complete) more operations, so we take each
+    // one off the queue before handling it.
+    io_uring_cqe *cqe;
+    while(io_uring_peek_cqe(&impl.ring, &cqe) == 0) {
+        io_uring_cqe completion = *cqe;
+        io_uring_cqe_seen(&impl.ring, cqe);
+
+        uint64_t data = io_uring_cqe_get_data64(&completion);
+        if(data == 0) {
+            continue; // Cancellations have no owner.
+        }
+        UringOperation *owner = reinterpret_cast<UringOperation*>((uintptr_t)(data & ~URING_OP_MASK));
+        owner->handle_completion((unsigned int)(data & URING_OP_MASK), &completion);
+    }
+}
+
+void UringLoop::submit_accept(UringOperation *owner, unsigned int op, int fd)
+{
+    io_uring_sqe *sqe = m_impl->get_sqe();
+    io_uring_prep_multishot_accept(sqe, fd, nullptr, nullptr, SOCK_CLOEXEC);
+    io_uring_sqe_set_data64(sqe, (uint64_t)(uintptr_t)owner | op);
+}
+
+void UringLoop::submit_recv(UringOperation *owner, unsigned int op, int fd)
+{
+    io_uring_sqe *sqe = m_impl->get_sqe();
+    io_uring_prep_recv_multishot(sqe, fd, nullptr, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    io_uring_sqe_set_data64(sqe, (uint64_t)(uintptr_t)owner | op);
+}
+
+void UringLoop::submit_sendmsg(UringOperation *owner, unsigned int op, int fd, const void *msg)
+{
+    io_uring_sqe *sqe = m_impl->get_sqe();
+    io_uring_prep_sendmsg(sqe, fd, static_cast<const msghdr*>(msg), MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(sqe, (uint64_t)(uintptr_t)owner | op);
+}
+
+void UringLoop::submit_cancel(int fd)
+{
+    io_uring_sqe *sqe = m_impl->get_sqe();
+    io_uring_prep_cancel_fd(sqe, fd, IORING_ASYNC_CANCEL_ALL);
+    io_uring_sqe_set_data64(sqe, 0);
+}
+
+std::unique_ptr<char[]> UringLoop::take_buffer(const io_uring_cqe *cqe)
+{
+    if(!(cqe->flags & IORING_CQE_F_BUFFER)) {
+        return nullptr;
+    }
+
+    // Copying the data out lets the buffer go straight back to the kernel, and hands the reader
+    // a buffer of its own (see ReceiveBuffer) as libuv would.
+    unsigned int id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    char *buffer = m_impl->buffers.get() + id * buffer_size;
+    std::unique_ptr<char[]> data(new char[cqe->res]);
+    memcpy(data.get(), buffer, cqe->res);
+
+    io_uring_buf_ring_add(m_impl->buf_ring, buffer, buffer_size, id,
+                          io_uring_buf_ring_mask(URING_NUM_BUFFERS), 0);
+    io_uring_buf_ring_advance(m_impl->buf_ring, 1);
+    return data;
+}
+
+struct UringSocket::WriteState {
+    std::vector<iovec> iov;
+    size_t start = 0; // The first iovec not yet completely sent.
+    msghdr msg;
+
+    // advance discounts "sent" bytes, returning true if there's more to send.
+    bool advance(size_t sent)
+    {
+        while(start < iov.size() && sent >= iov[start].iov_len) {
+            sent -= iov[start].iov_len;
+            ++start;
+        }
+        if(start < iov.size()) {
+            iov[start].iov_base = static_cast<char*>(iov[start].iov_base) + sent;
+            iov[start].iov_len -= sent;
+        }
+        return start < iov.size();
+    }
+};
+
+UringSocket::UringSocket(const std::shared_ptr<UringLoop> &loop, int fd) :
+    m_loop(loop), m_fd(fd), m_write(new WriteState)
+{
+    // Match what NetworkClient asks of a uvw::TcpHandle.
+    int on = 1, idle = 60;
+    setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    setsockopt(m_fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(m_fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+}
+
+UringSocket::~UringSocket()
+{
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+void UringSocket::read(DataCallback data, EndCallback end)
+{
+    m_data_callback = data;
+    m_end_callback = end;
+    submit_recv();
+}
+
+void UringSocket::write(const uv_buf_t *bufs, unsigned int nbufs, WriteCallback done)
+{
+    assert(m_write_callback == nullptr);
+    m_write_callback = done;
+
+    m_write->iov.resize(nbufs);
+    for(unsigned int i = 0; i < nbufs; ++i) {
+        m_write->iov[i].iov_base = bufs[i].base;
+        m_write->iov[i].iov_len = bufs[i].len;
+    }
+    m_write->start = 0;
+    if(!m_write->advance(0)) {
+        // Nothing to send (e.g. only empty buffers); say so on the next completion pass.
+        m_write->iov.clear();
+    }
+    submit_write();
+}
+
+void UringSocket::close()
+{
+    if(m_closing) {
+        return;
+    }
+    m_closing = true;
+
+    if(m_in_flight > 0) {
+        // The descriptor gets closed when the last operation comes back.
+        m_loop->submit_cancel(m_fd);
+    } else {
+        ::close(m_fd);
+        m_fd = -1;
+        end(0);
+    }
+}
+
+uvw::Addr UringSocket::peer() const
+{
+    sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    if(getpeername(m_fd, reinterpret_cast<sockaddr*>(&ss), &len) < 0) {
+        return uvw::Addr{};
+    }
+    return sockaddr_to_addr(ss);
+}
+
+uvw::Addr UringSocket::sock() const
+{
+    sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    if(getsockname(m_fd, reinterpret_cast<sockaddr*>(&ss), &len) < 0) {
+        return uvw::Addr{};
+    }
+    return sockaddr_to_addr(ss);
+}
+
+void UringSocket::submit_recv()
+{
+    started();
+    m_loop->submit_recv(this, URING_OP_RECV, m_fd);
+}
+
+void UringSocket::submit_write()
+{
+    WriteState &write = *m_write;
+    memset(&write.msg, 0, sizeof(write.msg));
+    write.msg.msg_iov = write.iov.data() + write.start;
+    write.msg.msg_iovlen = std::min(write.iov.size() - write.start, (size_t)IOV_MAX);
+
+    started();
+    m_loop->submit_sendmsg(this, URING_OP_SEND, m_fd, &write.msg);
+}
+
+void UringSocket::handle_completion(unsigned int op, const io_uring_cqe *cqe)
+{
+    if(op == URING_OP_RECV) {
+        if(cqe->res > 0) {
+            std::unique_ptr<char[]> data = m_loop->take_buffer(cqe);
+            if(!m_closing && m_data_callback != nullptr) {
+                m_data_callback(std::move(data), cqe->res);
+            }
+        }
+
+        if(!(cqe->flags & IORING_CQE_F_MORE)) {
+            // The kernel stopped the multishot recv. Running out of buffers (or of room to
+            // post completions) is only a pause; anything else is the end of the stream.
+            if(!m_closing) {
+                if(cqe->res > 0 || cqe->res == -ENOBUFS) {
+                    submit_recv();
+                } else {
+                    end(cqe->res);
+                }
+            }
+            finished();
+        }
+    } else if(op == URING_OP_SEND) {
+        int status = cqe->res < 0 ? cqe->res : 0;
+        if(cqe->res >= 0 && !m_closing && m_write->advance(cqe->res)) {
+            // A short send; carry on with the rest.
+            submit_write();
+        } else {
+            m_write->iov.clear();
+            WriteCallback done = std::move(m_write_callback);
+            m_write_callback = nullptr;
+            if(done != nullptr) {
+                done(status);
+            }
+        }
+        finished();
+    }
+}
+
+void UringSocket::started()
+{
+    if(m_in_flight++ == 0) {
+        m_self = shared_from_this();
+    }
+}
+
+void UringSocket::finished()
+{
+    if(--m_in_flight > 0) {
+        return;
+    }
+
+    if(m_closing && m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+        end(0);
+    }
+
+    // This may well be the last reference to us.
+    std::shared_ptr<UringSocket> self = std::move(m_self);
+}
+
+void UringSocket::end(int error)
+{
+    EndCallback callback = std::move(m_end_callback);
+    m_end_callback = nullptr;
+    m_data_callback = nullptr;
+    if(callback != nullptr) {
+        callback(error);
+    }
+}
+
+UringListener::UringListener(const std::shared_ptr<UringLoop> &loop) : m_loop(loop)
+{
+}
+
+UringListener::~UringListener()
+{
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+int UringListener::bind(const uvw::Addr &address, bool reuse_port)
+{
+    sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    socklen_t len;
+    if(uv_ip4_addr(address.ip.c_str(), address.port, reinterpret_cast<sockaddr_in*>(&ss)) == 0) {
+        len = sizeof(sockaddr_in);
+    } else if(uv_ip6_addr(address.ip.c_str(), address.port,
+                          reinterpret_cast<sockaddr_in6*>(&ss)) == 0) {
+        len = sizeof(sockaddr_in6);
+    } else {
+        return UV_EINVAL;
+    }
+
+    m_fd = socket(ss.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(m_fd < 0) {
+        return -errno;
+    }
+
+    int on = 1;
+    setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if(reuse_port && setsockopt(m_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        int err = -errno;
+        ::close(m_fd);
+        m_fd = -1;
+        return err;
+    }
+    if(::bind(m_fd, reinterpret_cast<sockaddr*>(&ss), len) < 0) {
+        int err = -errno;
+        ::close(m_fd);
+        m_fd = -1;
+        return err;
+    }
+
+    return 0;
+}
+
+void UringListener::listen(AcceptCallback accept, ErrorCallback error)
+{
+    m_accept_callback = accept;
+    m_error_callback = error;
+
+    if(::listen(m_fd, SOMAXCONN) < 0) {
+        m_error_callback(-errno);
+        return;
+    }
+
+    submit_accept();
+}
+
+void UringListener::close()
+{
+    if(m_closing) {
+        return;
+    }
+    m_closing = true;
+
+    if(m_in_flight) {
+        m_loop->submit_cancel(m_fd);
+    } else if(m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+void UringListener::submit_accept()
+{
+    m_in_flight = true;
+    m_self = shared_from_this();
+    m_loop->submit_accept(this, URING_OP_ACCEPT, m_fd);
+}
+
+void UringListener::handle_completion(unsigned int, const io_uring_cqe *cqe)
+{
+    if(cqe->res >= 0) {
+        std::shared_ptr<UringSocket> socket = std::make_shared<UringSocket>(m_loop, cqe->res);
+        if(!m_closing && m_accept_callback != nullptr) {
+            m_accept_callback(socket);
+        }
+    }
+
+    if(cqe->flags & IORING_CQE_F_MORE) {
+        return;
+    }
+
+    m_in_flight = false;
+    if(m_closing) {
+        ::close(m_fd);
+        m_fd = -1;
+    } else if(cqe->res >= 0 || cqe->res == -ECONNABORTED || cqe->res == -EMFILE ||
+              cqe->res == -ENFILE) {
+        // Errors on a single connection don't stop us listening.
+        submit_accept();
+        return;
+    } else if(m_error_callback != nullptr) {
+        m_error_callback(cqe->res);
+    }
+
+    std::shared_ptr<UringListener> self = std::move(m_self);
+}
+
+#else // !ASTRON_WITH_IO_URING
+
+// Without io_uring compiled in, get always returns nullptr, so none of the rest is ever used.
+
+struct UringLoop::Impl {
+};
+
+std::shared_ptr<UringLoop> UringLoop::get()
+{
+    return nullptr;
+}
+
+UringLoop::UringLoop()
+{
+}
+
+UringLoop::~UringLoop()
+{
+}
+
+int UringLoop::initialize(const std::shared_ptr<uvw::Loop> &)
+{
+    return UV_ENOSYS;
+}
+
+void UringLoop::handle_completions()
+{
+}
+
+void UringLoop::submit_accept(UringOperation *, unsigned int, int)
+{
+}
+
+void UringLoop::submit_recv(UringOperation *, unsigned int, int)
+{
+}
+
+void UringLoop::submit_sendmsg(UringOperation *, unsigned int, int, const void *)
+{
+}
+
+void UringLoop::submit_cancel(int)
+{
+}
+
+std::unique_ptr<char[]> UringLoop::take_buffer(const io_uring_cqe *)
+{
+    return nullptr;
+}
+
+struct UringSocket::WriteState {
+};
+
+UringSocket::UringSocket(const std::shared_ptr<UringLoop> &loop, int fd) : m_loop(loop), m_fd(fd)
+{
+}
+
+UringSocket::~UringSocket()
+{
+}
+
+void UringSocket::read(DataCallback, EndCallback end)
+{
+    end(UV_ENOSYS);
+}
+
+void UringSocket::write(const uv_buf_t *, unsigned int, WriteCallback done)
+{
+    done(UV_ENOSYS);
+}
+
+void UringSocket::close()
+{
+}
+
+uvw::Addr UringSocket::peer() const
+{
+    return uvw::Addr{};
+}
+
+uvw::Addr UringSocket::sock() const
+{
+    return uvw::Addr{};
+}
+
+void UringSocket::handle_completion(unsigned int, const io_uring_cqe *)
+{
+}
+
+void UringSocket::submit_recv()
+{
+}
+
+void UringSocket::submit_write()
+{
+}
+
+void UringSocket::started()
+{
+}
+
+void UringSocket::finished()
+{
+}
+
+void UringSocket::end(int)
+{
+}
+
+UringListener::UringListener(const std::shared_ptr<UringLoop> &loop) : m_loop(loop)
+{
+}
+
+UringListener::~UringListener()
+{
+}
+
+int UringListener::bind(const uvw::Addr &, bool)
+{
+    return UV_ENOSYS;
+}
+
+void UringListener::listen(AcceptCallback, ErrorCallback error)
+{
+    error(UV_ENOSYS);
+}
+
+void UringListener::close()
+{
+}
+
+void UringListener::handle_completion(unsigned int, const io_uring_cqe *)
+{
+}
+
+void UringListener::submit_accept()
+{
+}
+
+#endif // ASTRON_WITH_IO_URING
@@ -0,0 +1,149 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <string>
+#include "deps/uvw/uvw.hpp"
+
+// NOTES:
+//
+// The io_uring transport is an alternative to libuv for TCP sockets on Linux, for roles with a
+// great many connections (i.e. the ClientAgent). Sockets are still serviced on their loop's
+// thread: each loop has a ring whose completions are signalled through an eventfd the loop
+// polls, and everything queued for submission during a loop iteration goes to the kernel in
+// one io_uring_enter just before the loop next blocks. Listeners use multishot accept, and
+// sockets use multishot recv into a ring of provided buffers shared by every socket on the
+// loop, so an idle socket holds no buffer.
+//
+// It is only compiled in if Astron is built with USE_IO_URING (which needs liburing), and only
+// used where it's turned on in the config; if the kernel doesn't support it, UringLoop::get
+// returns nullptr and callers are expected to carry on with libuv.
+
+struct io_uring_cqe;
+class UringLoop;
+
+// A UringOperation is anything with io_uring operations in flight. Its completions are passed to
+// handle_completion, along with the operation code it gave when submitting.
+class UringOperation
+{
+  public:
+    virtual ~UringOperation() {}
+
+  protected:
+    virtual void handle_completion(unsigned int op, const io_uring_cqe *cqe) = 0;
+
+    friend class UringLoop;
+};
+
+// A UringLoop is the ring (and buffer ring) used by every io_uring socket on one uvw::Loop.
+class UringLoop : public std::enable_shared_from_this<UringLoop>
+{
+  public:
+    // get returns the UringLoop for the calling thread's loop (see TaskQueue::current), creating
+    //     it if need be, or nullptr if io_uring isn't available (in this build, or from this kernel).
+    static std::shared_ptr<UringLoop> get();
+    ~UringLoop();
+
+    // The size of each provided receive buffer.
+    static const unsigned int buffer_size = 16384;
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+
+    UringLoop();
+    int initialize(const std::shared_ptr<uvw::Loop> &loop);
+    void handle_completions();
+
+    // These queue an operation for submission; "op" is passed back to handle_completion.
+    void submit_accept(UringOperation *owner, unsigned int op, int fd);
+    void submit_recv(UringOperation *owner, unsigned int op, int fd);
+    void submit_sendmsg(UringOperation *owner, unsigned int op, int fd, const void *msg);
+    void submit_cancel(int fd);
+    // take_buffer copies out the provided buffer a recv completed into, and recycles it.
+    std::unique_ptr<char[]> take_buffer(const io_uring_cqe *cqe);
+
+    friend class UringSocket;
+    friend class UringListener;
+};
+
+// A UringSocket is a connected TCP socket serviced by io_uring. Its callbacks correspond to the
+// uvw events NetworkClient listens for on a TcpHandle.
+class UringSocket : public UringOperation, public std::enable_shared_from_this<UringSocket>
+{
+  public:
+    typedef std::function<void(std::unique_ptr<char[]> data, size_t length)> DataCallback;
+    // Called with 0 for an orderly EOF, or a (negative) libuv error code.
+    typedef std::function<void(int error)> EndCallback;
+    typedef std::function<void(int status)> WriteCallback;
+
+    UringSocket(const std::shared_ptr<UringLoop> &loop, int fd);
+    ~UringSocket();
+
+    // read starts receiving, calling "data" for each read and "end" once no more will come.
+    void read(DataCallback data, EndCallback end);
+
+    // write sends all of "bufs" (which must stay valid until then), then calls "done".
+    //     Only one write may be in flight at a time.
+    void write(const uv_buf_t *bufs, unsigned int nbufs, WriteCallback done);
+
+    // close cancels whatever is in flight; the descriptor is closed once it's all done.
+    void close();
+
+    uvw::Addr peer() const;
+    uvw::Addr sock() const;
+
+  protected:
+    virtual void handle_completion(unsigned int op, const io_uring_cqe *cqe);
+
+  private:
+    std::shared_ptr<UringLoop> m_loop;
+    int m_fd;
+    bool m_closing = false;
+    unsigned int m_in_flight = 0;
+    // We keep ourselves alive for as long as anything is in flight.
+    std::shared_ptr<UringSocket> m_self;
+
+    DataCallback m_data_callback;
+    EndCallback m_end_callback;
+    WriteCallback m_write_callback;
+    struct WriteState; // What's left of the write in flight.
+    std::unique_ptr<WriteState> m_write;
+
+    void submit_recv();
+    void submit_write();
+    void started();
+    void finished();
+    void end(int error);
+};
+
+// A UringListener accepts connections on a listening TCP socket with io_uring.
+class UringListener : public UringOperation, public std::enable_shared_from_this<UringListener>
+{
+  public:
+    typedef std::function<void(const std::shared_ptr<UringSocket> &socket)> AcceptCallback;
+    typedef std::function<void(int error)> ErrorCallback;
+
+    UringListener(const std::shared_ptr<UringLoop> &loop);
+    ~UringListener();
+
+    // bind creates a socket bound to "address"; it returns 0, or a (negative) libuv error code.
+    //     With "reuse_port", other sockets may be bound to the same address (see SO_REUSEPORT).
+    int bind(const uvw::Addr &address, bool reuse_port = false);
+    // listen starts accepting connections, until close is called.
+    void listen(AcceptCallback accept, ErrorCallback error);
+    void close();
+
+  protected:
+    virtual void handle_completion(unsigned int op, const io_uring_cqe *cqe);
+
+  private:
+    std::shared_ptr<UringLoop> m_loop;
+    int m_fd = -1;
+    bool m_closing = false;
+    bool m_in_flight = false;
+    std::shared_ptr<UringListener> m_self;
+    AcceptCallback m_accept_callback;
+    ErrorCallback m_error_callback;
+
+    void submit_accept();
+};
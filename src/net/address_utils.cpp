@@ -6,6 +6,11 @@
 #include "deps/uvw/uvw.hpp"
 #include "deps/uvw/uvw/util.hpp"
 #include <uv.h>
+#ifndef _WIN32
+#include <sys/un.h>
+#endif
+
+static const std::string unix_prefix = "unix:";
 
 static bool split_port(std::string &ip, uint16_t &port)
 {
@@ -108,11 +113,31 @@ static bool validate_hostname(const std::string &hostname)
     return true;
 }
 
+bool split_unix_address(const std::string &hostspec, std::string &path)
+{
+    if(hostspec.compare(0, unix_prefix.length(), unix_prefix) != 0) {
+        return false;
+    }
+
+    path = hostspec.substr(unix_prefix.length());
+    return true;
+}
+
 bool is_valid_address(const std::string &hostspec)
 {
     std::string host = hostspec;
     uint16_t port = 0;
 
+    std::string path;
+    if(split_unix_address(hostspec, path)) {
+    #ifdef _WIN32
+        return false;
+    #else
+        // The path has to fit in a sockaddr_un, along with its terminator.
+        return !path.empty() && path.length() < sizeof(sockaddr_un::sun_path);
+    #endif
+    }
+
     if(!split_port(host, port)) {
         return false;
     }
@@ -2,4 +2,8 @@
 
 bool is_valid_address(const std::string &hostspec);
 
+// split_unix_address returns true if "hostspec" names a Unix domain socket rather than a
+// TCP endpoint, as in "unix:/path/to.sock", and if so sets "path" to the socket's path.
+bool split_unix_address(const std::string &hostspec, std::string &path);
+
 std::vector<uvw::Addr> resolve_address(const std::string &hostspec, uint16_t port, const std::shared_ptr<uvw::Loop> &loop);
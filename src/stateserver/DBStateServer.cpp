@@ -1,6 +1,7 @@
 #include "core/global.h"
 #include "core/msgtypes.h"
 #include "config/constraints.h"
+#include "util/FieldStore.h"
 #include "dclass/dc/Class.h"
 #include "dclass/dc/Field.h"
 #include <unordered_set>
@@ -214,14 +215,14 @@ void DBStateServer::handle_set_field(DatagramIterator &dgi)
     uint16_t field_id = dgi.read_uint16();
 
     const Field* field = g_dcf->get_field_by_id(field_id);
-    if(field && field->has_keyword("db")) {
+    if(field && field->has_keyword(dclass::KW_DB)) {
         m_log->trace() << "Forwarding SetField for field \"" << field->get_name()
                        << "\" on object with id " << do_id << " to database.\n";
 
         DatagramPtr dg = Datagram::create(m_db_channel, do_id, DBSERVER_OBJECT_SET_FIELD);
         dg->add_doid(do_id);
         dg->add_uint16(field_id);
-        dg->add_data(dgi.read_remainder());
+        dg->add_data(dgi.read_remainder_view());
         route_datagram(dg);
     }
 }
@@ -245,7 +246,7 @@ void DBStateServer::handle_set_fields(DatagramIterator &dgi)
             m_log->warning() << "Received invalid field with id " << field_id << " in SetFields.\n";
             return;
         }
-        if(field->has_keyword("db")) {
+        if(field->has_keyword(dclass::KW_DB)) {
             dgi.unpack_field(field, db_fields[field]);
         } else {
             dgi.skip_field(field);
@@ -280,7 +281,7 @@ void DBStateServer::handle_get_field(channel_t sender, DatagramIterator &dgi)
 
     // Check field is "ram db" or "required"
     const Field* field = g_dcf->get_field_by_id(field_id);
-    if(!field || !(field->has_keyword("required") || field->has_keyword("ram"))) {
+    if(!field || !field->has_any_keyword(dclass::KW_REQUIRED | dclass::KW_RAM)) {
         DatagramPtr dg = Datagram::create(sender, r_do_id, STATESERVER_OBJECT_GET_FIELD_RESP);
         dg->add_uint32(r_context);
         dg->add_bool(false);
@@ -288,7 +289,7 @@ void DBStateServer::handle_get_field(channel_t sender, DatagramIterator &dgi)
         return;
     }
 
-    if(field->has_keyword("db")) {
+    if(field->has_keyword(dclass::KW_DB)) {
         // Get context for db query
         uint32_t db_context = m_next_context++;
 
@@ -344,7 +345,7 @@ void DBStateServer::handle_get_field_resp(DatagramIterator& dgi)
     m_log->trace() << "Received GetFieldResp from database." << std::endl;
 
     // Add database field payload to response (don't know dclass, so must copy payload) and send
-    dg->add_data(dgi.read_remainder());
+    dg->add_data(dgi.read_remainder_view());
     route_datagram(dg);
 }
 
@@ -370,8 +371,8 @@ void DBStateServer::handle_get_fields(channel_t sender, DatagramIterator &dgi)
             dg->add_uint32(r_context);
             dg->add_uint8(false);
             route_datagram(dg);
-        } else if(field->has_keyword("ram") || field->has_keyword("required")) {
-            if(field->has_keyword("db")) {
+        } else if(field->has_any_keyword(dclass::KW_RAM | dclass::KW_REQUIRED)) {
+            if(field->has_keyword(dclass::KW_DB)) {
                 db_fields.push_back(field);
             } else {
                 ram_fields.push_back(field);
@@ -446,7 +447,7 @@ void DBStateServer::handle_get_fields_resp(DatagramIterator& dgi)
     // Add database field payload to response (don't know dclass, so must copy payload).
     if(dgi.read_bool() == true) {
         dgi.read_uint16(); // Discard field count
-        dg->add_data(dgi.read_remainder());
+        dg->add_data(dgi.read_remainder_view());
     }
     route_datagram(dg);
 }
@@ -544,16 +545,14 @@ void DBStateServer::handle_get_all_resp(DatagramIterator& dgi)
     dg->add_uint16(r_class->get_id());
 
     // Add required fields to datagram
-    int dcc_field_count = r_class->get_num_fields();
-    for(int i = 0; i < dcc_field_count; ++i) {
-        const Field *field = r_class->get_field(i);
-        if(!field->as_molecular() && field->has_keyword("required")) {
-            auto req_it = required_fields.find(field);
-            if(req_it != required_fields.end()) {
-                dg->add_data(req_it->second);
-            } else {
-                dg->add_data(field->get_default_value());
-            }
+    const FieldLayout *layout = FieldLayout::get(r_class);
+    for(unsigned int slot : layout->get_required_slots(false, false)) {
+        const Field *field = layout->get_field(slot);
+        auto req_it = required_fields.find(field);
+        if(req_it != required_fields.end()) {
+            dg->add_data(req_it->second);
+        } else {
+            dg->add_data(field->get_default_value());
         }
     }
 
@@ -600,9 +599,9 @@ bool unpack_db_fields(DatagramIterator &dgi, const Class* dc_class,
         if(!field) {
             return false;
         }
-        if(field->has_keyword("required")) {
+        if(field->has_keyword(dclass::KW_REQUIRED)) {
             dgi.unpack_field(field, required[field]);
-        } else if(field->has_keyword("ram")) {
+        } else if(field->has_keyword(dclass::KW_RAM)) {
             dgi.unpack_field(field, ram[field]);
         } else {
             dgi.skip_field(field);
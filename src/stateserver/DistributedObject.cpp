@@ -13,20 +13,22 @@ using dclass::MolecularField;
 DistributedObject::DistributedObject(StateServer *stateserver, doid_t do_id, doid_t parent_id,
                                      zone_t zone_id, const Class *dclass, DatagramIterator &dgi,
                                      bool has_other) :
-    m_stateserver(stateserver), m_do_id(do_id), m_parent_id(INVALID_DO_ID), m_zone_id(0),
-    m_dclass(dclass), m_ai_channel(INVALID_CHANNEL), m_owner_channel(INVALID_CHANNEL),
-    m_ai_explicitly_set(false), m_parent_synchronized(false), m_next_context(0)
+    MDParticipantInterface(stateserver), m_stateserver(stateserver), m_do_id(do_id), m_parent_id(INVALID_DO_ID), m_zone_id(0),
+    m_dclass(dclass), m_fields(FieldLayout::get(dclass)), m_ai_channel(INVALID_CHANNEL),
+    m_owner_channel(INVALID_CHANNEL), m_ai_explicitly_set(false), m_parent_synchronized(false),
+    m_next_context(0)
 {
     stringstream name;
     name << dclass->get_name() << "(" << do_id << ")";
     m_log = new LogCategory("object", name.str());
     set_con_name(name.str());
 
-    for(unsigned int i = 0; i < m_dclass->get_num_fields(); ++i) {
-        const Field *field = m_dclass->get_field(i);
-        if(field->has_keyword("required") && !field->as_molecular()) {
-            dgi.unpack_field(field, m_required_fields[field]);
-        }
+    const FieldLayout *layout = m_fields.get_layout();
+    vector<uint8_t> data;
+    for(unsigned int slot = 0; slot < layout->get_num_required(); ++slot) {
+        data.clear();
+        dgi.unpack_field(layout->get_field(slot), data);
+        m_fields.set(slot, data);
     }
 
     if(has_other) {
@@ -40,8 +42,11 @@ DistributedObject::DistributedObject(StateServer *stateserver, doid_t do_id, doi
                 break;
             }
 
-            if(field->has_keyword("ram")) {
-                dgi.unpack_field(field, m_ram_fields[field]);
+            unsigned int slot = layout->get_ram_slot(field);
+            if(slot != FieldLayout::no_slot) {
+                data.clear();
+                dgi.unpack_field(field, data);
+                m_fields.set(slot, data);
             } else {
                 m_log->error() << "Received non-RAM field " << field->get_name()
                                << " within an OTHER section.\n";
@@ -50,6 +55,7 @@ DistributedObject::DistributedObject(StateServer *stateserver, doid_t do_id, doi
         }
     }
 
+    m_fields.shrink_to_fit();
     subscribe_channel(do_id);
 
     m_log->debug() << "Object created..." << endl;
@@ -62,16 +68,28 @@ DistributedObject::DistributedObject(StateServer *stateserver, doid_t do_id, doi
 DistributedObject::DistributedObject(StateServer *stateserver, channel_t sender, doid_t do_id,
                                      doid_t parent_id, zone_t zone_id, const Class *dclass,
                                      UnorderedFieldValues& required, FieldValues& ram) :
-    m_stateserver(stateserver), m_do_id(do_id), m_parent_id(INVALID_DO_ID), m_zone_id(0),
-    m_dclass(dclass), m_ai_channel(INVALID_CHANNEL), m_owner_channel(INVALID_CHANNEL),
-    m_ai_explicitly_set(false), m_next_context(0)
+    MDParticipantInterface(stateserver), m_stateserver(stateserver), m_do_id(do_id), m_parent_id(INVALID_DO_ID), m_zone_id(0),
+    m_dclass(dclass), m_fields(FieldLayout::get(dclass)), m_ai_channel(INVALID_CHANNEL),
+    m_owner_channel(INVALID_CHANNEL), m_ai_explicitly_set(false), m_next_context(0)
 {
     stringstream name;
     name << dclass->get_name() << "(" << do_id << ")";
     m_log = new LogCategory("object", name.str());
 
-    m_required_fields = required;
-    m_ram_fields = ram;
+    const FieldLayout *layout = m_fields.get_layout();
+    for(auto it = required.begin(); it != required.end(); ++it) {
+        unsigned int slot = layout->get_required_slot(it->first);
+        if(slot != FieldLayout::no_slot) {
+            m_fields.set(slot, it->second);
+        }
+    }
+    for(auto it = ram.begin(); it != ram.end(); ++it) {
+        unsigned int slot = layout->get_ram_slot(it->first);
+        if(slot != FieldLayout::no_slot) {
+            m_fields.set(slot, it->second);
+        }
+    }
+    m_fields.shrink_to_fit();
 
     subscribe_channel(do_id);
     handle_location_change(parent_id, zone_id, sender);
@@ -86,57 +104,39 @@ DistributedObject::~DistributedObject()
     }
 }
 
+// The fields themselves come from the store, which keeps them encoded for an object entering the
+// interest of many channels at once, to be copied in whole each time.
 void DistributedObject::append_required_data(DatagramPtr dg, bool client_only, bool also_owner)
 {
+    // Leave room for the other fields too, which usually follow, so the datagram is sized once.
+    dg->reserve(dg->size() + sizeof(doid_t) + sizeof(doid_t) + sizeof(zone_t) +
+                sizeof(uint16_t) + m_fields.get_sent_size(client_only, also_owner));
+
     dg->add_doid(m_do_id);
     dg->add_location(m_parent_id, m_zone_id);
     dg->add_uint16(m_dclass->get_id());
-    size_t field_count = m_dclass->get_num_fields();
-    for(size_t i = 0; i < field_count; ++i) {
-        const Field *field = m_dclass->get_field(i);
-        if(field->has_keyword("required") && !field->as_molecular() && (!client_only
-                || field->has_keyword("broadcast") || field->has_keyword("clrecv")
-                || (also_owner && field->has_keyword("ownrecv")))) {
-            dg->add_data(m_required_fields[field]);
-        }
-    }
+    m_fields.add_required(dg, client_only, also_owner);
 }
 
 void DistributedObject::append_other_data(DatagramPtr dg, bool client_only, bool also_owner)
 {
-    if(client_only) {
-        vector<const Field*> broadcast_fields;
-        for(auto it = m_ram_fields.begin(); it != m_ram_fields.end(); ++it) {
-            if(it->first->has_keyword("broadcast") || it->first->has_keyword("clrecv")
-               || (also_owner && it->first->has_keyword("ownrecv"))) {
-                broadcast_fields.push_back(it->first);
-            }
-        }
-
-        dg->add_uint16(broadcast_fields.size());
-        for(auto it = broadcast_fields.begin(); it != broadcast_fields.end(); ++it) {
-            dg->add_uint16((*it)->get_id());
-            dg->add_data(m_ram_fields[*it]);
-        }
-    } else {
-        dg->add_uint16(m_ram_fields.size());
-        for(auto it = m_ram_fields.begin(); it != m_ram_fields.end(); ++it) {
-            dg->add_uint16(it->first->get_id());
-            dg->add_data(it->second);
-        }
-    }
+    m_fields.add_other(dg, client_only, also_owner);
 }
 
-
+bool DistributedObject::has_ram_fields() const
+{
+    const FieldLayout *layout = m_fields.get_layout();
+    return m_fields.count_set(layout->get_num_required(), layout->get_num_slots()) != 0;
+}
 
 void DistributedObject::send_interest_entry(channel_t location, uint32_t context)
 {
-    DatagramPtr dg = Datagram::create(location, m_do_id, m_ram_fields.size() ?
+    DatagramPtr dg = Datagram::create(location, m_do_id, has_ram_fields() ?
                                       STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED_OTHER :
                                       STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED);
     dg->add_uint32(context);
     append_required_data(dg, true);
-    if(m_ram_fields.size()) {
+    if(has_ram_fields()) {
         append_other_data(dg, true);
     }
     route_datagram(dg);
@@ -144,11 +144,11 @@ void DistributedObject::send_interest_entry(channel_t location, uint32_t context
 
 void DistributedObject::send_location_entry(channel_t location)
 {
-    DatagramPtr dg = Datagram::create(location, m_do_id, m_ram_fields.size() ?
+    DatagramPtr dg = Datagram::create(location, m_do_id, has_ram_fields() ?
                                       STATESERVER_OBJECT_ENTER_LOCATION_WITH_REQUIRED_OTHER :
                                       STATESERVER_OBJECT_ENTER_LOCATION_WITH_REQUIRED);
     append_required_data(dg, true);
-    if(m_ram_fields.size()) {
+    if(has_ram_fields()) {
         append_other_data(dg, true);
     }
     route_datagram(dg);
@@ -156,11 +156,11 @@ void DistributedObject::send_location_entry(channel_t location)
 
 void DistributedObject::send_ai_entry(channel_t ai)
 {
-    DatagramPtr dg = Datagram::create(ai, m_do_id, m_ram_fields.size() ?
+    DatagramPtr dg = Datagram::create(ai, m_do_id, has_ram_fields() ?
                                       STATESERVER_OBJECT_ENTER_AI_WITH_REQUIRED_OTHER :
                                       STATESERVER_OBJECT_ENTER_AI_WITH_REQUIRED);
     append_required_data(dg);
-    if(m_ram_fields.size()) {
+    if(has_ram_fields()) {
         append_other_data(dg);
     }
     route_datagram(dg);
@@ -168,11 +168,11 @@ void DistributedObject::send_ai_entry(channel_t ai)
 
 void DistributedObject::send_owner_entry(channel_t owner)
 {
-    DatagramPtr dg = Datagram::create(owner, m_do_id, m_ram_fields.size() ?
+    DatagramPtr dg = Datagram::create(owner, m_do_id, has_ram_fields() ?
                                       STATESERVER_OBJECT_ENTER_OWNER_WITH_REQUIRED_OTHER :
                                       STATESERVER_OBJECT_ENTER_OWNER_WITH_REQUIRED);
     append_required_data(dg, true, true);
-    if(m_ram_fields.size()) {
+    if(has_ram_fields()) {
         append_other_data(dg, true, true);
     }
     route_datagram(dg);
@@ -343,10 +343,16 @@ void DistributedObject::wake_children()
 
 void DistributedObject::save_field(const Field *field, const vector<uint8_t> &data)
 {
-    if(field->has_keyword("required")) {
-        m_required_fields[field] = data;
-    } else if(field->has_keyword("ram")) {
-        m_ram_fields[field] = data;
+    const FieldLayout *layout = m_fields.get_layout();
+    unsigned int slot = FieldLayout::no_slot;
+    if(field->has_keyword(dclass::KW_REQUIRED)) {
+        slot = layout->get_required_slot(field);
+    } else if(field->has_keyword(dclass::KW_RAM)) {
+        slot = layout->get_ram_slot(field);
+    }
+
+    if(slot != FieldLayout::no_slot) {
+        m_fields.set(slot, data);
     }
 }
 
@@ -387,13 +393,13 @@ bool DistributedObject::handle_one_update(DatagramIterator &dgi, channel_t sende
     }
 
     unordered_set<channel_t> targets;
-    if(field->has_keyword("broadcast")) {
+    if(field->has_keyword(dclass::KW_BROADCAST)) {
         targets.insert(location_as_channel(m_parent_id, m_zone_id));
     }
-    if(field->has_keyword("airecv") && m_ai_channel && m_ai_channel != sender) {
+    if(field->has_keyword(dclass::KW_AIRECV) && m_ai_channel && m_ai_channel != sender) {
         targets.insert(m_ai_channel);
     }
-    if(field->has_keyword("ownrecv") && m_owner_channel && m_owner_channel != sender) {
+    if(field->has_keyword(dclass::KW_OWNRECV) && m_owner_channel && m_owner_channel != sender) {
         targets.insert(m_owner_channel);
     }
     if(targets.size()) { // TODO: Review this for efficiency?
@@ -429,20 +435,20 @@ bool DistributedObject::handle_one_get(DatagramPtr out, uint16_t field_id,
         return true;
     }
 
-    if(m_required_fields.count(field)) {
-        if(!is_subfield) {
-            out->add_uint16(field_id);
-        }
-        out->add_data(m_required_fields[field]);
-    } else if(m_ram_fields.count(field)) {
-        if(!is_subfield) {
-            out->add_uint16(field_id);
-        }
-        out->add_data(m_ram_fields[field]);
-    } else {
+    const FieldLayout *layout = m_fields.get_layout();
+    unsigned int slot = layout->get_required_slot(field);
+    if(slot == FieldLayout::no_slot || !m_fields.is_set(slot)) {
+        slot = layout->get_ram_slot(field);
+    }
+    if(slot == FieldLayout::no_slot || !m_fields.is_set(slot)) {
         return succeed_if_unset;
     }
 
+    if(!is_subfield) {
+        out->add_uint16(field_id);
+    }
+    out->add_data(m_fields.get(slot));
+
     return true;
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 #include "StateServer.h"
 #include "core/objtypes.h"
+#include "util/FieldStore.h"
 
 class DistributedObject : public MDParticipantInterface
 {
@@ -47,8 +48,7 @@ class DistributedObject : public MDParticipantInterface
     doid_t m_parent_id;
     zone_t m_zone_id;
     const dclass::Class *m_dclass;
-    UnorderedFieldValues m_required_fields;
-    FieldValues m_ram_fields;
+    FieldStore m_fields;
     channel_t m_ai_channel;
     channel_t m_owner_channel;
     bool m_ai_explicitly_set;
@@ -59,6 +59,7 @@ class DistributedObject : public MDParticipantInterface
 
     void append_required_data(DatagramPtr dg, bool client_only = false, bool also_owner = false);
     void append_other_data(DatagramPtr dg, bool client_only = false, bool also_owner = false);
+    bool has_ram_fields() const;
 
     void send_interest_entry(channel_t location, uint32_t context);
     void send_location_entry(channel_t location);
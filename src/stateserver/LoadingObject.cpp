@@ -11,7 +11,8 @@ using dclass::Field;
 LoadingObject::LoadingObject(DBStateServer *stateserver, doid_t do_id,
                              doid_t parent_id, zone_t zone_id,
                              const std::unordered_set<uint32_t> &contexts) :
-    m_dbss(stateserver), m_do_id(do_id), m_parent_id(parent_id), m_zone_id(zone_id),
+    MDParticipantInterface(stateserver), m_dbss(stateserver), m_do_id(do_id),
+    m_parent_id(parent_id), m_zone_id(zone_id),
     m_context(stateserver->m_next_context++), m_dclass(nullptr), m_valid_contexts(contexts),
     m_is_loaded(false)
 {
@@ -26,7 +27,8 @@ LoadingObject::LoadingObject(DBStateServer *stateserver, doid_t do_id,
 LoadingObject::LoadingObject(DBStateServer *stateserver, doid_t do_id, doid_t parent_id,
                              zone_t zone_id, const Class *dclass, DatagramIterator &dgi,
                              const std::unordered_set<uint32_t> &contexts) :
-    m_dbss(stateserver), m_do_id(do_id), m_parent_id(parent_id), m_zone_id(zone_id),
+    MDParticipantInterface(stateserver), m_dbss(stateserver), m_do_id(do_id),
+    m_parent_id(parent_id), m_zone_id(zone_id),
     m_context(stateserver->m_next_context++), m_dclass(dclass), m_valid_contexts(contexts),
     m_is_loaded(false)
 {
@@ -47,7 +49,7 @@ LoadingObject::LoadingObject(DBStateServer *stateserver, doid_t do_id, doid_t pa
             return;
         }
 
-        if(field->has_keyword("ram") || field->has_keyword("required")) {
+        if(field->has_any_keyword(dclass::KW_RAM | dclass::KW_REQUIRED)) {
             dgi.unpack_field(field, m_field_updates[field]);
         } else {
             m_log->error() << "Received non-RAM field " << field->get_name()
@@ -173,14 +175,14 @@ void LoadingObject::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
         for(std::size_t i{}; i < dcc_field_count; ++i) {
             const Field *field = r_dclass->get_field(i);
             if(!field->as_molecular()) {
-                if(field->has_keyword("required")) {
+                if(field->has_keyword(dclass::KW_REQUIRED)) {
                     if(m_field_updates.find(field) != m_field_updates.end()) {
                         m_required_fields[field] = m_field_updates[field];
                     } else if(m_required_fields.find(field) == m_required_fields.end()) {
                         std::string val = field->get_default_value();
                         m_required_fields[field] = std::vector<uint8_t>(val.begin(), val.end());
                     }
-                } else if(field->has_keyword("ram")) {
+                } else if(field->has_keyword(dclass::KW_RAM)) {
                     if(m_field_updates.find(field) != m_field_updates.end()) {
                         m_ram_fields[field] = m_field_updates[field];
                     }
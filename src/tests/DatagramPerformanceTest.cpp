@@ -0,0 +1,121 @@
+#include "core/global.h"
+#include "util/Datagram.h"
+#include <chrono>
+#include <vector>
+
+LogCategory dgperf_log("PerfTestDatagram", "Performance Test - Datagram allocation");
+
+#define DG_PERF_NUM_DATAGRAMS 2000000
+#define DG_PERF_NUM_RECEIVERS 4 // How many handles each datagram is routed to.
+#define DG_PERF_PAYLOAD "Hello, world! This is a typical field update."
+
+typedef std::chrono::steady_clock perf_clock;
+
+// A SharedDatagram is allocated the way Datagrams used to be, for comparison: a shared_ptr with
+// a control block of its own, and a separately allocated buffer which grows 64 bytes past what
+// it needs whenever it runs out.
+class SharedDatagram
+{
+  public:
+    SharedDatagram() : buf(new uint8_t[64]), buf_cap(64), buf_offset(0)
+    {
+    }
+    ~SharedDatagram()
+    {
+        delete [] buf;
+    }
+
+    void add_data(const void *data, size_t length)
+    {
+        if(buf_offset + length > buf_cap) {
+            uint8_t *tmp_buf = new uint8_t[buf_cap + length + 64];
+            memcpy(tmp_buf, buf, buf_cap);
+            delete [] buf;
+            buf = tmp_buf;
+            buf_cap = buf_cap + length + 64;
+        }
+        memcpy(buf + buf_offset, data, length);
+        buf_offset += length;
+    }
+
+    size_t size() const
+    {
+        return buf_offset;
+    }
+
+  private:
+    uint8_t *buf;
+    size_t buf_cap;
+    size_t buf_offset;
+};
+
+// DatagramPerformanceTest measures how many datagrams per second can be created, filled with a
+// server header and a small field update, handed out to a few receivers (as the MessageDirector
+// does when routing), and destroyed: once with Datagram::create, and once allocated the old way.
+class DatagramPerformanceTest
+{
+  public:
+    DatagramPerformanceTest()
+    {
+        dgperf_log.info() << "Starting Datagram allocation perf test..." << std::endl;
+
+        std::string payload = DG_PERF_PAYLOAD;
+        size_t total = 0;
+
+        std::vector<std::shared_ptr<const SharedDatagram> > shared_receivers;
+        shared_receivers.reserve(DG_PERF_NUM_RECEIVERS);
+        perf_clock::time_point start = perf_clock::now();
+        for(size_t i = 0; i < DG_PERF_NUM_DATAGRAMS; ++i) {
+            std::shared_ptr<SharedDatagram> dg(new SharedDatagram);
+            uint8_t num_targets = 1;
+            channel_t to = i, from = 1;
+            uint16_t msg_type = 2004;
+            doid_t do_id = i;
+            uint16_t field_id = 7;
+            dgsize_t length = payload.length();
+            dg->add_data(&num_targets, sizeof(num_targets));
+            dg->add_data(&to, sizeof(to));
+            dg->add_data(&from, sizeof(from));
+            dg->add_data(&msg_type, sizeof(msg_type));
+            dg->add_data(&do_id, sizeof(do_id));
+            dg->add_data(&field_id, sizeof(field_id));
+            dg->add_data(&length, sizeof(length));
+            dg->add_data(payload.data(), payload.length());
+            for(size_t n = 0; n < DG_PERF_NUM_RECEIVERS; ++n) {
+                shared_receivers.push_back(dg);
+            }
+            total += shared_receivers.back()->size();
+            shared_receivers.clear();
+        }
+        std::chrono::duration<double> shared_elapsed = perf_clock::now() - start;
+
+        std::vector<DatagramHandle> receivers;
+        receivers.reserve(DG_PERF_NUM_RECEIVERS);
+        start = perf_clock::now();
+        for(size_t i = 0; i < DG_PERF_NUM_DATAGRAMS; ++i) {
+            DatagramPtr dg = Datagram::create(i, 1, 2004);
+            dg->add_doid(i);
+            dg->add_uint16(7);
+            dg->add_string(payload);
+            for(size_t n = 0; n < DG_PERF_NUM_RECEIVERS; ++n) {
+                receivers.push_back(dg);
+            }
+            total -= receivers.back()->size();
+            receivers.clear();
+        }
+        std::chrono::duration<double> pooled_elapsed = perf_clock::now() - start;
+
+        if(total != 0) {
+            dgperf_log.fatal() << "The two kinds of datagram came out different sizes." << std::endl;
+            exit(1);
+        }
+
+        dgperf_log.info() << "shared_ptr: " << DG_PERF_NUM_DATAGRAMS / shared_elapsed.count()
+                          << " datagrams/second" << std::endl;
+        dgperf_log.info() << "Datagram::create: " << DG_PERF_NUM_DATAGRAMS / pooled_elapsed.count()
+                          << " datagrams/second (" << shared_elapsed.count() / pooled_elapsed.count()
+                          << "x)" << std::endl;
+    }
+};
+
+DatagramPerformanceTest perftest_datagram;
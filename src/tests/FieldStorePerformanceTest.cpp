@@ -0,0 +1,282 @@
+#include "core/global.h"
+#include "core/msgtypes.h"
+#include "core/objtypes.h"
+#include "dclass/dc/File.h"
+#include "dclass/file/read.h"
+#include "util/DatagramIterator.h"
+#include "util/FieldStore.h"
+#include <chrono>
+#include <sstream>
+#include <vector>
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#include <malloc.h>
+#define FS_PERF_HAVE_MALLINFO
+#endif
+
+LogCategory fsperf_log("PerfTestFieldStore", "Performance Test - Object field storage");
+
+#define FS_PERF_NUM_OBJECTS 1000000
+
+typedef std::chrono::steady_clock perf_clock;
+
+static const char *fs_perf_dc =
+    "dclass DistributedAvatar {\n"
+    "  setName(string) required broadcast db;\n"
+    "  setDNAString(blob) required broadcast db;\n"
+    "  setPosHpr(int16, int16, int16, int16, int16, int16) required broadcast ram;\n"
+    "  setHp(int16) required broadcast ram db;\n"
+    "  setMaxHp(int16) required broadcast ram db;\n"
+    "  setExperience(uint32) required ownrecv db;\n"
+    "  setMoney(uint32) required ownrecv db;\n"
+    "  setInventory(uint16[]) required ownrecv db;\n"
+    "  setFriendsList(uint32[]) required ownrecv db;\n"
+    "  setEmote(uint16) broadcast ram;\n"
+    "  setAnimState(string) broadcast ram;\n"
+    "  setGMLevel(uint8) ram db;\n"
+    "};\n";
+
+// MapFields keeps an object's fields the way DistributedObject used to, for comparison.
+struct MapFields {
+    UnorderedFieldValues required;
+    FieldValues ram;
+};
+
+// FieldStorePerformanceTest compares the memory used by, and the time taken to answer a
+// GET_ALL for, a million objects, with their fields in maps of vectors and in FieldStores.
+// The FieldStores are timed on their first GET_ALL, which encodes the fields; their memory is
+// measured again after the second, which leaves each of them with a snapshot.
+class FieldStorePerformanceTest
+{
+  public:
+    FieldStorePerformanceTest() : m_file(new dclass::File)
+    {
+        fsperf_log.info() << "Starting FieldStore perf test..." << std::endl;
+
+        const char *keywords[] = {"required", "ram", "db", "broadcast", "clrecv", "ownrecv"};
+        for(const char *keyword : keywords) {
+            m_file->add_keyword(keyword);
+        }
+        std::istringstream dc(fs_perf_dc);
+        if(!dclass::append(m_file, dc, "FieldStorePerformanceTest.dc")) {
+            fsperf_log.fatal() << "Couldn't parse the test DC file." << std::endl;
+            exit(1);
+        }
+        m_class = m_file->get_class_by_name("DistributedAvatar");
+        m_layout.reset(new FieldLayout(m_class));
+
+        size_t map_bytes;
+        uint64_t map_hash;
+        double map_elapsed;
+        {
+            std::vector<std::unique_ptr<MapFields> > objects(FS_PERF_NUM_OBJECTS);
+            size_t before = heap_used();
+            for(size_t i = 0; i < FS_PERF_NUM_OBJECTS; ++i) {
+                objects[i].reset(new MapFields);
+                fill(i, *objects[i]);
+            }
+            map_bytes = heap_used() - before;
+
+            perf_clock::time_point start = perf_clock::now();
+            for(size_t i = 0; i < FS_PERF_NUM_OBJECTS; ++i) {
+                get_all(i, *objects[i]);
+            }
+            map_elapsed = std::chrono::duration<double>(perf_clock::now() - start).count();
+
+            map_hash = 0;
+            for(size_t i = 0; i < FS_PERF_NUM_OBJECTS; ++i) {
+                map_hash = hash(map_hash, get_all(i, *objects[i]));
+            }
+        }
+
+        size_t store_bytes, snapshot_bytes;
+        uint64_t store_hash;
+        double store_elapsed;
+        {
+            std::vector<std::unique_ptr<FieldStore> > objects(FS_PERF_NUM_OBJECTS);
+            size_t before = heap_used();
+            for(size_t i = 0; i < FS_PERF_NUM_OBJECTS; ++i) {
+                objects[i].reset(new FieldStore(m_layout.get()));
+                fill(i, *objects[i]);
+            }
+            store_bytes = heap_used() - before;
+
+            perf_clock::time_point start = perf_clock::now();
+            for(size_t i = 0; i < FS_PERF_NUM_OBJECTS; ++i) {
+                get_all(i, *objects[i]);
+            }
+            store_elapsed = std::chrono::duration<double>(perf_clock::now() - start).count();
+
+            // Sent a second time, each object keeps a snapshot of its fields.
+            store_hash = 0;
+            for(size_t i = 0; i < FS_PERF_NUM_OBJECTS; ++i) {
+                store_hash = hash(store_hash, get_all(i, *objects[i]));
+            }
+            snapshot_bytes = heap_used() - before;
+        }
+
+        if(map_hash != store_hash) {
+            fsperf_log.fatal() << "The two kinds of object sent different GET_ALLs." << std::endl;
+            exit(1);
+        }
+
+#ifdef FS_PERF_HAVE_MALLINFO
+        fsperf_log.info() << "Maps: " << map_bytes / FS_PERF_NUM_OBJECTS << " bytes/object, "
+                          << "FieldStore: " << store_bytes / FS_PERF_NUM_OBJECTS
+                          << " bytes/object, " << snapshot_bytes / FS_PERF_NUM_OBJECTS
+                          << " once sent twice (with snapshots)" << std::endl;
+#endif
+        fsperf_log.info() << "Maps: " << map_elapsed * 1e9 / FS_PERF_NUM_OBJECTS
+                          << "ns per GET_ALL" << std::endl;
+        fsperf_log.info() << "FieldStore: " << store_elapsed * 1e9 / FS_PERF_NUM_OBJECTS
+                          << "ns per GET_ALL (" << map_elapsed / store_elapsed << "x)" << std::endl;
+    }
+
+  private:
+    dclass::File *m_file;
+    const dclass::Class *m_class;
+    std::unique_ptr<FieldLayout> m_layout;
+
+    // hash adds the contents of a datagram to a running FNV-1a hash.
+    static uint64_t hash(uint64_t h, DatagramHandle dg)
+    {
+        for(dgsize_t i = 0; i < dg->size(); ++i) {
+            h = (h ^ dg->get_data()[i]) * 1099511628211ULL;
+        }
+        return h;
+    }
+
+    static size_t heap_used()
+    {
+#ifdef FS_PERF_HAVE_MALLINFO
+        return mallinfo2().uordblks;
+#else
+        return 0;
+#endif
+    }
+
+    // values returns the fields the n'th object is generated with, as a datagram holding each
+    //     required field, then each of the ram fields it has.
+    DatagramPtr values(size_t n)
+    {
+        DatagramPtr dg = Datagram::create();
+        dg->add_string("Avatar #" + std::to_string(n));
+        dg->add_blob(std::vector<uint8_t>(12 + n % 8, uint8_t(n)));
+        for(int i = 0; i < 6; ++i) {
+            dg->add_int16(int16_t(n + i));
+        }
+        dg->add_int16(int16_t(n % 100));
+        dg->add_int16(100);
+        dg->add_uint32(uint32_t(n * 7));
+        dg->add_uint32(uint32_t(n % 10000));
+        dg->add_size(2 * sizeof(uint16_t) * (n % 4));
+        for(size_t i = 0; i < 2 * (n % 4); ++i) {
+            dg->add_uint16(uint16_t(i));
+        }
+        dg->add_size(sizeof(uint32_t) * (n % 6));
+        for(size_t i = 0; i < n % 6; ++i) {
+            dg->add_uint32(uint32_t(n + i));
+        }
+        dg->add_uint16(uint16_t(n % 30));
+        if(n % 2 == 0) {
+            dg->add_string("neutral");
+        }
+        return dg;
+    }
+
+    // ram_fields returns how many of the class's ram fields the n'th object has set.
+    static size_t ram_fields(size_t n)
+    {
+        return n % 2 == 0 ? 2 : 1;
+    }
+
+    void fill(size_t n, MapFields &fields)
+    {
+        DatagramPtr dg = values(n);
+        DatagramIterator dgi(dg);
+        for(unsigned int i = 0; i < m_class->get_num_fields(); ++i) {
+            const dclass::Field *field = m_class->get_field(i);
+            if(field->has_keyword("required")) {
+                dgi.unpack_field(field, fields.required[field]);
+            }
+        }
+        const char *ram_names[] = {"setEmote", "setAnimState"};
+        for(size_t i = 0; i < ram_fields(n); ++i) {
+            const dclass::Field *field = m_class->get_field_by_name(ram_names[i]);
+            dgi.unpack_field(field, fields.ram[field]);
+        }
+    }
+
+    void fill(size_t n, FieldStore &fields)
+    {
+        DatagramPtr dg = values(n);
+        DatagramIterator dgi(dg);
+        std::vector<uint8_t> data;
+        for(unsigned int slot = 0; slot < m_layout->get_num_required(); ++slot) {
+            data.clear();
+            dgi.unpack_field(m_layout->get_field(slot), data);
+            fields.set(slot, data);
+        }
+        const char *ram_names[] = {"setEmote", "setAnimState"};
+        for(size_t i = 0; i < ram_fields(n); ++i) {
+            const dclass::Field *field = m_class->get_field_by_name(ram_names[i]);
+            data.clear();
+            dgi.unpack_field(field, data);
+            fields.set(m_layout->get_ram_slot(field), data);
+        }
+        fields.shrink_to_fit();
+    }
+
+    DatagramPtr get_all(size_t n, MapFields &fields)
+    {
+        DatagramPtr dg = Datagram::create(1, n, STATESERVER_OBJECT_GET_ALL_RESP);
+        dg->add_uint32(0);
+        size_t length = sizeof(doid_t) + sizeof(doid_t) + sizeof(zone_t) + sizeof(uint16_t);
+        for(unsigned int i = 0; i < m_class->get_num_fields(); ++i) {
+            const dclass::Field *field = m_class->get_field(i);
+            if(field->has_keyword("required") && !field->as_molecular()) {
+                length += fields.required[field].size();
+            }
+        }
+        dg->reserve(dg->size() + length);
+
+        dg->add_doid(n);
+        dg->add_location(0, 0);
+        dg->add_uint16(m_class->get_id());
+        for(unsigned int i = 0; i < m_class->get_num_fields(); ++i) {
+            const dclass::Field *field = m_class->get_field(i);
+            if(field->has_keyword("required") && !field->as_molecular()) {
+                dg->add_data(fields.required[field]);
+            }
+        }
+
+        length = sizeof(uint16_t);
+        for(auto it = fields.ram.begin(); it != fields.ram.end(); ++it) {
+            length += sizeof(uint16_t) + it->second.size();
+        }
+        dg->reserve(dg->size() + length);
+        dg->add_uint16(fields.ram.size());
+        for(auto it = fields.ram.begin(); it != fields.ram.end(); ++it) {
+            dg->add_uint16(it->first->get_id());
+            dg->add_data(it->second);
+        }
+        return dg;
+    }
+
+    // get_all answers a GET_ALL the way DistributedObject does.
+    DatagramPtr get_all(size_t n, FieldStore &fields)
+    {
+        DatagramPtr dg = Datagram::create(1, n, STATESERVER_OBJECT_GET_ALL_RESP);
+        dg->add_uint32(0);
+        dg->reserve(dg->size() + sizeof(doid_t) + sizeof(doid_t) + sizeof(zone_t) +
+                    sizeof(uint16_t) + fields.get_sent_size(false, false));
+
+        dg->add_doid(n);
+        dg->add_location(0, 0);
+        dg->add_uint16(m_class->get_id());
+        fields.add_required(dg, false, false);
+        fields.add_other(dg, false, false);
+        return dg;
+    }
+};
+
+FieldStorePerformanceTest perftest_fieldstore;
@@ -0,0 +1,134 @@
+#include "core/global.h"
+#include "messagedirector/MessageDirector.h"
+#include <cstdlib>
+#include <new>
+
+LogCategory mdalloc_log("TestMDAlloc", "Unit Test - MessageDirector Allocations");
+
+#define MD_ALLOC_NUM_DATAGRAMS 1000
+
+// Count the heap allocations made by the current thread while t_count_allocations is set.
+static thread_local bool t_count_allocations = false;
+static thread_local size_t t_allocations = 0;
+
+void *operator new(size_t size)
+{
+    if(t_count_allocations) {
+        ++t_allocations;
+    }
+
+    void *ptr = malloc(size ? size : 1);
+    if(ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+class MDAllocationParticipant : public MDParticipantInterface
+{
+  public:
+    MDAllocationParticipant() : MDParticipantInterface(), num_messages(0)
+    {
+    }
+
+    virtual void handle_datagram(DatagramHandle, DatagramIterator &)
+    {
+        num_messages++;
+    }
+
+    void subscribe(channel_t c)
+    {
+        subscribe_channel(c);
+    }
+
+    void subscribe(channel_t lo, channel_t hi)
+    {
+        subscribe_range(lo, hi);
+    }
+
+    void send(DatagramHandle dg)
+    {
+        route_datagram(dg);
+    }
+
+    unsigned int num_messages;
+};
+
+// MDAllocationTest checks that routing a datagram to participants on the same
+// MessageDirector, with trace logging off, doesn't touch the heap.
+class MDAllocationTest
+{
+  public:
+    MDAllocationTest()
+    {
+        mdalloc_log.info() << "Starting allocation test..." << std::endl;
+
+        // Route synchronously, on this thread, like the main thread does when not threaded.
+        std::thread::id main_thread_id = g_main_thread_id;
+        g_main_thread_id = std::this_thread::get_id();
+        LogSeverity severity = g_logger->get_min_severity();
+        g_logger->set_min_severity(LSEVERITY_INFO);
+
+        MDAllocationParticipant *sender = new MDAllocationParticipant;
+        MDAllocationParticipant *receiver = new MDAllocationParticipant;
+        MDAllocationParticipant *range_receiver = new MDAllocationParticipant;
+        receiver->subscribe(4000);
+        receiver->subscribe(4001);
+        range_receiver->subscribe(3000, 5000);
+
+        DatagramPtr single = Datagram::create(4000, 1, 1234);
+        single->add_string("Hello, world!");
+        std::unordered_set<channel_t> receivers {4000, 4001, 4999};
+        DatagramPtr multi = Datagram::create(receivers, 1, 1234);
+        multi->add_string("Hello, world!");
+
+        // Let everything that's allocated lazily get allocated first.
+        sender->send(single);
+        sender->send(multi);
+        MessageDirector::singleton.route_datagram(nullptr, multi);
+
+        unsigned int expected = receiver->num_messages + MD_ALLOC_NUM_DATAGRAMS * 3;
+        t_allocations = 0;
+        t_count_allocations = true;
+        for(unsigned int i = 0; i < MD_ALLOC_NUM_DATAGRAMS; ++i) {
+            sender->send(single);
+            sender->send(multi);
+            MessageDirector::singleton.route_datagram(nullptr, multi);
+        }
+        t_count_allocations = false;
+
+        if(receiver->num_messages != expected) {
+            mdalloc_log.fatal() << "Routed " << MD_ALLOC_NUM_DATAGRAMS * 3 << " datagrams, but "
+                                << receiver->num_messages - (expected - MD_ALLOC_NUM_DATAGRAMS * 3)
+                                << " were received." << std::endl;
+            exit(1);
+        }
+        if(t_allocations != 0) {
+            mdalloc_log.fatal() << "Routing " << MD_ALLOC_NUM_DATAGRAMS * 3 << " datagrams made "
+                                << t_allocations << " heap allocations." << std::endl;
+            exit(1);
+        }
+
+        sender->terminate();
+        receiver->terminate();
+        range_receiver->terminate();
+
+        g_logger->set_min_severity(severity);
+        g_main_thread_id = main_thread_id;
+
+        mdalloc_log.info() << "Routed " << MD_ALLOC_NUM_DATAGRAMS * 3
+                           << " datagrams without allocating." << std::endl;
+    }
+};
+
+MDAllocationTest unittest_mdalloc;
@@ -6,28 +6,36 @@ class MDParticipantTest : public MDParticipantInterface
   public:
     MDParticipantTest() : MDParticipantInterface()
     {
+        // Route synchronously, on this thread, like the main thread does when not threaded.
+        std::thread::id main_thread_id = g_main_thread_id;
+        g_main_thread_id = std::this_thread::get_id();
+
         subscribe_channel(100);
         subscribe_channel(200);
 
-        Datagram dg2;
-        dg2.add_uint8(2);
-        dg2.add_channel(100);
-        dg2.add_channel(200);
-        dg2.add_string("test");
+        DatagramPtr dg2 = Datagram::create();
+        dg2->add_uint8(2);
+        dg2->add_channel(100);
+        dg2->add_channel(200);
+        dg2->add_string("test");
 
-        MessageDirector::singleton.handle_datagram(nullptr, dg2);
+        MessageDirector::singleton.route_datagram(nullptr, dg2);
 
         unsubscribe_channel(100);
         unsubscribe_channel(200);
 
         /*MessageDirector::singleton.subscribe_range(this, 1000, 2000);
         MessageDirector::singleton.unsubscribe_range(this, 1500, 1700);*/
+
+        g_main_thread_id = main_thread_id;
+        terminate();
     }
 
-    virtual void handle_datagram(Datagram &dg, DatagramIterator &dgi)
+    virtual void handle_datagram(DatagramHandle, DatagramIterator &dgi)
     {
         g_logger->log(LogSeverity::LSEVERITY_DEBUG) << dgi.read_string() << std::endl;
     }
 };
 
-MDParticipantTest unittest_mdparticipant;
+// N.B. the MessageDirector deletes participants once they terminate, so this must be on the heap.
+MDParticipantTest *unittest_mdparticipant = new MDParticipantTest;
@@ -25,20 +25,19 @@ class MDPerformanceParticipant : public MDParticipantInterface
         }
     }
 
-    virtual void handle_datagram(Datagram &dg, DatagramIterator &dgi)
+    virtual void handle_datagram(DatagramHandle, DatagramIterator &)
     {
     }
 
     void spam()
     {
-        Datagram dg(data, MD_PERF_DATASIZE);
-        send(dg);
+        route_datagram(Datagram::create(data, MD_PERF_DATASIZE));
         num_messages++;
     }
 
-    void spam(Datagram &dg)
+    void spam(DatagramHandle dg)
     {
-        send(dg);
+        route_datagram(dg);
         num_messages++;
     }
 
@@ -51,12 +50,19 @@ class MDPerformanceTest
     MDPerformanceTest()
     {
         mdperf_log.info() << "Starting perf test..." << std::endl;
+
+        // Route synchronously, on this thread, like the main thread does when not threaded.
+        std::thread::id main_thread_id = g_main_thread_id;
+        g_main_thread_id = std::this_thread::get_id();
+
         setup();
         speed_test();
         cleanup();
         setup();
         speed_test_no_memcpy();
         cleanup();
+
+        g_main_thread_id = main_thread_id;
     }
   private:
     MDPerformanceParticipant **m_participants;
@@ -80,7 +86,7 @@ class MDPerformanceTest
     {
         mdperf_log.info() << "Cleaning up..." << std::endl;
         for(uint32_t i = 0; i < MD_PERF_NUM_PARTICIPANTS; ++i) {
-            delete m_participants[i];
+            m_participants[i]->terminate();
         }
         delete [] m_participants;
         delete [] data;
@@ -107,7 +113,7 @@ class MDPerformanceTest
 
     void speed_test_no_memcpy()
     {
-        Datagram dg(data, MD_PERF_DATASIZE);
+        DatagramHandle dg = Datagram::create(data, MD_PERF_DATASIZE);
         mdperf_log.info() << "Starting speed test II (avoids memcopy)..." << std::endl;
         clock_t startTime = clock();
         while((clock() - startTime) / CLOCKS_PER_SEC < MD_PERF_TIME) {
@@ -0,0 +1,141 @@
+#include "core/global.h"
+#include "util/Datagram.h"
+#include "util/MPSCQueue.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+LogCategory mdqueueperf_log("PerfTestMDQueue", "Performance Test - MessageDirector Queue");
+
+#define MDQ_PERF_NUM_PRODUCERS 4
+#define MDQ_PERF_NUM_MESSAGES 250000 // per producer
+#define MDQ_PERF_CAPACITY (1 << 16)
+
+typedef std::chrono::steady_clock perf_clock;
+
+struct QueuedPerfMessage {
+    perf_clock::time_point enqueued;
+    DatagramHandle dg;
+};
+
+// The routing queue as it was before MPSCQueue: a std::queue guarded by a mutex,
+// with a condition variable rung on every push.
+class LockedPerfQueue
+{
+  public:
+    void push(QueuedPerfMessage &&msg)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_queue.push(std::move(msg));
+        m_cv.notify_one();
+    }
+
+    void pop(QueuedPerfMessage &msg)
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        while(m_queue.empty()) {
+            m_cv.wait(lock);
+        }
+        msg = std::move(m_queue.front());
+        m_queue.pop();
+    }
+
+  private:
+    std::mutex m_lock;
+    std::queue<QueuedPerfMessage> m_queue;
+    std::condition_variable m_cv;
+};
+
+class MPSCPerfQueue
+{
+  public:
+    MPSCPerfQueue() : m_queue(MDQ_PERF_CAPACITY)
+    {
+    }
+
+    void push(QueuedPerfMessage &&msg)
+    {
+        m_queue.push(std::move(msg));
+    }
+
+    void pop(QueuedPerfMessage &msg)
+    {
+        while(!m_queue.try_pop(msg)) {
+            m_queue.wait();
+        }
+    }
+
+  private:
+    MPSCQueue<QueuedPerfMessage> m_queue;
+};
+
+class MDQueuePerformanceTest
+{
+  public:
+    MDQueuePerformanceTest()
+    {
+        mdqueueperf_log.info() << "Starting queue perf test..." << std::endl;
+
+        DatagramPtr dg = Datagram::create(1234, 5678, 9);
+        dg->add_string("Hello, world!");
+        m_dg = dg;
+
+        run<LockedPerfQueue>("mutex + condition_variable");
+        run<MPSCPerfQueue>("MPSCQueue");
+    }
+
+  private:
+    DatagramHandle m_dg;
+
+    template<typename Q>
+    void run(const std::string &name)
+    {
+        Q queue;
+        const size_t total = MDQ_PERF_NUM_PRODUCERS * MDQ_PERF_NUM_MESSAGES;
+        std::vector<double> latencies;
+        latencies.reserve(total);
+
+        perf_clock::time_point start = perf_clock::now();
+
+        std::thread consumer([&]() {
+            QueuedPerfMessage msg;
+            for(size_t i = 0; i < total; ++i) {
+                queue.pop(msg);
+                std::chrono::duration<double, std::micro> latency = perf_clock::now() - msg.enqueued;
+                latencies.push_back(latency.count());
+            }
+        });
+
+        std::vector<std::thread> producers;
+        for(unsigned int i = 0; i < MDQ_PERF_NUM_PRODUCERS; ++i) {
+            producers.emplace_back([&]() {
+                for(unsigned int j = 0; j < MDQ_PERF_NUM_MESSAGES; ++j) {
+                    queue.push(QueuedPerfMessage {perf_clock::now(), m_dg});
+                }
+            });
+        }
+
+        for(auto it = producers.begin(); it != producers.end(); ++it) {
+            it->join();
+        }
+        consumer.join();
+
+        std::chrono::duration<double> elapsed = perf_clock::now() - start;
+
+        std::sort(latencies.begin(), latencies.end());
+        double p50 = latencies[latencies.size() / 2];
+        double p99 = latencies[latencies.size() * 99 / 100];
+
+        mdqueueperf_log.info() << name << ": " << total << " messages from "
+                               << MDQ_PERF_NUM_PRODUCERS << " producers in "
+                               << elapsed.count() << "s (" << total / elapsed.count()
+                               << " messages/second); enqueue-to-process latency p50 "
+                               << p50 << "us, p99 " << p99 << "us" << std::endl;
+    }
+};
+
+MDQueuePerformanceTest perftest_mdqueue;
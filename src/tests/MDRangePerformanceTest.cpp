@@ -0,0 +1,141 @@
+#include "core/global.h"
+#include "messagedirector/ChannelMap.h"
+#include <boost/icl/interval_map.hpp>
+#include <chrono>
+#include <random>
+
+LogCategory mdrangeperf_log("PerfTestMDRange", "Performance Test - ChannelMap Ranges");
+
+#define MDR_PERF_NUM_RANGES 10000
+#define MDR_PERF_NUM_SUBSCRIBERS 32
+#define MDR_PERF_CHANNEL_SPACE 1000000
+#define MDR_PERF_MAX_RANGE_WIDTH 20000
+#define MDR_PERF_NUM_LOOKUPS 1000000
+
+typedef std::chrono::steady_clock perf_clock;
+
+// The range subscriptions as they were before the flat range index:
+// a boost::icl::interval_map with a set of subscribers per segment.
+class IntervalMapRanges
+{
+  public:
+    void subscribe_range(ChannelSubscriber *p, channel_t lo, channel_t hi)
+    {
+        std::unordered_set<ChannelSubscriber *> participant_set;
+        participant_set.insert(p);
+        m_ranges += std::make_pair(boost::icl::discrete_interval<channel_t>::closed(lo, hi),
+                                   participant_set);
+    }
+
+    void unsubscribe_range(ChannelSubscriber *p, channel_t lo, channel_t hi)
+    {
+        std::unordered_set<ChannelSubscriber *> participant_set;
+        participant_set.insert(p);
+        m_ranges -= std::make_pair(boost::icl::discrete_interval<channel_t>::closed(lo, hi),
+                                   participant_set);
+    }
+
+    size_t lookup_channel(channel_t c)
+    {
+        m_found.clear();
+        auto range = boost::icl::find(m_ranges, c);
+        if(range != m_ranges.end()) {
+            m_found.insert(range->second.begin(), range->second.end());
+        }
+        return m_found.size();
+    }
+
+  private:
+    boost::icl::interval_map<channel_t, std::unordered_set<ChannelSubscriber *> > m_ranges;
+    std::unordered_set<ChannelSubscriber *> m_found;
+};
+
+class FlatRanges : public ChannelMap
+{
+  public:
+    size_t lookup_channel(channel_t c)
+    {
+        lookup_channels(&c, 1, m_found);
+        return m_found.size();
+    }
+
+  private:
+    std::vector<ChannelSubscriber *> m_found;
+};
+
+class MDRangePerformanceTest
+{
+  public:
+    MDRangePerformanceTest()
+    {
+        mdrangeperf_log.info() << "Starting range perf test..." << std::endl;
+
+        std::mt19937_64 gen(1234);
+        std::uniform_int_distribution<channel_t> lo_dist(0, MDR_PERF_CHANNEL_SPACE);
+        std::uniform_int_distribution<channel_t> width_dist(0, MDR_PERF_MAX_RANGE_WIDTH);
+        std::uniform_int_distribution<size_t> subscriber_dist(0, MDR_PERF_NUM_SUBSCRIBERS - 1);
+        for(unsigned int i = 0; i < MDR_PERF_NUM_RANGES; ++i) {
+            channel_t lo = lo_dist(gen);
+            m_ranges.push_back(PerfRange {subscriber_dist(gen), lo, lo + width_dist(gen)});
+        }
+
+        std::uniform_int_distribution<channel_t> channel_dist(0, MDR_PERF_CHANNEL_SPACE);
+        for(unsigned int i = 0; i < MDR_PERF_NUM_LOOKUPS; ++i) {
+            m_lookups.push_back(channel_dist(gen));
+        }
+
+        {
+            IntervalMapRanges ranges;
+            run(ranges, "boost::icl::interval_map");
+        }
+        {
+            FlatRanges ranges;
+            run(ranges, "ChannelMap");
+        }
+    }
+
+  private:
+    struct PerfRange {
+        size_t subscriber;
+        channel_t lo;
+        channel_t hi;
+    };
+
+    ChannelSubscriber m_subscribers[MDR_PERF_NUM_SUBSCRIBERS];
+    std::vector<PerfRange> m_ranges;
+    std::vector<channel_t> m_lookups;
+
+    template<typename M>
+    void run(M &ranges, const std::string &name)
+    {
+        perf_clock::time_point start = perf_clock::now();
+        for(auto it = m_ranges.begin(); it != m_ranges.end(); ++it) {
+            ranges.subscribe_range(&m_subscribers[it->subscriber], it->lo, it->hi);
+        }
+        std::chrono::duration<double> subscribe_time = perf_clock::now() - start;
+
+        size_t found = 0;
+        start = perf_clock::now();
+        for(auto it = m_lookups.begin(); it != m_lookups.end(); ++it) {
+            found += ranges.lookup_channel(*it);
+        }
+        std::chrono::duration<double> lookup_time = perf_clock::now() - start;
+
+        start = perf_clock::now();
+        for(auto it = m_ranges.begin(); it != m_ranges.end(); ++it) {
+            ranges.unsubscribe_range(&m_subscribers[it->subscriber], it->lo, it->hi);
+        }
+        std::chrono::duration<double> unsubscribe_time = perf_clock::now() - start;
+
+        mdrangeperf_log.info() << name << ": " << MDR_PERF_NUM_RANGES << " overlapping ranges from "
+                               << MDR_PERF_NUM_SUBSCRIBERS << " subscribers subscribed in "
+                               << subscribe_time.count() << "s, unsubscribed in "
+                               << unsubscribe_time.count() << "s; " << MDR_PERF_NUM_LOOKUPS
+                               << " point lookups (" << found << " subscribers found) in "
+                               << lookup_time.count() << "s ("
+                               << MDR_PERF_NUM_LOOKUPS / lookup_time.count()
+                               << " lookups/second)" << std::endl;
+    }
+};
+
+MDRangePerformanceTest perftest_mdrange;
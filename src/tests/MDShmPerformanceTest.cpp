@@ -0,0 +1,217 @@
+#include "core/global.h"
+#include "net/NetworkClient.h"
+#include "net/ShmTransport.h"
+#include <chrono>
+#include <cstdlib>
+#include <unistd.h>
+
+LogCategory mdshmperf_log("PerfTestMDShm", "Performance Test - MD Links over TCP and Shared Memory");
+
+#define MDS_PERF_NUM_SMALL 200000
+#define MDS_PERF_NUM_LARGE 100000
+#define MDS_PERF_BATCH 256
+#define MDS_PERF_WINDOW 4096 // The most datagrams in flight at a time.
+#define MDS_PERF_TIMEOUT 60.0
+
+typedef std::chrono::steady_clock perf_clock;
+
+class MDShmPerformanceHandler : public NetworkHandler
+{
+  public:
+    size_t received = 0;
+    bool disconnected = false;
+
+  protected:
+    virtual void initialize()
+    {
+    }
+
+    virtual void receive_datagram(DatagramHandle)
+    {
+        ++received;
+    }
+
+    virtual void receive_disconnect(const uvw::ErrorEvent &)
+    {
+        disconnected = true;
+    }
+};
+
+// MDShmPerformanceTest measures how fast datagrams of the sizes an MD link typically carries
+// get across a link between two MDs on the same host: over TCP loopback, and over shared memory.
+// Both ends run on a loop of our own, as the main thread would run them.
+class MDShmPerformanceTest
+{
+  public:
+    MDShmPerformanceTest()
+    {
+        mdshmperf_log.info() << "Starting MD link perf test..." << std::endl;
+
+        std::shared_ptr<uvw::Loop> loop = g_loop;
+        std::thread::id main_thread_id = g_main_thread_id;
+        g_loop = uvw::Loop::create();
+        g_main_thread_id = std::this_thread::get_id();
+
+        // Make sure the loop wakes up now and then, even if a link has stalled.
+        m_timer = g_loop->resource<uvw::TimerHandle>();
+        m_timer->start(uvw::TimerHandle::Time{10}, uvw::TimerHandle::Time{10});
+
+        run_tcp(64, MDS_PERF_NUM_SMALL);
+        run_shm(64, MDS_PERF_NUM_SMALL);
+        run_tcp(1024, MDS_PERF_NUM_LARGE);
+        run_shm(1024, MDS_PERF_NUM_LARGE);
+
+        m_timer->close();
+        m_timer = nullptr;
+        g_loop->run();
+        g_loop->close();
+
+        g_loop = loop;
+        g_main_thread_id = main_thread_id;
+    }
+
+  private:
+    std::shared_ptr<uvw::TimerHandle> m_timer;
+
+    template<typename P>
+    void run_until(P done, const std::string &what)
+    {
+        perf_clock::time_point deadline = perf_clock::now() +
+            std::chrono::duration_cast<perf_clock::duration>(
+                std::chrono::duration<double>(MDS_PERF_TIMEOUT));
+        while(!done()) {
+            if(perf_clock::now() > deadline) {
+                mdshmperf_log.fatal() << "Timed out waiting for " << what << "." << std::endl;
+                exit(1);
+            }
+            g_loop->run<uvw::Loop::Mode::ONCE>();
+        }
+    }
+
+    template<typename C>
+    double transfer(const std::shared_ptr<C> &sender, MDShmPerformanceHandler &receiving,
+                    size_t size, size_t count)
+    {
+        std::vector<uint8_t> payload(size, 0x42);
+        DatagramPtr dg = Datagram::create(payload);
+
+        size_t base = receiving.received;
+        perf_clock::time_point start = perf_clock::now();
+        for(size_t sent = 0; sent < count;) {
+            for(size_t i = 0; i < MDS_PERF_BATCH && sent < count; ++i, ++sent) {
+                sender->send_datagram(dg);
+            }
+            run_until([&]() {
+                return base + sent <= receiving.received + MDS_PERF_WINDOW;
+            }, "datagrams to be received");
+        }
+        run_until([&]() {
+            return receiving.received >= base + count;
+        }, "the last datagrams to be received");
+        std::chrono::duration<double> elapsed = perf_clock::now() - start;
+
+        if(receiving.received != base + count) {
+            mdshmperf_log.fatal() << "Sent " << count << " datagrams, but "
+                                  << receiving.received - base << " were received." << std::endl;
+            exit(1);
+        }
+        return elapsed.count();
+    }
+
+    void report(const std::string &name, size_t size, size_t count, double seconds)
+    {
+        mdshmperf_log.info() << name << ": " << count << " datagrams of " << size << " bytes in "
+                             << seconds << "s (" << count / seconds << " datagrams/second, "
+                             << count * size / seconds / 1000000.0 << " MB/second)" << std::endl;
+    }
+
+    void run_tcp(size_t size, size_t count)
+    {
+        MDShmPerformanceHandler sending, receiving;
+        std::shared_ptr<NetworkClient> receiver;
+
+        auto listener = g_loop->resource<uvw::TcpHandle>();
+        listener->on<uvw::ListenEvent>([&](const uvw::ListenEvent &, uvw::TcpHandle &srv) {
+            auto socket = g_loop->resource<uvw::TcpHandle>();
+            srv.accept(*socket);
+            receiver = std::make_shared<NetworkClient>(&receiving);
+            receiver->initialize(socket);
+        });
+        listener->bind("127.0.0.1", 0);
+        listener->listen();
+        uvw::Addr addr = listener->sock();
+
+        bool connected = false;
+        auto socket = g_loop->resource<uvw::TcpHandle>();
+        socket->once<uvw::ConnectEvent>([&](const uvw::ConnectEvent &, uvw::TcpHandle &) {
+            connected = true;
+        });
+        socket->connect(addr.ip, addr.port);
+        run_until([&]() {
+            return connected && receiver != nullptr;
+        }, "the TCP connection");
+
+        auto sender = std::make_shared<NetworkClient>(&sending);
+        sender->initialize(socket);
+        report("TCP loopback", size, count, transfer(sender, receiving, size, count));
+
+        sender->disconnect();
+        receiver->disconnect();
+        listener->close();
+        run_until([&]() {
+            return sending.disconnected && receiving.disconnected;
+        }, "the TCP connection to close");
+    }
+
+    void run_shm(size_t size, size_t count)
+    {
+        MDShmPerformanceHandler sending, receiving;
+        std::shared_ptr<ShmClient> receiver;
+
+        char dir[] = "/tmp/astron-shm-XXXXXX";
+        if(mkdtemp(dir) == nullptr) {
+            mdshmperf_log.fatal() << "Couldn't create a directory for the Unix socket." << std::endl;
+            exit(1);
+        }
+        std::string path = std::string(dir) + "/md.sock";
+
+        ShmAcceptorCallback callback = [&](ShmLink &link) {
+            receiver = std::make_shared<ShmClient>(&receiving);
+            receiver->initialize(link);
+        };
+        AcceptorErrorCallback err_callback = [&](const uvw::ErrorEvent &evt) {
+            mdshmperf_log.fatal() << "Couldn't bind " << path << ": " << evt.what() << std::endl;
+            exit(1);
+        };
+        ShmAcceptor acceptor(callback, err_callback);
+        acceptor.bind(path);
+
+        ShmLink link;
+        int err = shm_connect(path, SHM_DEFAULT_CAPACITY, link);
+        if(err == UV_ENOSYS) {
+            mdshmperf_log.info() << "Shared memory: not available on this platform." << std::endl;
+            acceptor.stop();
+            rmdir(dir);
+            return;
+        } else if(err != 0) {
+            mdshmperf_log.fatal() << "Couldn't connect to " << path << ": "
+                                  << uvw::ErrorEvent{err}.what() << std::endl;
+            exit(1);
+        }
+
+        auto sender = std::make_shared<ShmClient>(&sending);
+        sender->initialize(link);
+        run_until([&]() {
+            return receiver != nullptr;
+        }, "the shared-memory link");
+
+        report("Shared memory", size, count, transfer(sender, receiving, size, count));
+
+        sender->disconnect();
+        receiver->disconnect();
+        acceptor.stop();
+        rmdir(dir);
+    }
+};
+
+MDShmPerformanceTest perftest_mdshm;
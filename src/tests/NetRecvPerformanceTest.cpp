@@ -0,0 +1,111 @@
+#include "core/global.h"
+#include "net/NetworkClient.h"
+#include "util/Datagram.h"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+LogCategory netrecvperf_log("PerfTestNetRecv", "Performance Test - NetworkClient Receive");
+
+#define NETRECV_PERF_READ_SIZE (1 << 20)
+#define NETRECV_PERF_DATAGRAM_SIZE 40
+#define NETRECV_PERF_NUM_READS 64
+// The old code is quadratic in the datagrams per read, so it gets far fewer reads.
+#define NETRECV_PERF_NUM_LEGACY_READS 2
+
+typedef std::chrono::steady_clock perf_clock;
+
+// The receive path as it was before ReceiveBuffer: every read is appended to a vector,
+// every datagram is copied out of it, and whatever follows is copied into a new vector.
+class LegacyPerfReceiveBuffer
+{
+  public:
+    void feed(std::unique_ptr<char[]> data, size_t length,
+              const ReceiveBuffer::DatagramCallback &dispatch)
+    {
+        m_data_buf.insert(m_data_buf.end(), data.get(), data.get() + length);
+        while(m_data_buf.size() > sizeof(dgsize_t)) {
+            dgsize_t data_size = *reinterpret_cast<dgsize_t*>(m_data_buf.data());
+            if(m_data_buf.size() < data_size + sizeof(dgsize_t)) {
+                return;
+            }
+
+            size_t overread_size = m_data_buf.size() - data_size - sizeof(dgsize_t);
+            DatagramPtr dg = Datagram::create(m_data_buf.data() + sizeof(dgsize_t), data_size);
+            if(0 < overread_size) {
+                m_data_buf = std::vector<uint8_t>(
+                                 m_data_buf.data() + sizeof(dgsize_t) + data_size,
+                                 m_data_buf.data() + sizeof(dgsize_t) + data_size + overread_size);
+            } else {
+                m_data_buf = std::vector<uint8_t>();
+            }
+            dispatch(dg);
+        }
+    }
+
+  private:
+    std::vector<uint8_t> m_data_buf;
+};
+
+class NetRecvPerformanceTest
+{
+  public:
+    NetRecvPerformanceTest()
+    {
+        netrecvperf_log.info() << "Starting NetworkClient receive perf test..." << std::endl;
+
+        // A stream of datagrams, which repeats seamlessly once it runs out. It's cut into reads
+        // regardless of where the datagrams end, so most reads begin and end partway through one.
+        DatagramPtr dg = Datagram::create();
+        for(uint8_t i = 0; i < NETRECV_PERF_DATAGRAM_SIZE; ++i) {
+            dg->add_uint8(i);
+        }
+        dgsize_t len = swap_le(dg->size());
+        while(m_stream.size() < NETRECV_PERF_READ_SIZE) {
+            const uint8_t *tag = reinterpret_cast<const uint8_t*>(&len);
+            m_stream.insert(m_stream.end(), tag, tag + sizeof(dgsize_t));
+            m_stream.insert(m_stream.end(), dg->get_data(), dg->get_data() + dg->size());
+        }
+
+        run<LegacyPerfReceiveBuffer>("copy per datagram", NETRECV_PERF_NUM_LEGACY_READS);
+        run<ReceiveBuffer>("ReceiveBuffer", NETRECV_PERF_NUM_READS);
+    }
+
+  private:
+    std::vector<uint8_t> m_stream;
+
+    template<typename B>
+    void run(const std::string &name, size_t reads)
+    {
+        B buffer;
+        size_t received = 0, bytes = 0;
+        size_t position = 0;
+
+        std::chrono::duration<double> elapsed(0);
+        for(size_t i = 0; i < reads; ++i) {
+            // Copying the read in stands in for the socket, and isn't counted.
+            std::unique_ptr<char[]> read(new char[NETRECV_PERF_READ_SIZE]);
+            size_t first = std::min((size_t)NETRECV_PERF_READ_SIZE, m_stream.size() - position);
+            memcpy(read.get(), m_stream.data() + position, first);
+            memcpy(read.get() + first, m_stream.data(), NETRECV_PERF_READ_SIZE - first);
+            position = (position + NETRECV_PERF_READ_SIZE) % m_stream.size();
+
+            perf_clock::time_point start = perf_clock::now();
+            buffer.feed(std::move(read), NETRECV_PERF_READ_SIZE, [&](DatagramHandle dg) {
+                received++;
+                bytes += dg->size();
+            });
+            elapsed += perf_clock::now() - start;
+        }
+
+        netrecvperf_log.info() << name << ": " << received << " datagrams of "
+                               << NETRECV_PERF_DATAGRAM_SIZE << " bytes from " << reads
+                               << " reads of " << NETRECV_PERF_READ_SIZE << " bytes in "
+                               << elapsed.count() << "s (" << received / elapsed.count()
+                               << " datagrams/second, " << bytes / elapsed.count() / (1 << 20)
+                               << " MiB/second)" << std::endl;
+    }
+};
+
+NetRecvPerformanceTest perftest_netrecv;
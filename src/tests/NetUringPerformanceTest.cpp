@@ -0,0 +1,209 @@
+#include "core/global.h"
+#include "net/NetworkClient.h"
+#include "net/TcpAcceptor.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdlib>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+LogCategory neturingperf_log("PerfTestNetUring", "Performance Test - TCP with libuv and io_uring");
+
+#define NETURING_PERF_PORT 57190
+#define NETURING_PERF_NUM_CONNECTIONS 10000 // Each leaves a port in TIME_WAIT.
+#define NETURING_PERF_CONNECT_BATCH 64 // Stays under the listen backlog.
+#define NETURING_PERF_NUM_MESSAGES 2000000
+#define NETURING_PERF_MESSAGE_SIZE 40
+#define NETURING_PERF_WRITE_SIZE (1 << 16)
+#define NETURING_PERF_TIMEOUT 60.0
+
+typedef std::chrono::steady_clock perf_clock;
+
+class NetUringPerformanceHandler : public NetworkHandler
+{
+  public:
+    size_t received = 0;
+    bool disconnected = false;
+
+  protected:
+    virtual void initialize()
+    {
+    }
+
+    virtual void receive_datagram(DatagramHandle)
+    {
+        ++received;
+    }
+
+    virtual void receive_disconnect(const uvw::ErrorEvent &)
+    {
+        disconnected = true;
+    }
+};
+
+// NetUringPerformanceTest measures how many connections per second a TcpAcceptor accepts, and how
+// many small datagrams per second a NetworkClient receives on one connection, with libuv and (if
+// it's available) with io_uring. The peers use plain blocking sockets, so that the only work on
+// the loop is what's being measured.
+class NetUringPerformanceTest
+{
+  public:
+    NetUringPerformanceTest()
+    {
+        neturingperf_log.info() << "Starting TCP libuv/io_uring perf test..." << std::endl;
+
+        std::shared_ptr<uvw::Loop> loop = g_loop;
+        std::thread::id main_thread_id = g_main_thread_id;
+        g_loop = uvw::Loop::create();
+        g_main_thread_id = std::this_thread::get_id();
+
+        // Make sure the loop wakes up now and then, even if nothing's happening.
+        m_timer = g_loop->resource<uvw::TimerHandle>();
+        m_timer->start(uvw::TimerHandle::Time{10}, uvw::TimerHandle::Time{10});
+
+        run("libuv", false, NETURING_PERF_PORT);
+        run("io_uring", true, NETURING_PERF_PORT + 1);
+
+        m_timer->close();
+        m_timer = nullptr;
+        g_loop->run();
+        g_loop->close();
+
+        g_loop = loop;
+        g_main_thread_id = main_thread_id;
+    }
+
+  private:
+    std::shared_ptr<uvw::TimerHandle> m_timer;
+
+    template<typename P>
+    void run_until(P done, const std::string &what)
+    {
+        perf_clock::time_point deadline = perf_clock::now() +
+            std::chrono::duration_cast<perf_clock::duration>(
+                std::chrono::duration<double>(NETURING_PERF_TIMEOUT));
+        while(!done()) {
+            if(perf_clock::now() > deadline) {
+                neturingperf_log.fatal() << "Timed out waiting for " << what << "." << std::endl;
+                exit(1);
+            }
+            g_loop->run<uvw::Loop::Mode::ONCE>();
+        }
+    }
+
+    static int connect_to(unsigned int port)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            neturingperf_log.fatal() << "Couldn't connect to port " << port << "." << std::endl;
+            exit(1);
+        }
+        return fd;
+    }
+
+    void run(const std::string &name, bool io_uring, unsigned int port)
+    {
+        size_t accepted = 0;
+        NetworkSocket last;
+        TcpAcceptorCallback callback = [&](const NetworkSocket &socket, const uvw::Addr &,
+                                           const uvw::Addr &, const bool) {
+            ++accepted;
+            if(last != nullptr) {
+                last.close();
+            }
+            last = socket;
+        };
+        AcceptorErrorCallback err_callback = [&](const uvw::ErrorEvent &evt) {
+            neturingperf_log.fatal() << name << ": couldn't bind port " << port << ": "
+                                     << evt.what() << std::endl;
+            exit(1);
+        };
+        TcpAcceptor acceptor(callback, err_callback);
+        if(!acceptor.set_io_uring(io_uring)) {
+            neturingperf_log.info() << name << ": not available in this build or on this kernel."
+                                    << std::endl;
+            return;
+        }
+        acceptor.bind("127.0.0.1:" + std::to_string(port), port);
+        acceptor.start();
+
+        // Connections per second:
+        perf_clock::time_point start = perf_clock::now();
+        for(size_t connected = 0; connected < NETURING_PERF_NUM_CONNECTIONS;) {
+            std::vector<int> fds;
+            for(size_t i = 0; i < NETURING_PERF_CONNECT_BATCH; ++i, ++connected) {
+                fds.push_back(connect_to(port));
+            }
+            run_until([&]() {
+                return accepted >= connected;
+            }, "connections to be accepted");
+            for(int fd : fds) {
+                close(fd);
+            }
+        }
+        std::chrono::duration<double> elapsed = perf_clock::now() - start;
+        neturingperf_log.info() << name << ": accepted " << accepted << " connections in "
+                                << elapsed.count() << "s (" << accepted / elapsed.count()
+                                << " connections/second)" << std::endl;
+
+        // Messages per second, written by another thread as fast as the connection will take them:
+        NetUringPerformanceHandler handler;
+        auto receiver = std::make_shared<NetworkClient>(&handler);
+        last.close();
+        last = nullptr;
+        int fd = connect_to(port);
+        run_until([&]() {
+            return last != nullptr;
+        }, "the connection to be accepted");
+        receiver->initialize(last);
+
+        std::vector<uint8_t> stream;
+        dgsize_t len = swap_le((dgsize_t)NETURING_PERF_MESSAGE_SIZE);
+        for(size_t i = 0; i < NETURING_PERF_WRITE_SIZE / (sizeof(dgsize_t) + NETURING_PERF_MESSAGE_SIZE); ++i) {
+            const uint8_t *tag = reinterpret_cast<const uint8_t*>(&len);
+            stream.insert(stream.end(), tag, tag + sizeof(dgsize_t));
+            stream.insert(stream.end(), NETURING_PERF_MESSAGE_SIZE, 0x42);
+        }
+        size_t per_write = stream.size() / (sizeof(dgsize_t) + NETURING_PERF_MESSAGE_SIZE);
+        size_t writes = (NETURING_PERF_NUM_MESSAGES + per_write - 1) / per_write;
+
+        start = perf_clock::now();
+        std::thread writer([&]() {
+            for(size_t i = 0; i < writes; ++i) {
+                size_t written = 0;
+                while(written < stream.size()) {
+                    ssize_t n = write(fd, stream.data() + written, stream.size() - written);
+                    if(n <= 0) {
+                        return;
+                    }
+                    written += n;
+                }
+            }
+        });
+        run_until([&]() {
+            return handler.received >= writes * per_write;
+        }, "messages to be received");
+        elapsed = perf_clock::now() - start;
+        writer.join();
+        neturingperf_log.info() << name << ": received " << handler.received << " datagrams of "
+                                << NETURING_PERF_MESSAGE_SIZE << " bytes in " << elapsed.count()
+                                << "s (" << handler.received / elapsed.count()
+                                << " datagrams/second)" << std::endl;
+
+        close(fd);
+        run_until([&]() {
+            return handler.disconnected;
+        }, "the connection to close");
+        acceptor.stop();
+        g_loop->run<uvw::Loop::Mode::NOWAIT>();
+    }
+};
+
+NetUringPerformanceTest perftest_neturing;
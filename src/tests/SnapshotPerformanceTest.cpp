@@ -0,0 +1,242 @@
+#include "core/global.h"
+#include "core/msgtypes.h"
+#include "core/objtypes.h"
+#include "dclass/dc/File.h"
+#include "dclass/file/read.h"
+#include "util/DatagramIterator.h"
+#include "util/FieldStore.h"
+#include <chrono>
+#include <sstream>
+#include <vector>
+
+LogCategory snapperf_log("PerfTestSnapshot", "Performance Test - Object snapshots");
+
+// The number of clients which open interest in the zone, one after another.
+#define SNAP_PERF_NUM_CLIENTS 300
+
+typedef std::chrono::steady_clock perf_clock;
+
+static const char *snap_perf_dc =
+    "dclass DistributedAvatar {\n"
+    "  setName(string) required broadcast db;\n"
+    "  setDNAString(blob) required broadcast db;\n"
+    "  setPosHpr(int16, int16, int16, int16, int16, int16) required broadcast ram;\n"
+    "  setHp(int16) required broadcast ram db;\n"
+    "  setMaxHp(int16) required broadcast ram db;\n"
+    "  setExperience(uint32) required ownrecv db;\n"
+    "  setMoney(uint32) required ownrecv db;\n"
+    "  setInventory(uint16[]) required ownrecv db;\n"
+    "  setFriendsList(uint32[]) required ownrecv db;\n"
+    "  setEmote(uint16) broadcast ram;\n"
+    "  setAnimState(string) broadcast ram;\n"
+    "  setGMLevel(uint8) ram db;\n"
+    "};\n";
+
+// SnapshotPerformanceTest times a zone of N objects (for N from 1 to 1000) entering the
+// interest of a few hundred clients, with the objects' fields encoded for each entry (as
+// they used to be) and sent by the FieldStore, which copies them from a snapshot from the
+// second entry on; and again with every object updating a field between clients, so the
+// FieldStore never makes a snapshot and has to encode the fields for each entry too.
+class SnapshotPerformanceTest
+{
+  public:
+    SnapshotPerformanceTest() : m_file(new dclass::File)
+    {
+        snapperf_log.info() << "Starting snapshot perf test..." << std::endl;
+
+        const char *keywords[] = {"required", "ram", "db", "broadcast", "clrecv", "ownrecv"};
+        for(const char *keyword : keywords) {
+            m_file->add_keyword(keyword);
+        }
+        std::istringstream dc(snap_perf_dc);
+        if(!dclass::append(m_file, dc, "SnapshotPerformanceTest.dc")) {
+            snapperf_log.fatal() << "Couldn't parse the test DC file." << std::endl;
+            exit(1);
+        }
+        m_class = m_file->get_class_by_name("DistributedAvatar");
+        m_layout.reset(new FieldLayout(m_class));
+        m_pos_slot = m_layout->get_required_slot(m_class->get_field_by_name("setPosHpr"));
+
+        const size_t counts[] = {1, 10, 100, 1000};
+        for(size_t num_objects : counts) {
+            std::vector<std::unique_ptr<FieldStore> > zone(num_objects);
+            for(size_t i = 0; i < num_objects; ++i) {
+                zone[i].reset(new FieldStore(m_layout.get()));
+                fill(i, *zone[i]);
+            }
+
+            uint64_t encoded_hash, snapshot_hash;
+            double encoded = open_interest(zone, false, false, encoded_hash);
+            double snapshot = open_interest(zone, true, false, snapshot_hash);
+            if(encoded_hash != snapshot_hash) {
+                snapperf_log.fatal() << "The snapshots sent different entries from the fields."
+                                     << std::endl;
+                exit(1);
+            }
+            double snapshot_updating = open_interest(zone, true, true, snapshot_hash);
+            double encoded_updating = open_interest(zone, false, true, encoded_hash);
+            snapshot_updating = open_interest(zone, true, true, snapshot_hash);
+            if(encoded_hash != snapshot_hash) {
+                snapperf_log.fatal() << "The snapshots weren't updated with the fields."
+                                     << std::endl;
+                exit(1);
+            }
+
+            snapperf_log.info() << num_objects << " objects: "
+                                << encoded << "ns encoded, " << snapshot << "ns from snapshot ("
+                                << encoded / snapshot << "x); updating: "
+                                << encoded_updating << "ns encoded, " << snapshot_updating
+                                << "ns from the FieldStore, per entry" << std::endl;
+        }
+    }
+
+  private:
+    dclass::File *m_file;
+    const dclass::Class *m_class;
+    std::unique_ptr<FieldLayout> m_layout;
+    unsigned int m_pos_slot;
+
+    // hash adds the contents of a datagram to a running FNV-1a hash.
+    static uint64_t hash(uint64_t h, DatagramHandle dg)
+    {
+        for(dgsize_t i = 0; i < dg->size(); ++i) {
+            h = (h ^ dg->get_data()[i]) * 1099511628211ULL;
+        }
+        return h;
+    }
+
+    void fill(size_t n, FieldStore &fields)
+    {
+        DatagramPtr dg = Datagram::create();
+        dg->add_string("Avatar #" + std::to_string(n));
+        dg->add_blob(std::vector<uint8_t>(12 + n % 8, uint8_t(n)));
+        for(int i = 0; i < 6; ++i) {
+            dg->add_int16(int16_t(n + i));
+        }
+        dg->add_int16(int16_t(n % 100));
+        dg->add_int16(100);
+        dg->add_uint32(uint32_t(n * 7));
+        dg->add_uint32(uint32_t(n % 10000));
+        dg->add_size(2 * sizeof(uint16_t) * (n % 4));
+        for(size_t i = 0; i < 2 * (n % 4); ++i) {
+            dg->add_uint16(uint16_t(i));
+        }
+        dg->add_size(sizeof(uint32_t) * (n % 6));
+        for(size_t i = 0; i < n % 6; ++i) {
+            dg->add_uint32(uint32_t(n + i));
+        }
+        dg->add_uint16(uint16_t(n % 30));
+        if(n % 2 == 0) {
+            dg->add_string("neutral");
+        }
+
+        DatagramIterator dgi(dg);
+        std::vector<uint8_t> data;
+        for(unsigned int slot = 0; slot < m_layout->get_num_required(); ++slot) {
+            data.clear();
+            dgi.unpack_field(m_layout->get_field(slot), data);
+            fields.set(slot, data);
+        }
+        const char *ram_names[] = {"setEmote", "setAnimState"};
+        for(size_t i = 0; i < (n % 2 == 0 ? 2 : 1); ++i) {
+            const dclass::Field *field = m_class->get_field_by_name(ram_names[i]);
+            data.clear();
+            dgi.unpack_field(field, data);
+            fields.set(m_layout->get_ram_slot(field), data);
+        }
+        fields.shrink_to_fit();
+    }
+
+    // open_interest sends every object in the zone to each client in turn, and returns the
+    //     average time taken per entry, with a hash of all of the entries in "out_hash".
+    double open_interest(std::vector<std::unique_ptr<FieldStore> > &zone, bool from_snapshot,
+                         bool updating, uint64_t &out_hash)
+    {
+        out_hash = 0;
+        perf_clock::duration elapsed(0);
+        for(unsigned int client = 0; client < SNAP_PERF_NUM_CLIENTS; ++client) {
+            if(updating) {
+                // Move everything a little between clients, as happens in a busy zone.
+                std::vector<uint8_t> pos(6 * sizeof(int16_t), uint8_t(client));
+                for(auto &fields : zone) {
+                    fields->set(m_pos_slot, pos);
+                }
+            }
+
+            std::vector<DatagramPtr> entries;
+            entries.reserve(zone.size());
+            perf_clock::time_point start = perf_clock::now();
+            for(size_t i = 0; i < zone.size(); ++i) {
+                entries.push_back(from_snapshot ? snapshot_entry(client, i, *zone[i]) :
+                                  encoded_entry(client, i, *zone[i]));
+            }
+            elapsed += perf_clock::now() - start;
+
+            for(const DatagramPtr &dg : entries) {
+                out_hash = hash(out_hash, dg);
+            }
+        }
+        return std::chrono::duration<double, std::nano>(elapsed).count() /
+               (double(SNAP_PERF_NUM_CLIENTS) * zone.size());
+    }
+
+    // encoded_entry builds an ENTER_INTEREST from the fields one at a time, the way it was done
+    //     before objects kept snapshots.
+    DatagramPtr encoded_entry(uint32_t context, doid_t do_id, FieldStore &fields)
+    {
+        DatagramPtr dg = Datagram::create(1000 + context, do_id,
+                                          STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED_OTHER);
+        dg->add_uint32(context);
+
+        const std::vector<unsigned int> &required = m_layout->get_required_slots(true, false);
+        size_t length = sizeof(doid_t) + sizeof(doid_t) + sizeof(zone_t) + sizeof(uint16_t);
+        for(unsigned int slot : required) {
+            length += fields.get(slot).size();
+        }
+        dg->reserve(dg->size() + length);
+        dg->add_doid(do_id);
+        dg->add_location(1, 2);
+        dg->add_uint16(m_class->get_id());
+        for(unsigned int slot : required) {
+            dg->add_data(fields.get(slot));
+        }
+
+        const std::vector<unsigned int> &ram = m_layout->get_ram_slots(true, false);
+        uint16_t field_count = 0;
+        length = sizeof(uint16_t);
+        for(unsigned int slot : ram) {
+            if(fields.is_set(slot)) {
+                ++field_count;
+                length += sizeof(uint16_t) + fields.get(slot).size();
+            }
+        }
+        dg->reserve(dg->size() + length);
+        dg->add_uint16(field_count);
+        for(unsigned int slot : ram) {
+            if(fields.is_set(slot)) {
+                dg->add_uint16(m_layout->get_field(slot)->get_id());
+                dg->add_data(fields.get(slot));
+            }
+        }
+        return dg;
+    }
+
+    // snapshot_entry builds the same ENTER_INTEREST as DistributedObject::send_interest_entry.
+    DatagramPtr snapshot_entry(uint32_t context, doid_t do_id, FieldStore &fields)
+    {
+        DatagramPtr dg = Datagram::create(1000 + context, do_id,
+                                          STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED_OTHER);
+        dg->add_uint32(context);
+
+        dg->reserve(dg->size() + sizeof(doid_t) + sizeof(doid_t) + sizeof(zone_t) +
+                    sizeof(uint16_t) + fields.get_sent_size(true, false));
+        dg->add_doid(do_id);
+        dg->add_location(1, 2);
+        dg->add_uint16(m_class->get_id());
+        fields.add_required(dg, true, false);
+        fields.add_other(dg, true, false);
+        return dg;
+    }
+};
+
+SnapshotPerformanceTest perftest_snapshot;
@@ -0,0 +1,147 @@
+#ifdef ASTRON_WITH_ZSTD
+#include "core/global.h"
+#include "net/StreamCompressor.h"
+#include <cstdlib>
+#include <zstd.h>
+
+LogCategory streamcomp_log("TestStreamComp", "Unit Test - Stream Compression");
+
+#define STREAM_COMP_NUM_WRITES 50
+
+// StreamDecoder is the client's end of the stream: it decodes each write as it arrives.
+class StreamDecoder
+{
+  public:
+    StreamDecoder(const std::string &dict) : m_context(ZSTD_createDCtx())
+    {
+        if(!dict.empty()) {
+            ZSTD_DCtx_loadDictionary(m_context, dict.data(), dict.size());
+        }
+    }
+
+    ~StreamDecoder()
+    {
+        ZSTD_freeDCtx(m_context);
+    }
+
+    // decode appends everything "data" decodes to onto "out", returning false if it can't be
+    //     decoded (or isn't all there).
+    bool decode(const std::vector<char> &data, std::string &out)
+    {
+        char buf[4096];
+        ZSTD_inBuffer input = { data.data(), data.size(), 0 };
+        while(true) {
+            ZSTD_outBuffer output = { buf, sizeof(buf), 0 };
+            size_t ret = ZSTD_decompressStream(m_context, &output, &input);
+            if(ZSTD_isError(ret)) {
+                return false;
+            }
+            out.append(buf, output.pos);
+            if(input.pos == input.size && output.pos < output.size) {
+                return true;
+            }
+        }
+    }
+
+  private:
+    ZSTD_DCtx *m_context;
+};
+
+// StreamCompressorTest checks that every write is flushed, so the client can decode it on
+// its own as soon as it arrives, and that the dictionary is used by both ends.
+class StreamCompressorTest
+{
+  public:
+    StreamCompressorTest()
+    {
+        streamcomp_log.info() << "Starting stream compression test..." << std::endl;
+
+        std::string message = "Squeeze me, I am very compressible. ";
+        std::string content;
+        for(int i = 0; i < 32; ++i) {
+            content += message;
+        }
+        std::shared_ptr<CompressionDictionary> dict = CompressionDictionary::create(content, 3);
+        if(dict == nullptr) {
+            fail("Couldn't create a dictionary.");
+        }
+        if(dict->id() != 0) {
+            fail("A raw dictionary has an id.");
+        }
+
+        // Each write, which may be split over several buffers, can be decoded alone:
+        std::vector<std::vector<char>> writes;
+        std::string sent, decoded;
+        size_t compressed = 0;
+        {
+            std::unique_ptr<StreamCompressor> compressor = dict->acquire();
+            StreamDecoder decoder(content);
+            for(unsigned int i = 0; i < STREAM_COMP_NUM_WRITES; ++i) {
+                std::string number = std::to_string(i);
+                uv_buf_t bufs[2] = {
+                    uv_buf_init(const_cast<char*>(message.data()), message.size()),
+                    uv_buf_init(const_cast<char*>(number.data()), number.size())
+                };
+                std::vector<char> out;
+                if(!compressor->compress(bufs, i % 2 + 1, out)) {
+                    fail("Compressing write " + number + " failed.");
+                }
+                sent += message;
+                if(i % 2) {
+                    sent += number;
+                }
+
+                if(!decoder.decode(out, decoded) || decoded != sent) {
+                    fail("Write " + number + " couldn't be decoded as soon as it was sent.");
+                }
+                compressed += out.size();
+                writes.push_back(std::move(out));
+            }
+        }
+        if(compressed >= sent.size()) {
+            fail("Compression made " + std::to_string(sent.size()) + " bytes into " +
+                 std::to_string(compressed) + ".");
+        }
+
+        // ... but not without the dictionary:
+        {
+            StreamDecoder decoder("");
+            std::string undecoded;
+            bool ok = true;
+            for(const std::vector<char> &out : writes) {
+                ok = ok && decoder.decode(out, undecoded);
+            }
+            if(ok && undecoded == sent) {
+                fail("The stream was decoded without the dictionary.");
+            }
+        }
+
+        // A compressor taken back from the pool starts a new stream, with the same dictionary:
+        {
+            std::unique_ptr<StreamCompressor> compressor = dict->acquire();
+            StreamDecoder decoder(content);
+            uv_buf_t buf = uv_buf_init(const_cast<char*>(message.data()), message.size());
+            std::vector<char> out;
+            decoded.clear();
+            if(!compressor->compress(&buf, 1, out) || !decoder.decode(out, decoded) ||
+               decoded != message) {
+                fail("A reused compressor didn't start a new stream.");
+            }
+        }
+
+        streamcomp_log.info() << "Compressed " << sent.size() << " bytes over "
+                              << STREAM_COMP_NUM_WRITES << " writes into " << compressed
+                              << " bytes." << std::endl;
+    }
+
+  private:
+    void fail(const std::string &why)
+    {
+        streamcomp_log.fatal() << why << std::endl;
+        exit(1);
+    }
+};
+
+StreamCompressorTest unittest_streamcomp;
+
+#endif // ASTRON_WITH_ZSTD
@@ -0,0 +1,213 @@
+#include "core/global.h"
+#include "util/Datagram.h"
+#include "util/TaskQueue.h"
+#include <chrono>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+LogCategory taskqueueperf_log("PerfTestTaskQueue", "Performance Test - TaskQueue");
+
+#define TQ_PERF_NUM_VOLLEYS 50000 // round trips between two loops
+#define TQ_PERF_NUM_BURST 1000000 // tasks sent to a loop by another thread, as fast as it can
+
+typedef std::chrono::steady_clock perf_clock;
+
+// The TaskQueue as it was before MPSCQueue and TaskCallback: std::functions in a std::queue
+// guarded by a mutex, the flush handle rung for every one, and each copied out to be run.
+class LockedTaskQueue
+{
+  public:
+    ~LockedTaskQueue()
+    {
+        if(m_flush_handle) {
+            m_flush_handle->close();
+        }
+    }
+
+    void init_queue(const std::shared_ptr<uvw::Loop> &loop, std::thread::id thread_id)
+    {
+        m_thread_id = thread_id;
+        m_flush_handle = loop->resource<uvw::AsyncHandle>();
+        m_flush_handle->on<uvw::AsyncEvent>([self = this](const uvw::AsyncEvent&, uvw::AsyncHandle&) {
+            self->flush_tasks();
+        });
+    }
+
+    void enqueue_task(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            m_task_queue.push(task);
+        }
+
+        if(std::this_thread::get_id() != m_thread_id) {
+            m_flush_handle->send();
+        } else {
+            flush_tasks();
+        }
+    }
+
+    void flush_tasks()
+    {
+        if(m_in_flush) {
+            return;
+        }
+
+        m_in_flush = true;
+        std::queue<std::function<void()> > pending_tasks;
+        while(true) {
+            {
+                std::lock_guard<std::mutex> lock(m_queue_mutex);
+                if(m_task_queue.empty()) {
+                    break;
+                }
+                pending_tasks = std::move(m_task_queue);
+                m_task_queue = std::queue<std::function<void()> >();
+            }
+
+            while(!pending_tasks.empty()) {
+                std::function<void()> task = pending_tasks.front();
+                pending_tasks.pop();
+                task();
+            }
+        }
+        m_in_flush = false;
+    }
+
+  private:
+    std::mutex m_queue_mutex;
+    std::queue<std::function<void()> > m_task_queue;
+    std::shared_ptr<uvw::AsyncHandle> m_flush_handle;
+    std::thread::id m_thread_id;
+    bool m_in_flush = false;
+};
+
+// A PerfLoop runs a loop on a thread of its own, taking tasks from a Q, like a LoopThread does.
+template<typename Q>
+class PerfLoop
+{
+  public:
+    PerfLoop() : m_loop(uvw::Loop::create())
+    {
+        std::promise<void> ready;
+        m_thread = std::thread([this, &ready]() {
+            tasks.init_queue(m_loop, std::this_thread::get_id());
+            ready.set_value();
+            m_loop->run();
+        });
+        ready.get_future().wait();
+    }
+
+    ~PerfLoop()
+    {
+        std::shared_ptr<uvw::Loop> loop = m_loop;
+        tasks.enqueue_task([loop]() {
+            loop->stop();
+        });
+        m_thread.join();
+    }
+
+    Q tasks;
+
+  private:
+    std::shared_ptr<uvw::Loop> m_loop;
+    std::thread m_thread;
+};
+
+// TaskQueuePerformanceTest measures how fast tasks get from one thread's loop to another's:
+// first bouncing a task back and forth between two loops (each hop waits for the last, as a
+// reply to a message does), then with one thread sending a loop tasks as fast as it can (as
+// the MessageDirector's routing thread does when sending to a busy client). Each task holds a
+// datagram, like the tasks which send datagrams to NetworkClients.
+class TaskQueuePerformanceTest
+{
+  public:
+    TaskQueuePerformanceTest()
+    {
+        taskqueueperf_log.info() << "Starting TaskQueue perf test..." << std::endl;
+
+        DatagramPtr dg = Datagram::create(1234, 5678, 9);
+        dg->add_string("Hello, world!");
+        m_dg = dg;
+
+        double locked_volleys = ping_pong<LockedTaskQueue>("mutex + std::function");
+        double volleys = ping_pong<TaskQueue>("TaskQueue");
+        taskqueueperf_log.info() << "Ping-pong speedup: " << volleys / locked_volleys << "x" << std::endl;
+
+        double locked_burst = burst<LockedTaskQueue>("mutex + std::function");
+        double burst_rate = burst<TaskQueue>("TaskQueue");
+        taskqueueperf_log.info() << "Burst speedup: " << burst_rate / locked_burst << "x" << std::endl;
+    }
+
+  private:
+    DatagramHandle m_dg;
+
+    template<typename Q>
+    struct Court {
+        PerfLoop<Q> sides[2];
+        std::promise<void> done;
+    };
+
+    template<typename Q>
+    static void volley(Court<Q> *court, DatagramHandle dg, unsigned int remaining, unsigned int side)
+    {
+        if(remaining == 0) {
+            court->done.set_value();
+            return;
+        }
+
+        court->sides[side].tasks.enqueue_task([court, dg, remaining, side]() {
+            volley(court, dg, remaining - 1, 1 - side);
+        });
+    }
+
+    // ping_pong returns the number of round trips per second.
+    template<typename Q>
+    double ping_pong(const std::string &name)
+    {
+        Court<Q> court;
+        std::future<void> done = court.done.get_future();
+
+        perf_clock::time_point start = perf_clock::now();
+        volley(&court, m_dg, 2 * TQ_PERF_NUM_VOLLEYS, 0);
+        done.wait();
+        std::chrono::duration<double> elapsed = perf_clock::now() - start;
+
+        double rate = TQ_PERF_NUM_VOLLEYS / elapsed.count();
+        taskqueueperf_log.info() << name << ": " << TQ_PERF_NUM_VOLLEYS << " round trips in "
+                                 << elapsed.count() << "s (" << rate << " round trips/second)"
+                                 << std::endl;
+        return rate;
+    }
+
+    // burst returns the number of tasks run per second.
+    template<typename Q>
+    double burst(const std::string &name)
+    {
+        PerfLoop<Q> loop;
+        std::promise<void> all_done;
+        std::future<void> done = all_done.get_future();
+        size_t count = 0;
+
+        perf_clock::time_point start = perf_clock::now();
+        for(size_t i = 0; i < TQ_PERF_NUM_BURST; ++i) {
+            loop.tasks.enqueue_task([dg = m_dg, &count, &all_done]() {
+                if(++count == TQ_PERF_NUM_BURST) {
+                    all_done.set_value();
+                }
+            });
+        }
+        done.wait();
+        std::chrono::duration<double> elapsed = perf_clock::now() - start;
+
+        double rate = TQ_PERF_NUM_BURST / elapsed.count();
+        taskqueueperf_log.info() << name << ": " << TQ_PERF_NUM_BURST << " tasks from one thread in "
+                                 << elapsed.count() << "s (" << rate << " tasks/second)" << std::endl;
+        return rate;
+    }
+};
+
+TaskQueuePerformanceTest perftest_taskqueue;
@@ -1,14 +1,18 @@
 #pragma once
 #include <unordered_set>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <sstream>
 #include <exception>
 #include <stdexcept>
 #include <string.h> // memcpy
 #include <memory>
+#include <atomic>
+#include <type_traits>
 #include "core/types.h"
 #include "dclass/util/byteorder.h"
+#include "DatagramPool.h"
 
 #ifdef ASTRON_32BIT_DATAGRAMS
 typedef uint32_t dgsize_t;
@@ -20,8 +24,154 @@ typedef uint16_t dgsize_t;
 
 
 class Datagram; // foward declaration
-typedef std::shared_ptr<Datagram> DatagramPtr;
-typedef std::shared_ptr<const Datagram> DatagramHandle;
+
+// A DatagramSpan is a view of some bytes inside a Datagram (see the DatagramIterator's *_view
+// methods) or a FieldStore, which can be added to another datagram without copying them
+// anywhere else first. It's only valid for as long as what it points into.
+class DatagramSpan
+{
+  public:
+    DatagramSpan(const uint8_t *data, dgsize_t size) : m_data(data), m_size(size)
+    {
+    }
+
+    inline const uint8_t *data() const
+    {
+        return m_data;
+    }
+    inline dgsize_t size() const
+    {
+        return m_size;
+    }
+    inline bool empty() const
+    {
+        return m_size == 0;
+    }
+    inline const uint8_t *begin() const
+    {
+        return m_data;
+    }
+    inline const uint8_t *end() const
+    {
+        return m_data + m_size;
+    }
+
+  private:
+    const uint8_t *m_data;
+    dgsize_t m_size;
+};
+
+// A DatagramRef is a reference-counted handle to a Datagram, used just like a std::shared_ptr.
+// The count lives in the Datagram itself, though, so there's no separate control block to
+// allocate, and the Datagram is freed (back to the DatagramPool) when the last handle goes.
+template<typename T>
+class DatagramRef
+{
+  public:
+    DatagramRef() noexcept : m_ptr(nullptr)
+    {
+    }
+    DatagramRef(std::nullptr_t) noexcept : m_ptr(nullptr)
+    {
+    }
+    explicit DatagramRef(T *ptr) noexcept : m_ptr(ptr)
+    {
+        acquire();
+    }
+    DatagramRef(const DatagramRef &other) noexcept : m_ptr(other.m_ptr)
+    {
+        acquire();
+    }
+    DatagramRef(DatagramRef &&other) noexcept : m_ptr(other.m_ptr)
+    {
+        other.m_ptr = nullptr;
+    }
+    // A DatagramPtr converts to a DatagramHandle, but not the other way around.
+    template<typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+    DatagramRef(const DatagramRef<U> &other) noexcept : m_ptr(other.m_ptr)
+    {
+        acquire();
+    }
+    template<typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+    DatagramRef(DatagramRef<U> &&other) noexcept : m_ptr(other.m_ptr)
+    {
+        other.m_ptr = nullptr;
+    }
+
+    ~DatagramRef()
+    {
+        release();
+    }
+
+    DatagramRef &operator=(DatagramRef other) noexcept
+    {
+        std::swap(m_ptr, other.m_ptr);
+        return *this;
+    }
+
+    inline T *get() const noexcept
+    {
+        return m_ptr;
+    }
+    inline T &operator*() const noexcept
+    {
+        return *m_ptr;
+    }
+    inline T *operator->() const noexcept
+    {
+        return m_ptr;
+    }
+    inline explicit operator bool() const noexcept
+    {
+        return m_ptr != nullptr;
+    }
+
+    inline void reset() noexcept
+    {
+        release();
+        m_ptr = nullptr;
+    }
+
+    template<typename U>
+    inline bool operator==(const DatagramRef<U> &other) const noexcept
+    {
+        return m_ptr == other.m_ptr;
+    }
+    template<typename U>
+    inline bool operator!=(const DatagramRef<U> &other) const noexcept
+    {
+        return m_ptr != other.m_ptr;
+    }
+    inline bool operator==(std::nullptr_t) const noexcept
+    {
+        return m_ptr == nullptr;
+    }
+    inline bool operator!=(std::nullptr_t) const noexcept
+    {
+        return m_ptr != nullptr;
+    }
+
+  private:
+    T *m_ptr;
+
+    inline void acquire() const noexcept
+    {
+        if(m_ptr != nullptr) {
+            m_ptr->acquire_ref();
+        }
+    }
+    inline void release() const noexcept
+    {
+        if(m_ptr != nullptr) {
+            m_ptr->release_ref();
+        }
+    }
+
+    template<typename U> friend class DatagramRef;
+};
+
+typedef DatagramRef<Datagram> DatagramPtr;
+typedef DatagramRef<const Datagram> DatagramHandle;
 
 // A DatagramOverflow is an exception which occurs when an add_<value> method is called which would
 // increase the size of the datagram past DGSIZE_MAX (preventing integer and buffer overflow).
@@ -36,10 +186,26 @@ class DatagramOverflow : public std::runtime_error
 // server messages, as well as occasionally DistributedObject field data.
 class Datagram
 {
+  public:
+    // Payloads up to this size are kept inside the Datagram itself.
+    static const size_t inline_capacity = 128;
+
   protected:
+    // Where buf came from, and so how to free it.
+    enum class BufferKind : uint8_t {
+        INLINE, // It's buf_inline.
+        POOLED, // It's a block of buf_cap bytes from the DatagramPool.
+        ARRAY, // It was handed to us by the shallow-constructor, allocated with new[].
+        BORROWED // It's part of a larger buffer (see create_slice), which buf_owner keeps alive.
+    };
+
     uint8_t* buf;
     size_t buf_cap; // Can be larger than buf_offset, so use a size_t
     size_t buf_offset;
+    std::shared_ptr<const uint8_t> buf_owner;
+    BufferKind buf_kind;
+    mutable std::atomic<uint32_t> m_refs{0};
+    uint8_t buf_inline[inline_capacity];
 
     void check_add_length(dgsize_t len)
     {
@@ -52,91 +218,160 @@ class Datagram
         }
 
         if(new_offset > buf_cap) {
-            uint8_t *tmp_buf = new uint8_t[buf_cap + len + 64];
-            memcpy(tmp_buf, buf, buf_cap);
+            // Grow geometrically, so that a datagram built up piece by piece is only
+            // copied a logarithmic number of times.
+            size_t new_cap = buf_cap * 2;
+            if(new_cap > DGSIZE_MAX) {
+                new_cap = DGSIZE_MAX;
+            }
+            grow(new_cap > new_offset ? new_cap : new_offset);
+        }
+    }
+
+    // allocate_buf points buf at an empty buffer with room for at least "capacity" bytes.
+    void allocate_buf(size_t capacity)
+    {
+        if(capacity <= inline_capacity) {
+            buf = buf_inline;
+            buf_cap = inline_capacity;
+            buf_kind = BufferKind::INLINE;
+        } else {
+            buf_cap = DatagramPool::block_size(capacity);
+            buf = static_cast<uint8_t*>(DatagramPool::allocate(buf_cap));
+            buf_kind = BufferKind::POOLED;
+        }
+    }
+
+    // free_buf gives up buf, however it was allocated.
+    void free_buf()
+    {
+        switch(buf_kind) {
+        case BufferKind::INLINE:
+            break;
+        case BufferKind::POOLED:
+            DatagramPool::release(buf, buf_cap);
+            break;
+        case BufferKind::ARRAY:
             delete [] buf;
-            buf = tmp_buf;
-            buf_cap = buf_cap + len + 64;
+            break;
+        case BufferKind::BORROWED:
+            buf_owner = nullptr;
+            break;
+        }
+    }
+
+    // grow moves the datagram's data into a new buffer of at least "new_cap" bytes.
+    //     Its callers pick "new_cap": check_add_length doubles the old capacity (capped at
+    //     DGSIZE_MAX, but never less than the data being added needs), while reserve passes
+    //     on the capacity it was asked for. allocate_buf then rounds that up to buf_inline,
+    //     if it fits, or else to DatagramPool's block size. The new buffer is buf_inline only
+    //     when outgrowing a borrowed or array buffer smaller than inline_capacity.
+    void grow(size_t new_cap)
+    {
+        uint8_t *old_buf = buf;
+        BufferKind old_kind = buf_kind;
+        size_t old_cap = buf_cap;
+        std::shared_ptr<const uint8_t> old_owner = std::move(buf_owner);
+
+        allocate_buf(new_cap);
+        memcpy(buf, old_buf, buf_offset);
+
+        if(old_kind == BufferKind::POOLED) {
+            DatagramPool::release(old_buf, old_cap);
+        } else if(old_kind == BufferKind::ARRAY) {
+            delete [] old_buf;
         }
     }
+
     // default-constructor:
     //     creates a new datagram with some pre-allocated space
-    Datagram() : buf(new uint8_t[64]), buf_cap(64), buf_offset(0)
+    Datagram() : buf_offset(0)
     {
+        allocate_buf(64);
     }
 
-    /*
-    // TODO: Deal with overload collision with Datagram(uint16_t message_type)
-
     // sized-constructor:
     //     allows you to specify the capacity of the datagram ahead of time,
-    //     this should be used when the exact size is known ahead of time for performance
-    Datagram(dgsize_t capacity) : buf(new uint8_t[capacity]), buf_cap(capacity),
-    	buf_offset(0)
+    //     this should be used when the size is known ahead of time for performance.
+    //     (The Capacity wrapper keeps it from colliding with Datagram(uint16_t message_type).)
+    struct Capacity {
+        size_t bytes;
+    };
+    explicit Datagram(Capacity capacity) : buf_offset(0)
     {
+        allocate_buf(capacity.bytes);
     }
-    */
 
     // copy-constructor:
     //     creates a new datagram which is a deep-copy of another datagram;
     //     capacity is not perserved and instead is reduced to the size of the source datagram.
-    Datagram(const Datagram &dg) : buf(new uint8_t[dg.size()]), buf_cap(dg.size()),
-        buf_offset(dg.size())
+    Datagram(const Datagram &dg) : buf_offset(dg.size())
     {
+        allocate_buf(dg.size());
         memcpy(buf, dg.buf, dg.size());
     }
 
     // shallow-constructor:
     //     creates a new datagram that uses an existing buffer as its data
     Datagram(uint8_t *data, dgsize_t length, dgsize_t capacity) : buf(data),
-        buf_cap(capacity), buf_offset(length)
+        buf_cap(capacity), buf_offset(length), buf_kind(BufferKind::ARRAY)
+    {
+    }
+
+    // slice-constructor:
+    //     creates a new datagram that uses part of a buffer owned by someone else as its data.
+    Datagram(const std::shared_ptr<const uint8_t> &owner, const uint8_t *data, dgsize_t length) :
+        buf(const_cast<uint8_t*>(data)), buf_cap(length), buf_offset(length), buf_owner(owner),
+        buf_kind(BufferKind::BORROWED)
     {
     }
 
     // binary-constructor(pointer):
     //     creates a new datagram with a copy of the data contained at the pointer.
-    Datagram(const uint8_t *data, dgsize_t length) : buf(new uint8_t[length]), buf_cap(length),
-        buf_offset(length)
+    Datagram(const uint8_t *data, dgsize_t length) : buf_offset(length)
     {
+        allocate_buf(length);
         memcpy(buf, data, length);
     }
 
     // binary-constructor(vector):
     //     creates a new datagram with a copy of the binary data contained in a vector<uint8_t>.
-    Datagram(const std::vector<uint8_t> &data) : buf(new uint8_t[data.size()]),
-        buf_cap(data.size()), buf_offset(data.size())
+    Datagram(const std::vector<uint8_t> &data) : buf_offset(data.size())
     {
-        memcpy(buf, &data[0], data.size());
+        allocate_buf(data.size());
+        memcpy(buf, data.data(), data.size());
     }
 
     // binary-constructor(string):
     //     creates a new datagram with a copy of the data contained in a string, treated as binary.
-    Datagram(const std::string &data) : buf(new uint8_t[data.length()]), buf_cap(data.length()),
-        buf_offset(data.length())
+    Datagram(const std::string &data) : buf_offset(data.length())
     {
+        allocate_buf(data.length());
         memcpy(buf, data.c_str(), data.length());
     }
 
     // server-header-constructor(single-receiver):
     //     creates a new datagram initialized with a server header (accepts only 1 receiver).
-    Datagram(channel_t to_channel, channel_t from_channel, uint16_t message_type) :
-        buf(new uint8_t[64]), buf_cap(64), buf_offset(0)
+    Datagram(channel_t to_channel, channel_t from_channel, uint16_t message_type) : buf_offset(0)
     {
+        allocate_buf(64);
         add_server_header(to_channel, from_channel, message_type);
     }
 
     // server-header-constructor(multi-target):
     //     creates a new datagram initialized with a server header (accepts a set of receivers)
     Datagram(const std::unordered_set<channel_t> &to_channels, channel_t from_channel,
-             uint16_t message_type) : buf(new uint8_t[64]), buf_cap(64), buf_offset(0)
+             uint16_t message_type) : buf_offset(0)
     {
+        allocate_buf(64);
         add_server_header(to_channels, from_channel, message_type);
     }
 
     // control-header constructor:
     //     creates a new datagram initialized with a control header containing the msgtype.
-    Datagram(uint16_t message_type) : buf(new uint8_t[64]), buf_cap(64), buf_offset(0)
+    Datagram(uint16_t message_type) : buf_offset(0)
     {
+        allocate_buf(64);
         add_control_header(message_type);
     }
 
@@ -148,6 +383,16 @@ class Datagram
         return dg_ptr;
     }
 
+    // create_with_capacity makes an empty datagram with room for "capacity" bytes.
+    static DatagramPtr create_with_capacity(size_t capacity)
+    {
+        if(capacity > DGSIZE_MAX) {
+            capacity = DGSIZE_MAX;
+        }
+        DatagramPtr dg_ptr(new Datagram(Capacity{capacity}));
+        return dg_ptr;
+    }
+
     static DatagramPtr create(DatagramHandle dg)
     {
         DatagramPtr dg_ptr(new Datagram(*dg.get()));
@@ -160,6 +405,15 @@ class Datagram
         return dg_ptr;
     }
 
+    // create_slice makes a datagram out of "length" bytes at "data", without copying them,
+    //     which keeps "owner" (the buffer they're in) alive for as long as it exists.
+    static DatagramHandle create_slice(const std::shared_ptr<const uint8_t> &owner,
+                                       const uint8_t *data, dgsize_t length)
+    {
+        DatagramHandle dg_ptr(new Datagram(owner, data, length));
+        return dg_ptr;
+    }
+
     static DatagramPtr create(const uint8_t *data, dgsize_t length)
     {
         DatagramPtr dg_ptr(new Datagram(data, length));
@@ -203,7 +457,43 @@ class Datagram
     // destructor
     ~Datagram()
     {
-        delete [] buf;
+        free_buf();
+    }
+
+    // Datagrams themselves are allocated from the DatagramPool too.
+    static void *operator new(size_t size)
+    {
+        return DatagramPool::allocate(size);
+    }
+    static void operator delete(void *ptr, size_t size)
+    {
+        DatagramPool::release(ptr, size);
+    }
+
+    // acquire_ref and release_ref are used by DatagramRef to count the handles to a datagram.
+    //     The count is atomic, as handles are shared between threads (by the MessageDirector,
+    //     for one).
+    void acquire_ref() const
+    {
+        m_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    void release_ref() const
+    {
+        if(m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    // reserve makes room for the datagram to grow to "capacity" bytes without reallocating.
+    //     It doesn't shrink the datagram, and never reserves more than DGSIZE_MAX.
+    void reserve(size_t capacity)
+    {
+        if(capacity > DGSIZE_MAX) {
+            capacity = DGSIZE_MAX;
+        }
+        if(capacity > buf_cap) {
+            grow(capacity);
+        }
     }
 
     // add_bool adds an 8-bit integer to the datagram that is guaranteed
@@ -355,14 +645,18 @@ class Datagram
             buf_offset += data.size();
         }
     }
-    void add_data(const std::string &str)
+    void add_data(std::string_view str)
     {
         if(str.length()) {
             check_add_length(str.length());
-            memcpy(buf + buf_offset, str.c_str(), str.length());
+            memcpy(buf + buf_offset, str.data(), str.length());
             buf_offset += str.length();
         }
     }
+    void add_data(DatagramSpan data)
+    {
+        add_data(data.data(), data.size());
+    }
     void add_data(const uint8_t* data, dgsize_t length)
     {
         if(length) {
@@ -379,6 +673,18 @@ class Datagram
             buf_offset += dg->buf_offset;
         }
     }
+    // This one adds just the "length" bytes starting at "offset" in "dg".
+    void add_data(const DatagramHandle &dg, dgsize_t offset, dgsize_t length)
+    {
+        if(size_t(offset) + length > dg->buf_offset) {
+            std::stringstream err_str;
+            err_str << "dg tried to add data past the end of another dg, offset+length("
+                    << size_t(offset) + length << ")" << " size(" << dg->buf_offset << ")"
+                    << std::endl;
+            throw DatagramOverflow(err_str.str());
+        }
+        add_data(dg->buf + offset, length);
+    }
 
     // add_string adds a dclass string to the datagram from binary data;
     // a length tag (typically a uint16_t) is prepended to the string before it is added.
@@ -0,0 +1,210 @@
+#include "DatagramIterator.h"
+#include <string.h>
+using dclass::Number;
+
+// is_ascii returns true if none of the bytes have their high bit set.
+//     The bytes are ORed together a word at a time, which compilers turn into vector
+//     instructions, and checked once at the end (strings are short, and rarely bad).
+static inline bool is_ascii(const uint8_t* data, size_t length)
+{
+    uint64_t bits = 0;
+    size_t i = 0;
+    for(; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(uint64_t));
+        bits |= word;
+    }
+    for(; i < length; ++i) {
+        bits |= data[i];
+    }
+    return (bits & 0x8080808080808080ULL) == 0;
+}
+
+// load reads a T from data, which needn't be aligned.
+template<typename T>
+static inline T load(const uint8_t* data)
+{
+    T val;
+    memcpy(&val, data, sizeof(T));
+    return val;
+}
+
+// read_number returns the number of the given type at data, as NumericType::within_range reads it.
+static inline Number read_number(dclass::Type type, const uint8_t* data)
+{
+    using namespace dclass;
+    switch(type) {
+    case T_INT8:
+        return Number(int64_t(load<int8_t>(data)));
+    case T_INT16:
+        return Number(int64_t(load<int16_t>(data)));
+    case T_INT32:
+        return Number(int64_t(load<int32_t>(data)));
+    case T_INT64:
+        return Number(load<int64_t>(data));
+    case T_CHAR:
+    case T_UINT8:
+        return Number(uint64_t(load<uint8_t>(data)));
+    case T_UINT16:
+        return Number(uint64_t(load<uint16_t>(data)));
+    case T_UINT32:
+        return Number(uint64_t(load<uint32_t>(data)));
+    case T_UINT64:
+        return Number(load<uint64_t>(data));
+    case T_FLOAT32:
+        return Number(double(load<float>(data)));
+    case T_FLOAT64:
+        return Number(load<double>(data));
+    default:
+        return Number(int64_t(0));
+    }
+}
+
+// check_count throws a FieldConstraintViolation if an array has the wrong number of elements.
+static inline void check_count(const FieldPlan::Op &op, uint64_t elem_cnt)
+{
+    if(elem_cnt < op.min_count || elem_cnt > op.max_count) {
+        std::stringstream error;
+        error << "Failed to unpack variable-length field of type " << op.type->get_alias()
+              << " due to element count constraint violation (got " << elem_cnt << ")";
+        throw FieldConstraintViolation(error.str());
+    }
+}
+
+void DatagramIterator::unpack_plan(const FieldPlan &plan, std::vector<uint8_t> &buffer)
+{
+    // A Loop is an array whose elements are being unpacked.
+    struct Loop {
+        size_t start;    // the offset of the first element
+        uint64_t length; // the array's length in bytes, or how many elements an OP_REPEAT has
+        uint64_t count;  // how many elements have been started so far
+    };
+    Loop loops[FieldPlan::max_depth];
+    unsigned int depth = 0;
+
+    const FieldPlan::Op* ops = plan.unpack_ops().data();
+    const size_t num_ops = plan.unpack_ops().size();
+    const uint8_t* data = m_dg->get_data();
+
+    size_t pc = 0;
+    while(pc < num_ops) {
+        const FieldPlan::Op &op = ops[pc++];
+        switch(op.code) {
+        case FieldPlan::OP_SPAN: {
+            check_read_length(op.size);
+            buffer.insert(buffer.end(), data + m_offset, data + m_offset + op.size);
+            m_offset += op.size;
+            break;
+        }
+        case FieldPlan::OP_ASCII: {
+            check_read_length(op.size);
+            if(!is_ascii(data + m_offset, op.size)) {
+                std::stringstream error;
+                error << "Failed to unpack fixed-length string field of type " << op.type->get_alias()
+                      << " due to string encoding type violation";
+                throw FieldConstraintViolation(error.str());
+            }
+            buffer.insert(buffer.end(), data + m_offset, data + m_offset + op.size);
+            m_offset += op.size;
+            break;
+        }
+        case FieldPlan::OP_NUMERIC: {
+            check_read_length(op.size);
+            if(!op.range.contains(read_number(op.number_type, data + m_offset))) {
+                std::stringstream error;
+                error << "Failed to unpack numeric-type field of type " << op.type->get_alias()
+                      << " due to value range constraint violation";
+                throw FieldConstraintViolation(error.str());
+            }
+            buffer.insert(buffer.end(), data + m_offset, data + m_offset + op.size);
+            m_offset += op.size;
+            break;
+        }
+        case FieldPlan::OP_BLOB:
+        case FieldPlan::OP_VARSTRING: {
+            dgsize_t len = read_size();
+            dgsize_t net_len = swap_le(len);
+            buffer.insert(buffer.end(), (uint8_t*)&net_len, (uint8_t*)&net_len + sizeof(dgsize_t));
+
+            check_read_length(len);
+            if(op.code == FieldPlan::OP_VARSTRING && !is_ascii(data + m_offset, len)) {
+                std::stringstream error;
+                error << "Failed to unpack variable-length string field of type "
+                      << op.type->get_alias() << " due to string encoding type violation";
+                throw FieldConstraintViolation(error.str());
+            }
+            buffer.insert(buffer.end(), data + m_offset, data + m_offset + len);
+            m_offset += len;
+
+            check_count(op, len);
+            break;
+        }
+        case FieldPlan::OP_SPAN_ARRAY: {
+            dgsize_t len = read_size();
+            dgsize_t net_len = swap_le(len);
+            buffer.insert(buffer.end(), (uint8_t*)&net_len, (uint8_t*)&net_len + sizeof(dgsize_t));
+
+            // Elements are read until they reach the length, so a partial one still counts.
+            uint64_t elem_cnt = (len + op.size - 1) / op.size;
+            size_t length = elem_cnt * op.size;
+            check_read_length(length);
+            buffer.insert(buffer.end(), data + m_offset, data + m_offset + length);
+            m_offset += length;
+
+            check_count(op, elem_cnt);
+            break;
+        }
+        case FieldPlan::OP_VARARRAY: {
+            dgsize_t len = read_size();
+            dgsize_t net_len = swap_le(len);
+            buffer.insert(buffer.end(), (uint8_t*)&net_len, (uint8_t*)&net_len + sizeof(dgsize_t));
+
+            loops[depth++] = {m_offset, len, 0};
+            pc = op.jump;
+            break;
+        }
+        case FieldPlan::OP_VARARRAY_NEXT: {
+            Loop &loop = loops[depth - 1];
+            if(m_offset - loop.start < loop.length) {
+                ++loop.count;
+                pc = op.jump;
+                break;
+            }
+
+            --depth;
+            check_count(op, loop.count);
+            break;
+        }
+        case FieldPlan::OP_REPEAT: {
+            loops[depth++] = {m_offset, op.size, 0};
+            pc = op.jump;
+            break;
+        }
+        case FieldPlan::OP_REPEAT_NEXT: {
+            Loop &loop = loops[depth - 1];
+            if(loop.count < loop.length) {
+                ++loop.count;
+                pc = op.jump;
+                break;
+            }
+
+            --depth;
+            break;
+        }
+        }
+    }
+}
+
+void DatagramIterator::skip_plan(const FieldPlan &plan)
+{
+    for(const FieldPlan::Op &op : plan.skip_ops()) {
+        if(op.code == FieldPlan::OP_SPAN) {
+            check_read_length(op.size);
+            m_offset += op.size;
+        } else {
+            dgsize_t length = read_size();
+            check_read_length(length);
+            m_offset += length;
+        }
+    }
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "Datagram.h"
+#include "FieldPlan.h"
 #include "dclass/dc/Struct.h"
 #include "dclass/dc/Method.h"
 #include "dclass/dc/Field.h"
@@ -33,7 +34,7 @@ class DatagramIterator
     DatagramHandle m_dg;
     size_t m_offset;
 
-    void check_read_length(dgsize_t length)
+    void check_read_length(size_t length)
     {
         size_t new_offset = m_offset + length;
         if(new_offset > m_dg->size()) {
@@ -216,7 +217,10 @@ class DatagramIterator
     DatagramPtr read_datagram()
     {
         dgsize_t length = read_size();
-        return Datagram::create(m_dg->get_data() + m_offset, length);
+        check_read_length(length);
+        DatagramPtr dg = Datagram::create(m_dg->get_data() + m_offset, length);
+        m_offset += length;
+        return dg;
     }
 
     // read_data returns the next <length> bytes in the datagram.
@@ -234,6 +238,41 @@ class DatagramIterator
         return read_data(m_dg->size() - m_offset);
     }
 
+    // The *_view methods are like the methods above, but return views of the data inside the
+    // datagram rather than copies of it, which are only valid for as long as the datagram is.
+
+    // read_string_view reads a string from the datagram, like read_string.
+    std::string_view read_string_view()
+    {
+        dgsize_t length = read_size();
+        check_read_length(length);
+        std::string_view str((const char*)(m_dg->get_data() + m_offset), length);
+        m_offset += length;
+        return str;
+    }
+
+    // read_blob_view reads a blob from the datagram, like read_blob.
+    DatagramSpan read_blob_view()
+    {
+        dgsize_t length = read_size();
+        return read_data_view(length);
+    }
+
+    // read_data_view returns the next <length> bytes in the datagram.
+    DatagramSpan read_data_view(dgsize_t length)
+    {
+        check_read_length(length);
+        DatagramSpan data(m_dg->get_data() + m_offset, length);
+        m_offset += length;
+        return data;
+    }
+
+    // read_remainder_view returns the rest of the bytes in the datagram.
+    DatagramSpan read_remainder_view()
+    {
+        return read_data_view(m_dg->size() - m_offset);
+    }
+
 
     // unpack_field accepts a Field of a distributed class
     //     and returns the packed value for the field.
@@ -247,9 +286,18 @@ class DatagramIterator
     // unpack_field can also be called to read into an existing buffer.
     void unpack_field(const dclass::Field* field, std::vector<uint8_t> &buffer)
     {
-        unpack_dtype(field->get_type(), buffer);
+        const FieldPlan* plan = FieldPlan::get(field);
+        if(plan != nullptr) {
+            unpack_plan(*plan, buffer);
+        } else {
+            unpack_dtype(field->get_type(), buffer);
+        }
     }
 
+    // unpack_plan copies the data for a value into a buffer by running a field's plan,
+    //     making the same checks (and throwing the same exceptions) as unpack_dtype.
+    void unpack_plan(const FieldPlan &plan, std::vector<uint8_t> &buffer);
+
     // unpack_dtype accepts a DistributedType and copies the data for the value into a buffer.
     void unpack_dtype(const dclass::DistributedType* dtype, std::vector<uint8_t> &buffer)
     {
@@ -389,9 +437,18 @@ class DatagramIterator
     //     Throws DatagramIteratorEOF if it skips past the end of the datagram.
     void skip_field(const dclass::Field* field)
     {
-        skip_dtype(field->get_type());
+        const FieldPlan* plan = FieldPlan::get(field);
+        if(plan != nullptr) {
+            skip_plan(*plan);
+        } else {
+            skip_dtype(field->get_type());
+        }
     }
 
+    // skip_plan seeks past the packed data for a value by running a field's plan.
+    //     Throws DatagramIteratorEOF if it skips past the end of the datagram.
+    void skip_plan(const FieldPlan &plan);
+
     // skip_dtype can be used to seek past the packed data for a DistributedType.
     //     Throws DatagramIteratorEOF if it skips past the end of the datagram.
     void skip_dtype(const dclass::DistributedType *dtype)
@@ -0,0 +1,104 @@
+#include "DatagramPool.h"
+#include <new>
+#include <vector>
+
+namespace DatagramPool
+{
+
+
+// The size classes are every power of two from 2^min_shift to 2^max_shift bytes; anything
+// bigger than that goes straight to the system allocator.
+static const unsigned int min_shift = 6;
+static const unsigned int max_shift = 16;
+static const unsigned int num_classes = max_shift - min_shift + 1;
+
+// The most memory a thread keeps on each free list.
+static const size_t max_cached_bytes = 256 * 1024;
+
+// size_class returns the class of blocks which hold "size" bytes, or num_classes if none do.
+static inline unsigned int size_class(size_t size)
+{
+    unsigned int shift = min_shift;
+    while(shift <= max_shift && (size_t(1) << shift) < size) {
+        ++shift;
+    }
+    return shift - min_shift;
+}
+
+struct ThreadFreeLists;
+
+// Datagrams can still be freed on a thread after its free lists are destroyed (by other
+// thread_local destructors, say), so the lists keep track of whether they're still there.
+enum class ListState {
+    UNUSED,
+    ALIVE,
+    DEAD
+};
+static thread_local ListState t_state = ListState::UNUSED;
+
+struct ThreadFreeLists {
+    std::vector<void*> lists[num_classes];
+
+    ThreadFreeLists()
+    {
+        t_state = ListState::ALIVE;
+    }
+
+    ~ThreadFreeLists()
+    {
+        t_state = ListState::DEAD;
+        for(auto &list : lists) {
+            for(void *block : list) {
+                ::operator delete(block);
+            }
+        }
+    }
+};
+static thread_local ThreadFreeLists t_lists;
+
+// thread_lists returns the calling thread's free lists, or nullptr once they've been destroyed.
+static inline ThreadFreeLists *thread_lists()
+{
+    if(t_state == ListState::DEAD) {
+        return nullptr;
+    }
+    return &t_lists;
+}
+
+size_t block_size(size_t size)
+{
+    unsigned int n = size_class(size);
+    return n < num_classes ? size_t(1) << (n + min_shift) : size;
+}
+
+void *allocate(size_t size)
+{
+    unsigned int n = size_class(size);
+    if(n < num_classes) {
+        ThreadFreeLists *lists = thread_lists();
+        if(lists != nullptr && !lists->lists[n].empty()) {
+            void *block = lists->lists[n].back();
+            lists->lists[n].pop_back();
+            return block;
+        }
+    }
+
+    return ::operator new(block_size(size));
+}
+
+void release(void *block, size_t size)
+{
+    unsigned int n = size_class(size);
+    if(n < num_classes) {
+        ThreadFreeLists *lists = thread_lists();
+        if(lists != nullptr && lists->lists[n].size() < max_cached_bytes >> (n + min_shift)) {
+            lists->lists[n].push_back(block);
+            return;
+        }
+    }
+
+    ::operator delete(block);
+}
+
+
+} // close namespace DatagramPool
@@ -0,0 +1,23 @@
+#pragma once
+#include <stddef.h>
+
+// The DatagramPool hands out the memory that Datagrams, and buffers too big to fit inside them,
+// are made of. Blocks come in power-of-two size classes, and each thread keeps free lists of
+// them, so creating and destroying datagrams rarely has to go to the system allocator (or take
+// its locks). A block may be released on a different thread than it was allocated on; it just
+// joins that thread's free list.
+namespace DatagramPool
+{
+
+
+// block_size returns the size of the block that would be allocated for "size" bytes.
+size_t block_size(size_t size);
+
+// allocate returns a block of at least "size" bytes (block_size(size), exactly).
+void *allocate(size_t size);
+
+// release returns a block allocated for "size" bytes to the pool.
+void release(void *block, size_t size);
+
+
+} // close namespace DatagramPool
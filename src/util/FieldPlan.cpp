@@ -0,0 +1,229 @@
+#include "FieldPlan.h"
+#include "dclass/dc/File.h"
+#include "dclass/dc/Struct.h"
+#include "dclass/dc/Method.h"
+#include "dclass/dc/Parameter.h"
+#include "dclass/dc/ArrayType.h"
+#include "dclass/dc/NumericType.h"
+using namespace dclass;
+
+std::vector<std::unique_ptr<FieldPlan> > FieldPlan::plans;
+
+static FieldPlan::Op make_op(FieldPlan::OpCode code, const DistributedType* type, uint32_t size = 0)
+{
+    FieldPlan::Op op;
+    op.code = code;
+    op.size = size;
+    op.jump = 0;
+    op.number_type = type->get_type();
+    op.min_count = 0;
+    op.max_count = UINT64_MAX;
+    op.type = type;
+    return op;
+}
+
+// set_count_range copies the element count constraint of an array into the op,
+//     the same way ArrayType::within_range checks it.
+static void set_count_range(FieldPlan::Op &op, const ArrayType* array)
+{
+    NumericRange range = array->get_range();
+    if(array->get_array_size() > 0) {
+        op.min_count = op.max_count = array->get_array_size();
+    } else {
+        op.min_count = range.min.uinteger;
+        op.max_count = range.max.uinteger;
+    }
+}
+
+// add_span adds an OP_SPAN, or lengthens the last op if it's already one.
+static void add_span(std::vector<FieldPlan::Op> &ops, const DistributedType* type, uint32_t size)
+{
+    if(size == 0) {
+        return;
+    }
+
+    if(!ops.empty() && ops.back().code == FieldPlan::OP_SPAN) {
+        ops.back().size += size;
+        return;
+    }
+
+    ops.push_back(make_op(FieldPlan::OP_SPAN, type, size));
+}
+
+// compile_unpack adds the ops which unpack a value of dtype, making exactly the checks that
+//     DatagramIterator::unpack_dtype would, in the same order.
+//     Returns false if the type can't be compiled, in which case the ops are left incomplete.
+static bool compile_unpack(const DistributedType* dtype, std::vector<FieldPlan::Op> &ops,
+                           unsigned int depth)
+{
+    const bool skip_fixed = ((dtype->get_type() == T_STRUCT || dtype->get_type() == T_METHOD) &&
+                             dtype->has_range());
+
+    if(dtype->has_fixed_size() && !skip_fixed) {
+        const ArrayType* array = dtype->as_array();
+
+        if(dtype->get_type() == T_ARRAY && array && array->get_element_type()->has_range()) {
+            if(depth == FieldPlan::max_depth) {
+                return false;
+            }
+
+            size_t begin = ops.size();
+            ops.push_back(make_op(FieldPlan::OP_REPEAT, dtype, array->get_array_size()));
+            if(!compile_unpack(array->get_element_type(), ops, depth + 1)) {
+                return false;
+            }
+            ops[begin].jump = uint32_t(ops.size());
+
+            FieldPlan::Op next = make_op(FieldPlan::OP_REPEAT_NEXT, dtype);
+            next.jump = uint32_t(begin + 1);
+            ops.push_back(next);
+            return true;
+        }
+
+        const NumericType* num = dtype->as_numeric();
+        if(num && num->has_range()) {
+            FieldPlan::Op op = make_op(FieldPlan::OP_NUMERIC, dtype, dtype->get_size());
+            op.range = num->get_scaled_range();
+            ops.push_back(op);
+        } else if(dtype->get_type() == T_STRING) {
+            ops.push_back(make_op(FieldPlan::OP_ASCII, dtype, dtype->get_size()));
+        } else {
+            add_span(ops, dtype, dtype->get_size());
+        }
+        return true;
+    }
+
+    switch(dtype->get_type()) {
+    case T_VARSTRING:
+    case T_VARBLOB: {
+        FieldPlan::Op op = make_op(dtype->get_type() == T_VARSTRING ? FieldPlan::OP_VARSTRING :
+                                   FieldPlan::OP_BLOB, dtype);
+        set_count_range(op, dtype->as_array());
+        ops.push_back(op);
+        break;
+    }
+    case T_VARARRAY: {
+        if(depth == FieldPlan::max_depth) {
+            return false;
+        }
+
+        const ArrayType* array = dtype->as_array();
+        size_t begin = ops.size();
+        FieldPlan::Op op = make_op(FieldPlan::OP_VARARRAY, dtype);
+        set_count_range(op, array);
+        ops.push_back(op);
+        if(!compile_unpack(array->get_element_type(), ops, depth + 1)) {
+            return false;
+        }
+
+        if(ops.size() == begin + 1) {
+            // The elements don't take up any space, so there'd be no end to them.
+            return false;
+        }
+
+        if(ops.size() == begin + 2 && ops.back().code == FieldPlan::OP_SPAN) {
+            // Every element is just some bytes, so they can all be copied in one go.
+            op.code = FieldPlan::OP_SPAN_ARRAY;
+            op.size = ops.back().size;
+            ops.resize(begin);
+            ops.push_back(op);
+            break;
+        }
+
+        ops[begin].jump = uint32_t(ops.size());
+        op.code = FieldPlan::OP_VARARRAY_NEXT;
+        op.jump = uint32_t(begin + 1);
+        ops.push_back(op);
+        break;
+    }
+    case T_STRUCT: {
+        const Struct* dstruct = dtype->as_struct();
+        size_t num_fields = dstruct->get_num_fields();
+        for(unsigned int i = 0; i < num_fields; ++i) {
+            if(!compile_unpack(dstruct->get_field(i)->get_type(), ops, depth)) {
+                return false;
+            }
+        }
+        break;
+    }
+    case T_METHOD: {
+        const Method* dmethod = dtype->as_method();
+        size_t num_params = dmethod->get_num_parameters();
+        for(unsigned int i = 0; i < num_params; ++i) {
+            if(!compile_unpack(dmethod->get_parameter(i)->get_type(), ops, depth)) {
+                return false;
+            }
+        }
+        break;
+    }
+    default: {
+        // This case should be impossible, but a default is required by compilers
+        break;
+    }
+    }
+
+    return true;
+}
+
+// compile_skip adds the ops which skip a value of dtype, like DatagramIterator::skip_dtype.
+static void compile_skip(const DistributedType* dtype, std::vector<FieldPlan::Op> &ops)
+{
+    if(dtype->has_fixed_size()) {
+        add_span(ops, dtype, dtype->get_size());
+        return;
+    }
+
+    switch(dtype->get_type()) {
+    case T_VARSTRING:
+    case T_VARBLOB:
+    case T_VARARRAY: {
+        ops.push_back(make_op(FieldPlan::OP_BLOB, dtype));
+        break;
+    }
+    case T_STRUCT: {
+        const Struct* dstruct = dtype->as_struct();
+        size_t num_fields = dstruct->get_num_fields();
+        for(unsigned int i = 0; i < num_fields; ++i) {
+            compile_skip(dstruct->get_field(i)->get_type(), ops);
+        }
+        break;
+    }
+    case T_METHOD: {
+        const Method* dmethod = dtype->as_method();
+        size_t num_params = dmethod->get_num_parameters();
+        for(unsigned int i = 0; i < num_params; ++i) {
+            compile_skip(dmethod->get_parameter(i)->get_type(), ops);
+        }
+        break;
+    }
+    default: {
+        // This case should be impossible, but a default is required by compilers
+        break;
+    }
+    }
+}
+
+FieldPlan::FieldPlan(const Field* field) : m_field(field)
+{
+}
+
+void FieldPlan::compile_all(const File* file)
+{
+    plans.clear();
+    plans.resize(file->get_num_fields());
+    for(unsigned int id = 0; id < plans.size(); ++id) {
+        const Field* field = file->get_field_by_id(id);
+        if(field == nullptr || field->get_type() == nullptr) {
+            continue;
+        }
+
+        std::unique_ptr<FieldPlan> plan(new FieldPlan(field));
+        if(!compile_unpack(field->get_type(), plan->m_unpack, 0)) {
+            continue;
+        }
+        compile_skip(field->get_type(), plan->m_skip);
+        plan->m_unpack.shrink_to_fit();
+        plan->m_skip.shrink_to_fit();
+        plans[id] = std::move(plan);
+    }
+}
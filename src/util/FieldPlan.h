@@ -0,0 +1,105 @@
+#pragma once
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include "dclass/dc/DistributedType.h"
+#include "dclass/dc/NumericRange.h"
+#include "dclass/dc/Field.h"
+namespace dclass
+{
+class File;
+}
+
+// A FieldPlan is the packed layout of a Field's type, flattened into a list of operations when
+// the DC file is loaded. DatagramIterator::unpack_field and skip_field run these lists instead
+// of walking the DistributedType tree for every value they read, and every check the walk
+// would make is decided ahead of time, leaving only the ones which look at the data.
+class FieldPlan
+{
+  public:
+    enum OpCode : uint8_t {
+        // OP_SPAN copies a fixed number of bytes without checking them.
+        OP_SPAN,
+        // OP_ASCII copies a fixed-length string, checking that every character is 7-bit.
+        OP_ASCII,
+        // OP_NUMERIC copies a number, checking that it is within its type's range.
+        OP_NUMERIC,
+        // OP_BLOB copies a length-prefixed blob, checking its length.
+        OP_BLOB,
+        // OP_VARSTRING copies a length-prefixed string, checking its length and characters.
+        OP_VARSTRING,
+        // OP_SPAN_ARRAY copies a length-prefixed array of elements which are each an OP_SPAN.
+        OP_SPAN_ARRAY,
+        // OP_VARARRAY reads the length of an array and jumps to its OP_VARARRAY_NEXT.
+        OP_VARARRAY,
+        // OP_VARARRAY_NEXT jumps back to unpack the next element if there is any of the array
+        //     left, or else checks how many elements there were.
+        OP_VARARRAY_NEXT,
+        // OP_REPEAT starts unpacking the elements of a fixed-size array one at a time,
+        //     which is only done when they have constraints to check.
+        OP_REPEAT,
+        // OP_REPEAT_NEXT jumps back to unpack the next element, if there is one.
+        OP_REPEAT_NEXT,
+    };
+
+    struct Op {
+        OpCode code;
+        // size is the length of a span, string, or number; the size of each element of an
+        //     OP_SPAN_ARRAY; or the number of elements an OP_REPEAT repeats.
+        uint32_t size;
+        // jump is the index of the op a loop continues at.
+        uint32_t jump;
+        // number_type is how the number checked by an OP_NUMERIC is packed.
+        dclass::Type number_type;
+        // range is the range of values allowed by an OP_NUMERIC, as packed (ie. scaled).
+        dclass::NumericRange range;
+        // min_count and max_count are how many elements an array may have.
+        uint64_t min_count;
+        uint64_t max_count;
+        // type is the type the op was compiled from, for error messages.
+        const dclass::DistributedType* type;
+    };
+
+    // max_depth is the deepest that loops in a plan may nest; fields nested any deeper
+    //     don't get a plan, and are unpacked by walking their type instead.
+    static const unsigned int max_depth = 8;
+
+    // compile_all compiles a plan for every field in the file.
+    //     This must be done before any other threads start, as the plans aren't locked.
+    static void compile_all(const dclass::File* file);
+
+    // get returns the field's plan, or nullptr if it doesn't have one.
+    static inline const FieldPlan* get(const dclass::Field* field);
+
+    // unpack_ops returns the ops which copy (and check) a value of the field.
+    inline const std::vector<Op>& unpack_ops() const
+    {
+        return m_unpack;
+    }
+
+    // skip_ops returns the ops which skip a value of the field, which are only ever OP_SPAN,
+    //     or OP_BLOB to skip something length-prefixed. Skipping checks nothing.
+    inline const std::vector<Op>& skip_ops() const
+    {
+        return m_skip;
+    }
+
+  private:
+    FieldPlan(const dclass::Field* field);
+
+    const dclass::Field* m_field;
+    std::vector<Op> m_unpack;
+    std::vector<Op> m_skip;
+
+    // The plans made by compile_all, by field id.
+    static std::vector<std::unique_ptr<FieldPlan> > plans;
+};
+
+inline const FieldPlan* FieldPlan::get(const dclass::Field* field)
+{
+    unsigned int id = field->get_id();
+    if(id < plans.size() && plans[id] != nullptr && plans[id]->m_field == field) {
+        return plans[id].get();
+    }
+    return nullptr;
+}
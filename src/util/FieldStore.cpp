@@ -0,0 +1,346 @@
+#include "FieldStore.h"
+#include <algorithm>
+#include <cassert>
+#include "dclass/dc/File.h"
+#include "dclass/dc/Field.h"
+using namespace dclass;
+
+std::vector<std::unique_ptr<FieldLayout> > FieldLayout::layouts;
+
+FieldLayout::FieldLayout(const Class* dclass) : m_class(dclass)
+{
+    auto add_slot = [this](const Field* field) {
+        const DistributedType* type = field->get_type();
+        Slot slot;
+        slot.field = field;
+        slot.size = (type != nullptr && type->has_fixed_size()) ? type->get_size() : 0;
+        slot.offset = 0;
+        m_slots.push_back(slot);
+    };
+
+    for(unsigned int i = 0; i < dclass->get_num_fields(); ++i) {
+        const Field* field = dclass->get_field(i);
+        if(field->has_keyword(KW_REQUIRED) && !field->as_molecular()) {
+            add_slot(field);
+        }
+        if(field->has_keyword(KW_DB)) {
+            m_db_fields.push_back(field);
+        }
+    }
+    m_num_required = (unsigned int)m_slots.size();
+
+    std::vector<const Field*> ram_fields;
+    for(unsigned int i = 0; i < dclass->get_num_fields(); ++i) {
+        const Field* field = dclass->get_field(i);
+        if(field->has_keyword(KW_RAM)) {
+            ram_fields.push_back(field);
+        }
+    }
+    std::sort(ram_fields.begin(), ram_fields.end(), FieldPtrComp());
+    for(const Field* field : ram_fields) {
+        add_slot(field);
+    }
+
+    for(unsigned int slot = 0; slot < m_slots.size(); ++slot) {
+        std::vector<unsigned int>* sent = slot < m_num_required ? m_required_sent : m_ram_sent;
+        const Field* field = m_slots[slot].field;
+        sent[recipient(false, false)].push_back(slot);
+        if(field->has_any_keyword(KW_BROADCAST | KW_CLRECV)) {
+            sent[recipient(true, false)].push_back(slot);
+        }
+        if(field->has_any_keyword(KW_BROADCAST | KW_CLRECV | KW_OWNRECV)) {
+            sent[recipient(true, true)].push_back(slot);
+        }
+
+        unsigned int id = field->get_id();
+        auto it = std::find_if(m_index.begin(), m_index.end(), [id](const Index &index) {
+            return index.id == id;
+        });
+        if(it == m_index.end()) {
+            m_index.push_back(Index{id, no_slot, no_slot});
+            it = m_index.end() - 1;
+        }
+        (slot < m_num_required ? it->required_slot : it->ram_slot) = slot;
+    }
+    std::sort(m_index.begin(), m_index.end(), [](const Index &lhs, const Index &rhs) {
+        return lhs.id < rhs.id;
+    });
+
+    // Lay out the start of the store: the bitmap (padded out so the table of offsets is
+    // aligned), the table, and then the fixed-size fields.
+    m_bitmap_size = uint32_t(((m_slots.size() + 7) / 8 + 3) & ~size_t(3));
+    uint32_t offset = m_bitmap_size;
+    for(Slot &slot : m_slots) {
+        if(slot.size == 0) {
+            slot.offset = offset;
+            offset += 2 * sizeof(uint32_t);
+        }
+    }
+    for(Slot &slot : m_slots) {
+        if(slot.size != 0) {
+            slot.offset = offset;
+            offset += slot.size;
+        }
+    }
+    m_header_size = offset;
+}
+
+void FieldLayout::compile_all(const File* file)
+{
+    layouts.clear();
+    for(unsigned int i = 0; i < file->get_num_classes(); ++i) {
+        const Class* dclass = file->get_class(i);
+        if(dclass->get_id() >= layouts.size()) {
+            layouts.resize(dclass->get_id() + 1);
+        }
+        layouts[dclass->get_id()].reset(new FieldLayout(dclass));
+    }
+}
+
+const FieldLayout::Index* FieldLayout::find(const Field* field) const
+{
+    unsigned int id = field->get_id();
+    auto it = std::lower_bound(m_index.begin(), m_index.end(), id,
+    [](const Index &index, unsigned int id) {
+        return index.id < id;
+    });
+    if(it == m_index.end() || it->id != id) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+unsigned int FieldLayout::get_required_slot(const Field* field) const
+{
+    const Index* index = find(field);
+    return index != nullptr ? index->required_slot : no_slot;
+}
+
+unsigned int FieldLayout::get_ram_slot(const Field* field) const
+{
+    const Index* index = find(field);
+    return index != nullptr ? index->ram_slot : no_slot;
+}
+
+FieldStore::FieldStore(const FieldLayout* layout) : m_layout(layout),
+    m_data(new uint8_t[layout->m_header_size]()), m_size(layout->m_header_size),
+    m_capacity(layout->m_header_size), m_garbage(0), m_sent(0)
+{
+}
+
+unsigned int FieldStore::count_set(unsigned int first, unsigned int last) const
+{
+    unsigned int count = 0;
+    for(unsigned int slot = first; slot < last; ++slot) {
+        count += is_set(slot);
+    }
+    return count;
+}
+
+void FieldStore::set(unsigned int slot, const uint8_t* data, size_t length)
+{
+    m_sent = 0;
+    for(std::unique_ptr<Snapshot> &snapshot : m_snapshots) {
+        snapshot.reset();
+    }
+
+    const FieldLayout::Slot &info = m_layout->m_slots[slot];
+    uint8_t &bits = m_data[slot / 8];
+    const uint8_t bit = uint8_t(1 << (slot % 8));
+
+    if(info.size != 0) {
+        assert(length == info.size);
+        memcpy(m_data.get() + info.offset, data, info.size);
+        bits |= bit;
+        return;
+    }
+
+    uint32_t entry[2];
+    memcpy(entry, m_data.get() + info.offset, sizeof(entry));
+    if(bits & bit) {
+        if(entry[1] == length) {
+            if(length != 0) {
+                memcpy(m_data.get() + entry[0], data, length);
+            }
+            return;
+        }
+
+        // The old value can't be reused, so it's left behind until the store is compacted.
+        bits &= ~bit;
+        m_garbage += entry[1];
+    }
+
+    if(m_size + length > m_capacity) {
+        uint32_t needed = uint32_t(m_size - m_garbage + length);
+        reallocate(needed + needed / 2);
+    }
+
+    if(length != 0) {
+        memcpy(m_data.get() + m_size, data, length);
+    }
+    entry[0] = m_size;
+    entry[1] = uint32_t(length);
+    memcpy(m_data.get() + info.offset, entry, sizeof(entry));
+    m_size += uint32_t(length);
+    m_data[slot / 8] |= bit;
+}
+
+size_t FieldStore::get_sent_size(bool client_only, bool also_owner) const
+{
+    unsigned int recipient = FieldLayout::recipient(client_only, also_owner);
+    const Snapshot* snapshot = m_snapshots[recipient].get();
+    if(snapshot != nullptr) {
+        return snapshot->data.size();
+    }
+    return required_size(recipient) + other_size(recipient);
+}
+
+void FieldStore::add_required(DatagramPtr dg, bool client_only, bool also_owner)
+{
+    unsigned int recipient = FieldLayout::recipient(client_only, also_owner);
+
+    // Most objects change between being sent, or aren't sent again at all, so the snapshot is
+    // only worth its memory the second time round.
+    if(m_snapshots[recipient] == nullptr) {
+        uint8_t bit = uint8_t(1 << recipient);
+        if(!(m_sent & bit)) {
+            m_sent |= bit;
+            size_t length = required_size(recipient);
+            write_required(recipient, dg->add_buffer(dgsize_t(length)));
+            return;
+        }
+        make_snapshot(recipient);
+    }
+
+    const Snapshot &snapshot = *m_snapshots[recipient];
+    dg->add_data(snapshot.data.data(), dgsize_t(snapshot.required_size));
+}
+
+void FieldStore::add_other(DatagramPtr dg, bool client_only, bool also_owner)
+{
+    unsigned int recipient = FieldLayout::recipient(client_only, also_owner);
+    const Snapshot* snapshot = m_snapshots[recipient].get();
+    if(snapshot == nullptr) {
+        size_t length = other_size(recipient);
+        write_other(recipient, dg->add_buffer(dgsize_t(length)));
+        return;
+    }
+
+    dg->add_data(snapshot->data.data() + snapshot->required_size,
+                 dgsize_t(snapshot->data.size() - snapshot->required_size));
+}
+
+size_t FieldStore::get_snapshot_size() const
+{
+    size_t size = 0;
+    for(const std::unique_ptr<Snapshot> &snapshot : m_snapshots) {
+        if(snapshot != nullptr) {
+            size += sizeof(Snapshot) + snapshot->data.capacity();
+        }
+    }
+    return size;
+}
+
+void FieldStore::make_snapshot(unsigned int recipient)
+{
+    std::unique_ptr<Snapshot> snapshot(new Snapshot);
+    snapshot->data.resize(required_size(recipient) + other_size(recipient));
+    uint8_t* out = write_required(recipient, snapshot->data.data());
+    snapshot->required_size = out - snapshot->data.data();
+    write_other(recipient, out);
+    m_snapshots[recipient] = std::move(snapshot);
+}
+
+size_t FieldStore::required_size(unsigned int recipient) const
+{
+    size_t length = 0;
+    for(unsigned int slot : m_layout->m_required_sent[recipient]) {
+        length += get(slot).size();
+    }
+    return length;
+}
+
+size_t FieldStore::other_size(unsigned int recipient) const
+{
+    size_t length = sizeof(uint16_t);
+    for(unsigned int slot : m_layout->m_ram_sent[recipient]) {
+        if(is_set(slot)) {
+            length += sizeof(uint16_t) + get(slot).size();
+        }
+    }
+    return length;
+}
+
+uint8_t* FieldStore::write_required(unsigned int recipient, uint8_t* out) const
+{
+    for(unsigned int slot : m_layout->m_required_sent[recipient]) {
+        DatagramSpan value = get(slot);
+        if(!value.empty()) {
+            memcpy(out, value.data(), value.size());
+            out += value.size();
+        }
+    }
+    return out;
+}
+
+uint8_t* FieldStore::write_other(unsigned int recipient, uint8_t* out) const
+{
+    // The ram slots are in order of field id, which is the order the fields are sent in.
+    uint8_t* count_at = out;
+    uint16_t count = 0;
+    out += sizeof(uint16_t);
+    for(unsigned int slot : m_layout->m_ram_sent[recipient]) {
+        if(!is_set(slot)) {
+            continue;
+        }
+
+        uint16_t id = swap_le(uint16_t(m_layout->get_field(slot)->get_id()));
+        memcpy(out, &id, sizeof(id));
+        out += sizeof(id);
+
+        DatagramSpan value = get(slot);
+        if(!value.empty()) {
+            memcpy(out, value.data(), value.size());
+            out += value.size();
+        }
+        ++count;
+    }
+    count = swap_le(count);
+    memcpy(count_at, &count, sizeof(count));
+    return out;
+}
+
+void FieldStore::shrink_to_fit()
+{
+    if(m_garbage != 0 || m_capacity != m_size) {
+        reallocate(m_size - m_garbage);
+    }
+}
+
+void FieldStore::reallocate(uint32_t capacity)
+{
+    assert(capacity >= m_size - m_garbage);
+
+    std::unique_ptr<uint8_t[]> data(new uint8_t[capacity]);
+    uint32_t size = m_layout->m_header_size;
+    memcpy(data.get(), m_data.get(), size);
+
+    for(unsigned int slot = 0; slot < m_layout->get_num_slots(); ++slot) {
+        const FieldLayout::Slot &info = m_layout->m_slots[slot];
+        if(info.size != 0 || !is_set(slot)) {
+            continue;
+        }
+
+        uint32_t entry[2];
+        memcpy(entry, m_data.get() + info.offset, sizeof(entry));
+        memcpy(data.get() + size, m_data.get() + entry[0], entry[1]);
+        entry[0] = size;
+        memcpy(data.get() + info.offset, entry, sizeof(entry));
+        size += entry[1];
+    }
+
+    m_data = std::move(data);
+    m_size = size;
+    m_capacity = capacity;
+    m_garbage = 0;
+}
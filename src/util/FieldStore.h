@@ -0,0 +1,231 @@
+#pragma once
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include "Datagram.h"
+#include "dclass/dc/DistributedType.h"
+#include "dclass/dc/Class.h"
+namespace dclass
+{
+class File;
+}
+
+// A FieldLayout assigns a slot to every field a distributed object of a Class stores, when the
+// DC file is loaded: first its required fields, in the order the class declares them (the order
+// they are sent in), then its ram fields, in order of field id. A field which is both has a slot
+// of each kind. Fields of a fixed size are given a place of their own in a FieldStore, and the
+// others an entry in its table of offsets.
+class FieldLayout
+{
+  public:
+    static const unsigned int no_slot = ~0u;
+
+    FieldLayout(const dclass::Class* dclass);
+
+    // compile_all makes the layout of every class in the file.
+    //     This must be done before any other threads start, as the layouts aren't locked.
+    static void compile_all(const dclass::File* file);
+
+    // get returns the class's layout, or nullptr if it doesn't have one.
+    static inline const FieldLayout* get(const dclass::Class* dclass);
+
+    inline const dclass::Class* get_class() const
+    {
+        return m_class;
+    }
+
+    // get_num_slots returns the number of slots; the required slots are [0, get_num_required()),
+    //     and the ram slots [get_num_required(), get_num_slots()).
+    inline unsigned int get_num_slots() const
+    {
+        return (unsigned int)m_slots.size();
+    }
+    inline unsigned int get_num_required() const
+    {
+        return m_num_required;
+    }
+
+    // get_field returns the field stored in the slot.
+    inline const dclass::Field* get_field(unsigned int slot) const
+    {
+        return m_slots[slot].field;
+    }
+
+    // get_required_slot and get_ram_slot return the slot the field is stored in as a required or
+    //     ram field, or no_slot if it isn't one.
+    unsigned int get_required_slot(const dclass::Field* field) const;
+    unsigned int get_ram_slot(const dclass::Field* field) const;
+
+    // get_required_slots and get_ram_slots return the slots of the fields which are sent to
+    //     whoever an object's fields are being sent to: everyone (all of them), clients
+    //     (broadcast and clrecv fields), or its owner (which also gets ownrecv fields).
+    inline const std::vector<unsigned int>& get_required_slots(bool client_only,
+            bool also_owner) const
+    {
+        return m_required_sent[recipient(client_only, also_owner)];
+    }
+    inline const std::vector<unsigned int>& get_ram_slots(bool client_only, bool also_owner) const
+    {
+        return m_ram_sent[recipient(client_only, also_owner)];
+    }
+
+    // get_db_fields returns the class's db fields, in the order the class declares them.
+    inline const std::vector<const dclass::Field*>& get_db_fields() const
+    {
+        return m_db_fields;
+    }
+
+  private:
+    friend class FieldStore;
+
+    struct Slot {
+        const dclass::Field* field;
+        // size is the size of the field if it's fixed, or else 0.
+        uint32_t size;
+        // offset is where a fixed-size field is kept in the store, or else where its entry
+        //     is in the table of offsets.
+        uint32_t offset;
+    };
+
+    // An Index finds the slots of a field by its id.
+    struct Index {
+        unsigned int id;
+        unsigned int required_slot;
+        unsigned int ram_slot;
+    };
+
+    const dclass::Class* m_class;
+    std::vector<Slot> m_slots;
+    unsigned int m_num_required;
+    std::vector<Index> m_index; // sorted by id
+
+    // The slots sent to everyone, to clients, and to owners.
+    std::vector<unsigned int> m_required_sent[3];
+    std::vector<unsigned int> m_ram_sent[3];
+    std::vector<const dclass::Field*> m_db_fields;
+
+    static inline unsigned int recipient(bool client_only, bool also_owner)
+    {
+        return client_only ? (also_owner ? 2 : 1) : 0;
+    }
+
+    // The store starts with a bit for each slot which is set, then the table of offsets, then
+    // the fixed-size fields; the values of the rest come after, in no particular order.
+    uint32_t m_bitmap_size;
+    uint32_t m_header_size;
+
+    const Index* find(const dclass::Field* field) const;
+
+    // The layouts made by compile_all, by class id.
+    static std::vector<std::unique_ptr<FieldLayout> > layouts;
+};
+
+inline const FieldLayout* FieldLayout::get(const dclass::Class* dclass)
+{
+    unsigned int id = dclass->get_id();
+    if(id < layouts.size() && layouts[id] != nullptr && layouts[id]->m_class == dclass) {
+        return layouts[id].get();
+    }
+    return nullptr;
+}
+
+// A FieldStore keeps the values of an object's fields, laid out by a FieldLayout, in a single
+// block of memory instead of a vector per field in a map (which is several allocations, and
+// far more bookkeeping than data, for an object with a handful of small fields). Fixed-size
+// values are overwritten in place; a variable-size value that changes length is written after
+// the others, and the block is compacted when it runs out of room.
+//
+// It also keeps the fields sent to each kind of recipient already encoded, as a snapshot, once
+// an object has been sent to more than one (everyone with interest in its zone) between changes.
+class FieldStore
+{
+  public:
+    FieldStore(const FieldLayout* layout);
+    FieldStore(const FieldStore&) = delete;
+    FieldStore &operator=(const FieldStore&) = delete;
+
+    inline const FieldLayout* get_layout() const
+    {
+        return m_layout;
+    }
+
+    // is_set returns true if the slot has been given a value.
+    inline bool is_set(unsigned int slot) const
+    {
+        return (m_data[slot / 8] & (1 << (slot % 8))) != 0;
+    }
+
+    // count_set returns how many of the slots in [first, last) have been given a value.
+    unsigned int count_set(unsigned int first, unsigned int last) const;
+
+    // get returns the value in the slot, which is empty if it hasn't been set.
+    inline DatagramSpan get(unsigned int slot) const
+    {
+        if(!is_set(slot)) {
+            return DatagramSpan(nullptr, 0);
+        }
+
+        const FieldLayout::Slot &info = m_layout->m_slots[slot];
+        if(info.size != 0) {
+            return DatagramSpan(m_data.get() + info.offset, dgsize_t(info.size));
+        }
+
+        uint32_t entry[2];
+        memcpy(entry, m_data.get() + info.offset, sizeof(entry));
+        return DatagramSpan(m_data.get() + entry[0], dgsize_t(entry[1]));
+    }
+
+    // set copies a value into the slot.
+    void set(unsigned int slot, const uint8_t* data, size_t length);
+    inline void set(unsigned int slot, const std::vector<uint8_t> &data)
+    {
+        set(slot, data.data(), data.size());
+    }
+
+    // shrink_to_fit compacts the store, and frees any room it has to spare.
+    void shrink_to_fit();
+
+    // get_sent_size returns the number of bytes add_required and add_other append between them.
+    size_t get_sent_size(bool client_only, bool also_owner) const;
+
+    // add_required appends the values of the required fields sent to a kind of recipient (see
+    //     FieldLayout::get_required_slots), one after another, and add_other appends the number
+    //     of its ram fields which are set followed by the id and value of each. The first time
+    //     the fields are sent to a kind of recipient after one is set, they're encoded straight
+    //     into the datagram; if they're sent again before the next is set, they're kept encoded
+    //     as a snapshot, which is copied in whole from then on.
+    void add_required(DatagramPtr dg, bool client_only, bool also_owner);
+    void add_other(DatagramPtr dg, bool client_only, bool also_owner);
+
+    // get_snapshot_size returns the number of bytes the store's snapshots take up.
+    size_t get_snapshot_size() const;
+
+  private:
+    // A Snapshot is the fields sent to one kind of recipient, as add_required and then
+    // add_other append them. It's freed as soon as a field is set.
+    struct Snapshot {
+        std::vector<uint8_t> data;
+        size_t required_size;
+    };
+
+    const FieldLayout* m_layout;
+    std::unique_ptr<uint8_t[]> m_data;
+    uint32_t m_size;     // the number of bytes used, including old values
+    uint32_t m_capacity;
+    uint32_t m_garbage;  // the number of bytes taken up by old values
+    uint8_t m_sent;      // a bit for each kind of recipient sent the fields since one was set
+    std::unique_ptr<Snapshot> m_snapshots[3]; // by recipient
+
+    // make_snapshot encodes the recipient's snapshot.
+    void make_snapshot(unsigned int recipient);
+
+    // required_size and other_size return the length of what write_required and write_other
+    //     encode to "out", which must have room for it; they return the end of what they wrote.
+    size_t required_size(unsigned int recipient) const;
+    size_t other_size(unsigned int recipient) const;
+    uint8_t* write_required(unsigned int recipient, uint8_t* out) const;
+    uint8_t* write_other(unsigned int recipient, uint8_t* out) const;
+
+    // reallocate moves the store to a new block of the given capacity, leaving out old values.
+    void reallocate(uint32_t capacity);
+};
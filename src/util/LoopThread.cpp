@@ -0,0 +1,58 @@
+#include "LoopThread.h"
+
+LoopThread::LoopThread() : m_loop(uvw::Loop::create())
+{
+}
+
+LoopThread::~LoopThread()
+{
+    stop();
+}
+
+void LoopThread::start()
+{
+    assert(m_thread == nullptr);
+
+    m_thread.reset(new std::thread(std::bind(&LoopThread::run, this)));
+
+    std::unique_lock<std::mutex> lock(m_ready_lock);
+    m_ready_cv.wait(lock, [this]() {
+        return m_ready;
+    });
+}
+
+void LoopThread::stop()
+{
+    if(m_thread == nullptr) {
+        return;
+    }
+
+    std::shared_ptr<uvw::Loop> loop = m_loop;
+    m_tasks.enqueue_task([loop]() {
+        loop->stop();
+    });
+    m_thread->join();
+    m_thread.reset();
+}
+
+void LoopThread::run()
+{
+    m_tasks.init_queue(m_loop, std::this_thread::get_id());
+    m_tasks.make_current();
+
+    {
+        std::lock_guard<std::mutex> lock(m_ready_lock);
+        m_ready = true;
+    }
+    m_ready_cv.notify_all();
+
+    // The queue's flush handle keeps the loop running until stop is called.
+    m_loop->run();
+
+    // Close whatever is still open on the loop, and run it until they've finished closing,
+    // so that nothing is left registered on it when it is closed.
+    m_loop->walk([](uvw::BaseHandle &handle) {
+        handle.close();
+    });
+    m_loop->run();
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "deps/uvw/uvw.hpp"
+#include "util/TaskQueue.h"
+
+// A LoopThread is an event loop of its own, run on a thread of its own, for a role that
+// spreads its sockets over more than the main loop (e.g. the ClientAgent's "threads").
+// Anything created by a task running on it (NetworkClients, Timeouts, acceptors...) finds
+// the loop through TaskQueue::current(), and stays on it.
+class LoopThread
+{
+  public:
+    LoopThread();
+    ~LoopThread();
+
+    // start spawns the thread, and returns once its loop is ready for tasks.
+    void start();
+    // stop stops the loop once the tasks already queued for it have run, closes the handles
+    //     still open on it, and waits for the thread to finish.
+    void stop();
+
+    inline TaskQueue &tasks()
+    {
+        return m_tasks;
+    }
+    inline const std::shared_ptr<uvw::Loop> &loop() const
+    {
+        return m_loop;
+    }
+
+  private:
+    std::shared_ptr<uvw::Loop> m_loop;
+    TaskQueue m_tasks;
+    std::unique_ptr<std::thread> m_thread;
+
+    std::mutex m_ready_lock;
+    std::condition_variable m_ready_cv;
+    bool m_ready = false;
+
+    void run();
+};
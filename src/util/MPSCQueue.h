@@ -0,0 +1,211 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+// An MPSCQueue is a lock-free, multi-producer/single-consumer FIFO.
+// Any number of threads may push concurrently, but only one thread at a time
+// may pop from the queue (the "consumer").
+//
+// The fast path is a bounded ring of cells, each tagged with a sequence number
+// so that producers can claim a slot with a single atomic increment and publish
+// it with a release-store; the consumer never takes a lock to pop.
+//
+// Pushing never blocks: if the ring is full, values go to a mutex-guarded
+// overflow list instead.  A producer keeps using the overflow until the consumer
+// has caught up with all of it, so values from one producer always come out in
+// the order they went in.
+//
+// The consumer may park itself with wait() when the queue is empty.  Producers
+// only touch the parking lock when the consumer is actually parked.
+template<typename T>
+class MPSCQueue
+{
+  public:
+    // The capacity of the ring is rounded up to the next power of two.
+    explicit MPSCQueue(size_t capacity)
+    {
+        size_t cap = 2;
+        while(cap < capacity) {
+            cap <<= 1;
+        }
+
+        m_mask = cap - 1;
+        m_cells.reset(new Cell[cap]);
+        for(size_t i = 0; i < cap; ++i) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+    // push appends a value to the queue.  Safe to call from any thread.
+    void push(T &&value)
+    {
+        if(m_overflow_size.load(std::memory_order_acquire) != 0 || !try_push_ring(value)) {
+            std::lock_guard<std::mutex> lock(m_overflow_lock);
+            m_overflow.push_back(std::move(value));
+            m_overflow_size.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        wake_consumer();
+    }
+
+    // try_pop removes the value at the head of the queue; returns false if empty.
+    // Must only be called from the consumer thread.
+    bool try_pop(T &value)
+    {
+        if(!m_spilled.empty()) {
+            // Values that made it into the ring before we took the overflow
+            // may be older than the overflowed ones, so they go first.
+            if((intptr_t)(m_spill_pos - m_dequeue_pos) > 0 && try_pop_ring(value)) {
+                return true;
+            }
+
+            value = std::move(m_spilled.front());
+            m_spilled.pop_front();
+            m_overflow_size.fetch_sub(1, std::memory_order_release);
+            return true;
+        }
+
+        if(try_pop_ring(value)) {
+            return true;
+        }
+
+        if(m_overflow_size.load(std::memory_order_acquire) == 0) {
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_overflow_lock);
+            m_spilled.swap(m_overflow);
+            m_spill_pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+
+        return try_pop(value);
+    }
+
+    // empty returns true if there is no value ready to be popped.
+    // Must only be called from the consumer thread.
+    bool empty() const
+    {
+        const Cell &cell = m_cells[m_dequeue_pos & m_mask];
+        return cell.sequence.load(std::memory_order_acquire) != m_dequeue_pos + 1
+               && m_overflow_size.load(std::memory_order_acquire) == 0;
+    }
+
+    // overflow_size returns the number of values that were pushed while the ring was full and
+    //     haven't been popped yet; nothing bounds it but memory.  Safe to call from any thread.
+    size_t overflow_size() const
+    {
+        return m_overflow_size.load(std::memory_order_relaxed);
+    }
+
+    // wait parks the consumer until the queue is non-empty or until interrupt() is called.
+    // Must only be called from the consumer thread.
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m_park_lock);
+        m_parked.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while(empty() && !m_interrupted) {
+            m_park_cv.wait(lock);
+        }
+        m_interrupted = false;
+        m_parked.store(false, std::memory_order_relaxed);
+    }
+
+    // interrupt wakes up the consumer if it is parked (or makes its next wait()
+    // return immediately), even if the queue is still empty.
+    void interrupt()
+    {
+        std::lock_guard<std::mutex> lock(m_park_lock);
+        m_interrupted = true;
+        m_park_cv.notify_one();
+    }
+
+  private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    // try_push_ring moves the value into the ring; returns false (leaving the value
+    // untouched) if the ring is full.
+    bool try_push_ring(T &value)
+    {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while(true) {
+            Cell &cell = m_cells[pos & m_mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if(diff == 0) {
+                if(m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(diff < 0) {
+                // The consumer hasn't freed this slot yet: we're full.
+                return false;
+            } else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop_ring(T &value)
+    {
+        Cell &cell = m_cells[m_dequeue_pos & m_mask];
+        size_t seq = cell.sequence.load(std::memory_order_acquire);
+        if((intptr_t)seq - (intptr_t)(m_dequeue_pos + 1) < 0) {
+            return false;
+        }
+
+        value = std::move(cell.value);
+        cell.value = T();
+        cell.sequence.store(m_dequeue_pos + m_mask + 1, std::memory_order_release);
+        ++m_dequeue_pos;
+        return true;
+    }
+
+    void wake_consumer()
+    {
+        // Pairs with the fence in wait(): either the consumer sees our value,
+        // or we see that it has parked and ring the bell.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_parked.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(m_park_lock);
+            m_park_cv.notify_one();
+        }
+    }
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+
+    // Producer and consumer positions live on separate cache lines.
+    alignas(64) std::atomic<size_t> m_enqueue_pos {0};
+    alignas(64) size_t m_dequeue_pos = 0;
+
+    // The overflow list, and the number of overflowed values not yet popped
+    // (including those the consumer has already moved into m_spilled).
+    alignas(64) std::atomic<size_t> m_overflow_size {0};
+    std::mutex m_overflow_lock;
+    std::deque<T> m_overflow;
+    // Consumer-only: overflowed values taken out of m_overflow, and the ring
+    // position at the time they were taken.
+    std::deque<T> m_spilled;
+    size_t m_spill_pos = 0;
+
+    // Parking state for the consumer; only touched when the queue runs dry.
+    alignas(64) std::atomic<bool> m_parked {false};
+    bool m_interrupted = false;
+    std::mutex m_park_lock;
+    std::condition_variable m_park_cv;
+};
@@ -0,0 +1,143 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// A TaskCallback is a move-only void() callable, for the tasks run by a TaskQueue.
+// Unlike a std::function it never has to copy what it holds, and anything up to inline_size
+// bytes (most lambdas: a few pointers, handles and shared_ptrs) is stored inside it, so
+// wrapping a lambda doesn't allocate.
+class TaskCallback
+{
+  public:
+    static const size_t inline_size = 48;
+
+    TaskCallback() noexcept : m_ops(nullptr)
+    {
+    }
+    TaskCallback(std::nullptr_t) noexcept : m_ops(nullptr)
+    {
+    }
+
+    template<typename F, typename = typename std::enable_if<
+                 !std::is_same<typename std::decay<F>::type, TaskCallback>::value>::type>
+    TaskCallback(F &&func)
+    {
+        typedef typename std::decay<F>::type Func;
+        if constexpr(sizeof(Func) <= inline_size && alignof(Func) <= alignof(std::max_align_t) &&
+                     std::is_nothrow_move_constructible<Func>::value) {
+            new (m_storage) Func(std::forward<F>(func));
+            m_ops = inline_ops<Func>();
+        } else {
+            *reinterpret_cast<Func**>(m_storage) = new Func(std::forward<F>(func));
+            m_ops = heap_ops<Func>();
+        }
+    }
+
+    TaskCallback(TaskCallback &&other) noexcept : m_ops(other.m_ops)
+    {
+        if(m_ops != nullptr) {
+            m_ops->relocate(other.m_storage, m_storage);
+            other.m_ops = nullptr;
+        }
+    }
+
+    TaskCallback &operator=(TaskCallback &&other) noexcept
+    {
+        if(this != &other) {
+            reset();
+            m_ops = other.m_ops;
+            if(m_ops != nullptr) {
+                m_ops->relocate(other.m_storage, m_storage);
+                other.m_ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    TaskCallback(const TaskCallback&) = delete;
+    TaskCallback &operator=(const TaskCallback&) = delete;
+
+    ~TaskCallback()
+    {
+        reset();
+    }
+
+    // reset destroys the callable, leaving the TaskCallback empty.
+    void reset() noexcept
+    {
+        if(m_ops != nullptr) {
+            m_ops->destroy(m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+    void operator()()
+    {
+        m_ops->invoke(m_storage);
+    }
+
+    explicit operator bool() const
+    {
+        return m_ops != nullptr;
+    }
+
+  private:
+    // Ops are how a TaskCallback calls, moves and destroys the type of callable it holds.
+    struct Ops {
+        void (*invoke)(void *storage);
+        // relocate moves the callable from one storage to another, destroying the original.
+        void (*relocate)(void *from, void *to) noexcept;
+        void (*destroy)(void *storage) noexcept;
+    };
+
+    template<typename Func>
+    static void invoke_inline(void *storage)
+    {
+        (*static_cast<Func*>(storage))();
+    }
+    template<typename Func>
+    static void relocate_inline(void *from, void *to) noexcept
+    {
+        new (to) Func(std::move(*static_cast<Func*>(from)));
+        static_cast<Func*>(from)->~Func();
+    }
+    template<typename Func>
+    static void destroy_inline(void *storage) noexcept
+    {
+        static_cast<Func*>(storage)->~Func();
+    }
+
+    template<typename Func>
+    static void invoke_heap(void *storage)
+    {
+        (**static_cast<Func**>(storage))();
+    }
+    template<typename Func>
+    static void relocate_heap(void *from, void *to) noexcept
+    {
+        *static_cast<Func**>(to) = *static_cast<Func**>(from);
+    }
+    template<typename Func>
+    static void destroy_heap(void *storage) noexcept
+    {
+        delete *static_cast<Func**>(storage);
+    }
+
+    template<typename Func>
+    static const Ops *inline_ops()
+    {
+        static const Ops ops = {&invoke_inline<Func>, &relocate_inline<Func>, &destroy_inline<Func>};
+        return &ops;
+    }
+    template<typename Func>
+    static const Ops *heap_ops()
+    {
+        static const Ops ops = {&invoke_heap<Func>, &relocate_heap<Func>, &destroy_heap<Func>};
+        return &ops;
+    }
+
+    alignas(std::max_align_t) unsigned char m_storage[inline_size];
+    const Ops *m_ops;
+};
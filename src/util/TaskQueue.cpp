@@ -1,6 +1,14 @@
 #include "TaskQueue.h"
+#include "TimerWheel.h"
 
-TaskQueue TaskQueue::singleton;
+TaskQueue &TaskQueue::singleton = *new TaskQueue;
+
+// The queue of the LoopThread running on this thread, if any.
+static thread_local TaskQueue *current_queue = nullptr;
+
+TaskQueue::TaskQueue()
+{
+}
 
 TaskQueue::~TaskQueue()
 {
@@ -11,6 +19,31 @@ TaskQueue::~TaskQueue()
     }
 }
 
+TaskQueue &TaskQueue::current()
+{
+    return current_queue != nullptr ? *current_queue : singleton;
+}
+
+const std::shared_ptr<uvw::Loop> &TaskQueue::loop() const
+{
+    return m_loop != nullptr ? m_loop : g_loop;
+}
+
+bool TaskQueue::in_loop_thread() const
+{
+    return std::this_thread::get_id() == (m_loop != nullptr ? m_thread_id : g_main_thread_id);
+}
+
+TimerWheel &TaskQueue::timers()
+{
+    assert(in_loop_thread());
+
+    if(m_timers == nullptr) {
+        m_timers.reset(new TimerWheel(loop()));
+    }
+    return *m_timers;
+}
+
 void TaskQueue::init_queue()
 {
     assert(std::this_thread::get_id() == g_main_thread_id);
@@ -21,44 +54,63 @@ void TaskQueue::init_queue()
     });
 }
 
+void TaskQueue::init_queue(const std::shared_ptr<uvw::Loop> &loop, std::thread::id thread_id)
+{
+    m_loop = loop;
+    m_thread_id = thread_id;
+
+    m_flush_handle = loop->resource<uvw::AsyncHandle>();
+    m_flush_handle->on<uvw::AsyncEvent>([self = this](const uvw::AsyncEvent&, uvw::AsyncHandle&) {
+        self->flush_tasks();
+    });
+}
+
+void TaskQueue::make_current()
+{
+    assert(in_loop_thread());
+    current_queue = this;
+}
+
 void TaskQueue::enqueue_task(TaskCallback task)
 {
-    {
-        std::lock_guard<std::mutex> lock(m_queue_mutex);
-        m_task_queue.push(task);        
-    }
+    m_task_queue.push(std::move(task));
 
-    if(std::this_thread::get_id() != g_main_thread_id) {
-        m_flush_handle->send();
-    } else {
+    if(in_loop_thread()) {
         flush_tasks();
+    } else if(!m_wakeup_pending.exchange(true, std::memory_order_acq_rel)) {
+        m_flush_handle->send();
     }
 }
 
 void TaskQueue::flush_tasks()
 {
-    // We need to make absolutely certain this is running within the main (loop's) thread.
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    // We need to make absolutely certain this is running within the loop's thread.
+    assert(in_loop_thread());
 
     if(m_in_flush) {
-        // We're already in the middle of a flush_tasks operation.    
+        // We're already in the middle of a flush_tasks operation.
         return;
     }
 
     m_in_flush = true;
-    std::queue<TaskCallback> pending_tasks;
 
-    {
-        std::lock_guard<std::mutex> lock(m_queue_mutex);
-        pending_tasks = std::move(m_task_queue);
-    }
-
-    {
-        while(!pending_tasks.empty()) {
-            TaskCallback task = pending_tasks.front();
-            pending_tasks.pop();
+    // Tasks enqueued on this thread by a task we're running don't ring the flush handle,
+    // and while m_wakeup_pending is still set, tasks from other threads don't either:
+    // so keep going until there are none left.
+    TaskCallback task;
+    while(true) {
+        while(m_task_queue.try_pop(task)) {
             task();
+            task.reset();
+        }
+
+        // Whoever enqueues a task after this will ring the flush handle again. Clearing the
+        // flag with an exchange makes sure we see the tasks of anyone who saw it set.
+        m_wakeup_pending.exchange(false, std::memory_order_acq_rel);
+        if(m_task_queue.empty()) {
+            break;
         }
+        m_wakeup_pending.store(true, std::memory_order_relaxed);
     }
 
     m_in_flush = false;
@@ -1,24 +1,54 @@
 #pragma once
 
-#include <queue>
-#include <mutex>
+#include <atomic>
 #include <thread>
 #include "core/global.h"
 #include "deps/uvw/uvw.hpp"
+#include "MPSCQueue.h"
+#include "TaskCallback.h"
+class TimerWheel;
 
-typedef std::function<void()> TaskCallback;
-
+// A TaskQueue runs tasks on the thread that runs its loop, in the order they were enqueued.
+// The singleton belongs to the main loop (g_loop); a LoopThread has one of its own.
+//
+// Tasks from other threads go through a lock-free queue, and only the first one since the
+// loop last emptied it rings the flush handle; the rest are picked up by that same flush.
 class TaskQueue
 {
     private:
-        std::mutex m_queue_mutex;
-        std::queue<TaskCallback> m_task_queue;
+        MPSCQueue<TaskCallback> m_task_queue {1024};
         std::shared_ptr<uvw::AsyncHandle> m_flush_handle;
+        // Set once the flush handle has been rung, until the queue is found empty again.
+        std::atomic<bool> m_wakeup_pending {false};
         bool m_in_flush = false;
+        // Unset for the singleton, which always follows g_loop and g_main_thread_id.
+        std::shared_ptr<uvw::Loop> m_loop;
+        std::thread::id m_thread_id;
+        std::unique_ptr<TimerWheel> m_timers;
     public:
+        TaskQueue();
         ~TaskQueue();
-        static TaskQueue singleton;
+        // N.B. the singleton is never destroyed, so that it is still there for the participants
+        //     the MessageDirector singleton releases as it is destroyed at exit.
+        static TaskQueue &singleton;
+
+        // current returns the TaskQueue for the loop run by the calling thread: the singleton,
+        //     unless the caller is on a LoopThread.
+        static TaskQueue &current();
+
         void init_queue();
+        // init_queue sets up a queue for "loop", run by the thread "thread_id"; that thread
+        //     should then call make_current.
+        void init_queue(const std::shared_ptr<uvw::Loop> &loop, std::thread::id thread_id);
+        void make_current();
+
+        // loop returns the loop the queue's tasks run on.
+        const std::shared_ptr<uvw::Loop> &loop() const;
+        // in_loop_thread returns true if called from the thread running the queue's loop.
+        bool in_loop_thread() const;
+        // timers returns the TimerWheel for the queue's loop. Must be called from its thread.
+        TimerWheel &timers();
+
         void enqueue_task(TaskCallback task);
         void flush_tasks();
 };
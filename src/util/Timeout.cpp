@@ -2,23 +2,23 @@
 #include "core/global.h"
 
 Timeout::Timeout(unsigned long ms, std::function<void()> f) :
-    m_loop(g_loop),
-    m_timer(nullptr),
+    m_tasks(&TaskQueue::current()),
+    m_started(false),
     m_callback_disabled(false)
 {
     initialize(ms, f);
 }
 
 Timeout::Timeout() :
-    m_loop(g_loop),
-    m_timer(nullptr),
+    m_tasks(&TaskQueue::current()),
+    m_started(false),
     m_callback_disabled(false)
 {
 }
 
 void Timeout::initialize(unsigned long ms, TimeoutCallback callback)
 {
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    assert(m_tasks->in_loop_thread());
 
     m_timeout_interval = ms;
     m_callback = callback;
@@ -26,11 +26,10 @@ void Timeout::initialize(unsigned long ms, TimeoutCallback callback)
 
 void Timeout::setup()
 {
-    assert(m_timer == nullptr);
+    assert(!m_started);
 
-    m_timer = m_loop->resource<uvw::TimerHandle>();
-
-    m_timer->on<uvw::TimerEvent>([self = this](const uvw::TimerEvent&, uvw::TimerHandle&) {
+    m_started = true;
+    m_timer.set_callback([self = this]() {
         self->timer_callback();
     });
 }
@@ -39,10 +38,9 @@ void Timeout::destroy_timer()
 {
     m_callback = nullptr;
 
-    if(m_timer) {
-        m_timer->stop();
-        m_timer->close();
-        m_timer = nullptr;
+    if(m_started) {
+        m_timer.stop();
+        m_started = false;
     }
 
     delete this;
@@ -50,7 +48,7 @@ void Timeout::destroy_timer()
 
 void Timeout::timer_callback()
 {
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    assert(m_tasks->in_loop_thread());
 
     if(m_callback != nullptr && !m_callback_disabled.exchange(true)) {
         m_callback();
@@ -61,29 +59,28 @@ void Timeout::timer_callback()
 
 void Timeout::reset()
 {
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    assert(m_tasks->in_loop_thread());
 
-    if(m_timer == nullptr) {
+    if(!m_started) {
         setup();
     }
 
-    m_timer->stop();
-    m_timer->start(uvw::TimerHandle::Time{m_timeout_interval}, uvw::TimerHandle::Time{0});
+    m_timer.start(m_tasks->timers(), m_timeout_interval);
 }
 
 bool Timeout::cancel()
 {
     const bool already_cancelled = !m_callback_disabled.exchange(true);
 
-    if(std::this_thread::get_id() != g_main_thread_id) {
-        TaskQueue::singleton.enqueue_task([self = this]() {
+    if(!m_tasks->in_loop_thread()) {
+        m_tasks->enqueue_task([self = this]() {
             self->cancel();
         });
 
         return already_cancelled;
     }
 
-    if(m_timer != nullptr) {
+    if(m_started) {
         destroy_timer();
     }
 
@@ -2,17 +2,18 @@
 #include <functional>
 #include <atomic>
 #include <memory>
-#include "deps/uvw/uvw.hpp"
 #include "util/TaskQueue.h"
+#include "util/TimerWheel.h"
 
-// This class abstracts the uvw::TimerHandle timer in order to provide a generic
+// This class abstracts a TimerWheel timer in order to provide a generic
 // facility for timeouts. Once constructed, this class will wait a certain
 // amount of time and then call the function. The timeout must be canceled
 // with cancel() before you invalidate your callback.
 //
 // You must start the timeout with start().
 //
-// NOTE: The thread that calls the function is the main thread.
+// NOTE: The thread that calls the function is the one running the loop the Timeout was
+// created on: the main thread, unless it was created on a LoopThread.
 // Make sure that your callback doesn't have unintended consequences on performance.
 // NOTE 2: The Timeout deletes itself under 2 different conditions:
 // a) The timeout has been reached
@@ -44,8 +45,9 @@ class Timeout
     void initialize(unsigned long ms, TimeoutCallback callback);
 
   private:
-    std::shared_ptr<uvw::Loop> m_loop;
-    std::shared_ptr<uvw::TimerHandle> m_timer;
+    TaskQueue *m_tasks; // The queue (and loop) of the thread we were created on.
+    TimerWheel::Timer m_timer;
+    bool m_started;
     TimeoutCallback m_callback;
     unsigned long m_timeout_interval;
 
@@ -0,0 +1,262 @@
+#include "TimerWheel.h"
+#include <cassert>
+
+static inline void list_init(TimerWheel::Link &list)
+{
+    list.prev = list.next = &list;
+}
+
+static inline bool list_empty(const TimerWheel::Link &list)
+{
+    return list.next == &list;
+}
+
+static inline void list_unlink(TimerWheel::Link *link)
+{
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->prev = link->next = link;
+}
+
+static inline void list_push_back(TimerWheel::Link &list, TimerWheel::Link *link)
+{
+    link->prev = list.prev;
+    link->next = &list;
+    list.prev->next = link;
+    list.prev = link;
+}
+
+TimerWheel::Timer::Timer() : m_wheel(nullptr), m_expires(0), m_slot(0)
+{
+    prev = next = this;
+}
+
+TimerWheel::Timer::~Timer()
+{
+    stop();
+}
+
+void TimerWheel::Timer::start(TimerWheel &wheel, uint64_t ms)
+{
+    stop();
+
+    if(wheel.m_count == 0 && !wheel.m_advancing) {
+        // Nothing's due, so the wheel can skip ahead to the present instead of working its
+        // way there tick by tick.
+        wheel.m_now = wheel.loop_now();
+    }
+
+    m_wheel = &wheel;
+    m_expires = wheel.loop_now() + ms;
+    if(m_expires <= wheel.m_now) {
+        // It's due now, but the wheel has already run the slot for now.
+        m_expires = wheel.m_now + 1;
+    }
+    wheel.insert(this);
+
+    if(!wheel.m_advancing && (!wheel.m_armed || m_expires < wheel.m_wakeup)) {
+        wheel.arm(m_expires);
+    }
+}
+
+void TimerWheel::Timer::stop()
+{
+    if(m_wheel != nullptr) {
+        m_wheel->remove(this);
+    }
+}
+
+TimerWheel::TimerWheel(const std::shared_ptr<uvw::Loop> &loop) :
+    m_loop(loop), m_handle(loop->resource<uvw::TimerHandle>()), m_now(loop_now())
+{
+    for(Link &list : m_slots) {
+        list_init(list);
+    }
+
+    m_handle->on<uvw::TimerEvent>([self = this](const uvw::TimerEvent&, uvw::TimerHandle&) {
+        self->on_timer();
+    });
+}
+
+TimerWheel::~TimerWheel()
+{
+    // Anything still scheduled will never go off now.
+    for(unsigned int slot = 0; slot < num_levels * slots_per_level; ++slot) {
+        while(!list_empty(m_slots[slot])) {
+            remove(static_cast<Timer*>(m_slots[slot].next));
+        }
+    }
+
+    m_handle->stop();
+    m_handle->close();
+}
+
+uint64_t TimerWheel::loop_now() const
+{
+    return m_loop->now().count();
+}
+
+void TimerWheel::insert(Timer *timer)
+{
+    // Only a timer moving down a level can be due right now, in which case it goes in the
+    // slot that's about to be run.
+    assert(timer->m_expires >= m_now);
+
+    // A timer goes in the lowest level which goes far enough ahead. Anything further off
+    // than the top level goes as far ahead in it as it can, and is put back in when that
+    // slot comes around.
+    uint64_t delta = timer->m_expires - m_now;
+    uint64_t expires = timer->m_expires;
+    unsigned int level = 0;
+    while(delta >> (level_bits * (level + 1)) != 0) {
+        if(++level == num_levels - 1) {
+            const uint64_t max_delta = (uint64_t(1) << (level_bits * num_levels)) - 1;
+            if(delta > max_delta) {
+                expires = m_now + max_delta;
+            }
+            break;
+        }
+    }
+
+    unsigned int slot = (unsigned int)(expires >> (level_bits * level)) & slot_mask;
+    link(timer, level * slots_per_level + slot);
+}
+
+void TimerWheel::link(Timer *timer, unsigned int slot)
+{
+    timer->m_slot = slot;
+    list_push_back(m_slots[slot], timer);
+
+    unsigned int level = slot / slots_per_level, index = slot & slot_mask;
+    m_occupied[level][index / 64] |= uint64_t(1) << (index % 64);
+    ++m_count;
+}
+
+void TimerWheel::remove(Timer *timer)
+{
+    list_unlink(timer);
+    timer->m_wheel = nullptr;
+    --m_count;
+
+    // The timer might have been in a list taken out of its slot to be run (or moved down a
+    // level), in which case the slot was already marked empty.
+    unsigned int slot = timer->m_slot;
+    if(list_empty(m_slots[slot])) {
+        unsigned int level = slot / slots_per_level, index = slot & slot_mask;
+        m_occupied[level][index / 64] &= ~(uint64_t(1) << (index % 64));
+    }
+}
+
+void TimerWheel::detach(unsigned int slot, Link &list)
+{
+    list_init(list);
+    if(!list_empty(m_slots[slot])) {
+        list.next = m_slots[slot].next;
+        list.prev = m_slots[slot].prev;
+        list.next->prev = &list;
+        list.prev->next = &list;
+        list_init(m_slots[slot]);
+    }
+
+    unsigned int level = slot / slots_per_level, index = slot & slot_mask;
+    m_occupied[level][index / 64] &= ~(uint64_t(1) << (index % 64));
+}
+
+uint64_t TimerWheel::next_tick() const
+{
+    const uint64_t lap_start = m_now & ~uint64_t(slot_mask);
+
+    // The slots of the lowest level after the current one, in this lap:
+    unsigned int from = (unsigned int)(m_now & slot_mask) + 1;
+    for(unsigned int word = from / 64; word < bitmap_words; ++word) {
+        uint64_t bits = m_occupied[0][word];
+        if(word == from / 64) {
+            bits &= ~uint64_t(0) << (from % 64);
+        }
+        if(bits != 0) {
+            return lap_start + word * 64 + __builtin_ctzll(bits);
+        }
+    }
+
+    // Otherwise, the start of the next lap, when the levels above are cascaded.
+    return lap_start + slots_per_level;
+}
+
+void TimerWheel::advance(uint64_t target)
+{
+    m_advancing = true;
+    while(m_now < target) {
+        if(m_count == 0) {
+            m_now = target;
+            break;
+        }
+
+        uint64_t next = next_tick();
+        if(next > target) {
+            m_now = target;
+            break;
+        }
+
+        m_now = next;
+        if((m_now & slot_mask) == 0) {
+            cascade(1);
+        }
+        expire((unsigned int)(m_now & slot_mask));
+    }
+    m_advancing = false;
+}
+
+void TimerWheel::cascade(unsigned int level)
+{
+    if(level >= num_levels) {
+        return;
+    }
+
+    unsigned int index = (unsigned int)(m_now >> (level_bits * level)) & slot_mask;
+    if(index == 0) {
+        // This level has come around too, so first bring down what's due from the one above.
+        cascade(level + 1);
+    }
+
+    Link list;
+    detach(level * slots_per_level + index, list);
+    while(!list_empty(list)) {
+        Timer *timer = static_cast<Timer*>(list.next);
+        list_unlink(timer);
+        --m_count;
+        insert(timer);
+    }
+}
+
+void TimerWheel::expire(unsigned int slot)
+{
+    Link list;
+    detach(slot, list);
+    while(!list_empty(list)) {
+        Timer *timer = static_cast<Timer*>(list.next);
+        remove(timer);
+
+        // The callback may start the timer again, or delete it; either way we're done with it.
+        if(timer->m_callback) {
+            timer->m_callback();
+        }
+    }
+}
+
+void TimerWheel::arm(uint64_t tick)
+{
+    uint64_t now = loop_now();
+    m_wakeup = tick;
+    m_armed = true;
+    m_handle->start(uvw::TimerHandle::Time{tick > now ? tick - now : 0}, uvw::TimerHandle::Time{0});
+}
+
+void TimerWheel::on_timer()
+{
+    m_armed = false;
+    advance(loop_now());
+
+    if(m_count > 0) {
+        arm(next_tick());
+    }
+}
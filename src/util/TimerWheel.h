@@ -0,0 +1,111 @@
+#pragma once
+#include <stdint.h>
+#include <memory>
+#include "deps/uvw/uvw.hpp"
+#include "util/TaskCallback.h"
+
+// A TimerWheel keeps all of the timers on a loop, so that they can be started, restarted and
+// stopped without going through libuv's timer heap: that's O(log n) each time, which adds up
+// with a heartbeat to re-arm for every client. The wheel is hierarchical: timers due within
+// 256ms are kept in the slot for the millisecond they're due, later ones in the slot for the
+// 256ms (or 65s, or 4.6h) they're due within, and they're moved down a level when that comes
+// around. Starting or stopping a timer just links it into or out of a list, and the wheel
+// keeps a single libuv timer armed for the next time it has something to do.
+//
+// Each TaskQueue has a TimerWheel for its loop (see TaskQueue::timers), which must only ever
+// be used from the thread running that loop.
+class TimerWheel
+{
+  public:
+    // A Link is an entry in one of the wheel's lists of timers.
+    struct Link {
+        Link *prev;
+        Link *next;
+    };
+
+    // A Timer calls back once, some time after it's started, unless it's stopped (or started
+    // again) first. It may be started again from its own callback, or destroyed by it.
+    class Timer : private Link
+    {
+      public:
+        Timer();
+        ~Timer();
+
+        Timer(const Timer&) = delete;
+        Timer &operator=(const Timer&) = delete;
+
+        inline void set_callback(TaskCallback callback)
+        {
+            m_callback = std::move(callback);
+        }
+
+        // start schedules the callback for "ms" milliseconds from now, on the wheel's loop.
+        //     If the timer was already running, it's rescheduled.
+        void start(TimerWheel &wheel, uint64_t ms);
+        // stop unschedules the callback, if it's scheduled.
+        void stop();
+
+        inline bool is_active() const
+        {
+            return m_wheel != nullptr;
+        }
+
+      private:
+        friend class TimerWheel;
+
+        TaskCallback m_callback;
+        TimerWheel *m_wheel; // The wheel the timer is scheduled on, if it's active.
+        uint64_t m_expires;  // The tick it's due at.
+        unsigned int m_slot; // The list it's in: level * slots_per_level + slot.
+    };
+
+    TimerWheel(const std::shared_ptr<uvw::Loop> &loop);
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel &operator=(const TimerWheel&) = delete;
+
+  private:
+    static const unsigned int level_bits = 8;
+    static const unsigned int slots_per_level = 1 << level_bits;
+    static const unsigned int slot_mask = slots_per_level - 1;
+    static const unsigned int num_levels = 4;
+    static const unsigned int bitmap_words = slots_per_level / 64;
+
+    std::shared_ptr<uvw::Loop> m_loop;
+    std::shared_ptr<uvw::TimerHandle> m_handle;
+
+    // A tick is a millisecond of the loop's time. m_now is the last one the wheel has run.
+    uint64_t m_now;
+    size_t m_count = 0; // The number of timers scheduled.
+
+    // The libuv timer is armed to go off at m_wakeup, if m_armed.
+    bool m_armed = false;
+    bool m_advancing = false;
+    uint64_t m_wakeup = 0;
+
+    Link m_slots[num_levels * slots_per_level];
+    // A bit is set for every slot with a timer in it.
+    uint64_t m_occupied[num_levels][bitmap_words] = {};
+
+    uint64_t loop_now() const;
+
+    void insert(Timer *timer);
+    void remove(Timer *timer);
+    void link(Timer *timer, unsigned int slot);
+
+    // detach moves everything in a slot into "list", leaving the slot empty.
+    void detach(unsigned int slot, Link &list);
+
+    // next_tick returns the next tick (in the current lap of the lowest level) at which the
+    //     wheel has something to do: either to run a slot, or to move timers down a level.
+    uint64_t next_tick() const;
+
+    // advance runs every tick up to "target", calling back the timers that are due.
+    void advance(uint64_t target);
+    void cascade(unsigned int level);
+    void expire(unsigned int slot);
+
+    void arm(uint64_t tick);
+    void on_timer();
+};
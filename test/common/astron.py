@@ -1,7 +1,7 @@
-import os, time, socket, struct, tempfile, subprocess, ssl
+import os, time, mmap, socket, struct, tempfile, subprocess, ssl
 
 __all__ = ['Daemon', 'Datagram', 'DatagramIterator',
-           'MDConnection', 'ChannelConnection', 'ClientConnection']
+           'MDConnection', 'ShmMDConnection', 'ChannelConnection', 'ClientConnection']
 
 class Daemon(object):
     DAEMON_PATH = './astrond'
@@ -85,11 +85,21 @@ CONSTANTS = {
     'CONTROL_REMOVE_CHANNEL':       9001,
     'CONTROL_ADD_RANGE':            9002,
     'CONTROL_REMOVE_RANGE':         9003,
+    'CONTROL_ADD_CHANNELS':         9004,
+    'CONTROL_REMOVE_CHANNELS':      9005,
+    'CONTROL_ADD_RANGES':           9006,
+    'CONTROL_REMOVE_RANGES':        9007,
     'CONTROL_ADD_POST_REMOVE':      9010,
     'CONTROL_CLEAR_POST_REMOVE':    9011,
     'CONTROL_SET_CON_NAME':         9012,
     'CONTROL_SET_CON_URL':          9013,
     'CONTROL_LOG_MESSAGE':          9014,
+    'CONTROL_WATCH_INTEREST':           9015,
+    'CONTROL_INTEREST_READY':           9016,
+    'CONTROL_INTEREST_ADD_CHANNELS':    9017,
+    'CONTROL_INTEREST_REMOVE_CHANNELS': 9018,
+    'CONTROL_INTEREST_ADD_RANGES':      9019,
+    'CONTROL_INTEREST_REMOVE_RANGES':   9020,
 
     # State Server control message-type constants
     'STATESERVER_CREATE_OBJECT_WITH_REQUIRED':          2000,
@@ -397,6 +407,53 @@ class Datagram(object):
         dg.add_channel(lower)
         return dg
 
+    @classmethod
+    def create_channel_list(cls, msgtype, channels):
+        dg = cls.create_control()
+        dg.add_uint16(msgtype)
+        dg.add_uint16(len(channels))
+        for channel in channels:
+            dg.add_channel(channel)
+        return dg
+
+    @classmethod
+    def create_range_list(cls, msgtype, ranges):
+        dg = cls.create_control()
+        dg.add_uint16(msgtype)
+        dg.add_uint16(len(ranges))
+        for lower, upper in ranges:
+            dg.add_channel(lower)
+            dg.add_channel(upper)
+        return dg
+
+    @classmethod
+    def create_add_channels(cls, channels):
+        return cls.create_channel_list(CONTROL_ADD_CHANNELS, channels)
+
+    @classmethod
+    def create_remove_channels(cls, channels):
+        return cls.create_channel_list(CONTROL_REMOVE_CHANNELS, channels)
+
+    @classmethod
+    def create_add_ranges(cls, ranges):
+        return cls.create_range_list(CONTROL_ADD_RANGES, ranges)
+
+    @classmethod
+    def create_remove_ranges(cls, ranges):
+        return cls.create_range_list(CONTROL_REMOVE_RANGES, ranges)
+
+    @classmethod
+    def create_watch_interest(cls):
+        dg = cls.create_control()
+        dg.add_uint16(CONTROL_WATCH_INTEREST)
+        return dg
+
+    @classmethod
+    def create_interest_ready(cls):
+        dg = cls.create_control()
+        dg.add_uint16(CONTROL_INTEREST_READY)
+        return dg
+
     @classmethod
     def create_add_post_remove(cls, sender, datagram):
         dg = cls.create_control()
@@ -559,6 +616,108 @@ class MDConnection(object):
 
         return result
 
+class ShmMDConnection(object):
+    """An MD link over shared memory, connected to an MD's shm_bind socket.
+
+    Each direction is a ring with a 192-byte header (tail at 0, head at 64, reader_waiting
+    at 128, writer_waiting at 132) followed by records: a uint32 length, with the top bit
+    set if the datagram continues in the next record, then the data, padded to 8 bytes.
+    We poll for incoming records rather than sleeping on our doorbell."""
+
+    HEADER_SIZE = 192
+    MORE_FRAGMENTS = 0x80000000
+    WRAP = 0xFFFFFFFF
+
+    def __init__(self, path, capacity=4096):
+        self.capacity = capacity
+        self.ring_size = self.HEADER_SIZE + capacity
+        self.s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.s.connect(path)
+
+        self.memory = os.memfd_create('astron-test')
+        os.ftruncate(self.memory, 2 * self.ring_size)
+        self.m = mmap.mmap(self.memory, 2 * self.ring_size)
+        self.doorbell = os.eventfd(0, os.EFD_NONBLOCK)
+        self.peer_doorbell = os.eventfd(0, os.EFD_NONBLOCK)
+
+        hello = b'ASTRSHM\0' + struct.pack('<II', 1, capacity)
+        socket.send_fds(self.s, [hello], [self.memory, self.peer_doorbell, self.doorbell])
+
+        self.partial = b''
+
+    def _get(self, fmt, offset):
+        return struct.unpack_from(fmt, self.m, offset)[0]
+
+    def _put(self, fmt, offset, value):
+        struct.pack_into(fmt, self.m, offset, value)
+
+    def _write(self, data, more):
+        record = (4 + len(data) + 7) & ~7
+        tail = self._get('<Q', 0)
+        offset = tail % self.capacity
+        if record > self.capacity - offset:
+            self._put('<I', self.HEADER_SIZE + offset, self.WRAP)
+            tail += self.capacity - offset
+            offset = 0
+        while tail + record - self._get('<Q', 64) > self.capacity:
+            time.sleep(0.001)
+        position = self.HEADER_SIZE + offset
+        self._put('<I', position, len(data) | (self.MORE_FRAGMENTS if more else 0))
+        self.m[position + 4:position + 4 + len(data)] = data
+        self._put('<Q', 0, tail + record)
+
+    def send(self, datagram):
+        data = datagram.get_data()
+        fragment = self.capacity // 4
+        for start in range(0, max(len(data), 1), fragment):
+            self._write(data[start:start + fragment], start + fragment < len(data))
+        os.eventfd_write(self.peer_doorbell, 1)
+
+    def recv(self):
+        dg = self.recv_maybe()
+        if dg is None:
+            raise EOFError('No message received')
+        return dg
+
+    def recv_maybe(self, timeout=0.1):
+        deadline = time.time() + timeout
+        base = self.ring_size
+        while True:
+            tail = self._get('<Q', base)
+            head = self._get('<Q', base + 64)
+            if tail == head:
+                if time.time() > deadline:
+                    return None
+                time.sleep(0.001)
+                continue
+
+            offset = head % self.capacity
+            position = base + self.HEADER_SIZE + offset
+            word = self._get('<I', position)
+            if word == self.WRAP:
+                self._put('<Q', base + 64, head + self.capacity - offset)
+                continue
+
+            length = word & ~self.MORE_FRAGMENTS
+            self.partial += self.m[position + 4:position + 4 + length]
+            self._put('<Q', base + 64, head + ((4 + length + 7) & ~7))
+            if self._get('<I', base + 132):
+                # The MD is out of room and waiting on us.
+                self._put('<I', base + 132, 0)
+                os.eventfd_write(self.peer_doorbell, 1)
+            if not word & self.MORE_FRAGMENTS:
+                data, self.partial = self.partial, b''
+                return Datagram(data)
+
+    def close(self):
+        self.s.close()
+        self.m.close()
+        for fd in (self.memory, self.doorbell, self.peer_doorbell):
+            os.close(fd)
+
+    def flush(self):
+        while self.recv_maybe(): pass
+
 class ChannelConnection(MDConnection):
     def __init__(self, connAddr, connPort, MDChannel=None):
         c = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
@@ -1,11 +1,17 @@
 #!/usr/bin/env python3
-import unittest, time, ssl, struct
-from socket import socket, AF_INET, SOCK_STREAM, error as socket_error
+import unittest, time, ssl, struct, os, tempfile, ctypes, ctypes.util
+from socket import socket, AF_INET, SOCK_STREAM, SOCK_DGRAM, timeout as socket_timeout, error as socket_error
 from common.unittests import ProtocolTest
 from common.astron import *
 from common.dcfile import *
 from common.tls import *
 
+# A raw dictionary for the compressing CA, primed with what test_compression sends.
+COMPRESSION_DICT = b'\xb3\x15' * 64 + b'Squeeze me, I am very compressible. ' * 32
+DICT_PATH = os.path.join(tempfile.mkdtemp(prefix='astron'), 'client.dict')
+with open(DICT_PATH, 'wb') as f:
+    f.write(COMPRESSION_DICT)
+
 CONFIG = """\
 messagedirector:
     bind: 127.0.0.1:57123
@@ -69,6 +75,29 @@ roles:
           min: 440600
           max: 440649
 
+    - type: clientagent
+      bind: 127.0.0.1:57236
+      version: "Sword Art Online v5.1"
+      threads: 3
+      channels:
+          min: 550600
+          max: 550699
+      client:
+          write_buffer_size: 0
+          write_timeout_ms: 0
+
+    - type: clientagent
+      bind: 127.0.0.1:57237
+      version: "Sword Art Online v5.1"
+      channels:
+          min: 660600
+          max: 660699
+      client:
+          write_buffer_size: 0
+          write_timeout_ms: 0
+          write_coalesce_us: 50000
+          write_coalesce_bytes: 64
+
     - type: clientagent
       bind: 127.0.0.1:51201
       version: "Sword Art Online v5.1"
@@ -78,9 +107,89 @@ roles:
       client:
           heartbeat_timeout: 1000
 
-""" % (USE_THREADING, test_dc)
+    - type: clientagent
+      bind: 127.0.0.1:57238
+      version: "Sword Art Online v5.1"
+      channels:
+          min: 770600
+          max: 770699
+      client:
+          write_buffer_size: 0
+          write_timeout_ms: 0
+          compression: true
+          compression_dictionary: %r
+
+    - type: clientagent
+      bind: 127.0.0.1:57239
+      udp_bind: 127.0.0.1:57240
+      version: "Sword Art Online v5.1"
+      channels:
+          min: 880600
+          max: 880699
+      client:
+          write_buffer_size: 0
+          write_timeout_ms: 0
+
+""" % (USE_THREADING, test_dc, DICT_PATH)
 VERSION = 'Sword Art Online v5.1'
 
+class ZstdStream(object):
+    """Decodes a zstd stream with libzstd (through ctypes), as a client would."""
+
+    class Buffer(ctypes.Structure):
+        _fields_ = [('data', ctypes.c_void_p), ('size', ctypes.c_size_t), ('pos', ctypes.c_size_t)]
+
+    def __init__(self, dictionary):
+        path = ctypes.util.find_library('zstd')
+        self.lib = ctypes.CDLL(path) if path else None
+        if self.lib is None:
+            return
+        self.lib.ZSTD_createDCtx.restype = ctypes.c_void_p
+        self.lib.ZSTD_isError.argtypes = [ctypes.c_size_t]
+        self.lib.ZSTD_DCtx_loadDictionary.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t]
+        self.lib.ZSTD_DCtx_loadDictionary.restype = ctypes.c_size_t
+        self.lib.ZSTD_decompressStream.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p]
+        self.lib.ZSTD_decompressStream.restype = ctypes.c_size_t
+        self.lib.ZSTD_freeDCtx.argtypes = [ctypes.c_void_p]
+        self.dctx = self.lib.ZSTD_createDCtx()
+        self.lib.ZSTD_DCtx_loadDictionary(self.dctx, dictionary, len(dictionary))
+        self.decoded = b''
+
+    def close(self):
+        if self.lib is not None:
+            self.lib.ZSTD_freeDCtx(self.dctx)
+
+    def feed(self, data):
+        # Everything the CA writes is flushed, so whatever arrives can be decoded in full.
+        src = ctypes.create_string_buffer(data, len(data))
+        dst = ctypes.create_string_buffer(1 << 16)
+        inbuf = self.Buffer(ctypes.cast(src, ctypes.c_void_p), len(data), 0)
+        while True:
+            outbuf = self.Buffer(ctypes.cast(dst, ctypes.c_void_p), len(dst), 0)
+            ret = self.lib.ZSTD_decompressStream(self.dctx, ctypes.byref(outbuf), ctypes.byref(inbuf))
+            if self.lib.ZSTD_isError(ret):
+                raise ValueError('Undecodable zstd stream')
+            self.decoded += dst.raw[:outbuf.pos]
+            if inbuf.pos == inbuf.size and outbuf.pos < outbuf.size:
+                return
+
+    def read_datagram(self, sock):
+        # Reads from the socket until a whole datagram has been decoded, or nothing more comes.
+        while True:
+            if len(self.decoded) >= DGSIZE_SIZE_BYTES:
+                length = int.from_bytes(self.decoded[:DGSIZE_SIZE_BYTES], 'little')
+                if len(self.decoded) >= DGSIZE_SIZE_BYTES + length:
+                    data = self.decoded[DGSIZE_SIZE_BYTES:DGSIZE_SIZE_BYTES + length]
+                    self.decoded = self.decoded[DGSIZE_SIZE_BYTES + length:]
+                    return Datagram(data)
+            try:
+                data = sock.recv(4096)
+            except socket_error:
+                return None
+            if not data:
+                return None
+            self.feed(data)
+
 class TestClientAgent(ProtocolTest):
     @classmethod
     def setUpClass(cls):
@@ -199,6 +308,178 @@ class TestClientAgent(ProtocolTest):
 
         client.close()
 
+        # A client offering compression is told it was turned down, as it isn't enabled here:
+        client = self.connect(False)
+        dg = Datagram()
+        dg.add_uint16(CLIENT_HELLO)
+        dg.add_uint32(DC_HASH)
+        dg.add_string(VERSION)
+        dg.add_uint8(1) # zstd
+        client.send(dg)
+        dg = Datagram()
+        dg.add_uint16(CLIENT_HELLO_RESP)
+        dg.add_uint8(0) # No compression
+        self.expect(client, dg, isClient = True)
+
+        client.close()
+
+        # ... and likewise for a UDP channel, as there's no udp_bind:
+        client = self.connect(False)
+        dg = Datagram()
+        dg.add_uint16(CLIENT_HELLO)
+        dg.add_uint32(DC_HASH)
+        dg.add_string(VERSION)
+        dg.add_uint8(0) # No compression
+        dg.add_uint8(1) # UDP, please
+        client.send(dg)
+        dg = Datagram()
+        dg.add_uint16(CLIENT_HELLO_RESP)
+        dg.add_uint8(0) # No compression
+        dg.add_uint8(0) # No UDP
+        self.expect(client, dg, isClient = True)
+
+        client.close()
+
+    def test_compression(self):
+        self.server.flush()
+        # Offer zstd to a CA with compression turned on:
+        client = self.connect(False, port=57238)
+        dg = Datagram()
+        dg.add_uint16(CLIENT_HELLO)
+        dg.add_uint32(DC_HASH)
+        dg.add_string(VERSION)
+        dg.add_uint8(1) # zstd
+        client.send(dg)
+
+        # The response itself isn't compressed, but says whether what follows is:
+        dgi = DatagramIterator(client.recv())
+        self.assertEqual(dgi.read_uint16(), CLIENT_HELLO_RESP)
+        if dgi.read_uint8() == 0:
+            client.close()
+            self.skipTest('astrond was built without zstd')
+        self.assertEqual(dgi.read_uint32(), 0) # A raw dictionary has no id.
+
+        stream = ZstdStream(COMPRESSION_DICT)
+        if stream.lib is None:
+            client.close()
+            self.skipTest('libzstd is needed to decode the stream')
+
+        id = self.identify(client, min=770600, max=770699)
+
+        # Each datagram can be decoded as soon as it arrives, with the shared dictionary:
+        for i in range(3):
+            raw_dg = Datagram()
+            raw_dg.add_uint16(5555)
+            raw_dg.add_uint32(i)
+            raw_dg.add_string('Squeeze me, I am very compressible. ' * 4)
+            dg = Datagram.create([id], 1, CLIENTAGENT_SEND_DATAGRAM)
+            dg.add_string(raw_dg.get_data())
+            self.server.send(dg)
+
+            received = stream.read_datagram(client.s)
+            self.assertTrue(received is not None, "No compressed datagram received")
+            self.assertTrue(received.equals(raw_dg))
+
+        # ... and so can the eject, at the very end of the stream:
+        dg = Datagram.create([id], 1, CLIENTAGENT_EJECT)
+        dg.add_uint16(4321)
+        dg.add_string('Off you go.')
+        self.server.send(dg)
+
+        received = stream.read_datagram(client.s)
+        self.assertTrue(received is not None, "No compressed eject received")
+        dgi = DatagramIterator(received)
+        self.assertEqual(dgi.read_uint16(), CLIENT_EJECT)
+        self.assertEqual(dgi.read_uint16(), 4321)
+
+        stream.close()
+        client.close()
+
+    def test_unreliable(self):
+        self.server.flush()
+        # Ask a CA with a udp_bind for a UDP channel:
+        client = self.connect(False, port=57239)
+        dg = Datagram()
+        dg.add_uint16(CLIENT_HELLO)
+        dg.add_uint32(DC_HASH)
+        dg.add_string(VERSION)
+        dg.add_uint8(0) # No compression
+        dg.add_uint8(1) # UDP, please
+        client.send(dg)
+
+        dgi = DatagramIterator(client.recv())
+        self.assertEqual(dgi.read_uint16(), CLIENT_HELLO_RESP)
+        self.assertEqual(dgi.read_uint8(), 0) # No compression
+        self.assertEqual(dgi.read_uint8(), 1) # UDP
+        token = dgi.read_uint64()
+        self.assertEqual(dgi.read_uint16(), 57240)
+
+        id = self.identify(client, min=880600, max=880699)
+        self.set_state(client, CLIENT_STATE_ESTABLISHED)
+
+        # Give it an object with an unreliable field:
+        dg = Datagram.create([id], 1, STATESERVER_OBJECT_ENTER_OWNER_WITH_REQUIRED)
+        dg.add_doid(88008800)
+        dg.add_doid(1234) # Parent
+        dg.add_zone(5678) # Zone
+        dg.add_uint16(DistributedMover)
+        self.server.send(dg)
+
+        dg = Datagram()
+        dg.add_uint16(CLIENT_ENTER_OBJECT_REQUIRED_OWNER)
+        dg.add_doid(88008800)
+        dg.add_doid(1234) # Parent
+        dg.add_zone(5678) # Zone
+        dg.add_uint16(DistributedMover)
+        self.expect(client, dg, isClient = True)
+
+        def move(x, y):
+            dg = Datagram.create([id], 1, STATESERVER_OBJECT_SET_FIELD)
+            dg.add_doid(88008800)
+            dg.add_uint16(setPos)
+            dg.add_int16(x)
+            dg.add_int16(y)
+            self.server.send(dg)
+
+            dg = Datagram()
+            dg.add_uint16(CLIENT_OBJECT_SET_FIELD)
+            dg.add_doid(88008800)
+            dg.add_uint16(setPos)
+            dg.add_int16(x)
+            dg.add_int16(y)
+            return dg
+
+        # Until the client has sent its token over UDP, updates stay on TCP:
+        self.expect(client, move(1, 2), isClient = True)
+
+        udp = socket(AF_INET, SOCK_DGRAM)
+        udp.settimeout(0.1)
+        token_dg = Datagram()
+        token_dg.add_uint64(token)
+
+        # A token sent from anywhere but the client's own IP is ignored:
+        spoofer = socket(AF_INET, SOCK_DGRAM)
+        spoofer.settimeout(0.1)
+        spoofer.bind(('127.0.0.2', 0))
+        spoofer.sendto(token_dg.get_data(), ('127.0.0.1', 57240))
+        time.sleep(0.1)
+        self.expect(client, move(3, 4), isClient = True)
+        self.assertRaises(socket_timeout, spoofer.recv, 1024)
+        spoofer.close()
+
+        # Once it's registered, unreliable updates go over UDP, and not TCP:
+        udp.sendto(token_dg.get_data(), ('127.0.0.1', 57240))
+        time.sleep(0.1)
+        for i in range(3):
+            expected = move(5 + i, 6 + i)
+            data = udp.recv(1024)
+            self.assertEqual(struct.unpack('<I', data[:4])[0], i + 1) # Sequence number
+            self.assertTrue(Datagram(data[4:]).equals(expected))
+        self.expectNone(client)
+
+        udp.close()
+        client.close()
+
     def test_anonymous(self):
         self.server.flush()
         # Connect and hello:
@@ -3412,6 +3693,76 @@ class TestClientAgent(ProtocolTest):
 
         self.server.send(Datagram.create_remove_channel(10010))
 
+    def test_threads(self):
+        self.server.flush()
+
+        # The connections are shared out between the CA's threads; each client should work
+        # just the same, whichever thread it ended up on.
+        clients = [self.connect(port=57236) for i in range(12)]
+        ids = [self.identify(client, min=550600, max=550699) for client in clients]
+        self.assertEqual(len(set(ids)), len(ids))
+
+        for client, id in zip(clients, ids):
+            raw_dg = Datagram()
+            raw_dg.add_uint16(5555)
+            raw_dg.add_channel(id)
+
+            dg = Datagram.create([id], 1, CLIENTAGENT_SEND_DATAGRAM)
+            dg.add_string(raw_dg.get_data())
+            self.server.send(dg)
+
+            self.expect(client, raw_dg, isClient = True)
+
+        for client, id in zip(clients, ids):
+            dg = Datagram.create([id], 1, CLIENTAGENT_EJECT)
+            dg.add_uint16(4321)
+            dg.add_string('Off you go.')
+            self.server.send(dg)
+
+            self.assertDisconnect(client, 4321)
+
+    def test_write_coalesce(self):
+        self.server.flush()
+        client = self.connect(port=57237)
+        id = self.identify(client, min=660600, max=660699)
+
+        # A lone datagram is held for the window, then written.
+        raw_dg = Datagram()
+        raw_dg.add_uint16(5555)
+        raw_dg.add_uint32(0)
+        dg = Datagram.create([id], 1, CLIENTAGENT_SEND_DATAGRAM)
+        dg.add_string(raw_dg.get_data())
+        self.server.send(dg)
+        self.expect(client, raw_dg, isClient = True)
+
+        # A burst goes out in order, whether it's held or passes write_coalesce_bytes.
+        raw_dgs = []
+        for i in range(20):
+            raw_dg = Datagram()
+            raw_dg.add_uint16(5555)
+            raw_dg.add_uint32(i + 1)
+            raw_dgs.append(raw_dg)
+
+            dg = Datagram.create([id], 1, CLIENTAGENT_SEND_DATAGRAM)
+            dg.add_string(raw_dg.get_data())
+            self.server.send(dg)
+        for raw_dg in raw_dgs:
+            self.expect(client, raw_dg, isClient = True)
+
+        # Held datagrams still go out ahead of an eject.
+        raw_dg = Datagram()
+        raw_dg.add_uint16(5555)
+        raw_dg.add_uint32(99)
+        dg = Datagram.create([id], 1, CLIENTAGENT_SEND_DATAGRAM)
+        dg.add_string(raw_dg.get_data())
+        self.server.send(dg)
+        dg = Datagram.create([id], 1, CLIENTAGENT_EJECT)
+        dg.add_uint16(4321)
+        dg.add_string('Off you go.')
+        self.server.send(dg)
+        self.expect(client, raw_dg, isClient = True)
+        self.assertDisconnect(client, 4321)
+
     # Test the interest timeout
     # The heartbeat timeout is configured for 1000ms (1 second)
     def test_heartbeat_timeout(self):
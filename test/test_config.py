@@ -66,6 +66,23 @@ class TestConfigCore(ConfigTest):
             """ % test_dc
         self.assertEqual(self.checkConfig(config), 'Valid')
 
+    def test_routing_threads(self):
+        config = """\
+            messagedirector:
+                bind: 127.0.0.1:57123
+                threaded: true
+                routing_threads: 4
+            """
+        self.assertEqual(self.checkConfig(config), 'Valid')
+
+    def test_routing_threads_zero(self):
+        config = """\
+            messagedirector:
+                bind: 127.0.0.1:57123
+                routing_threads: 0
+            """
+        self.assertEqual(self.checkConfig(config), 'Invalid')
+
     def test_roles_missing_type(self):
         config = """\
             messagedirector:
@@ -1,5 +1,5 @@
 #!/usr/bin/env python3
-import unittest
+import os, tempfile, unittest
 from socket import *
 
 from common.unittests import ProtocolTest
@@ -11,6 +11,25 @@ messagedirector:
     connect: 127.0.0.1:57124
 """
 
+ROOT_CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:57125
+"""
+
+SHM_PATH = os.path.join(tempfile.mkdtemp(prefix='astron'), 'md.sock')
+SHM_CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:57126
+    shm_bind: %s
+""" % SHM_PATH
+
+UNIX_DIR = tempfile.mkdtemp(prefix='astron')
+UNIX_CONFIG = """\
+messagedirector:
+    bind: unix:%s
+    connect: unix:%s
+""" % (os.path.join(UNIX_DIR, 'md.sock'), os.path.join(UNIX_DIR, 'upstream.sock'))
+
 class TestMessageDirector(ProtocolTest):
     @classmethod
     def setUpClass(cls):
@@ -617,14 +636,10 @@ class TestMessageDirector(ProtocolTest):
         self.c2.send(dg)
         self.expect(self.l1, dg)
 
-        # Then remove that range and see all the inbetween parts die
+        # Then remove that range and see all the inbetween parts die, in one batch
         self.c2.send(Datagram.create_remove_range(1000, 5000))
-        expected = []
-        expected.append(Datagram.create_remove_range(1000, 3043))
-        expected.append(Datagram.create_remove_range(3475, 3525))
-        expected.append(Datagram.create_remove_range(3650, 4200))
-        expected.append(Datagram.create_remove_range(4763, 5000))
-        self.expectMany(self.l1, expected)
+        self.expect(self.l1, Datagram.create_remove_ranges([(1000, 3043), (3475, 3525),
+                                                            (3650, 4200), (4763, 5000)]))
         self.expectNone(self.l1)
 
         # Cleanup
@@ -634,7 +649,127 @@ class TestMessageDirector(ProtocolTest):
         self.__class__.c2 = self.connectToServer()
         self.l1.flush()
 
+    def test_batched_subscriptions(self):
+        self.l1.flush()
+        self.c1.flush()
+        self.c2.flush()
+
+        # Subscribe to several channels at once; the MD should pass them up as one batch.
+        self.c1.send(Datagram.create_add_channels([5550001, 5550002, 5550003]))
+        self.expect(self.l1, Datagram.create_add_channels([5550001, 5550002, 5550003]))
+        self.expectNone(self.l1)
+
+        # Check that every channel in the batch is routed.
+        for channel in (5550001, 5550002, 5550003):
+            dg = Datagram.create([channel], 123456789, 1234)
+            dg.add_string('BATCH')
+            self.c2.send(dg)
+            self.expect(self.c1, dg)
+            self.expect(self.l1, dg)
+        self.expectNone(self.c1)
+
+        # Removing some channels that another participant still wants only sends up the rest.
+        self.c2.send(Datagram.create_add_channel(5550002))
+        self.expectNone(self.l1)
+        self.c1.send(Datagram.create_remove_channels([5550001, 5550002]))
+        self.expect(self.l1, Datagram.create_remove_channel(5550001))
+        self.expectNone(self.l1)
+
+        # Do the same for a batch of ranges...
+        self.c1.send(Datagram.create_add_ranges([(6000, 6099), (6200, 6299)]))
+        self.expect(self.l1, Datagram.create_add_ranges([(6000, 6099), (6200, 6299)]))
+        self.expectNone(self.l1)
+
+        for channel, routed in ((5999, False), (6000, True), (6099, True),
+                                (6100, False), (6250, True), (6300, False)):
+            dg = Datagram.create([channel], 123456789, 1234)
+            dg.add_string('BATCH')
+            self.c2.send(dg)
+            if routed:
+                self.expect(self.c1, dg)
+            self.expectNone(self.c1)
+            self.expect(self.l1, dg)
+
+        self.c1.send(Datagram.create_remove_ranges([(6000, 6099), (6200, 6249)]))
+        self.expect(self.l1, Datagram.create_remove_ranges([(6000, 6099), (6200, 6249)]))
+        self.expectNone(self.l1)
+
+        # A truncated batch must not be applied at all: the participant is dropped,
+        # taking only the subscriptions it had before with it.
+        dg = Datagram.create_control()
+        dg.add_uint16(CONTROL_ADD_CHANNELS)
+        dg.add_uint16(3)
+        dg.add_channel(5550010)
+        dg.add_channel(5550011)
+        self.c1.send(dg)
+        self.expectMany(self.l1, [Datagram.create_remove_channel(5550003),
+                                  Datagram.create_remove_range(6250, 6299)])
+        self.expectNone(self.l1)
+        self.assertRaises(EOFError, self.c1.recv_maybe)
+
+        # Cleanup
+        self.c1.close()
+        self.c2.close()
+        self.__class__.c1 = self.connectToServer()
+        self.__class__.c2 = self.connectToServer()
+        self.l1.flush()
+
+    def test_interest(self):
+        self.l1.flush()
+        self.c1.flush()
+        self.c2.flush()
+
+        def send_from_c1(channels):
+            dg = Datagram.create(channels, 123456789, 1234)
+            dg.add_string('INTEREST')
+            self.c1.send(dg)
+            return dg
+
+        # Until upstream says what it's interested in, everything goes upstream...
+        self.expect(self.l1, send_from_c1([7771]))
+
+        # ...and afterwards, only what it's interested in.
+        self.l1.send(Datagram.create_channel_list(CONTROL_INTEREST_ADD_CHANNELS, [7770]))
+        self.l1.send(Datagram.create_range_list(CONTROL_INTEREST_ADD_RANGES, [(7800, 7899)]))
+        self.l1.send(Datagram.create_interest_ready())
+        self.expectNone(self.c1)
+
+        self.expect(self.l1, send_from_c1([7770]))
+        send_from_c1([7771])
+        self.expectNone(self.l1)
+        self.expect(self.l1, send_from_c1([7800]))
+        self.expect(self.l1, send_from_c1([7899]))
+        send_from_c1([7900])
+        self.expectNone(self.l1)
+        self.expect(self.l1, send_from_c1([7771, 7850]))
+
+        # Keep up with changes...
+        self.l1.send(Datagram.create_channel_list(CONTROL_INTEREST_REMOVE_CHANNELS, [7770]))
+        self.l1.send(Datagram.create_range_list(CONTROL_INTEREST_REMOVE_RANGES, [(7800, 7849)]))
+        self.expectNone(self.c1)
+        send_from_c1([7770])
+        send_from_c1([7820])
+        self.expectNone(self.l1)
+        self.expect(self.l1, send_from_c1([7850]))
+
+        # Local subscribers aren't affected; subscriptions still go upstream.
+        self.c2.send(Datagram.create_add_channel(7771))
+        self.expect(self.l1, Datagram.create_add_channel(7771))
+        dg = send_from_c1([7771])
+        self.expect(self.c2, dg)
+        self.expectNone(self.l1)
+
+        # Cleanup: have upstream be interested in everything again.
+        self.l1.send(Datagram.create_range_list(CONTROL_INTEREST_ADD_RANGES,
+                                                [(0, (1 << (8 * CHANNEL_SIZE_BYTES)) - 1)]))
+        self.c2.send(Datagram.create_remove_channel(7771))
+        self.expect(self.l1, Datagram.create_remove_channel(7771))
+        self.expect(self.l1, send_from_c1([7900]))
+        self.l1.flush()
+
     def test_malformed_control(self):
+        self.l1.flush()
+
         dg = Datagram()
         dg.add_uint16(0) # Datagram length
         dg.add_uint8(1) # Number of recipients
@@ -654,6 +789,8 @@ class TestMessageDirector(ProtocolTest):
         self.l1.flush()
 
     def test_malformed_single(self):
+        self.l1.flush()
+
         dg = Datagram()
         dg.add_uint16(0) # Datagram length
         dg.add_uint8(1) # Number of recipients
@@ -671,5 +808,203 @@ class TestMessageDirector(ProtocolTest):
         self.__class__.c1 = self.connectToServer()
         self.l1.flush()
 
+class TestMessageDirectorRoot(ProtocolTest):
+    @classmethod
+    def setUpClass(cls):
+        cls.daemon = Daemon(ROOT_CONFIG)
+        cls.daemon.start()
+
+        cls.c1 = cls.connectToServer(port=57125)
+        cls.c2 = cls.connectToServer(port=57125)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.c1.close()
+        cls.c2.close()
+        cls.daemon.stop()
+
+    def test_watch_interest(self):
+        self.c1.flush()
+        self.c2.flush()
+
+        self.c2.send(Datagram.create_add_channel(8880))
+        self.c2.send(Datagram.create_add_range(8900, 8999))
+        self.expectNone(self.c1)
+
+        # Asking to watch the MD's interest gets everything subscribed so far...
+        self.c1.send(Datagram.create_watch_interest())
+        self.expect(self.c1, Datagram.create_channel_list(CONTROL_INTEREST_ADD_CHANNELS, [8880]))
+        self.expect(self.c1, Datagram.create_range_list(CONTROL_INTEREST_ADD_RANGES,
+                                                        [(8900, 8999)]))
+        self.expect(self.c1, Datagram.create_interest_ready())
+        self.expectNone(self.c1)
+
+        # ...then every channel that gains its first subscriber...
+        self.c2.send(Datagram.create_add_channel(8881))
+        self.expect(self.c1, Datagram.create_channel_list(CONTROL_INTEREST_ADD_CHANNELS, [8881]))
+        self.c2.send(Datagram.create_add_channel(8881))
+        self.expectNone(self.c1)
+
+        # ...other than by the watcher itself...
+        self.c1.send(Datagram.create_add_channel(8882))
+        self.expectNone(self.c1)
+
+        # ...and only the parts of ranges that weren't subscribed to yet.
+        c3 = self.connectToServer(port=57125)
+        c3.send(Datagram.create_add_range(8950, 9050))
+        self.expect(self.c1, Datagram.create_range_list(CONTROL_INTEREST_ADD_RANGES,
+                                                        [(9000, 9050)]))
+        c3.send(Datagram.create_remove_range(8950, 9050))
+        self.expect(self.c1, Datagram.create_range_list(CONTROL_INTEREST_REMOVE_RANGES,
+                                                        [(9000, 9050)]))
+        self.expectNone(self.c1)
+        c3.close()
+
+        # A subscriber going away takes its interest with it.
+        self.c2.close()
+        self.expectMany(self.c1, [
+            Datagram.create_channel_list(CONTROL_INTEREST_REMOVE_CHANNELS, [8880]),
+            Datagram.create_channel_list(CONTROL_INTEREST_REMOVE_CHANNELS, [8881]),
+            Datagram.create_range_list(CONTROL_INTEREST_REMOVE_RANGES, [(8900, 8999)])])
+        self.expectNone(self.c1)
+
+        # Cleanup
+        self.c1.close()
+        self.__class__.c1 = self.connectToServer(port=57125)
+        self.__class__.c2 = self.connectToServer(port=57125)
+
+class TestMessageDirectorShm(ProtocolTest):
+    @classmethod
+    def setUpClass(cls):
+        cls.daemon = Daemon(SHM_CONFIG)
+        cls.daemon.start()
+
+        cls.c1 = cls.connectToServer(port=57126)
+        cls.s1 = ShmMDConnection(SHM_PATH)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.c1.close()
+        cls.s1.close()
+        cls.daemon.stop()
+
+    def test_shm_routing(self):
+        self.c1.flush()
+        self.s1.flush()
+
+        # Subscriptions and datagrams both work over shared memory...
+        self.s1.send(Datagram.create_add_channel(5000))
+        self.c1.send(Datagram.create_add_channel(5001))
+        self.expectNone(self.s1)
+        dg = Datagram.create([5000], 5001, 1234)
+        dg.add_string('Over the ring')
+        self.c1.send(dg)
+        self.expect(self.s1, dg)
+        self.expectNone(self.c1)
+
+        dg = Datagram.create([5001], 5000, 1234)
+        dg.add_string('And back')
+        self.s1.send(dg)
+        self.expect(self.c1, dg)
+        self.expectNone(self.s1)
+
+        # ...as do datagrams too big to fit in a single record, either way.
+        dg = Datagram.create([5000], 5001, 1234)
+        dg.add_blob(b'x' * 3000)
+        self.c1.send(dg)
+        self.expect(self.s1, dg)
+
+        dg = Datagram.create([5001], 5000, 1234)
+        dg.add_blob(b'y' * 3000)
+        self.s1.send(dg)
+        self.expect(self.c1, dg)
+
+        # Cleanup
+        self.s1.send(Datagram.create_remove_channel(5000))
+        self.c1.send(Datagram.create_remove_channel(5001))
+
+    def test_shm_disconnect(self):
+        self.c1.flush()
+
+        s2 = ShmMDConnection(SHM_PATH)
+        s2.send(Datagram.create_add_channel(5100))
+        dg = Datagram.create([5101], 5100, 1234)
+        dg.add_string('Goodbye')
+        s2.send(Datagram.create_add_post_remove(5100, dg))
+        self.c1.send(Datagram.create_add_channel(5101))
+        self.expectNone(self.c1)
+
+        # Closing the socket takes the link down, which sends its post-removes.
+        s2.close()
+        self.expect(self.c1, dg)
+        self.expectNone(self.c1)
+
+        # Cleanup
+        self.c1.send(Datagram.create_remove_channel(5101))
+
+    def test_shm_bad_hello(self):
+        sock = socket(AF_UNIX, SOCK_STREAM)
+        sock.settimeout(1.0)
+        sock.connect(SHM_PATH)
+        sock.send(b'NOTSHM\0\0' + b'\0' * 8)
+        self.assertEqual(sock.recv(1), b'')
+        sock.close()
+
+class TestMessageDirectorUnix(ProtocolTest):
+    @classmethod
+    def setUpClass(cls):
+        listener = socket(AF_UNIX, SOCK_STREAM)
+        listener.bind(os.path.join(UNIX_DIR, 'upstream.sock'))
+        listener.listen(1)
+
+        cls.daemon = Daemon(UNIX_CONFIG)
+        cls.daemon.start()
+
+        upstream, _ = listener.accept()
+        listener.close()
+        cls.l1 = MDConnection(upstream)
+
+        cls.c1 = cls.connectToUnix()
+        cls.c2 = cls.connectToUnix()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.c1.close()
+        cls.c2.close()
+        cls.l1.close()
+        cls.daemon.stop()
+
+    @classmethod
+    def connectToUnix(cls):
+        sock = socket(AF_UNIX, SOCK_STREAM)
+        sock.connect(os.path.join(UNIX_DIR, 'md.sock'))
+        return MDConnection(sock)
+
+    def test_unix_routing(self):
+        self.l1.flush()
+        self.c1.flush()
+        self.c2.flush()
+
+        # Subscriptions made over a Unix socket go upstream over a Unix socket...
+        self.c1.send(Datagram.create_add_channel(6000))
+        self.expect(self.l1, Datagram.create_add_channel(6000))
+
+        # ...and datagrams are framed exactly as they are over TCP, both ways.
+        dg = Datagram.create([6000], 6001, 1234)
+        dg.add_string('Same host')
+        self.c2.send(dg)
+        self.expect(self.c1, dg)
+        self.expect(self.l1, dg)
+        self.expectNone(self.c2)
+
+        dg = Datagram.create([6000], 6002, 1234)
+        dg.add_blob(b'z' * 3000)
+        self.l1.send(dg)
+        self.expect(self.c1, dg)
+        self.expectNone(self.c2)
+
+        # Cleanup
+        self.c1.send(Datagram.create_remove_channel(6000))
+
 if __name__ == '__main__':
     unittest.main()